@@ -153,6 +153,26 @@ xyz arc::station(double along) const
     return segment::station(along);
 }
 
+void arc::stations(const double *alongs,xyz *out,int n) const
+{
+  int i;
+  double len,angalong,rdelta,diameter;
+  if (delta)
+  {
+    len=length();
+    rdelta=bintorad(delta);
+    diameter=radius(0)*2;
+    for (i=0;i<n;i++)
+    {
+      angalong=alongs[i]/len*rdelta;
+      out[i]=xyz(xy(start)+cossin((angalong-rdelta)/2+rchordbearing)*sin(angalong/2)*diameter,
+		 elev(alongs[i]));
+    }
+  }
+  else
+    segment::stations(alongs,out,n);
+}
+
 int arc::bearing(double along) const
 {
   double len=length();
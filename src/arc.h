@@ -72,6 +72,7 @@ public:
   virtual double length() const;
   virtual double epsilon() const;
   virtual xyz station(double along) const;
+  virtual void stations(const double *alongs,xyz *out,int n) const;
   virtual int bearing(double along) const;
   virtual xy center();
   virtual bool isCurly();
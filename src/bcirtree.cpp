@@ -0,0 +1,113 @@
+/******************************************************/
+/*                                                    */
+/* bcirtree.cpp - hierarchy of bounding circles       */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <cfloat>
+#include "bcirtree.h"
+
+using namespace std;
+
+double slack(const bcir &a)
+/* The circles are enlarged by a few ulps of the coordinates, so that the
+ * ends of a piece, which are on its bounding circle, are not found to be
+ * outside it because of roundoff.
+ */
+{
+  return (fabs(a.center.getx())+fabs(a.center.gety())+a.radius)*4*DBL_EPSILON;
+}
+
+bcir enclosingCircle(const bcir &a,const bcir &b)
+{
+  bcir ret;
+  double d=dist(a.center,b.center);
+  if (d+b.radius<=a.radius)
+    ret=a;
+  else if (d+a.radius<=b.radius)
+    ret=b;
+  else
+  {
+    ret.radius=(d+a.radius+b.radius)/2;
+    ret.center=a.center+(b.center-a.center)*((ret.radius-a.radius)/d);
+    ret.radius+=slack(ret);
+  }
+  return ret;
+}
+
+BcirTree::BcirTree()
+{
+  nLeaves=0;
+  valid=false;
+}
+
+void BcirTree::clear()
+{
+  nodes.clear();
+  nLeaves=0;
+  valid=false;
+}
+
+bool BcirTree::isValid(size_t n)
+{
+  return valid && n==nLeaves;
+}
+
+void BcirTree::buildNode(int k,int lo,int hi,const vector<bcir> &leaves)
+{
+  int mid=(lo+hi)/2;
+  nodes[k].lo=lo;
+  nodes[k].hi=hi;
+  if (hi-lo==1)
+  {
+    nodes[k].circle=leaves[lo];
+    nodes[k].circle.radius+=slack(leaves[lo]);
+  }
+  else
+  {
+    buildNode(2*k,lo,mid,leaves);
+    buildNode(2*k+1,mid,hi,leaves);
+    nodes[k].circle=enclosingCircle(nodes[2*k].circle,nodes[2*k+1].circle);
+  }
+}
+
+void BcirTree::build(const vector<bcir> &leaves)
+{
+  size_t sz=2;
+  while (sz<2*leaves.size())
+    sz*=2;
+  nodes.clear();
+  if (leaves.size())
+  {
+    nodes.resize(sz);
+    buildNode(1,0,leaves.size(),leaves);
+  }
+  nLeaves=leaves.size();
+  valid=true;
+}
+
+int BcirTree::depth()
+{
+  int ret=0;
+  size_t n;
+  for (n=nodes.size();n>2;n/=2)
+    ret++;
+  return ret;
+}
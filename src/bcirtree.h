@@ -0,0 +1,208 @@
+/******************************************************/
+/*                                                    */
+/* bcirtree.h - hierarchy of bounding circles         */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef BCIRTREE_H
+#define BCIRTREE_H
+#include <vector>
+#include <array>
+#include <queue>
+#include <cmath>
+#include "drawobj.h"
+
+/* Polylines and alignments with fewer pieces than this are searched
+ * piece by piece; building the tree isn't worth it.
+ */
+#define BCIRTREE_MIN 32
+
+bcir enclosingCircle(const bcir &a,const bcir &b);
+
+struct BcirNode
+{
+  bcir circle;
+  int lo,hi; // the pieces from lo to hi-1
+};
+
+class BcirTree
+/* A binary tree of bounding circles over the pieces of a polyline or
+ * alignment. Node 1 is the root; node k has children 2k and 2k+1, which
+ * split its pieces in half. Each node's circle encloses its children's
+ * circles, so a query can skip every piece under a circle that is too far
+ * from the point, or, for winding number, replace them all with the chord
+ * from the first to the last if the point is outside the circle.
+ *
+ * The tree is built lazily by the polyline and cleared whenever a piece or
+ * bounding circle changes.
+ */
+{
+public:
+  BcirTree();
+  void clear();
+  bool isValid(size_t n);
+  void build(const std::vector<bcir> &leaves);
+  int depth();
+  template<class F> double closest(xy topoint,double closesofar,F pieceClosest);
+  template<class F> double dirbound(int angle,double boundsofar,F pieceBound);
+  template<class F,class G> double in(xy point,F piece,G span);
+  template<class F> void overlaps(BcirTree &other,F pieces);
+private:
+  std::vector<BcirNode> nodes;
+  size_t nLeaves;
+  bool valid;
+  void buildNode(int k,int lo,int hi,const std::vector<bcir> &leaves);
+};
+
+typedef std::pair<double,int> BcirBound;
+typedef std::priority_queue<BcirBound,std::vector<BcirBound>,std::greater<BcirBound> > BcirQueue;
+
+template<class F> double BcirTree::closest(xy topoint,double closesofar,F pieceClosest)
+/* pieceClosest(n,closesofar) returns the distance from topoint to piece n.
+ * Nodes are visited nearest first, and the search stops when the nearest
+ * remaining circle is farther than the closest piece found so far.
+ */
+{
+  BcirQueue q;
+  int k,c;
+  double d;
+  if (nodes.size()>1)
+    q.push(BcirBound(dist(nodes[1].circle.center,topoint)-nodes[1].circle.radius,1));
+  while (q.size() && q.top().first<closesofar)
+  {
+    k=q.top().second;
+    q.pop();
+    if (nodes[k].hi-nodes[k].lo==1)
+    {
+      d=pieceClosest(nodes[k].lo,closesofar);
+      if (d<closesofar)
+	closesofar=d;
+    }
+    else
+      for (c=2*k;c<2*k+2;c++)
+      {
+	d=dist(nodes[c].circle.center,topoint)-nodes[c].circle.radius;
+	if (d<closesofar)
+	  q.push(BcirBound(d,c));
+      }
+  }
+  return closesofar;
+}
+
+template<class F> double BcirTree::dirbound(int angle,double boundsofar,F pieceBound)
+// pieceBound(n,boundsofar) returns piece n's dirbound.
+{
+  BcirQueue q;
+  int k,c;
+  double d;
+  if (nodes.size()>1)
+    q.push(BcirBound(nodes[1].circle.center.dirbound(angle)-nodes[1].circle.radius,1));
+  while (q.size() && q.top().first<boundsofar)
+  {
+    k=q.top().second;
+    q.pop();
+    if (nodes[k].hi-nodes[k].lo==1)
+    {
+      d=pieceBound(nodes[k].lo,boundsofar);
+      if (d<boundsofar)
+	boundsofar=d;
+    }
+    else
+      for (c=2*k;c<2*k+2;c++)
+      {
+	d=nodes[c].circle.center.dirbound(angle)-nodes[c].circle.radius;
+	if (d<boundsofar)
+	  q.push(BcirBound(d,c));
+      }
+  }
+  return boundsofar;
+}
+
+template<class F,class G> double BcirTree::in(xy point,F piece,G span)
+/* piece(n) returns the winding number of piece n around point.
+ * span(lo,hi) returns the winding number of the chord from the start of
+ * piece lo to the end of piece hi-1, or NaN if point is on it. Only nodes
+ * whose circles contain point are opened.
+ */
+{
+  std::vector<int> stack;
+  int k;
+  double ret=0,s;
+  if (nodes.size()>1)
+    stack.push_back(1);
+  while (stack.size())
+  {
+    k=stack.back();
+    stack.pop_back();
+    if (dist(nodes[k].circle.center,point)>nodes[k].circle.radius)
+    {
+      s=span(nodes[k].lo,nodes[k].hi);
+      if (!std::isnan(s))
+      {
+	ret+=s;
+	continue;
+      }
+    }
+    if (nodes[k].hi-nodes[k].lo==1)
+      ret+=piece(nodes[k].lo);
+    else
+    {
+      stack.push_back(2*k+1);
+      stack.push_back(2*k);
+    }
+  }
+  return ret;
+}
+
+template<class F> void BcirTree::overlaps(BcirTree &other,F pieces)
+/* Calls pieces(m,n) for every piece m of this tree and piece n of other
+ * whose bounding circles overlap. The larger circle of a pair is split.
+ */
+{
+  std::vector<std::array<int,2> > stack;
+  int j,k;
+  bool jleaf,kleaf;
+  if (nodes.size()>1 && other.nodes.size()>1)
+    stack.push_back(std::array<int,2>{1,1});
+  while (stack.size())
+  {
+    j=stack.back()[0];
+    k=stack.back()[1];
+    stack.pop_back();
+    BcirNode &m=nodes[j],&n=other.nodes[k];
+    if (dist(m.circle.center,n.circle.center)>m.circle.radius+n.circle.radius)
+      continue;
+    jleaf=m.hi-m.lo==1;
+    kleaf=n.hi-n.lo==1;
+    if (jleaf && kleaf)
+      pieces(m.lo,n.lo);
+    else if (kleaf || (!jleaf && m.circle.radius>=n.circle.radius))
+    {
+      stack.push_back(std::array<int,2>{2*j+1,k});
+      stack.push_back(std::array<int,2>{2*j,k});
+    }
+    else
+    {
+      stack.push_back(std::array<int,2>{j,2*k+1});
+      stack.push_back(std::array<int,2>{j,2*k});
+    }
+  }
+}
+#endif
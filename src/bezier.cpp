@@ -65,7 +65,8 @@ triangle::triangle()
   a=b=c=NULL;
   aneigh=bneigh=cneigh=NULL;
   peri=sarea=0;
-  memset(gradmat,0,sizeof(gradmat));
+  stamp=0;
+  gradmat.setzero();
 #ifndef FLATTRIANGLE
   memset(ctrl,0,sizeof(ctrl));
   nocubedir=INT_MAX;
@@ -143,12 +144,15 @@ xyz triangle::gradient3(xy pnt)
 
 xy triangle::gradient(xy pnt)
 {
-  xyz g3;
-  double g2[2];
-  g3=gradient3(pnt);
-  g2[0]=g3.x*gradmat[0][0]+g3.y*gradmat[0][1]+g3.z*gradmat[0][2];
-  g2[1]=g3.x*gradmat[1][0]+g3.y*gradmat[1][1]+g3.z*gradmat[1][2];
-  return xy(g2[0],g2[1]);
+  xyz g;
+  fixedmatrix<3,1> g3;
+  fixedmatrix<2,1> g2;
+  g=gradient3(pnt);
+  g3[0][0]=g.x;
+  g3[1][0]=g.y;
+  g3[2][0]=g.z;
+  g2=gradmat*g3;
+  return xy(g2[0][0],g2[1][0]);
 }
 
 triangleHit triangle::hitTest(xy pnt)
@@ -28,6 +28,7 @@
 #include <array>
 #include "cogo.h"
 #include "segment.h"
+#include "fixedmatrix.h"
 #define M_SQRT_3_4 0.86602540378443864676372317
 #define M_SQRT_3 1.73205080756887729352744634
 #define M_SQRT_1_3 0.5773502691896257645091487805
@@ -94,7 +95,8 @@ public:
   std::vector<segment> subdiv;
   double peri,sarea;
   triangle *aneigh,*bneigh,*cneigh;
-  double gradmat[2][3]; // to compute gradient from three partial gradients
+  fixedmatrix<2,3> gradmat; // to compute gradient from three partial gradients
+  unsigned stamp; // generation of local sets this triangle is in
   triangle();
   bool ptValid();
   void setneighbor(triangle *neigh);
@@ -30,6 +30,7 @@
 #include <csignal>
 #include <cfloat>
 #include <cstring>
+#include <thread>
 #include <QTime>
 #include "config.h"
 #include "point.h"
@@ -67,6 +68,7 @@
 #include "hnum.h"
 #include "ellipsoid.h"
 #include "projection.h"
+#include "gridfactor.h"
 #include "color.h"
 #include "document.h"
 #include "relprime.h"
@@ -81,6 +83,7 @@
 #include "sourcegeoid.h"
 #include "bicubic.h"
 #include "matrix.h"
+#include "fixedmatrix.h"
 #include "curvefit.h"
 #include "quaternion.h"
 #include "kml.h"
@@ -88,6 +91,8 @@
 #include "manyarc.h"
 #include "leastsquares.h"
 #include "smooth5.h"
+#include "lrucache.h"
+#include "cancel.h"
 #include "readtin.h"
 
 #define psoutput true
@@ -507,6 +512,84 @@ void loadknowndet(matrix &mat,string dump)
   cout<<endl;
 }
 
+void testmatrixkernels()
+/* Checks the blocked and threaded multiplication against adding up each
+ * entry with pairwisesum, the in-place operations, and elimination of a
+ * matrix big enough to use threads.
+ */
+{
+  matrix a(37,300),b(300,29),c,d,at,big(300,300),x(300,1),y,z;
+  vector<double> prods;
+  int i,j,k;
+  bool same=true;
+  double maxerr=0;
+  a.randomize_c();
+  b.randomize_c();
+  c=a*b;
+  for (i=0;i<37;i++)
+    for (j=0;j<29;j++)
+    {
+      prods.clear();
+      for (k=0;k<300;k++)
+	prods.push_back(a[i][k]*b[k][j]);
+      same=same && c[i][j]==pairwisesum(prods);
+    }
+  tassert(same);
+  at=a.transpose();
+  d=a.transmult();
+  c.mult(a,at);
+  for (i=0;i<37;i++)
+    for (j=0;j<37;j++)
+      same=same && c[i][j]==d[i][j];
+  tassert(same);
+  c.mult(c,d); // aliased
+  d=d*d;
+  d-=c;
+  d+=d;
+  d*=3;
+  for (i=0;i<37;i++)
+    for (j=0;j<37;j++)
+      same=same && d[i][j]==0;
+  tassert(same);
+  big.randomize_c();
+  x.randomize_c();
+  y=big*x;
+  z=big;
+  z.gausselim(y);
+  for (i=0;i<300;i++)
+    if (fabs(y[i][0]-x[i][0])>maxerr)
+      maxerr=fabs(y[i][0]-x[i][0]);
+  cout<<"300×300 elimination error "<<maxerr<<endl;
+  tassert(maxerr<1e-9);
+}
+
+void matrixbench()
+// Times multiplication and elimination of sizes from 8 to 4096.
+{
+  int n,tmul,ttrans,telim;
+  matrix a,b,c,x;
+  QTime starttime;
+  for (n=8;n<=4096;n*=2)
+  {
+    a.resize(n,n);
+    b.resize(n,n);
+    x.resize(n,1);
+    a.randomize_c();
+    b.randomize_c();
+    x.randomize_c();
+    starttime.start();
+    c.mult(a,b);
+    tmul=starttime.elapsed();
+    starttime.start();
+    c=a.transmult();
+    ttrans=starttime.elapsed();
+    starttime.start();
+    a.gausselim(x);
+    telim=starttime.elapsed();
+    cout<<n<<": multiply "<<tmul<<" ms, transmult "<<ttrans<<" ms, gausselim "<<telim<<" ms\n";
+  }
+}
+
 void testmatrix()
 {
   int i,j,chk2,chk3,chk4;
@@ -647,6 +730,74 @@ void testmatrix()
   tassert(rs4.determinant()==0);
   rs4[3][3]=1;
   tassert(fabs(rs4.determinant()*9-100)<1e-12);
+  testmatrixkernels();
+}
+
+void testfixedmatrix()
+{
+  matrix a(6,6),b(6,2),c,d;
+  fixedmatrix<6,6> fa,fai,prod;
+  fixedmatrix<6,2> fb,fc,fx;
+  fixedmatrix<6,1> fcol;
+  fixedmatrix<1,6> frow;
+  double qpoints[16][16];
+  int i,j;
+  double maxerr=0;
+  bool threw=false;
+  a.randomize_c();
+  b.randomize_c();
+  fa=fixedmatrix<6,6>(a);
+  fb=fixedmatrix<6,2>(b);
+  c=a*b;
+  fc=fa*fb;
+  for (i=0;i<6;i++)
+    for (j=0;j<2;j++)
+      if (fabs(fc[i][j]-c[i][j])>maxerr)
+	maxerr=fabs(fc[i][j]-c[i][j]);
+  cout<<"Fixed product differs by "<<maxerr<<endl;
+  tassert(maxerr<1e-9);
+  d=fc;
+  tassert(d.getrows()==6 && d.getcolumns()==2 && d[5][1]==fc[5][1]);
+  try
+  {
+    fc=fixedmatrix<6,2>(a);
+  }
+  catch (BeziExcept &e)
+  {
+    threw=true;
+  }
+  tassert(threw);
+  fai=invert(fa);
+  prod=fa*fai;
+  for (maxerr=i=0;i<6;i++)
+    for (j=0;j<6;j++)
+      if (fabs(prod[i][j]-(i==j))>maxerr)
+	maxerr=fabs(prod[i][j]-(i==j));
+  cout<<"Fixed inverse error "<<maxerr<<endl;
+  tassert(maxerr<1e-12);
+  fx=solve(fa,fa*fb);
+  for (maxerr=i=0;i<6;i++)
+    for (j=0;j<2;j++)
+      if (fabs(fx[i][j]-fb[i][j])>maxerr)
+	maxerr=fabs(fx[i][j]-fb[i][j]);
+  tassert(maxerr<1e-9);
+  for (i=0;i<6;i++)
+    fcol[i][0]=frow[0][i]=i+1;
+  tassert((frow*fcol)[0][0]==91);
+  tassert((fcol*frow).trace()==91);
+  tassert(fcol.transpose()[0][5]==6);
+  prod.setzero();
+  tassert(std::isnan(invert(prod)[0][0]));
+  for (i=0;i<16;i++)
+    for (j=0;j<16;j++)
+      qpoints[i][j]=0;
+  prod=autocorr(qpoints,16);
+  tassert(prod[0][0]==256);
+  tassert(prod[1][1]==85);
+  tassert(prod[0][1]==0 && prod[1][0]==0);
+  for (i=0;i<6;i++)
+    for (j=0;j<6;j++)
+      tassert(prod[i][j]==prod[j][i]);
 }
 
 void testquaternion()
@@ -1897,6 +2048,90 @@ void testnewton()
   tassert(fabs(sqr(x)-3)<1e-15);
 }
 
+void testlengthtree()
+/* Checks the tree of lengths against adding them up one by one, then checks
+ * that inserting into a polyspiral keeps its length right without calling
+ * setlengths, and times building a long alignment.
+ */
+{
+  LengthTree lt;
+  vector<double> lens,cums;
+  int i,j,nwrong=0;
+  double cum,appendTime;
+  manysum sum;
+  polyspiral r;
+  alignment al;
+  QTime starttime;
+  for (i=0;i<1000;i++)
+    lens.push_back(fabs(sin(i*1.618034))*10);
+  lens[500]=0;
+  lt.assign(lens);
+  for (i=0;i<3000;i++)
+  {
+    j=(i*7919)%lens.size();
+    switch (i%3)
+    {
+      case 0:
+	lens[j]=fabs(cos(i*2.718281))*10;
+	lt.set(j,lens[j]);
+	break;
+      case 1:
+	lens.insert(lens.begin()+j,1);
+	lt.insert(j,1);
+	break;
+      case 2:
+	lens.erase(lens.begin()+j);
+	lt.erase(j);
+	break;
+    }
+  }
+  tassert(lt.size()==lens.size());
+  for (cum=i=0;i<lens.size();i++)
+  {
+    cum+=lens[i];
+    if (fabs(lt[i]-cum)>1e-9)
+      nwrong++;
+    if (lens[i]>1e-6 && lt.find(cum-lens[i]/2)!=i)
+      nwrong++;
+    if (lt.find(lt[i])<=i)
+      nwrong++;
+  }
+  tassert(nwrong==0);
+  tassert(lt.find(-1)==0);
+  tassert(lt.find(NAN)==lt.size());
+  tassert(lt.find(lt.back())==lt.size());
+  lt.prefixSums(cums);
+  tassert(cums.size()==lt.size());
+  for (i=0;i<cums.size();i++)
+    if (cums[i]!=lt[i])
+      nwrong++;
+  tassert(nwrong==0);
+  for (i=0;i<1000000;i++)
+  {
+    j=(i*7919u)%lens.size();
+    lens[j]=fabs(sin(i*0.5772157))*1e4;
+    lt.set(j,lens[j]);
+  }
+  for (i=0;i<lens.size();i++)
+    sum+=lens[i];
+  cout<<"Length tree off by "<<lt.back()-sum.total()<<" after a million changes\n";
+  tassert(fabs(lt.back()-sum.total())<sum.total()*1e-13);
+  for (i=0;i<200;i++)
+    r.insert(xy(cos(i*M_PI/100),sin(i*M_PI/100))*100*(1+0.3*sin(i*7*M_PI/100)));
+  cum=r.length();
+  r.setlengths();
+  cout<<"Polyspiral length "<<cum<<" after inserting, "<<r.length()<<" after setlengths\n";
+  tassert(fabs(cum-r.length())<1e-9);
+  starttime.start();
+  al.appendPoint(xy(0,0));
+  al.appendPoint(xy(100,0));
+  for (i=0;i<5000;i++)
+    al.appendTangentCurve(0,50,(i&1)?0.004:-0.004);
+  appendTime=starttime.elapsed();
+  cout<<"Appending 5000 curves took "<<appendTime<<" ms\n";
+  tassert(fabs(al.length()-250100)<1e-6);
+}
+
 void testmanysum()
 {
   manysum ms,negms;
@@ -2793,6 +3028,7 @@ void testcogospiral2(spiralarc a,spiralarc b,PostScript &ps,vector<xy> expected,
   vector<array<alosta,2> > inters;
   vector<alosta> beside;
   int i,j;
+  QTime starttime;
   aSnip=snip20(a,aStart,aEnd);
   bSnip=snip20(b,bStart,bEnd);
   bNeg=-bSnip;
@@ -2809,7 +3045,9 @@ void testcogospiral2(spiralarc a,spiralarc b,PostScript &ps,vector<xy> expected,
   ps.setcolor(0,0,1);
   ps.spline(aEnd.approx3d(0.001/ps.getscale()));
   ps.spline(bEnd.approx3d(0.001/ps.getscale()));
+  starttime.start();
   inters=intersections(&aSnip,&bSnip);
+  cout<<"intersections took "<<starttime.elapsed()<<" ms\n";
   beside=besidement1(&aSnip,aSnip.length()/2,&bNeg,bSnip.length()/2);
   tassert((nint>>inters.size())&1);
   if (((nint>>inters.size())&1)==0)
@@ -3052,6 +3290,55 @@ void test1curly(double curvature,double clothance,PostScript &ps,array<int,3> &t
   times[0]+=niter;
 }
 
+void testpolyintersect()
+/* Two seven-pointed stars, one rotated half a point from the other, cross
+ * 14 times near the circle of radius 100, twice at vertices. Compares
+ * walking the two trees of bounding circles with trying all pairs.
+ */
+{
+  int i,j,n=0;
+  double ang,treeTime,allTime;
+  polyspiral a,b;
+  vector<array<alosta,2> > inters,int0;
+  spiralarc aspi,bspi;
+  QTime starttime;
+  for (i=0;i<200;i++)
+  {
+    ang=i*M_PI/100;
+    a.insert(xy(cos(ang),sin(ang))*100*(1+0.3*sin(7*ang)));
+    b.insert(xy(cos(ang),sin(ang))*100*(1-0.3*sin(7*ang)));
+  }
+  a.smooth();
+  b.smooth();
+  a.setlengths();
+  b.setlengths();
+  starttime.start();
+  inters=intersections(a,b);
+  treeTime=starttime.elapsed();
+  cout<<inters.size()<<" intersections of two stars\n";
+  tassert(inters.size()==14);
+  for (i=0;i<inters.size();i++)
+  {
+    tassert(fabs(inters[i][0].station.length()-100)<0.01); // smoothing moves them off the circle
+    tassert(dist(inters[i][0].station,a.station(inters[i][0].along))<1e-6);
+    tassert(dist(inters[i][1].station,b.station(inters[i][1].along))<1e-6);
+    if (i)
+      tassert(inters[i][0].along>inters[i-1][0].along);
+  }
+  starttime.start();
+  for (i=0;i<a.size();i++)
+    for (j=0;j<b.size();j++)
+    {
+      aspi=a.getspiralarc(i);
+      bspi=b.getspiralarc(j);
+      int0=intersections(&aspi,&bspi);
+      n+=int0.size();
+    }
+  allTime=starttime.elapsed();
+  cout<<"Tree "<<treeTime<<" ms, all pairs "<<allTime<<" ms, "<<n<<" intersections\n";
+  tassert(n>=14);
+}
+
 void testcurly()
 /* This outputs "bogus spiralarc" as it draws the maximum-length spiralarc.
  * The endpoints are sufficiently inaccurate that approx3d complains.
@@ -3217,6 +3504,38 @@ void testcurvefit()
   for (i=1;i<48;i++)
     points.push_back(pa.station(16*i));
   test1curvefit(points,startLine,endLine,0.0001,ps);
+  /* Residuals of many points computed in threads, starting from the closest
+   * arcs on a slightly different curve, must match those computed in one
+   * thread from scratch.
+   */
+  points.clear();
+  polyarc many=manyArc(spiralarc(xyz(0,0,0),0.002,0.00001,0,-384,384),48);
+  polyarc near=manyArc(spiralarc(xyz(0,0,0),0.00201,0.00001,0,-384,384),48);
+  vector<xy> manyPoints;
+  vector<int> pieces;
+  vector<double> resid0,resid1;
+  double maxdiff=0;
+  QTime starttime;
+  int time0,time1;
+  for (i=0;i<20000;i++)
+    manyPoints.push_back(many.station(many.length()*(i+0.5)/20000)+
+			 cossin((int)rng.uirandom())*(rng.ucrandom()/32.));
+  near.setlengths();
+  curvefitResiduals(near,manyPoints,&pieces);
+  fitThreads=1;
+  starttime.start();
+  resid0=curvefitResiduals(many,manyPoints);
+  time0=starttime.elapsed();
+  fitThreads=0;
+  starttime.start();
+  resid1=curvefitResiduals(many,manyPoints,&pieces);
+  time1=starttime.elapsed();
+  for (i=0;i<manyPoints.size();i++)
+    if (fabs(resid0[i]-resid1[i])>maxdiff)
+      maxdiff=fabs(resid0[i]-resid1[i]);
+  cout<<manyPoints.size()<<" residuals: "<<time0<<" ms in one thread, "<<time1<<" ms warm in threads, max difference "<<maxdiff<<endl;
+  tassert(maxdiff<1e-9);
+  tassert(pieces.size()==manyPoints.size() && pieces[0]==0 && pieces.back()==47);
 }
 
 void test1manyarc(spiralarc s,PostScript &ps)
@@ -3348,6 +3667,73 @@ vector<double> cubicIntersections(segment cubic,segment apx)
   return ret;
 }
 
+void testmanyarcbulk()
+/* Converts 64 copies of a smoothed star, rotated and moved, to polyarcs
+ * within 1 mm, all at once in threads with a cache, and checks that they are
+ * within tolerance and agree with converting the first few one at a time
+ * without a cache. Then checks that the cache hits, and that an unreachable
+ * tolerance is reported without trying every number of arcs.
+ */
+{
+  int i,j,nwrong=0;
+  double along,err,maxerr=0,serialTime,bulkTime;
+  polyspiral star;
+  vector<polyspiral> curves;
+  vector<polyarc> serial,bulk;
+  ManyArcCache cache;
+  bool met;
+  QTime starttime;
+  for (i=0;i<70;i++)
+    star.insert(xy(cos(i*M_PI/35),sin(i*M_PI/35))*30*(1+0.3*sin(i*7*M_PI/35)));
+  star.smooth();
+  star.setlengths();
+  for (i=0;i<64;i++)
+  {
+    curves.push_back(star);
+    curves.back()._roscat(xy(0,0),DEG30/7*i,1,cossin(DEG30/7*i),xy(i*100,i*37));
+  }
+  starttime.start();
+  for (i=0;i<4;i++)
+    serial.push_back(polyarc(curves[i],0.001));
+  serialTime=starttime.elapsed()*curves.size()/serial.size();
+  starttime.start();
+  bulk=manyArc(curves,0.001);
+  bulkTime=starttime.elapsed();
+  cout<<curves.size()<<" polyspirals to arcs: about "<<serialTime<<" ms one at a time, "
+      <<bulkTime<<" ms in threads with cache\n";
+  tassert(bulk.size()==curves.size());
+  for (i=0;i<curves.size();i++)
+  {
+    if (i>=serial.size());
+    else if (bulk[i].size()!=serial[i].size())
+      nwrong++;
+    else
+      for (j=0;j<bulk[i].size();j++)
+	if (dist(bulk[i].getEndpoint(j),serial[i].getEndpoint(j))>1e-6)
+	  nwrong++;
+    for (j=0;j<100;j++)
+    {
+      along=curves[i].length()*(j+0.5)/100;
+      xyz sta=curves[i].station(along);
+      err=dist(bulk[i].station(bulk[i].closest(sta)),sta);
+      if (err>maxerr)
+	maxerr=err;
+    }
+  }
+  cout<<"Max error "<<maxerr<<", "<<bulk[0].size()<<" arcs for "<<star.size()<<" spiralarcs\n";
+  tassert(nwrong==0);
+  tassert(maxerr<0.0011);
+  for (i=0;i<4;i++)
+    polyarc(curves[i],0.001,&cache);
+  cout<<"Cache: "<<cache.getHits()<<" hits, "<<cache.getMisses()<<" misses\n";
+  tassert(cache.getHits()>cache.getMisses() && cache.getUnmet()==0);
+  spiralarc tight(xyz(0,0,0),0.002,0.00001,0,-384,384);
+  starttime.start();
+  polyarc unmet=manyArcWithin(tight,1e-6,&met);
+  cout<<"Gave up on tolerance 1e-6 in "<<starttime.elapsed()<<" ms with "<<unmet.size()<<" arcs\n";
+  tassert(!met && unmet.size()==MANYARC_MAX);
+}
+
 void testmanyarc()
 /* Approximating a spiralarc by a smooth sequence of arcs.
  * In the approximation where the difference in curvature times the length is
@@ -3708,6 +4094,48 @@ void testspiral()
   cout<<"Barely too curly spiralarc is from "<<ldecimal(-sqrt(t2))<<" to "<<ldecimal(sqrt(t2+M_PI))<<endl;
 }
 
+void testcornu()
+/* Compares the fast cornu functions with the series over the range used in
+ * surveying, and times them. The largest t in a curly spiralarc is 1.430067.
+ */
+{
+  int i,j,k;
+  double t,cu,cl,err,maxerr1=0,maxerr3=0,fastTime,seriesTime;
+  xy sum;
+  QTime starttime;
+  for (i=-2000;i<=2000;i++)
+  {
+    t=i/1000.;
+    err=dist(cornu(t),cornuSeries(t));
+    if (err>maxerr1)
+      maxerr1=err;
+  }
+  for (i=-15;i<=15;i++)
+    for (j=-20;j<=20;j++)
+      for (k=-6;k<=6;k++)
+      {
+	t=i/10.;
+	cu=j/5.;
+	cl=k/2.;
+	err=dist(cornu(t,cu,cl),cornuSeries(t,cu,cl));
+	if (err>maxerr3)
+	  maxerr3=err;
+      }
+  cout<<"Max error of cornu(t) "<<maxerr1<<", of cornu(t,cu,cl) "<<maxerr3<<endl;
+  tassert(maxerr1<1e-15);
+  tassert(maxerr3<1e-13);
+  starttime.start();
+  for (i=0;i<100000;i++)
+    sum+=cornu(i/50000.-1)+cornu(i/50000.-1,1,1);
+  fastTime=starttime.elapsed();
+  starttime.start();
+  for (i=0;i<100000;i++)
+    sum+=cornuSeries(i/50000.-1)+cornuSeries(i/50000.-1,1,1);
+  seriesTime=starttime.elapsed();
+  cout<<"100000 pairs of cornu calls took "<<fastTime<<" ms, series "<<seriesTime<<" ms\n";
+  tassert(sum.isfinite());
+}
+
 void testarea3()
 {
   int i,j,itype;
@@ -4065,6 +4493,102 @@ void checkgrad(double &avgerror,double &maxerror)
   avgerror=sqrt(error/n);
 }
 
+void testedgeindex()
+/* Checks that the edge index finds the same edges as looking through all
+ * of them, at various zoom levels.
+ */
+{
+  int i,j,nfound,nbrute;
+  double radius,minLength;
+  xy center;
+  set<edge *> found;
+  vector<edge *> foundv;
+  map<int,edge>::iterator e;
+  bool same;
+  doc.makepointlist(1);
+  doc.pl[1].clear();
+  aster(doc,3000);
+  doc.pl[1].maketin();
+  tassert(!doc.pl[1].edgeIndex.isValid(doc.pl[1].edges.size()));
+  doc.pl[1].edgeIndex.build(doc.pl[1].edges);
+  tassert(doc.pl[1].edgeIndex.isValid(doc.pl[1].edges.size()));
+  tassert(doc.pl[1].edgeIndex.size()==doc.pl[1].edges.size());
+  cout<<doc.pl[1].edges.size()<<" edges in "<<doc.pl[1].edgeIndex.nLevels()<<" levels\n";
+  for (i=0;i<100;i++)
+  {
+    center=xy(rng.usrandom()/1024.-32,rng.usrandom()/1024.-32);
+    radius=rng.usrandom()/2048.;
+    minLength=rng.usrandom()/16384.;
+    foundv=doc.pl[1].edgeIndex.find(center,radius,minLength);
+    found.clear();
+    for (j=0;j<foundv.size();j++)
+      found.insert(foundv[j]);
+    tassert(found.size()==foundv.size());
+    same=true;
+    for (e=doc.pl[1].edges.begin(),nbrute=0;e!=doc.pl[1].edges.end();++e)
+      if (e->second.length()>minLength && dist(e->second.midpoint(),center)<=radius+e->second.length()/2)
+      {
+	nbrute++;
+	if (!found.count(&e->second))
+	  same=false;
+      }
+    nfound=found.size();
+    if (!same || nfound!=nbrute)
+      cout<<"center "<<ldecimal(center.getx())<<','<<ldecimal(center.gety())<<" radius "<<ldecimal(radius)
+          <<" minLength "<<ldecimal(minLength)<<" found "<<nfound<<" should be "<<nbrute<<endl;
+    tassert(same && nfound==nbrute);
+  }
+  for (e=doc.pl[1].edges.begin();e!=doc.pl[1].edges.end() && !e->second.isFlippable();++e);
+  tassert(e!=doc.pl[1].edges.end());
+  e->second.flip(&doc.pl[1]);
+  tassert(!doc.pl[1].edgeIndex.isValid(doc.pl[1].edges.size()));
+}
+
+void testlocalsets()
+/* Checks that the local sets, used when painting a small part of a big TIN,
+ * include all edges well inside the circle, with no duplicates, both when
+ * started from the qindex and when panned a little.
+ */
+{
+  int i,j,nmissed;
+  double radius;
+  xy center;
+  set<edge *> found;
+  set<triangle *> foundTri;
+  map<int,edge>::iterator e;
+  doc.makepointlist(1);
+  doc.pl[1].clear();
+  aster(doc,3000);
+  doc.pl[1].maketin();
+  doc.pl[1].maketriangles();
+  doc.pl[1].makeqindex();
+  doc.pl[1].setLocalSets(xy(0,0),1000);
+  tassert(doc.pl[1].localSetsAll);
+  center=xy(5,-3);
+  radius=8;
+  for (i=0;i<10;i++)
+  {
+    doc.pl[1].setLocalSets(center,radius);
+    tassert(!doc.pl[1].localSetsAll);
+    found.clear();
+    for (j=0;j<doc.pl[1].localEdges.size();j++)
+      found.insert(doc.pl[1].localEdges[j]);
+    tassert(found.size()==doc.pl[1].localEdges.size());
+    foundTri.clear();
+    for (j=0;j<doc.pl[1].localTriangles.size();j++)
+      foundTri.insert(doc.pl[1].localTriangles[j]);
+    tassert(foundTri.size()==doc.pl[1].localTriangles.size());
+    for (e=doc.pl[1].edges.begin(),nmissed=0;e!=doc.pl[1].edges.end();++e)
+      if (dist(*e->second.a,center)<radius*0.9 && dist(*e->second.b,center)<radius*0.9 &&
+	  !found.count(&e->second))
+	nmissed++;
+    if (nmissed)
+      cout<<nmissed<<" edges missed at step "<<i<<endl;
+    tassert(nmissed==0);
+    center+=xy(0.3,0.2); // pan by less than radius/8
+  }
+}
+
 void testmakegrad()
 {
   double avgerror,maxerror,corr;
@@ -4503,6 +5027,138 @@ void test1adjstl(array<int,3> stlSplit,array<int,3> stlMin,array<int,3> stlAdj)
   }
 }
 
+class ShortBuf: public streambuf
+// Takes a limited number of bytes, then fails, like a full disk.
+{
+public:
+  ShortBuf(size_t n)
+  {
+    room=n;
+  }
+protected:
+  virtual int overflow(int c)
+  {
+    if (room==0 || c==EOF)
+      return EOF;
+    room--;
+    return c;
+  }
+private:
+  size_t room;
+};
+
+void teststlmesh(int surface)
+/* Writes a binary STL file of a small TIN and checks that it is watertight:
+ * every edge of every STL triangle is matched by the same edge going
+ * the other way in another triangle, and that the header has the number of
+ * triangles written. On FLATSLOPE every edge has split 1, so every
+ * triangle's bottom is one triangle. The progress reaches 1000‰. On CIRPAR it
+ * also checks that a canceled write and a failed write throw instead of
+ * hanging or aborting.
+ */
+{
+  Printer3dSize printer={P3S_RECTANGULAR,100,100,50,1,1,3,0.02};
+  StlFrame frame;
+  stringstream stlFile;
+  char header[80];
+  unsigned i,j,count,nMismatched=0;
+  int nNotified=0;
+  long long written;
+  ActionProgress progress;
+  array<array<float,3>,3> vertices;
+  map<pair<array<float,3>,array<float,3> >,int> halfEdges;
+  map<pair<array<float,3>,array<float,3> >,int>::iterator k;
+  map<int,edge>::iterator e;
+  doc.makepointlist(1);
+  doc.pl[1].clear();
+  setsurface(surface);
+  aster(doc,100);
+  doc.pl[1].maketin();
+  doc.pl[1].makegrad(0.);
+  doc.pl[1].maketriangles();
+  doc.pl[1].setgradient();
+  frame=turnFitInPrinter(doc.pl[1],printer,false,true);
+  cout<<"Scale 1:"<<printer.scaleDenom<<endl;
+  if (surface==CIRPAR)
+    tassert(printer.scaleDenom==200);
+  setStlSplits(doc.pl[1],printer.resolution*printer.scaleDenom/printer.scaleNum/1000);
+  if (surface==FLATSLOPE)
+  { /* makegrad doesn't get the gradients exactly, so the Bézier sides have a
+     * little curvature. Set the splits that an exact plane would get.
+     */
+    for (e=doc.pl[1].edges.begin();e!=doc.pl[1].edges.end();++e)
+      e->second.stlsplit=0;
+  }
+  actionProgress()=&progress;
+  progress.notify=[&]{nNotified++;};
+  written=writeStlMesh(stlFile,doc.pl[1],frame,false,3);
+  actionProgress()=nullptr;
+  tassert(progress.permille==1000 && nNotified>0);
+  stlFile.read(header,80);
+  count=readleint(stlFile);
+  cout<<count<<" STL triangles\n";
+  tassert(count==written && count>2*doc.pl[1].triangles.size());
+  tassert(fileSize(stlFile)==84+50*count);
+  stlFile.seekg(84);
+  for (i=0;i<count;i++)
+  {
+    for (j=0;j<3;j++)
+      readlefloat(stlFile); // normal
+    for (j=0;j<9;j++)
+      vertices[j/3][j%3]=readlefloat(stlFile);
+    readleshort(stlFile);
+    for (j=0;j<3;j++)
+    {
+      halfEdges[make_pair(vertices[j],vertices[(j+1)%3])]++;
+      halfEdges[make_pair(vertices[(j+1)%3],vertices[j])]--;
+    }
+  }
+  for (k=halfEdges.begin();k!=halfEdges.end();++k)
+    if (k->second)
+      nMismatched++;
+  cout<<nMismatched<<" mismatched half-edges\n";
+  tassert(nMismatched==0);
+  if (surface==CIRPAR)
+  { // A canceled write stops, as when the user cancels it in viewtin.
+    atomic<bool> cancel(true);
+    stringstream canceledFile;
+    int caught=0;
+    cancelFlag()=&cancel;
+    try
+    {
+      writeStlMesh(canceledFile,doc.pl[1],frame,false,3);
+    }
+    catch (BeziExcept &e)
+    {
+      caught=e.getNumber();
+    }
+    cancelFlag()=nullptr;
+    tassert(caught==actioncanceled);
+    tassert(fileSize(canceledFile)<84+50*count);
+  }
+  if (surface==CIRPAR)
+  { /* A write error in any thread comes back to the caller. Finer splits
+     * make enough chunks that the worker threads have some to write.
+     */
+    ShortBuf shortBuf(200000);
+    ostream shortFile(&shortBuf);
+    bool caught=false;
+    setStlSplits(doc.pl[1],printer.resolution*printer.scaleDenom/printer.scaleNum/10000);
+    shortFile.exceptions(ios::badbit|ios::failbit);
+    try
+    {
+      written=writeStlMesh(shortFile,doc.pl[1],frame,false,3);
+    }
+    catch (ios::failure &e)
+    {
+      caught=true;
+    }
+    tassert(caught);
+    if (!caught)
+      cout<<written<<" STL triangles written to a short file\n";
+  }
+}
+
 void teststl()
 {
   StlTriangle stltri;
@@ -4540,6 +5196,8 @@ void teststl()
   test1adjstl(stlSplit0,stlMin2,stlAdj02);
   test1adjstl(stlSplit0,stlMin3,stlAdj03);
   test1adjstl(stlSplit0,stlMin4,stlAdj04);
+  teststlmesh(CIRPAR);
+  teststlmesh(FLATSLOPE);
 }
 
 void testdirbound()
@@ -4818,7 +5476,7 @@ void testpolyline()
   r=polyspiral();
   for (i=0;i<600;i++)
   {
-    r.insert(cossin(i*0xfc1ecd6));
+    r.insert(cossin((int)(i*0xfc1ecd6u))); // unsigned, so that it wraps
     if (i==0)
       r.open();
   }
@@ -4848,6 +5506,209 @@ void testalignment()
   tassert(al0.endStation()==0);
 }
 
+double bruteIn(polyspiral &r,xy pnt)
+{
+  int i,sz=r.size();
+  double ret=0;
+  xy a,b;
+  for (i=0;i<sz;i++)
+  {
+    a=r.getEndpoint(i);
+    b=r.getEndpoint((i+1)%sz);
+    if (pnt!=a && pnt!=b)
+      ret+=bintorot(foldangle(dir(pnt,b)-dir(pnt,a)));
+    ret+=r.getspiralarc(i).in(pnt);
+  }
+  return ret;
+}
+
+double bruteClosest(polyspiral &r,xy pnt)
+// Returns the distance, which is unique, unlike the station.
+{
+  int i;
+  double closesofar=INFINITY,alo,d;
+  spiralarc si;
+  bcir bc;
+  for (i=0;i<r.size();i++)
+  {
+    si=r.getspiralarc(i);
+    bc=si.boundCircle();
+    if (dist(bc.center,pnt)-bc.radius<closesofar)
+    {
+      alo=si.closest(pnt,closesofar,true);
+      d=dist(si.station(alo),pnt);
+      if (d<closesofar)
+	closesofar=d;
+    }
+  }
+  return closesofar;
+}
+
+void testbcirtree()
+/* Makes a seven-pointed star of 2000 spirals and checks closest, in, and
+ * dirbound, which use the tree of bounding circles, against looking at
+ * every piece, then times them.
+ */
+{
+  int i,j,nwrong=0;
+  polyspiral r;
+  alignment al;
+  xy pnt;
+  double ang,rad,treeIn,bruteInside,treeDist,bruteDist,bound,bruteBound,along;
+  double treeTime=0,bruteTime=0;
+  QTime starttime;
+  vector<xy> pnts;
+  for (i=0;i<2000;i++)
+  {
+    ang=i*M_PI/1000;
+    r.insert(xy(cos(ang),sin(ang))*100*(1+0.3*sin(7*ang)));
+  }
+  r.smooth();
+  r.setlengths();
+  for (i=0;i<1000;i++)
+    pnts.push_back(xy(sin(i*1.618034),cos(i*2.718281))*150);
+  for (i=0;i<pnts.size();i++)
+  {
+    pnt=pnts[i];
+    treeIn=r.in(pnt);
+    bruteInside=bruteIn(r,pnt);
+    if (fabs(treeIn-bruteInside)>1e-9)
+      nwrong++;
+    ang=atan2(pnt.gety(),pnt.getx());
+    rad=100*(1+0.3*sin(7*ang));
+    if (pnt.length()<rad-1)
+      tassert(fabs(treeIn-1)<1e-9);
+    if (pnt.length()>rad+1)
+      tassert(fabs(treeIn)<1e-9);
+  }
+  cout<<nwrong<<" points differ in winding number"<<endl;
+  tassert(nwrong==0);
+  for (nwrong=i=0;i<pnts.size();i++)
+  {
+    pnt=pnts[i];
+    treeDist=dist(r.station(r.closest(pnt)),pnt);
+    bruteDist=bruteClosest(r,pnt);
+    if (fabs(treeDist-bruteDist)>1e-6)
+      nwrong++;
+  }
+  cout<<nwrong<<" points differ in closest distance"<<endl;
+  tassert(nwrong==0);
+  for (i=0;i<16;i++)
+  {
+    bound=r.dirbound(i*DEG45/2);
+    for (bruteBound=INFINITY,j=0;j<r.size();j++)
+      bruteBound=min(bruteBound,r.getspiralarc(j).dirbound(i*DEG45/2));
+    tassert(fabs(bound-bruteBound)<1e-9);
+  }
+  starttime.start();
+  for (i=0;i<pnts.size();i++)
+  {
+    r.closest(pnts[i]);
+    r.in(pnts[i]);
+  }
+  treeTime=starttime.elapsed();
+  starttime.start();
+  for (i=0;i<pnts.size();i++)
+  {
+    bruteClosest(r,pnts[i]);
+    bruteIn(r,pnts[i]);
+  }
+  bruteTime=starttime.elapsed();
+  cout<<pnts.size()<<" closest and in on "<<r.size()<<" spirals: "<<treeTime
+      <<" ms with tree, "<<bruteTime<<" ms piece by piece"<<endl;
+  al.appendPoint(xy(0,0));
+  al.appendPoint(xy(100,0));
+  for (i=0;i<200;i++)
+    al.appendTangentCurve(0,50,(i&1)?0.004:-0.004);
+  for (nwrong=i=0;i<pnts.size();i++)
+  {
+    pnt=xy(pnts[i].getx()*33+5000,pnts[i].gety()); // survey shots along a road
+    along=al.closest(pnt);
+    treeDist=dist(al.xyStation(along),pnt);
+    for (bruteDist=INFINITY,j=0;j<201;j++)
+      bruteDist=min(bruteDist,dist(pnt,al.getHorizontalCurve(j).station(al.getHorizontalCurve(j).closest(pnt,INFINITY,true))));
+    if (fabs(treeDist-bruteDist)>1e-6)
+      nwrong++;
+  }
+  cout<<nwrong<<" points differ in closest distance to alignment"<<endl;
+  tassert(nwrong==0);
+}
+
+bool sameStation(xyz a,xyz b)
+// The batch and single stations should agree, including where they're NaN.
+{
+  bool ret=(std::isnan(a.getx()) && std::isnan(b.getx())) || dist(xy(a),xy(b))<1e-9;
+  ret=ret && ((std::isnan(a.elev()) && std::isnan(b.elev())) || fabs(a.elev()-b.elev())<1e-9);
+  return ret;
+}
+
+void teststations()
+/* Computes stations of a polyline, polyarc, polyspiral, and alignment at
+ * alongs in scrambled order, some off the ends, with stations() and with
+ * station(), and times them.
+ */
+{
+  int i,nwrong=0;
+  polyline p;
+  polyspiral r;
+  alignment al;
+  double ang,batchTime,singleTime;
+  vector<double> alongs;
+  vector<xyz> batch,single;
+  QTime starttime;
+  for (i=0;i<200;i++)
+  {
+    ang=i*M_PI/100;
+    r.insert(xy(cos(ang),sin(ang))*100*(1+0.3*sin(7*ang)));
+    p.insert(xy(cos(ang),sin(ang))*100*(1+0.3*sin(7*ang)));
+  }
+  r.smooth();
+  r.setlengths();
+  p.setlengths();
+  polyarc a(r,0.01);
+  a.setlengths();
+  for (i=0;i<100000;i++)
+    alongs.push_back((sin(i*1.618034)*0.51+0.5)*r.length());
+  alongs[1]=0;
+  alongs[2]=r.length();
+  alongs[3]=NAN;
+  batch.resize(alongs.size());
+  starttime.start();
+  r.stations(&alongs[0],&batch[0],alongs.size());
+  batchTime=starttime.elapsed();
+  starttime.start();
+  for (i=0;i<alongs.size();i++)
+    single.push_back(r.station(alongs[i]));
+  singleTime=starttime.elapsed();
+  for (i=0;i<alongs.size();i++)
+    nwrong+=!sameStation(batch[i],single[i]);
+  cout<<alongs.size()<<" polyspiral stations: "<<batchTime<<" ms batched, "<<singleTime<<" ms one by one"<<endl;
+  tassert(std::isnan(batch[3].getx()));
+  tassert(batch[2].isfinite());
+  p.stations(&alongs[0],&batch[0],alongs.size());
+  for (i=0;i<alongs.size();i++)
+    nwrong+=!sameStation(batch[i],p.station(alongs[i]));
+  a.stations(&alongs[0],&batch[0],alongs.size());
+  for (i=0;i<alongs.size();i++)
+    nwrong+=!sameStation(batch[i],a.station(alongs[i]));
+  p.stations(&alongs[0],&batch[0],5); // few alongs, looked up in the tree
+  for (i=0;i<5;i++)
+    nwrong+=!sameStation(batch[i],p.station(alongs[i]));
+  al.appendPoint(xy(0,0));
+  al.appendPoint(xy(100,0));
+  for (i=0;i<200;i++)
+    al.appendTangentCurve(0,50,(i&1)?0.004:-0.004);
+  for (i=0;i<alongs.size();i++)
+    alongs[i]=(sin(i*2.718281)*0.51+0.5)*al.length()+al.startStation();
+  alongs[1]=al.startStation();
+  alongs[2]=al.endStation();
+  al.stations(&alongs[0],&batch[0],alongs.size());
+  for (i=0;i<alongs.size();i++)
+    nwrong+=!sameStation(batch[i],al.station(alongs[i]));
+  cout<<nwrong<<" stations differ"<<endl;
+  tassert(nwrong==0);
+}
+
 bool before(xy a1,xy a2,xy a3,xy b1,xy b2,xy b3)
 /* Returns true if a2 is nearer along than b2.
  * They are on different curves, so this isn't totally well-defined,
@@ -5377,6 +6238,90 @@ void testkrugerscale(ellipsoid *ellip)
   }
 }
 
+void testkrugerclenshaw(ellipsoid *ellip)
+/* Compares the Clenshaw sums with the term-by-term sums over the area that
+ * transmer draws, and times both.
+ */
+{
+  vector<xy> pnts,fast[4],slow[4];
+  int i,j,k,ms[2];
+  double maxdiff[4]={0,0,0,0};
+  QTime starttime;
+  for (i=0;i<=100;i++)
+    for (j=0;j<=100;j++)
+      pnts.push_back(xy(j*4e4,i*1e5));
+  for (k=0;k<2;k++)
+  {
+    krugerReference=k;
+    starttime.start();
+    for (i=0;i<pnts.size();i++)
+    {
+      (k?slow:fast)[0].push_back(ellip->krugerize(pnts[i]));
+      (k?slow:fast)[1].push_back(ellip->dekrugerize(pnts[i]));
+      (k?slow:fast)[2].push_back(ellip->krugerizeDeriv(pnts[i]));
+      (k?slow:fast)[3].push_back(ellip->dekrugerizeDeriv(pnts[i]));
+    }
+    ms[k]=starttime.elapsed();
+  }
+  krugerReference=false;
+  for (i=0;i<pnts.size();i++)
+    for (j=0;j<4;j++)
+      if (dist(fast[j][i],slow[j][i])>maxdiff[j])
+	maxdiff[j]=dist(fast[j][i],slow[j][i]);
+  cout<<ellip->getName()<<" Clenshaw "<<ms[0]<<" ms, term by term "<<ms[1]<<" ms"<<endl;
+  cout<<"Maximum differences "<<maxdiff[0]<<' '<<maxdiff[1]<<' '<<maxdiff[2]<<' '<<maxdiff[3]<<endl;
+  tassert(maxdiff[0]<1e-6 && maxdiff[1]<1e-6);
+  tassert(maxdiff[2]<1e-12 && maxdiff[3]<1e-12);
+}
+
+void testgeodclosed(ellipsoid *ellip)
+/* Compares the closed-form geod with the iterative one over the whole globe,
+ * from 10 km below to 1000 km above the ellipsoid, and times both.
+ */
+{
+  vector<xyz> pnts;
+  vector<latlongelev> fast,slow,batch;
+  int i,ms[2];
+  double maxang=0,maxelev=0,maxround=0;
+  bool same=true;
+  latlongelev lle;
+  QTime starttime;
+  for (i=0;i<100000;i++)
+  {
+    lle.lat=asin((i%1000)/500.-0.999);
+    lle.lon=(i/1000)*M_PI/50-M_PI;
+    lle.elev=((unsigned)i*0x9e3779b9u)%1010000-10000.;
+    pnts.push_back(ellip->geoc(lle));
+  }
+  starttime.start();
+  for (i=0;i<pnts.size();i++)
+    fast.push_back(ellip->geod(pnts[i]));
+  ms[0]=starttime.elapsed();
+  starttime.start();
+  for (i=0;i<pnts.size();i++)
+    slow.push_back(ellip->geodIterative(pnts[i]));
+  ms[1]=starttime.elapsed();
+  batch=ellip->geod(pnts);
+  for (i=0;i<pnts.size();i++)
+  {
+    same=same && batch[i].lat==fast[i].lat && batch[i].elev==fast[i].elev;
+    if (fabs(fast[i].lat-slow[i].lat)>maxang)
+      maxang=fabs(fast[i].lat-slow[i].lat);
+    if (fabs(fast[i].lon-slow[i].lon)>maxang)
+      maxang=fabs(fast[i].lon-slow[i].lon);
+    if (fabs(fast[i].elev-slow[i].elev)>maxelev)
+      maxelev=fabs(fast[i].elev-slow[i].elev);
+    if (dist(ellip->geoc(fast[i]),pnts[i])>maxround)
+      maxround=dist(ellip->geoc(fast[i]),pnts[i]);
+  }
+  cout<<ellip->getName()<<" geod closed form "<<ms[0]<<" ms, iterative "<<ms[1]<<" ms"<<endl;
+  cout<<"Differences: angle "<<maxang<<" elevation "<<maxelev<<" round trip "<<maxround<<endl;
+  tassert(same);
+  tassert(maxang<1e-14 && maxelev<1e-7 && maxround<1e-7);
+  lle=ellip->geod(ellip->getCenter()+xyz(1000,2000,3000)); // in the core, where the closed form doesn't work
+  tassert(std::isnan(lle.lat) || fabs(lle.lat)<=M_PI/2);
+}
+
 void testellipsoid()
 {
   double rad,cenlat,conlat,invconlat,conscale;
@@ -5493,6 +6438,9 @@ void testellipsoid()
       <<"->"<<pnt2.east()<<','<<pnt2.north()
       <<" dist "<<dist(pnt0,pnt2)<<endl;
   testkrugerscale(&WGS84);
+  testkrugerclenshaw(&WGS84);
+  testgeodclosed(&WGS84);
+  testgeodclosed(&Clarke);
 }
 
 float BeninBoundary[][2]=
@@ -5684,6 +6632,73 @@ void testTransMerc()
  * 60° 1.56419578
  * 30° 1.13975353
  */
+void testprojectioncells(ProjectionList &plist)
+/* Checks cover, which looks in a table of cells, against testing every
+ * projection, at points all over the earth and thickly in North America.
+ */
+{
+  int i,j,k,msCover,msAll;
+  vector<latlong> lls;
+  vector<vector<int> > byAll;
+  ProjectionList covering;
+  bool same=true;
+  QTime starttime;
+  for (i=0;i<100000;i++)
+    if (i%2)
+      lls.push_back(latlong(asin(((unsigned)i*0x9e3779b9u)/2147483648.-1),(i%3600)*M_PI/1800-M_PI));
+    else
+      lls.push_back(latlong(degtorad(25+(i%250)*0.1),degtorad(-125+(i/250%600)*0.1)));
+  starttime.start();
+  byAll.resize(lls.size());
+  for (i=0;i<lls.size();i++)
+    for (j=0;j<plist.size();j++)
+      if (plist[j]->in(lls[i]))
+	byAll[i].push_back(j);
+  msAll=starttime.elapsed();
+  starttime.start();
+  for (i=0;i<lls.size();i++)
+    covering=plist.cover(lls[i]);
+  msCover=starttime.elapsed();
+  for (i=0;i<lls.size();i++)
+  {
+    covering=plist.cover(lls[i]);
+    if (covering.size()!=byAll[i].size())
+      same=false;
+    else
+      for (k=0;k<covering.size();k++)
+	if (covering[k]!=plist[byAll[i][k]])
+	  same=false;
+  }
+  cout<<lls.size()<<" points: every projection "<<msAll<<" ms, cells "<<msCover<<" ms"<<endl;
+  tassert(same);
+}
+
+void testprojectionstrips()
+/* UTM-like zones from 80°S to 84°N, each bounded by four points, have edges
+ * long enough that the boundary as flattened is far from the great circles
+ * between the points, and they straddle the edges of cube faces. Zones near
+ * the antipode of the Arabian Sea are left out; their flattened boundaries
+ * go almost all the way around infinity, and in() gets them wrong.
+ */
+{
+  int i;
+  stringstream zones;
+  ProjectionList plist;
+  for (i=24;i<56;i++)
+  {
+    zones<<"Country:UTM\nState:\nZone:"<<setw(2)<<i+1<<"N\nVersion:WGS84\n";
+    zones<<"Projection:TM\nEllipsoid:WGS84\nMeridian:"<<abs(i*6-177)<<(i<30?'W':'E')<<'\n';
+    zones<<"Scale:0.9996\nOriginLL:0N "<<abs(i*6-177)<<(i<30?'W':'E')<<"\nOriginXY:500000,0\n";
+    zones<<"Boundary:"<<abs(i*6-180.5)<<(i*6-180.5<0?'W':'E')<<" 80S ";
+    zones<<abs(i*6-173.5)<<(i*6-173.5<0?'W':'E')<<" 80S ";
+    zones<<abs(i*6-173.5)<<(i*6-173.5<0?'W':'E')<<" 84N ";
+    zones<<abs(i*6-180.5)<<(i*6-180.5<0?'W':'E')<<" 84N\nFoot:INT\n\n";
+  }
+  plist.readFile(zones);
+  tassert(plist.size()==32);
+  testprojectioncells(plist);
+}
+
 void testprojection()
 {
   int i;
@@ -5798,6 +6813,7 @@ void testprojection()
   grid=GeorgiaWest.latlongToGrid(llBV067202);
   cout<<grid.east()<<' '<<grid.north()<<' '<<dist(grid,xyBV067202)<<endl;
   tassert(dist(grid,xyBV067202)<0.001);
+  testprojectionstrips();
   if (pfile)
   {
     plist.readFile(pfile);
@@ -5813,6 +6829,7 @@ void testprojection()
       cout<<"Distance from Oakland NAD27 to NAD83 is "<<distOldNewOakland<<endl;
       tassert(fabs(distOldNewOakland-7.868)<0.001);
     }
+    testprojectioncells(plist);
     for (i=0;i<plist.size();i++)
     {
       proj=plist[i];
@@ -5829,6 +6846,62 @@ void testprojection()
     cout<<"Projection list is uninstalled. Skipping projection list test.\n";
 }
 
+void testgridfactor()
+/* Converts a 100×100 grid of points in Georgia West from grid to latlong and
+ * back, checks the batch against the one-point functions, and times both.
+ */
+{
+  latlong gawll(degtorad(30),degtorad(-505/6.));
+  TransverseMercatorEllipsoid GeorgiaWest(&GRS80,gawll.lon,0.9999,gawll,xy(7e5,0));
+  cubemap geoid;
+  vector<xyz> grid;
+  vector<latlong> lls;
+  vector<double> elevs;
+  vector<PointFactors> batch,back;
+  PointFactors one;
+  double maxdist=0,minComb=INFINITY,maxComb=-INFINITY;
+  bool same=true;
+  int i,ms;
+  QTime starttime;
+  for (i=0;i<6;i++)
+    geoid.faces[i].und[0]=-30*65536; // geoid 30 m below ellipsoid
+  geoid.scale=1/65536.;
+  for (i=0;i<10000;i++)
+    grid.push_back(xyz(6e5+(i%100)*2000,3e5+(i/100)*2000,200+(i%7)*10));
+  starttime.start();
+  batch=gridFactors(GeorgiaWest,geoid,grid,4);
+  ms=starttime.elapsed();
+  cout<<"Grid to latlong: "<<grid.size()<<" points in "<<ms<<" ms"<<endl;
+  for (i=0;i<grid.size();i++)
+  {
+    one=gridFactors(GeorgiaWest,geoid,grid[i]);
+    same=same && one.ll.lat==batch[i].ll.lat && one.ll.lon==batch[i].ll.lon &&
+         one.combined==batch[i].combined && one.convergence==batch[i].convergence;
+    tassert(batch[i].separation==-30);
+    if (batch[i].combined<minComb)
+      minComb=batch[i].combined;
+    if (batch[i].combined>maxComb)
+      maxComb=batch[i].combined;
+    lls.push_back(batch[i].ll);
+    elevs.push_back(batch[i].elevation);
+  }
+  tassert(same);
+  cout<<"Combined factor from "<<ldecimal(minComb)<<" to "<<ldecimal(maxComb)<<endl;
+  tassert(minComb>0.9998 && maxComb<1.0001);
+  starttime.start();
+  back=latlongFactors(GeorgiaWest,geoid,lls,elevs,3);
+  ms=starttime.elapsed();
+  cout<<"Latlong to grid: "<<lls.size()<<" points in "<<ms<<" ms"<<endl;
+  for (i=0;i<grid.size();i++)
+  {
+    if (dist(back[i].grid,xy(grid[i]))>maxdist)
+      maxdist=dist(back[i].grid,xy(grid[i]));
+    tassert(fabs(back[i].combined-batch[i].combined)<1e-12);
+  }
+  cout<<"Round trip error "<<maxdist<<endl;
+  tassert(maxdist<1e-6);
+}
+
 void spotcheckcolor(int col0,int col1)
 {
   int col2;
@@ -6340,6 +7413,117 @@ void testleastsquares()
   tassert(dist(xyz(x[0],x[1],x[2]),xyz(0.25,0.25,0.5))<1e-9);
 }
 
+void gridNetwork(int side,SparseMatrix &m,vector<double> &v,vector<xy> &approx,vector<xy> &actual)
+/* Makes the linearized observation equations of a network of stations on a
+ * square grid, 100 m apart, whose approximate coordinates are a few cm off.
+ * Each station is measured by distance to its neighbors to the east, north,
+ * and northeast, and the corners are located by GPS. The unknowns are the
+ * corrections to x and y of each station.
+ */
+{
+  int i,j,k,row=0,a,b;
+  int nbr[3][2]={{1,0},{0,1},{1,1}};
+  xy u;
+  approx.clear();
+  actual.clear();
+  v.clear();
+  for (i=0;i<side;i++)
+    for (j=0;j<side;j++)
+    {
+      actual.push_back(xy(i*100,j*100));
+      approx.push_back(actual.back()+cossin((int)rng.uirandom())*(rng.ucrandom()/16384.));
+    }
+  m.resize(2*side*(side-1)+sqr(side-1)+8,2*side*side);
+  for (i=0;i<side;i++)
+    for (j=0;j<side;j++)
+      for (k=0;k<3;k++)
+	if (i+nbr[k][0]<side && j+nbr[k][1]<side)
+	{
+	  a=i*side+j;
+	  b=(i+nbr[k][0])*side+j+nbr[k][1];
+	  u=(approx[b]-approx[a])/dist(approx[a],approx[b]);
+	  m.add(row,2*a,-u.getx());
+	  m.add(row,2*a+1,-u.gety());
+	  m.add(row,2*b,u.getx());
+	  m.add(row,2*b+1,u.gety());
+	  v.push_back(dist(actual[a],actual[b])-dist(approx[a],approx[b]));
+	  row++;
+	}
+  for (i=0;i<4;i++)
+  {
+    a=(i&1)*(side-1)*side+(i>>1)*(side-1);
+    m.add(row,2*a,1);
+    v.push_back(actual[a].getx()-approx[a].getx());
+    row++;
+    m.add(row,2*a+1,1);
+    v.push_back(actual[a].gety()-approx[a].gety());
+    row++;
+  }
+  m.finish();
+}
+
+void testsparse()
+{
+  SparseMatrix m,n(3,3);
+  SparseCholesky chol;
+  vector<double> v,sx,dx;
+  vector<xy> approx,actual;
+  int i,j;
+  int sides[]={10,22,71,224};
+  double maxdiff=0,maxerr=0;
+  QTime starttime;
+  int denseTime,sparseTime;
+  n.add(0,0,4);
+  n.add(1,1,3);
+  n.add(0,1,1);
+  n.add(2,2,0);
+  n.add(1,0,1);
+  n.finish();
+  n.add(2,2,2);
+  n.finish();
+  tassert(n.nonzeros()==5 && n.get(0,1)==1 && n.get(2,2)==2 && n.get(2,0)==0);
+  chol.factor(n);
+  sx=chol.solve(vector<double>{5,4,2}); // 4x+y=5, x+3y=4, 2z=2
+  cout<<"Sparse solution ("<<ldecimal(sx[0])<<','<<ldecimal(sx[1])<<','<<ldecimal(sx[2])<<")\n";
+  tassert(dist(xyz(sx[0],sx[1],sx[2]),xyz(1,1,1))<1e-12);
+  n.resize(2,2);
+  n.add(0,0,1);
+  n.add(0,1,1);
+  n.add(1,0,1);
+  n.add(1,1,1);
+  n.finish();
+  chol.factor(n);
+  sx=chol.solve(vector<double>{2,2}); // singular, one unknown is NaN
+  tassert(chol.rank()==1 && std::isnan(sx[0])!=std::isnan(sx[1]));
+  for (j=0;j<4;j++)
+  {
+    gridNetwork(sides[j],m,v,approx,actual);
+    starttime.start();
+    sx=sparseLeastSquares(m,v);
+    sparseTime=starttime.elapsed();
+    chol.factor(m.normalMatrix());
+    maxerr=0;
+    for (i=0;i<approx.size();i++)
+      if (dist(approx[i]+xy(sx[2*i],sx[2*i+1]),actual[i])>maxerr)
+	maxerr=dist(approx[i]+xy(sx[2*i],sx[2*i+1]),actual[i]);
+    cout<<sx.size()<<" unknowns, "<<v.size()<<" observations, "<<chol.nonzeros()<<" in factor: sparse "<<sparseTime<<" ms";
+    if (sx.size()<=1200)
+    {
+      starttime.start();
+      dx=linearLeastSquares(m.dense(),v);
+      denseTime=starttime.elapsed();
+      cout<<", dense "<<denseTime<<" ms";
+      for (i=0;i<sx.size();i++)
+	if (fabs(sx[i]-dx[i])>maxdiff)
+	  maxdiff=fabs(sx[i]-dx[i]);
+    }
+    cout<<", max error "<<maxerr<<endl;
+    tassert(maxerr<1e-4);
+  }
+  cout<<"Sparse and dense differ by "<<maxdiff<<endl;
+  tassert(maxdiff<1e-9);
+}
+
 void clampcubic()
 /* Determine values which will be used to check whether a spiralarc well
  * approximates a contour. The contour segment is a piece of an elliptic
@@ -6617,6 +7801,32 @@ void testhistogram()
   ps.close();
 }
 
+void testlrucache()
+{
+  LruCache<int,string> cache(3);
+  string val;
+  cout<<"Testing LRU cache..."<<endl;
+  cache.put(1,"one");
+  cache.put(2,"two");
+  cache.put(3,"three");
+  tassert(cache.get(1,val) && val=="one"); // 1 is now the most recent
+  cache.put(4,"four"); // throws out 2
+  tassert(cache.size()==3);
+  tassert(!cache.get(2,val));
+  tassert(cache.get(3,val) && val=="three");
+  cache.put(1,"uno");
+  cache.put(5,"five"); // throws out 4
+  tassert(!cache.get(4,val));
+  tassert(cache.get(1,val) && val=="uno");
+  tassert(cache.findIf([](int k,const string &v){return k>2;},val) && val=="five");
+  cache.put(6,"six"); // throws out 3, not 5, which findIf used
+  tassert(cache.get(5,val));
+  tassert(!cache.get(3,val));
+  tassert(!cache.findIf([](int k,const string &v){return v=="two";},val));
+  cache.clear();
+  tassert(cache.size()==0 && !cache.get(1,val));
+}
+
 void testsmooth5()
 {
   unsigned int i,lasti=0,previ;
@@ -6738,6 +7948,79 @@ void testquadhash()
   }
 }
 
+void testquadbasis()
+/* Checks the basis table against geoquad::undulation, that the model
+ * computed from it is bit for bit the undulation, that correction recovers
+ * a geoquad from half its samples, and that the inverse cache gives the same
+ * matrices when filled from several threads.
+ */
+{
+  int i,j,k,qsz;
+  geoquad gq,unitquad,zero;
+  double qpoints[16][16],maxdiff=0;
+  array<double,6> corr;
+  vector<thread> threads;
+  vector<int> wrong(4,0);
+  cout<<"Testing quad basis..."<<endl;
+  for (qsz=4;qsz<=16;qsz++)
+  {
+    const QuadBasis &basis=quadBasis(qsz);
+    tassert(basis.size==qsz);
+    for (k=0;k<6;k++)
+    {
+      for (i=0;i<6;i++)
+	unitquad.und[i]=i==k;
+      for (i=0;i<qsz;i++)
+	for (j=0;j<qsz;j++)
+	  tassert(basis.comp[k][i*qsz+j]==unitquad.undulation(qscale(i,qsz),qscale(j,qsz)));
+    }
+    for (i=0;i<6;i++)
+      gq.und[i]=sin(i*1.618034+qsz)*6553600;
+    for (i=0;i<qsz;i++)
+      for (j=0;j<qsz;j++)
+	qpoints[i][j]=gq.undulation(qscale(i,qsz),qscale(j,qsz));
+    maxdiff=max(maxdiff,maxerror(gq,qpoints,qsz));
+  }
+  cout<<"Tabulated model differs from undulation by "<<maxdiff<<endl;
+  tassert(maxdiff==0);
+  qsz=16;
+  zero.und[0]=0;
+  for (i=0;i<6;i++)
+    gq.und[i]=(i*7-17)*4096;
+  for (i=0;i<qsz;i++)
+    for (j=0;j<qsz;j++)
+      qpoints[i][j]=(i+2*j<20)?NAN:gq.undulation(qscale(i,qsz),qscale(j,qsz));
+  corr=correction(zero,qpoints,qsz);
+  for (i=0;i<6;i++)
+    tassert(fabs(corr[i]-gq.und[i])<1e-6);
+  tassert(maxerror(gq,qpoints,qsz)<1e-6);
+  tassert(maxerror(zero,qpoints,qsz)>4096);
+  auto work=[&](int t)
+  {
+    int pat,i,j;
+    double qp[16][16];
+    fixedmatrix<6,6> cached,direct;
+    for (pat=0;pat<64;pat++)
+    {
+      for (i=0;i<qsz;i++)
+	for (j=0;j<qsz;j++)
+	  qp[i][j]=(3*i+j<(pat*3+t)%40)?NAN:1;
+      cached=quadInverse(qp,qsz);
+      direct=invert(autocorr(qp,qsz));
+      for (i=0;i<6;i++)
+	for (j=0;j<6;j++)
+	  if (cached[i][j]!=direct[i][j])
+	    wrong[t]++;
+    }
+  };
+  for (i=0;i<4;i++)
+    threads.push_back(thread(work,i));
+  for (i=0;i<4;i++)
+    threads[i].join();
+  for (i=0;i<4;i++)
+    tassert(wrong[i]==0);
+}
+
 void testvball()
 {
   int lat,lon,olat,olon,i,j;
@@ -6842,6 +8125,75 @@ void testvball()
   cout<<"done."<<endl;
 }
 
+bool sameDouble(double a,double b)
+// True if a and b are the same bits, or both NaN.
+{
+  return (std::isnan(a) && std::isnan(b)) || (a==b && signbit(a)==signbit(b));
+}
+
+void testvballbatch()
+/* Checks that encodedirs and decodedirs give exactly what encodedir and
+ * decodedir give, including the zero vector, NaN, infinities, and points
+ * on the edges and corners of the cube, and times them.
+ */
+{
+  int i,n=1000000;
+  vector<double> x,y,z,ox(n),oy(n),oz(n);
+  vector<vball> v(n),vs(n);
+  xyz dir;
+  double special[]={0,-0.0,1,-1,3,-3,INFINITY,-INFINITY,NAN};
+  int scalarTime,batchTime,wrong=0;
+  QTime starttime;
+  cout<<"Testing batch volleyball conversion..."<<endl;
+  for (i=0;i<729;i++)
+  {
+    x.push_back(special[i%9]);
+    y.push_back(special[i/9%9]);
+    z.push_back(special[i/81]);
+  }
+  while (x.size()<n)
+  {
+    x.push_back(((short)rng.usrandom()+rng.usrandom()/65536.)/(rng.usrandom()+1));
+    y.push_back(((short)rng.usrandom()+rng.usrandom()/65536.)/(rng.usrandom()+1));
+    z.push_back(((short)rng.usrandom()+rng.usrandom()/65536.)/(rng.usrandom()+1));
+  }
+  starttime.start();
+  for (i=0;i<n;i++)
+    vs[i]=encodedir(xyz(x[i],y[i],z[i]));
+  scalarTime=starttime.elapsed();
+  starttime.start();
+  encodedirs(&x[0],&y[0],&z[0],&v[0],n);
+  batchTime=starttime.elapsed();
+  cout<<"encode: scalar "<<scalarTime<<" ms, batch "<<batchTime<<" ms"<<endl;
+  for (i=0;i<n;i++)
+    if (v[i].face!=vs[i].face || !sameDouble(v[i].x,vs[i].x) || !sameDouble(v[i].y,vs[i].y))
+      wrong++;
+  tassert(wrong==0);
+  for (i=0;i<729;i++)
+  { // Put points on the edges and corners of every face.
+    v[i].face=i%8;
+    v[i].x=special[i/8%3+1]*(i/24%2?1:0.5);
+    v[i].y=special[i/48%3+1]*(i/144%2?1:-0.25);
+  }
+  starttime.start();
+  for (i=0;i<n;i++)
+  {
+    dir=decodedir(v[i]);
+    x[i]=dir.getx();
+    y[i]=dir.gety();
+    z[i]=dir.getz();
+  }
+  scalarTime=starttime.elapsed();
+  starttime.start();
+  decodedirs(&v[0],&ox[0],&oy[0],&oz[0],n);
+  batchTime=starttime.elapsed();
+  cout<<"decode: scalar "<<scalarTime<<" ms, batch "<<batchTime<<" ms"<<endl;
+  for (i=0;i<n;i++)
+    if (!sameDouble(x[i],ox[i]) || !sameDouble(y[i],oy[i]) || !sameDouble(z[i],oz[i]))
+      wrong++;
+  tassert(wrong==0);
+}
+
 xy unfold(vball pnt)
 {
   xy ret(-2,-2);
@@ -7188,6 +8540,110 @@ void testgpolyline()
   tassert(p1.size()==4);
 }
 
+void randomLeaves(geoquad &quad,int depth)
+// Subdivides quad at random and gives about 3/4 of the leaves data.
+{
+  int i;
+  if (depth>0 && rng.ucrandom()<200)
+  {
+    quad.subdivide();
+    for (i=0;i<4;i++)
+      randomLeaves(*quad.sub[i],depth-1);
+  }
+  else if (rng.ucrandom()<192)
+    quad.und[0]=0;
+}
+
+void testedgeboundary()
+/* Checks that cancelling hashed edges gives the same boundary as merging
+ * the boundaries of geoquads, on a random cubemap with holes, islands,
+ * and loops touching at corners.
+ */
+{
+  cubemap cmap;
+  gboundary fast,slow;
+  int i,fastTime,slowTime;
+  double fastPerim,slowPerim;
+  QTime timer;
+  for (i=0;i<6;i++)
+    randomLeaves(cmap.faces[i],5);
+  timer.start();
+  fast=cmap.gbounds();
+  fastTime=timer.elapsed();
+  timer.start();
+  slow=cmap.gboundsMerge();
+  slowTime=timer.elapsed();
+  fastPerim=fast.perimeter();
+  slowPerim=slow.perimeter();
+  cout<<fast.size()<<" loops "<<fast.totalSegments()<<" segments, hashed "<<fastTime<<
+    " ms; "<<slow.size()<<" loops "<<slow.totalSegments()<<" segments, merged "<<
+    slowTime<<" ms"<<endl;
+  cout<<"area "<<fast.area()<<' '<<slow.area()<<" perimeter "<<ldecimal(fastPerim)<<' '<<ldecimal(slowPerim)<<endl;
+  tassert(fast.size()==slow.size());
+  tassert(fast.totalSegments()==slow.totalSegments());
+  tassert(fast.area()==slow.area());
+  tassert(fabs(fastPerim-slowPerim)<1e-6*slowPerim);
+  cmap.clear();
+  tassert(cmap.gbounds().size()==0);
+  for (i=0;i<6;i++)
+    cmap.faces[i].und[0]=0;
+  tassert(cmap.gbounds().size()==0);
+  cmap.faces[2].und[0]=0x80000000;
+  fast=cmap.gbounds();
+  tassert(fast.size()==1 && fast[0].size()==4);
+}
+
+void testgboundaryin()
+/* Checks in() through the grid against checking every boundary, and the
+ * batch form against the one-point form.
+ */
+{
+  cubemap cmap;
+  gboundary gb;
+  vector<xyz> pnts;
+  vector<unsigned> batch;
+  vball v;
+  int i,nwrong=0,gridTime,directTime,batchTime;
+  unsigned bits;
+  QTime timer;
+  for (i=0;i<6;i++)
+    randomLeaves(cmap.faces[i],4);
+  gb=cmap.gbounds();
+  for (i=gb.size()-1;i>=32;i--)
+    gb.erase(i);
+  for (i=0;i<30000;i++)
+  {
+    v.face=rng.ucrandom()%6+1;
+    v.x=rng.usrandom()/32768.-1;
+    v.y=rng.usrandom()/32768.-1;
+    pnts.push_back(decodedir(v));
+  }
+  for (i=0;i<1000;i++)
+    pnts.push_back(gb.nearPoint());
+  timer.start();
+  for (i=bits=0;i<pnts.size();i++)
+    bits^=gb.in(pnts[i]);
+  gridTime=timer.elapsed();
+  timer.start();
+  for (i=0;i<pnts.size();i++)
+    if (gb.inDirect(pnts[i])!=gb.in(pnts[i]))
+      nwrong++;
+  directTime=timer.elapsed();
+  timer.start();
+  batch=gb.in(pnts);
+  batchTime=timer.elapsed();
+  cout<<gb.size()<<" boundaries "<<gb.totalSegments()<<" segments, "<<pnts.size()<<
+    " points: grid "<<gridTime<<" ms, direct and grid "<<directTime<<
+    " ms, batch "<<batchTime<<" ms, "<<nwrong<<" differ"<<endl;
+  tassert(nwrong==0);
+  for (i=0;i<pnts.size();i++)
+    if (batch[i]!=gb.in(pnts[i]))
+      nwrong++;
+  tassert(nwrong==0);
+  gb.clear();
+  tassert(gb.in(pnts[0])==0);
+}
+
 void testvballgeoid()
   /* Make a geoid file showing the numerals 1-6 on their faces. The KML file
    * will be for developers to see how volleyball coordinates work.
@@ -8162,6 +9618,10 @@ int main(int argc, char *argv[])
     testmeasure();
   if (shoulddo("matrix"))
     testmatrix();
+  if (shoulddo("fixedmatrix"))
+    testfixedmatrix();
+  if (shoulddo("matrixbench"))
+    matrixbench();
   if (shoulddo("quaternion"))
     testquaternion();
   if (shoulddo("copytopopoints"))
@@ -8202,6 +9662,8 @@ int main(int argc, char *argv[])
     testbrent();
   if (shoulddo("newton"))
     testnewton();
+  if (shoulddo("lengthtree"))
+    testlengthtree();
   if (shoulddo("manysum"))
     testmanysum(); // >2 s
   if (shoulddo("vcurve"))
@@ -8210,6 +9672,8 @@ int main(int argc, char *argv[])
     testintegertrig();
   if (shoulddo("leastsquares"))
     testleastsquares();
+  if (shoulddo("sparse"))
+    testsparse();
   if (shoulddo("minquad"))
     testminquad();
   if (shoulddo("circle"))
@@ -8220,6 +9684,8 @@ int main(int argc, char *argv[])
     testarc();
   if (shoulddo("spiral"))
     testspiral();
+  if (shoulddo("cornu"))
+    testcornu();
   if (shoulddo("spiralarc"))
     testspiralarc(); // 10.5 s
   if (shoulddo("property"))
@@ -8228,16 +9694,24 @@ int main(int argc, char *argv[])
     testobjlist();
   if (shoulddo("cogospiral"))
     testcogospiral();
+  if (shoulddo("polyintersect"))
+    testpolyintersect();
   if (shoulddo("curly"))
     testcurly();
   if (shoulddo("curvefit"))
     testcurvefit();
   if (shoulddo("manyarc"))
     testmanyarc(); // 3 s
+  if (shoulddo("manyarcbulk"))
+    testmanyarcbulk();
   if (shoulddo("closest"))
     testclosest();
   if (shoulddo("qindex"))
     testqindex();
+  if (shoulddo("edgeindex"))
+    testedgeindex();
+  if (shoulddo("localsets"))
+    testlocalsets();
   if (shoulddo("makegrad"))
     testmakegrad();
   if (shoulddo("derivs"))
@@ -8260,6 +9734,10 @@ int main(int argc, char *argv[])
     testpolyline();
   if (shoulddo("alignment"))
     testalignment();
+  if (shoulddo("bcirtree"))
+    testbcirtree();
+  if (shoulddo("stations"))
+    teststations();
   if (shoulddo("bezier3d"))
     testbezier3d();
   if (shoulddo("angleconv"))
@@ -8276,6 +9754,8 @@ int main(int argc, char *argv[])
     testellipsoid();
   if (shoulddo("projection"))
     testprojection();
+  if (shoulddo("gridfactor"))
+    testgridfactor();
   if (shoulddo("color"))
     testcolor();
   if (shoulddo("layer"))
@@ -8302,16 +9782,26 @@ int main(int argc, char *argv[])
     testsmooth5();
   if (shoulddo("quadhash"))
     testquadhash(); // 8 s
+  if (shoulddo("quadbasis"))
+    testquadbasis();
+  if (shoulddo("lrucache"))
+    testlrucache();
   if (shoulddo("smallcircle"))
     testsmallcircle();
   if (shoulddo("cylinterval"))
     testcylinterval();
   if (shoulddo("vball"))
     testvball();
+  if (shoulddo("vballbatch"))
+    testvballbatch();
   if (shoulddo("geoid"))
     testgeoid();
   if (shoulddo("geoidboundary"))
     testgeoidboundary(); // 45 s
+  if (shoulddo("edgeboundary"))
+    testedgeboundary();
+  if (shoulddo("gboundaryin"))
+    testgboundaryin();
   if (shoulddo("gpolyline"))
     testgpolyline();
   if (shoulddo("vballgeoid"))
@@ -93,6 +93,11 @@
         <source>badabsorient</source>
         <translation>Insufficient or indeterminate data for absolute orientation</translation>
     </message>
+    <message>
+        <location filename="except.cpp" line="49"/>
+        <source>actioncanceled</source>
+        <translation>Canceled.</translation>
+    </message>
 </context>
 <context>
     <name>ContourIntervalDialog</name>
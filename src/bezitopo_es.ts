@@ -93,6 +93,11 @@
         <source>badabsorient</source>
         <translation>Dados insuficientes o indeterminados para orientación absoluta</translation>
     </message>
+    <message>
+        <location filename="except.cpp" line="49"/>
+        <source>actioncanceled</source>
+        <translation>Cancelado.</translation>
+    </message>
 </context>
 <context>
     <name>ContourIntervalDialog</name>
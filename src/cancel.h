@@ -0,0 +1,114 @@
+/******************************************************/
+/*                                                    */
+/* cancel.h - cancel long file reads and writes       */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CANCEL_H
+#define CANCEL_H
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <cmath>
+#include "except.h"
+
+/* An I/O thread points cancelFlag at the flag of the action it is running.
+ * Readers and writers call checkCancel in their loops; when the GUI sets the
+ * flag, checkCancel throws actionCanceled, which unwinds out of the action.
+ * In a thread not running an action, such as bezitest, the flag is null and
+ * checkCancel does nothing.
+ */
+
+inline std::atomic<bool> *&cancelFlag()
+{
+  static thread_local std::atomic<bool> *flag=nullptr;
+  return flag;
+}
+
+inline bool isCanceled(std::atomic<bool> *flag)
+{
+  return flag && flag->load(std::memory_order_relaxed);
+}
+
+inline void checkCancel()
+{
+  if (isCanceled(cancelFlag()))
+    throw BeziExcept(actionCanceled);
+}
+
+/* Likewise, an I/O thread points actionProgress at the progress of the
+ * action it is running, which the loops that call checkCancel update. The
+ * GUI reads permille when notify tells it that it has changed. notify is
+ * called in the I/O thread, at most a thousand times per action.
+ */
+struct ActionProgress
+{
+  std::atomic<int> permille;
+  std::function<void()> notify;
+  ActionProgress()
+  {
+    permille=0;
+  }
+};
+
+inline ActionProgress *&actionProgress()
+{
+  static thread_local ActionProgress *progress=nullptr;
+  return progress;
+}
+
+inline void setProgress(ActionProgress *progress,double done,double total)
+// For worker threads of an action, which don't have actionProgress set.
+{
+  int pm;
+  if (progress && total>0)
+  {
+    pm=lrint(1000*done/total);
+    if (pm<0)
+      pm=0;
+    if (pm>1000)
+      pm=1000;
+    if (progress->permille.exchange(pm,std::memory_order_relaxed)!=pm && progress->notify)
+      progress->notify();
+  }
+}
+
+inline void checkCancel(double done,double total)
+{
+  setProgress(actionProgress(),done,total);
+  checkCancel();
+}
+
+inline double streamSize(std::istream &file)
+/* Returns the size of a seekable stream, leaving its position unchanged,
+ * or 0 if it can't tell.
+ */
+{
+  std::streamoff here=file.tellg(),end;
+  if (here<0)
+    return 0;
+  file.seekg(0,std::ios::end);
+  end=file.tellg();
+  file.seekg(here);
+  return end>0?end:0;
+}
+
+#endif
@@ -23,6 +23,7 @@
  */
 #include <cfloat>
 #include <iostream>
+#include <algorithm>
 #include "ldecimal.h"
 #include "cogospiral.h"
 #include "manysum.h"
@@ -330,6 +331,35 @@ vector<alosta> intersection1(segment *a,double a1,segment *b,double b1,bool exte
   return ret;
 }
 
+void overlappingCells(segment *a,int ai0,int ai1,int adiv,segment *b,int bi0,int bi1,int bdiv,vector<array<int,2> > &cells)
+/* a is divided into adiv pieces and b into bdiv pieces. Finds the pairs of
+ * pieces, from ai0 to ai1-1 on a and from bi0 to bi1-1 on b, whose bounding
+ * circles overlap. A run of pieces of length l is within l/2 of its middle
+ * station, so the circle is centered there. The larger run is split in half.
+ */
+{
+  double alen=a->length(),blen=b->length(),arad,brad;
+  xy acen,bcen;
+  arad=(ai1-ai0)*alen/adiv/2;
+  brad=(bi1-bi0)*blen/bdiv/2;
+  acen=a->station((ai0+ai1)*alen/adiv/2);
+  bcen=b->station((bi0+bi1)*blen/bdiv/2);
+  if (dist(acen,bcen)>(arad+brad)*(1+1e-9)+(acen.length()+bcen.length())*DBL_EPSILON*16)
+    return;
+  if (ai1-ai0==1 && bi1-bi0==1)
+    cells.push_back(array<int,2>{ai0,bi0});
+  else if (bi1-bi0==1 || (ai1-ai0>1 && arad>=brad))
+  {
+    overlappingCells(a,ai0,(ai0+ai1)/2,adiv,b,bi0,bi1,bdiv,cells);
+    overlappingCells(a,(ai0+ai1)/2,ai1,adiv,b,bi0,bi1,bdiv,cells);
+  }
+  else
+  {
+    overlappingCells(a,ai0,ai1,adiv,b,bi0,(bi0+bi1)/2,bdiv,cells);
+    overlappingCells(a,ai0,ai1,adiv,b,(bi0+bi1)/2,bi1,bdiv,cells);
+  }
+}
+
 /* If two spiralarcs intersect twice near the end of both, the secant method
  * may miss one, but the tangent method will find both. Conversely, if they
  * osculate, the tangent method will fail to converge because of roundoff,
@@ -341,12 +371,19 @@ vector<array<alosta,2> > intersections(segment *a,segment *b,bool extend)
  * intersections, occasionally even the wrong parity of number of intersections
  * (1 or 3 for tangent circles, where it should return 2). You must check whether
  * the resulting pieces of a are on opposite sides of b.
+ *
+ * a and b are divided into adiv and bdiv pieces. Only pairs of pieces whose
+ * bounding circles overlap are tried, by the secant method on the pieces and
+ * the tangent method from their corners, so two long curves that cross a few
+ * times take O(adiv+bdiv) Newton solves, not O(adiv*bdiv). If extend is true,
+ * the intersection may be off the ends, so all pairs are tried.
  */
 {
   vector<array<alosta,2> > inters,ret;
   array<alosta,2> int1;
   vector<alosta> int0;
-  vector<int> bounds;
+  vector<int> bounds,corners;
+  vector<array<int,2> > cells;
   int h,i,j,adiv,bdiv,range,rangeSize;
   double maxcur,endcur,alen,blen;
   alen=a->length();
@@ -365,32 +402,39 @@ vector<array<alosta,2> > intersections(segment *a,segment *b,bool extend)
   bdiv=nearbyint(maxcur*blen+blen/alen)+3;
   if (bdiv<3 || bdiv>4096)
     bdiv=4096;
-  if (std::isnan(alen))
-    adiv=-1;
-  if (std::isnan(blen))
-    bdiv=-1;
-  for (i=0;i<adiv;i++)
-    for (j=0;j<bdiv;j++)
+  if (std::isnan(alen) || std::isnan(blen))
+    adiv=bdiv=0;
+  if (extend)
+    for (i=0;i<adiv;i++)
+      for (j=0;j<bdiv;j++)
+	cells.push_back(array<int,2>{i,j});
+  else if (adiv && bdiv)
+    overlappingCells(a,0,adiv,adiv,b,0,bdiv,bdiv,cells);
+  for (i=0;i<cells.size();i++)
+  {
+    int0=intersection1(a,cells[i][0]*alen/adiv,(cells[i][0]+1)*alen/adiv,
+		       b,cells[i][1]*blen/bdiv,(cells[i][1]+1)*blen/bdiv,extend);
+    if (int0.size())
     {
-      int0=intersection1(a,i*alen/adiv,(i+1)*alen/adiv,b,j*blen/bdiv,(j+1)*blen/bdiv,extend);
-      if (int0.size())
-      {
-	int1[0]=int0[0];
-	int1[1]=int0[1];
-	inters.push_back(int1);
-      }
+      int1[0]=int0[0];
+      int1[1]=int0[1];
+      inters.push_back(int1);
     }
-  for (i=0;i<=adiv;i++)
-    for (j=0;j<=bdiv;j++)
+    for (j=0;j<4;j++)
+      corners.push_back((cells[i][0]+(j&1))*(bdiv+1)+cells[i][1]+(j>>1));
+  }
+  sort(corners.begin(),corners.end());
+  corners.erase(unique(corners.begin(),corners.end()),corners.end());
+  for (i=0;i<corners.size();i++)
+  {
+    int0=intersection1(a,(corners[i]/(bdiv+1))*alen/adiv,b,(corners[i]%(bdiv+1))*blen/bdiv,extend);
+    if (int0.size())
     {
-      int0=intersection1(a,i*alen/adiv,b,j*blen/bdiv,extend);
-      if (int0.size())
-      {
-	int1[0]=int0[0];
-	int1[1]=int0[1];
-	inters.push_back(int1);
-      }
+      int1[0]=int0[0];
+      int1[1]=int0[1];
+      inters.push_back(int1);
     }
+  }
   for (h=relprime(inters.size());h;h=(h>1)?relprime(h):0) // Shell sort
     for (i=h;i<inters.size();i++)
       for (j=i-h;j>=0 && (inters[j][0].along>inters[j+h][0].along || (inters[j][0].along==inters[j+h][0].along && inters[j][1].along>inters[j+h][1].along));j-=h)
@@ -436,6 +480,47 @@ vector<array<alosta,2> > intersections(segment *a,segment *b,bool extend)
   return ret;
 }
 
+vector<array<alosta,2> > intersections(polyspiral &a,polyspiral &b)
+/* Returns the intersections of a and b in order along a. The alongs are
+ * stations along the polyspirals. Only pairs of spiralarcs whose bounding
+ * circles overlap, found by walking both trees of bounding circles, are
+ * intersected. An intersection at a vertex may be found on both spiralarcs
+ * which meet there; it is returned once. Call setlengths on both first.
+ */
+{
+  vector<array<alosta,2> > inters,ret,int0;
+  spiralarc aspi,bspi;
+  int i;
+  double toler=(a.length()+b.length())*DBL_EPSILON*65536;
+  a.boundTree().overlaps(b.boundTree(),[&](int m,int n)
+    {
+      aspi=a.getspiralarc(m);
+      bspi=b.getspiralarc(n);
+      int0=intersections(&aspi,&bspi);
+      for (i=0;i<int0.size();i++)
+      {
+	int0[i][0].along+=a.getCumLength(m);
+	int0[i][1].along+=b.getCumLength(n);
+	inters.push_back(int0[i]);
+      }
+    });
+  sort(inters.begin(),inters.end(),[](const array<alosta,2> &p,const array<alosta,2> &q)
+    {
+      return p[0].along<q[0].along;
+    });
+  auto same=[&](const array<alosta,2> &p,const array<alosta,2> &q)
+    { // The first and last vertex of a closed polyspiral are the same.
+      double da=fabs(p[0].along-q[0].along),db=fabs(p[1].along-q[1].along);
+      return (da<=toler || da>=a.length()-toler) && (db<=toler || db>=b.length()-toler);
+    };
+  for (i=0;i<inters.size();i++)
+    if (ret.size()==0 || !same(ret.back(),inters[i]))
+      ret.push_back(inters[i]);
+  if (ret.size()>1 && !a.isopen() && same(ret[0],ret.back()))
+    ret.pop_back();
+  return ret;
+}
+
 double meanSquareDistance(segment *a,segment *b)
 /* All points on a should have a closest point on b, without going off the ends
  * of b. In other words, a should be part of the approximation to b.
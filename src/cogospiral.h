@@ -44,6 +44,7 @@
 #include "point.h"
 #include "spiral.h"
 #include "circle.h"
+#include "polyline.h"
 
 /* Constants for Gaussian quadrature of sixth-degree polynomial resulting from
  * squaring a cubic, for calculating the RMS distance between a spiral and
@@ -77,6 +78,7 @@ struct alosta
 std::vector<alosta> intersection1(segment *a,double a1,double a2,segment *b,double b1,double b2,bool extend=false);
 std::vector<alosta> intersection1(segment *a,double a1,segment *b,double b1,bool extend=false);
 std::vector<std::array<alosta,2> > intersections(segment *a,segment *b,bool extend=false);
+std::vector<std::array<alosta,2> > intersections(polyspiral &a,polyspiral &b);
 double meanSquareDistance(segment *a,segment *b);
 std::array<double,4> weightedDistance(segment *a,segment *b);
 std::array<double,2> besidement(Circle a,Circle b);
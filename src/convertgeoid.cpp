@@ -23,6 +23,11 @@
  */
 #include <iostream>
 #include <ctime>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <memory>
+#include <tuple>
 #include "config.h"
 #include "geoid.h"
 #include "sourcegeoid.h"
@@ -39,12 +44,14 @@
 #include "kml.h"
 #include "smooth5.h"
 #include "cmdopt.h"
+#include "lrucache.h"
 using namespace std;
 
 document doc;
 vector<geoformat> formatlist;
 int verbosity=1;
-bool helporversion=false,commandError=false,inputKml=false,didConvert=false;
+bool helporversion=false,commandError=false,inputKml=false,outputKml=true,didConvert=false;
+bool serveMode=false;
 int qsz=4;
 int latFineness=0,lonFineness=0;
 double bolTolerance=0,bolSubdivision=0,bolSpacing=0;
@@ -68,7 +75,9 @@ vector<option> options(
     {'s',"subdiv","distance","Subdivision limit of geoquads, typ. 1 km"},
     {'e',"endian","big/native/little","Output endianness (for ngs)"},
     {'q',"quadsample","n 4-16","Geoquad sampling fineness"},
-    {'S',"spacing","distance","Geoquad search spacing, typ. 100 km"}
+    {'S',"spacing","distance","Geoquad search spacing, typ. 100 km"},
+    {'\0',"no-kml","","Don't write KML outline of output file"},
+    {'\0',"serve","","Make excerpts requested on standard input"}
   });
 
 vector<token> cmdline;
@@ -283,25 +292,44 @@ void frontformat(string fmt)
 }
 
 histogram errorspread(double tolerance)
+/* The Halton points are taken a block at a time, so that the output geoid
+ * can be looked up with one call to cubemap::undulations. The number of
+ * points depends on how many bars the histogram has, so the last block
+ * may not be used up.
+ */
 {
   histogram ret(-1/65536.,1/65536.);
   halton hal;
   latlong ll;
   xyz loc;
-  int i;
-  double origelev,cvtelev;
+  int i,j;
+  const int blocksz=256;
+  double origelev,x[blocksz],y[blocksz],z[blocksz],cvtelev[blocksz];
   ret.addinterval(-tolerance/1.25,tolerance/1.25);
   ret.addinterval(-tolerance,tolerance);
   ret.addinterval(-tolerance*1.25,tolerance*1.25);
-  for (i=0;i*ret.nbars()<16777216;i++)
+  for (i=0;i*ret.nbars()<16777216;)
   {
-    ll=hal.onearth();
-    loc=Sphere.geoc(ll,0);
-    cvtelev=outputgeoid.elev(loc);
-    origelev=avgelev(loc);
-    if (isfinite(cvtelev) && isfinite(origelev))
+    for (j=0;j<blocksz;j++)
+    {
+      ll=hal.onearth();
+      loc=Sphere.geoc(ll,0);
+      x[j]=loc.getx();
+      y[j]=loc.gety();
+      z[j]=loc.getz();
+    }
+    if (outputgeoid.cmap)
+      outputgeoid.cmap->undulations(x,y,z,cvtelev,blocksz);
+    else
+      for (j=0;j<blocksz;j++)
+	cvtelev[j]=outputgeoid.elev(xyz(x[j],y[j],z[j]));
+    for (j=0;j<blocksz && i*ret.nbars()<16777216;j++,i++)
     {
-      ret<<(cvtelev-origelev);
+      origelev=avgelev(xyz(x[j],y[j],z[j]));
+      if (isfinite(cvtelev[j]) && isfinite(origelev))
+      {
+	ret<<(cvtelev[j]-origelev);
+      }
     }
   }
   return ret;
@@ -564,6 +592,12 @@ void argpass2()
           commandError=true;
 	}
 	break;
+      case 15:
+        outputKml=false;
+        break;
+      case 16:
+        serveMode=true;
+        break;
       default:
 	if (!helporversion)
 	  readgeoid(cmdline[i].nonopt);
@@ -575,7 +609,9 @@ void argpass2()
  * -o file		Sets the output filename. The file is written after
  * 			all input files are read.
  * -c lat long radius	Excerpts a circle from the geoid file.
- * Outputting the KML file is automatic; there is no option for it.
+ * --no-kml		Doesn't output the KML file, which is otherwise automatic.
+ * --serve		Reads the input files, then makes excerpts of them as
+ * 			requested on standard input (see serveExcerpts).
  * Arguments not tagged by an option are input files.
  * 
  * Example:
@@ -585,6 +621,18 @@ void argpass2()
  * and outputs the boundary to file Macksville.gsf.kml .
  */
 
+void timedKml(gboundary gb,string filename)
+/* Tells how long the KML outline took, which is the time that --no-kml
+ * would save.
+ */
+{
+  chrono::steady_clock::time_point start=chrono::steady_clock::now();
+  outKml(gb,filename);
+  cout<<"Wrote "<<filename<<" in "<<fixed<<setprecision(3)<<
+    chrono::duration<double>(chrono::steady_clock::now()-start).count()<<
+    " s"<<defaultfloat<<endl;
+}
+
 bool oneBoldatni()
 {
   if (nInputFiles==1)
@@ -593,6 +641,306 @@ bool oneBoldatni()
     return false;
 }
 
+void setupCubemap(geoid &g)
+// Gives g an empty cubemap and a boldatni header for geoid undulation.
+{
+  g.cmap=new cubemap;
+  g.ghdr=new geoheader;
+  g.cmap->scale=1/65536.;
+  g.ghdr->logScale=-16;
+  g.ghdr->planet=BOL_EARTH;
+  g.ghdr->dataType=BOL_UNDULATION;
+  g.ghdr->encoding=BOL_VARLENGTH;
+  g.ghdr->ncomponents=1;
+  g.ghdr->xComponentBits=0; // geoheader has no constructor; a reused heap block isn't zero
+}
+
+void setBolDefaults()
+{
+  if (bolTolerance<=0)
+    bolTolerance=0.001;
+  if (bolSubdivision<=0)
+    bolSubdivision=1000;
+  if (bolSpacing<=0)
+    bolSpacing=1e5;
+}
+
+void fillCubemap(geoid &g)
+/* Interrogates and refines the six faces of g's cubemap from the input
+ * geoids, within excerptcircles if there are any. g.ghdr->tolerance must
+ * already be set.
+ */
+{
+  int i;
+  g.ghdr->sublimit=bolSubdivision;
+  g.ghdr->spacing=bolSpacing;
+  if (oneBoldatni())
+  {
+    g.ghdr->excerpted=true;
+    g.ghdr->origHash=geo[0].ghdr->origHash;
+  }
+  else
+    g.ghdr->excerpted=false;
+  for (i=0;i<6;i++)
+  {
+    interroquad(g.cmap->faces[i],g.ghdr->spacing);
+    refine(g.cmap->faces[i],g.cmap->scale,g.ghdr->tolerance,g.ghdr->sublimit,g.ghdr->spacing,qsz,allBoldatni());
+  }
+}
+
+/* Excerpts are cached by format, center (latitude and longitude as binary
+ * angles), radius (binary angle), and tolerance (boldatni only).
+ *
+ * A boldatni excerpt is made of a circle an eighth bigger than requested,
+ * then cropped to the requested circle; a later request for a circle inside
+ * it, with the same tolerance, is cropped from it too. Refining a geoquad
+ * depends on the circle only through whether the geoquad overlaps it, so
+ * blanking the geoquads that don't overlap the requested circle gives the
+ * same cubemap, and the same file, that -c writes.
+ *
+ * A lattice excerpt is reused only for the same circle. Its points are
+ * placed by interpolating between its bounds, and the slopes at its edges
+ * are one-sided, so part of a bigger lattice would not be the same.
+ */
+typedef tuple<string,int,int,int,double> ExcerptKey;
+
+struct CachedExcerpt
+{
+  smallcircle cir;
+  shared_ptr<geoid> excerpt;
+};
+
+const size_t excerptCacheSize=32;
+LruCache<ExcerptKey,CachedExcerpt> excerptCache(excerptCacheSize);
+
+bool circleContains(smallcircle big,smallcircle small)
+/* Returns true if small is inside big with room to spare, so that roundoff
+ * in overlap can't find a geoquad that overlaps small but not big.
+ */
+{
+  double apart=atan2((big.center*small.center).length(),dot(big.center,small.center));
+  return apart+bintorad(small.radius)+1e-6<bintorad(big.radius);
+}
+
+void cropQuad(geoquad &quad,smallcircle cir)
+/* Blanks the parts of quad that don't overlap cir, as refine leaves them
+ * when cir is the only excerpt circle. It descends the same way refine does.
+ */
+{
+  int i;
+  if (!overlap(cir,quad))
+    quad.clear();
+  else if (quad.subdivided())
+    for (i=0;i<4;i++)
+      cropQuad(*quad.sub[i],cir);
+}
+
+bool hasData(geoquad &quad)
+{
+  int i;
+  bool ret=false;
+  if (quad.subdivided())
+    for (i=0;i<4 && !ret;i++)
+      ret=hasData(*quad.sub[i]);
+  else
+    ret=!quad.isnan();
+  return ret;
+}
+
+shared_ptr<geoid> makeExcerpt(smallcircle cir,double tolerance,const geoformat &fmt)
+/* Makes an excerpt of the input geoids in format fmt. Returns null if the
+ * circle has no geoid data.
+ */
+{
+  shared_ptr<geoid> ret(new geoid);
+  vector<cylinterval> inputbounds;
+  cylinterval bound;
+  int i;
+  excerptcircles.clear();
+  excerptcircles.push_back(cir);
+  dataArea.clear();
+  totalArea.clear();
+  if (fmt.cmd=="bol")
+  {
+    setupCubemap(*ret);
+    ret->ghdr->namesFormats=outputgeoid.ghdr->namesFormats;
+    ret->ghdr->tolerance=tolerance;
+    fillCubemap(*ret);
+    outProgress();
+    cout<<endl;
+    if (dataArea.total()<=0)
+      ret.reset();
+  }
+  else
+  {
+    for (i=0;i<geo.size();i++)
+      inputbounds.push_back(geo[i].boundrect());
+    excerptinterval=cir.boundrect();
+    excerptinterval.round(latFineness,lonFineness);
+    bound=intersect(excerptinterval,combine(inputbounds));
+    ret->glat=new geolattice;
+    ret->glat->setbound(bound);
+    ret->glat->setfineness(latFineness,lonFineness);
+    ret->glat->setundula();
+    ret->glat->setslopes();
+    if (ret->glat->boundrect().area()<=0)
+      ret.reset();
+  }
+  return ret;
+}
+
+string serveRequest(string line)
+/* Does one request and returns the answer. The request is
+ * center radius format filename [tolerance]
+ * e.g. "38N99W 150km gsf Macksville.gsf" or "38N 99W 150km bol ks.bol 2mm".
+ * An excerpt already made that covers the circle (see ExcerptKey) is
+ * reused. An exception while making or writing the excerpt is answered as
+ * an error, and the server goes on to the next request.
+ */
+{
+  istringstream words(line);
+  vector<string> tokens;
+  string word,centerstr,howGot;
+  latlong ll;
+  double radius=NAN,tolerance;
+  int i,j,fmtnum=-1;
+  smallcircle cir,cover;
+  ExcerptKey key;
+  CachedExcerpt cached;
+  shared_ptr<geoid> output;
+  bool bol,found;
+  chrono::steady_clock::time_point start=chrono::steady_clock::now();
+  ostringstream answer;
+  while (words>>word)
+    tokens.push_back(word);
+  ll=parselatlong(centerstr,DEGREE);
+  for (i=0;ll.valid()<2 && i<tokens.size();i++)
+  {
+    centerstr+=tokens[i]+" ";
+    ll=parselatlong(centerstr,DEGREE);
+  }
+  if (ll.valid()<2 || ll.lat<-M_PI/2 || ll.lat>M_PI/2)
+    return "error no center";
+  if (tokens.size()<i+3)
+    return "error request is center radius format filename [tolerance]";
+  try
+  {
+    radius=doc.ms.parseMeasurement(tokens[i],LENGTH).magnitude;
+    tolerance=bolTolerance;
+    if (tokens.size()>i+3)
+      tolerance=doc.ms.parseMeasurement(tokens[i+3],LENGTH).magnitude;
+  }
+  catch (...)
+  {
+    return "error can't parse distance";
+  }
+  if (!(radius>0 && radius<=1e7))
+    return "error radius is 10000 km max";
+  if (tolerance<sqrt(6)/65536)
+    tolerance=sqrt(6)/65536;
+  for (j=0;j<formatlist.size();j++)
+    if (formatlist[j].cmd==tokens[i+1])
+      fmtnum=j;
+  if (fmtnum<0 || !formatlist[fmtnum].writefunc)
+    return "error can't write format "+tokens[i+1];
+  if (formatlist[fmtnum].cmd!="bol")
+  {
+    if (!latFineness || !lonFineness)
+      return "error no fineness; please specify -F";
+    tolerance=0;
+  }
+  cir.center=Sphere.geoc(ll,0);
+  cir.setradius(radtobin(radius/Sphere.avgradius()));
+  bol=formatlist[fmtnum].cmd=="bol";
+  cover=cir;
+  if (bol)
+  {
+    cover.setradius(cir.radius+cir.radius/8);
+    found=excerptCache.findIf([&](const ExcerptKey &k,const CachedExcerpt &c)
+			      {return get<0>(k)=="bol" && get<4>(k)==tolerance &&
+				      circleContains(c.cir,cir);},cached);
+  }
+  else
+  {
+    key=make_tuple(formatlist[fmtnum].cmd,radtobin(ll.lat),radtobin(ll.lon),cir.radius,tolerance);
+    found=excerptCache.get(key,cached);
+  }
+  if (found)
+    howGot="cached";
+  else
+  {
+    try
+    {
+      cached.cir=cover;
+      cached.excerpt=makeExcerpt(cover,tolerance,formatlist[fmtnum]);
+    }
+    catch (BeziExcept &e)
+    {
+      return "error making excerpt: exception "+to_string(e.getNumber());
+    }
+    catch (exception &e)
+    {
+      return string("error making excerpt: ")+e.what();
+    }
+    if (!cached.excerpt)
+      return "error no geoid data in circle";
+    key=make_tuple(formatlist[fmtnum].cmd,radtobin(ll.lat),radtobin(ll.lon),cover.radius,tolerance);
+    excerptCache.put(key,cached);
+    howGot="new";
+  }
+  output=cached.excerpt;
+  if (bol)
+  {
+    output.reset(new geoid(*cached.excerpt));
+    for (found=false,j=0;j<6;j++)
+    {
+      cropQuad(output->cmap->faces[j],cir);
+      found|=hasData(output->cmap->faces[j]);
+    }
+    if (!found)
+      return "error no geoid data in circle";
+  }
+  try
+  {
+    formatlist[fmtnum].writefunc(*output,tokens[i+2]);
+  }
+  catch (BeziExcept &e)
+  {
+    return "error writing "+tokens[i+2]+": exception "+to_string(e.getNumber());
+  }
+  catch (exception &e)
+  {
+    return "error writing "+tokens[i+2]+": "+e.what();
+  }
+  answer<<"ok "<<tokens[i+2]<<' '<<howGot<<' '<<fixed<<setprecision(1)<<
+    chrono::duration<double,milli>(chrono::steady_clock::now()-start).count()<<" ms";
+  return answer.str();
+}
+
+void serveExcerpts()
+/* Keeps the input geoids loaded and makes excerpts of them as requested,
+ * one request per line on stdin, one answer per line on stdout, beginning
+ * with "ok" or "error". Everything else that would go to stdout, such as
+ * progress, goes to stderr. A blank line is ignored; "quit" or end of file
+ * stops. To take requests on a local socket, run it under socat or inetd.
+ */
+{
+  string line;
+  streambuf *answerBuf=cout.rdbuf();
+  ostream answer(answerBuf);
+  setBolDefaults();
+  cout.rdbuf(cerr.rdbuf());
+  while (getline(cin,line))
+  {
+    if (line.find_first_not_of(" \t\r")==string::npos)
+      continue;
+    if (line=="quit")
+      break;
+    answer<<serveRequest(line)<<endl;
+  }
+  cout.rdbuf(answerBuf);
+}
+
 int main(int argc, char *argv[])
 {
   ofstream ofile;
@@ -617,15 +965,8 @@ int main(int argc, char *argv[])
     initformat("ngatxt","grd","US National Geospatial-Intelligence Agency text",readusngatxt,writeusngatxt);
     initformat("ngabin","","US National Geospatial-Intelligence Agency binary",readusngabin,nullptr);
   }
-  outputgeoid.cmap=new cubemap;
-  outputgeoid.ghdr=new geoheader;
+  setupCubemap(outputgeoid);
   outputgeoid.glat=new geolattice;
-  outputgeoid.cmap->scale=1/65536.;
-  outputgeoid.ghdr->logScale=-16;
-  outputgeoid.ghdr->planet=BOL_EARTH;
-  outputgeoid.ghdr->dataType=BOL_UNDULATION;
-  outputgeoid.ghdr->encoding=BOL_VARLENGTH;
-  outputgeoid.ghdr->ncomponents=1;
   outputgeoid.ghdr->tolerance=0.003;
   outputgeoid.ghdr->sublimit=1000;
   outputgeoid.ghdr->spacing=1e5;
@@ -661,11 +1002,13 @@ int main(int argc, char *argv[])
   latticebound=intersect(excerptinterval,combine(inputbounds));
   //cout<<"latticebound "<<formatlatlong(latlong(latticebound.sbd,latticebound.wbd),DEGREE+SEXAG2);
   //cout<<' '<<formatlatlong(latlong(latticebound.nbd,latticebound.ebd),DEGREE+SEXAG2)<<endl;
-  if (!helporversion && !commandError && (geo.size() || !nInputFiles))
+  if (serveMode && !helporversion && !commandError && geo.size())
+    serveExcerpts();
+  else if (!helporversion && !commandError && (geo.size() || !nInputFiles))
   {
     if (inputKml)
       for (i=0;i<geo.size();i++)
-        outKml(gbounds(geo[i]),infilenames[i]+".kml");
+        timedKml(gbounds(geo[i]),infilenames[i]+".kml");
     if (!outfilename.length())
     {
       if (infilebasenames.size()==1)
@@ -683,33 +1026,9 @@ int main(int argc, char *argv[])
     if (outfilename.length())
       if (formatlist[0].cmd=="bol")
       {
-        if (bolTolerance<=0)
-          bolTolerance=0.001;
-        if (bolSubdivision<=0)
-          bolSubdivision=1000;
-        if (bolSpacing<=0)
-          bolSpacing=1e5;
+        setBolDefaults();
         outputgeoid.ghdr->tolerance=bolTolerance;
-        outputgeoid.ghdr->sublimit=bolSubdivision;
-        outputgeoid.ghdr->spacing=bolSpacing;
-	if (oneBoldatni())
-	{
-	  outputgeoid.ghdr->excerpted=true;
-	  outputgeoid.ghdr->origHash=geo[0].ghdr->origHash;
-	}
-	else
-	  outputgeoid.ghdr->excerpted=false;
-        for (i=0;i<6;i++)
-        {
-          //cout<<"Face "<<i+1;
-          //cout.flush();
-          interroquad(outputgeoid.cmap->faces[i],outputgeoid.ghdr->spacing);
-          /*if (cube.faces[i].isfull()>=0)
-            cout<<" has data"<<endl;
-          else
-            cout<<" is empty"<<endl;*/
-          refine(outputgeoid.cmap->faces[i],outputgeoid.cmap->scale,outputgeoid.ghdr->tolerance,outputgeoid.ghdr->sublimit,outputgeoid.ghdr->spacing,qsz,allBoldatni());
-        }
+        fillCubemap(outputgeoid);
         outProgress();
         cout<<endl;
         undrange=outputgeoid.cmap->undrange();
@@ -755,7 +1074,10 @@ int main(int argc, char *argv[])
       {
         cout<<"Writing "<<outfilename<<endl;
         formatlist[0].writefunc(outputgeoid,outfilename);
-        outKml(gbounds(outputgeoid),outfilename+".kml");
+        if (outputKml)
+          timedKml(gbounds(outputgeoid),outfilename+".kml");
+        else
+          cout<<"Not writing "<<outfilename<<".kml"<<endl;
       }
       else
         cerr<<"Can't write in format "<<formatlist[0].cmd<<"; it is a whole-earth-only format."<<endl;
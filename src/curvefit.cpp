@@ -24,6 +24,9 @@
 
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <atomic>
 #include "curvefit.h"
 #include "manysum.h"
 #include "csv.h"
@@ -32,6 +35,7 @@
 
 using namespace std;
 
+int fitThreads=0;
 int fitDir=0;
 /* fitDir is rotated by PHIQUARTER (145.623°) and the endpoints, except the
  * first and last which are moved along their lines, are moved along lines
@@ -76,10 +80,16 @@ bool FitRec::isnan() const
 }
 
 void FitRec::breakArcs(set<int> which,polyarc apx)
+/* Also renumbers the closest pieces, so that they still point to the arc,
+ * or the first half of the arc, closest to each point.
+ */
 {
   set<int>::reverse_iterator i;
+  int j;
   for (i=which.rbegin();i!=which.rend();i++)
     endpoints.insert(endpoints.begin()+*i,apx.getarc(*i).midpoint());
+  for (j=0;j<pieces.size();j++)
+    pieces[j]+=distance(which.begin(),which.lower_bound(pieces[j]));
 }
 
 double diff(const FitRec &a,const FitRec &b,Circle startLine,Circle endLine)
@@ -145,34 +155,81 @@ FitRec initialCurve(deque<Circle> lines,int pieces,PostScript &ps,BoundRect &br)
   return ret;
 }
 
-vector<double> curvefitResiduals(polyarc q,vector<xy> points)
-/* The points must not be off the ends of q.
+void curvefitResiduals(vector<polyarc> &curves,const vector<xy> &points,vector<int> &pieces,vector<vector<double> > &resid)
+/* Computes the residuals of points from all the curves, which have the same
+ * number of arcs, on fitThreads threads. Each thread takes a chunk of points
+ * on one curve at a time. If pieces has one element per point, it is the
+ * closest arc to each point on a curve near these, and closestNear starts
+ * from it; on return, it holds the closest arcs on curves[0].
+ *
+ * The points must not be off the ends of the curves.
  */
 {
-  vector<double> ret;
-  int i,bear;
-  double along;
-  for (i=0;i<points.size();i++)
+  const size_t chunkSize=256;
+  size_t nChunks=(points.size()+chunkSize-1)/chunkSize;
+  atomic<size_t> nextJob(0);
+  vector<int> newPieces(points.size(),-1);
+  vector<thread> threads;
+  bool warm=pieces.size()==points.size();
+  int i,nthreads=fitThreads;
+  resid.resize(curves.size());
+  for (i=0;i<curves.size();i++)
   {
-    along=q.closest(points[i]);
-    bear=q.bearing(along)+DEG90;
-    ret.push_back(distanceInDirection(q.station(along),points[i],bear));
+    resid[i].resize(points.size());
+    curves[i].boundTree(); // Build it now, not in several threads at once.
   }
-  return ret;
+  auto work=[&]()
+  {
+    size_t job,j,end;
+    int c,piece;
+    double along;
+    while ((job=nextJob++)<nChunks*curves.size())
+    {
+      c=job/nChunks;
+      end=min(points.size(),(job%nChunks+1)*chunkSize);
+      for (j=job%nChunks*chunkSize;j<end;j++)
+      {
+	piece=warm?pieces[j]:-1;
+	along=curves[c].closestNear(points[j],piece);
+	resid[c][j]=distanceInDirection(curves[c].station(along),points[j],curves[c].bearing(along)+DEG90);
+	if (c==0)
+	  newPieces[j]=piece;
+      }
+    }
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
+  for (i=1;i<nthreads && i<nChunks*curves.size();i++)
+    threads.push_back(thread(work));
+  work();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+  pieces.swap(newPieces);
+}
+
+vector<double> curvefitResiduals(polyarc q,const vector<xy> &points,vector<int> *pieces)
+/* If pieces is not null, it is used and updated as above.
+ */
+{
+  vector<polyarc> curves(1,q);
+  vector<vector<double> > resid;
+  vector<int> noPieces;
+  curvefitResiduals(curves,points,pieces?*pieces:noPieces,resid);
+  return resid[0];
 }
 
-double curvefitSquareError(polyarc q,vector<xy> points)
+double curvefitSquareError(polyarc q,const vector<xy> &points,vector<int> *pieces)
 {
-  vector<double> resid=curvefitResiduals(q,points);
+  vector<double> resid=curvefitResiduals(q,points,pieces);
   int i;
   for (i=0;i<resid.size();i++)
     resid[i]*=resid[i];
   return pairwisesum(resid);
 }
 
-double curvefitMaxError(polyarc q,vector<xy> points)
+double curvefitMaxError(polyarc q,const vector<xy> &points,vector<int> *pieces)
 {
-  vector<double> resid=curvefitResiduals(q,points);
+  vector<double> resid=curvefitResiduals(q,points,pieces);
   int i;
   double maxerr=0;
   for (i=0;i<resid.size();i++)
@@ -181,24 +238,14 @@ double curvefitMaxError(polyarc q,vector<xy> points)
   return maxerr;
 }
 
-vector<int> closestPieces(polyline &p,vector<xy> points)
-{
-  vector<int> ret;
-  int i;
-  ret.resize(points.size());
-  for (i=0;i<points.size();i++)
-    ret[i]=p.stationSegment(p.closest(points[i]));
-  return ret;
-}
-
-set<int> breakWhich(polyarc q,vector<xy> points)
+set<int> breakWhich(polyarc q,const vector<xy> &points)
 /* Returns one or two indices of arc to break, those that have the points
  * with the worst errors.
  */
 {
   set<int> ret;
-  vector<double> resid=curvefitResiduals(q,points);
-  vector<int> cp=closestPieces(q,points);
+  vector<int> cp;
+  vector<double> resid=curvefitResiduals(q,points,&cp);
   map<int,int> cpCount;
   int i,negWorst=-1,posWorst=-1;
   double worstPos=-INFINITY,worstNeg=INFINITY;
@@ -262,12 +309,13 @@ vector<int> adjustDirs(polyarc apx,int fitDir)
   return ret;
 }
 
-FitRec adjust1step(vector<xy> points,Circle startLine,FitRec fr,Circle endLine,bool twoD)
+FitRec adjust1step(const vector<xy> &points,Circle startLine,FitRec fr,Circle endLine,bool twoD)
 {
   int i,j,sz=fr.endpoints.size(),d=twoD+1;
   vector<double> adjustment;
-  vector<double> resid;
-  vector<double> plusresid,minusresid;
+  vector<vector<double> > resid;
+  vector<polyarc> curves;
+  vector<int> pieces=fr.pieces;
   polyarc apx=arcFitApprox(startLine,fr,endLine);
   vector<int> adjdirs=adjustDirs(apx,fitDir);
   double shortDist=fr.shortDist(startLine,endLine);
@@ -281,6 +329,11 @@ FitRec adjust1step(vector<xy> points,Circle startLine,FitRec fr,Circle endLine,b
     hxy.push_back(cossin(adjdirs[i])*h);
     hyx.push_back(cossin(adjdirs[i]+DEG90)*h);
   }
+  /* curves[0] is the curve being adjusted; curves[2i+1] and curves[2i+2] are
+   * it with the ith parameter moved plus and minus. Their residuals are all
+   * computed at once, so that all threads have work.
+   */
+  curves.push_back(apx);
   for (i=0;i<sz*d+3;i++)
   {
     plusoffsets.endpoints.clear();
@@ -324,13 +377,14 @@ FitRec adjust1step(vector<xy> points,Circle startLine,FitRec fr,Circle endLine,b
     }
     else
       plusoffsets.startBear=minusoffsets.startBear=fr.startBear;
-    plusresid=curvefitResiduals(arcFitApprox(startLine,plusoffsets,endLine),points);
-    minusresid=curvefitResiduals(arcFitApprox(startLine,minusoffsets,endLine),points);
-    for (j=0;j<plusresid.size();j++)
-      sidedefl[j][i]=plusresid[j]-minusresid[j];
+    curves.push_back(arcFitApprox(startLine,plusoffsets,endLine));
+    curves.push_back(arcFitApprox(startLine,minusoffsets,endLine));
   }
-  resid=curvefitResiduals(arcFitApprox(startLine,fr,endLine),points);
-  adjustment=linearLeastSquares(sidedefl,resid);
+  curvefitResiduals(curves,points,pieces,resid);
+  for (i=0;i<sz*d+3;i++)
+    for (j=0;j<points.size();j++)
+      sidedefl[j][i]=resid[2*i+1][j]-resid[2*i+2][j];
+  adjustment=linearLeastSquares(sidedefl,resid[0]);
   // Limit the adjustment to 4096 furmans (22.5°) to keep close to linear.
   for (i=0;i<adjustment.size();i++)
     if (fabs(adjustment[i])>maxadj)
@@ -340,6 +394,7 @@ FitRec adjust1step(vector<xy> points,Circle startLine,FitRec fr,Circle endLine,b
   ret.startOff=fr.startOff-h*adjustment[0];
   ret.endOff=fr.endOff-h*adjustment[sz*d+1];
   ret.startBear=fr.startBear-lrint(adjustment[sz*d+2]*FURMAN1);
+  ret.pieces=pieces;
   for (i=0;i<sz;i++)
     if (twoD)
       ret.endpoints.push_back(fr.endpoints[i]-hxy[i]*adjustment[i+1]-hyx[i]*adjustment[i+sz+1]);
@@ -348,7 +403,7 @@ FitRec adjust1step(vector<xy> points,Circle startLine,FitRec fr,Circle endLine,b
   return ret;
 }
 
-FitRec adjustArcs(vector<xy> points,Circle startLine,FitRec fr,Circle endLine)
+FitRec adjustArcs(const vector<xy> &points,Circle startLine,FitRec fr,Circle endLine)
 /* Adjusts the polyarc defined by startLine, fr, and endLine until the maximum
  * error stops getting better.
  */
@@ -375,7 +430,7 @@ FitRec adjustArcs(vector<xy> points,Circle startLine,FitRec fr,Circle endLine)
     stepDir();
     apx=arcFitApprox(startLine,fr,endLine);
     lastError=thisError;
-    thisError=curvefitMaxError(apx,points);
+    thisError=curvefitMaxError(apx,points,&fr.pieces);
     if (thisError>=lastError)
       j++;
     i++;
@@ -394,6 +449,7 @@ polyarc fitPolyarc(Circle startLine,vector<xy> points,Circle endLine,double tole
   BoundRect br;
   polyarc apx;
   set<int> breaks;
+  chrono::steady_clock::time_point start;
   hints.push_front(startLine);
   hints.push_back(endLine);
   ps.open("fitPolyarc.ps");
@@ -410,6 +466,7 @@ polyarc fitPolyarc(Circle startLine,vector<xy> points,Circle endLine,double tole
    */
   for (i=0;maxerr>toler;i++)
   {
+    start=chrono::steady_clock::now();
     lastfr=fr;
     fr=adjustArcs(points,startLine,fr,endLine);
     apx=arcFitApprox(startLine,fr,endLine);
@@ -426,8 +483,9 @@ polyarc fitPolyarc(Circle startLine,vector<xy> points,Circle endLine,double tole
 	ps.circle(fr.endpoints[j],0.5/ps.getscale());
       ps.endpage();
     }
-    cout<<apx.size()<<" arcs\n";
-    maxerr=curvefitMaxError(apx,points);
+    maxerr=curvefitMaxError(apx,points,&fr.pieces);
+    cout<<apx.size()<<" arcs, max error "<<maxerr<<", "
+      <<chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-start).count()<<" ms\n";
     if (maxerr>toler)
     {
       breaks=breakWhich(apx,points);
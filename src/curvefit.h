@@ -37,6 +37,7 @@ struct FitRec
   double endOff;
   double startCur; // used only when fitting a polyspiral
   int startBear;
+  std::vector<int> pieces; // closest arc to each point, from the last fit
   double shortDist(Circle startLine,Circle endLine) const;
   bool isnan() const;
   void breakArcs(std::set<int> which,polyarc apx);
@@ -51,14 +52,20 @@ double diff(const FitRec &a,const FitRec &b,Circle startLine,Circle endLine);
  */
 FitRec initialCurve(std::deque<Circle> lines,int pieces,PostScript &ps,BoundRect &br);
 
+extern int fitThreads;
+/* Number of threads used to compute residuals. If 0 or negative, uses as
+ * many threads as the processor has.
+ */
+
 void stepDir();
-std::vector<double> curvefitResiduals(polyarc q,std::vector<xy> points);
-double curvefitSquareError(polyarc q,std::vector<xy> points);
-double curvefitMaxError(polyarc q,std::vector<xy> points);
-std::set<int> breakWhich(polyarc q,std::vector<xy> points);
+void curvefitResiduals(std::vector<polyarc> &curves,const std::vector<xy> &points,std::vector<int> &pieces,std::vector<std::vector<double> > &resid);
+std::vector<double> curvefitResiduals(polyarc q,const std::vector<xy> &points,std::vector<int> *pieces=nullptr);
+double curvefitSquareError(polyarc q,const std::vector<xy> &points,std::vector<int> *pieces=nullptr);
+double curvefitMaxError(polyarc q,const std::vector<xy> &points,std::vector<int> *pieces=nullptr);
+std::set<int> breakWhich(polyarc q,const std::vector<xy> &points);
 polyarc arcFitApprox(Circle startLine,FitRec fr,Circle endLine);
-FitRec adjust1step(std::vector<xy> points,Circle startLine,FitRec fr,Circle endLine,bool twoD);
-FitRec adjustArcs(std::vector<xy> points,Circle startLine,FitRec fr,Circle endLine);
+FitRec adjust1step(const std::vector<xy> &points,Circle startLine,FitRec fr,Circle endLine,bool twoD);
+FitRec adjustArcs(const std::vector<xy> &points,Circle startLine,FitRec fr,Circle endLine);
 
 /* Fits a polyarc to the points. The initial polyarc is formed by fitting
  * a spiralarc to the midpoints of startLine and endLine perpendicular to both,
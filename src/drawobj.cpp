@@ -134,6 +134,11 @@ unsigned drawobj::hash()
   return 0;
 }
 
+drawobj *drawobj::clone()
+{
+  return nullptr;
+}
+
 double drawobj::dirbound(int angle,double boundsofar)
 {
   return INFINITY;
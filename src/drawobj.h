@@ -129,6 +129,10 @@ public:
   }
   virtual void roscat(xy tfrom,int ro,double sca,xy tto); // rotate, scale, translate
   virtual unsigned hash();
+  virtual drawobj *clone();
+  /* Returns a copy made with new, which the RenderCache renders in another
+   * thread, or nullptr if the object has to be rendered where it is.
+   */
   virtual double dirbound(int angle,double boundsofar=INFINITY);
   virtual bezier3d approx3d(double precision);
   virtual std::vector<drawingElement> render3d(double precision,int layer,int color,int width,int linetype);
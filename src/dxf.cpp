@@ -27,6 +27,7 @@
 #include "binio.h"
 #include "textfile.h"
 #include "ldecimal.h"
+#include "cancel.h"
 using namespace std;
 
 TagRange tagTable[]=
@@ -424,11 +425,16 @@ vector<GroupCode> readDxfGroups(istream &file,bool mode)
   GroupCode oneCode;
   vector<GroupCode> ret;
   bool cont=true;
+  double fileBytes=streamSize(file);
   TextFile tfile(file);
   if (!mode)
     cont=readDxfMagic(file);
   while (cont)
   {
+    if ((ret.size()&4095)==0) // tellg may be a system call
+      checkCancel(file.tellg(),fileBytes);
+    else
+      checkCancel();
     if (mode)
       oneCode=readDxfText(tfile);
     else
@@ -688,7 +694,7 @@ void insertTriangle(vector<GroupCode> &dxfData,triangle &tri,double outUnit)
   insertXyz(dxfData,13,*tri.c/outUnit); // triangle is indicated by repeating a corner.
 }
 
-void insertPolyline(vector<GroupCode> &dxfData,polyspiral &poly,DxfLayer &lay,double outUnit)
+void insertPolyline(vector<GroupCode> &dxfData,polyarc &apx,DxfLayer &lay,double outUnit)
 /* A closed polyarc with the last segment having nonzero curvature looks
  * like this:
  * 70	//closedFlag
@@ -717,7 +723,6 @@ void insertPolyline(vector<GroupCode> &dxfData,polyspiral &poly,DxfLayer &lay,do
 {
   GroupCode entityType(0),layerName(8),colorNumber(62);
   GroupCode nVertices(90),closedFlag(70),elev(38);
-  polyarc apx(poly,0.001);
   int delta;
   int i;
   entityType.str="LWPOLYLINE";
@@ -742,3 +747,9 @@ void insertPolyline(vector<GroupCode> &dxfData,polyspiral &poly,DxfLayer &lay,do
     }
   }
 }
+
+void insertPolyline(vector<GroupCode> &dxfData,polyspiral &poly,DxfLayer &lay,double outUnit)
+{
+  polyarc apx(poly,DXF_ARC_TOLER);
+  insertPolyline(dxfData,apx,lay,outUnit);
+}
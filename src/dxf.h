@@ -82,6 +82,9 @@ GroupCode readDxfBinary(std::istream &file);
 void writeDxfText(std::ostream &file,GroupCode code);
 void writeDxfBinary(std::ostream &file,GroupCode code);
 void writeDxfGroups(std::ostream &file,std::vector<GroupCode> &codes,bool mode);
+// DXF has no spirals, so they're approximated with arcs within this distance.
+#define DXF_ARC_TOLER 0.001
+
 std::vector<GroupCode> readDxfGroups(std::istream &file,bool mode);
 std::vector<GroupCode> readDxfGroups(std::string filename);
 std::vector<std::array<xyz,3> > extractTriangles(std::vector<GroupCode> dxfData);
@@ -90,4 +93,5 @@ void openEntitySection(std::vector<GroupCode> &dxfData);
 void closeEntitySection(std::vector<GroupCode> &dxfData);
 void dxfEnd(std::vector<GroupCode> &dxfData);
 void insertTriangle(std::vector<GroupCode> &dxfData,triangle &tri,double outUnit);
+void insertPolyline(std::vector<GroupCode> &dxfData,polyarc &apx,DxfLayer &lay,double outUnit);
 void insertPolyline(std::vector<GroupCode> &dxfData,polyspiral &poly,DxfLayer &lay,double outUnit);
@@ -0,0 +1,185 @@
+/******************************************************/
+/*                                                    */
+/* edgeindex.cpp - multiresolution index of TIN edges */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include "edgeindex.h"
+#include "tin.h"
+
+using namespace std;
+
+EdgeIndex::EdgeIndex()
+{
+  nEdges=0;
+  valid=false;
+}
+
+void EdgeIndex::clear()
+/* Called whenever edges are flipped or the TIN is cleared. The index is
+ * rebuilt the next time it's needed.
+ */
+{
+  levels.clear();
+  nEdges=0;
+  valid=false;
+}
+
+bool EdgeIndex::isValid(size_t n)
+{
+  return valid && n==nEdges;
+}
+
+size_t EdgeIndex::size()
+{
+  size_t i,ret=0;
+  for (i=0;i<levels.size();i++)
+    ret+=levels[i].edges.size();
+  return ret;
+}
+
+void buildLevel(EdgeLevel &lev,vector<edge *> &levEdges)
+{
+  int i,cell;
+  double left=INFINITY,right=-INFINITY,bottom=INFINITY,top=-INFINITY;
+  xy mid;
+  vector<int> cellOf;
+  vector<int> fill;
+  lev.maxLength=0;
+  for (i=0;i<levEdges.size();i++)
+  {
+    mid=levEdges[i]->midpoint();
+    if (mid.getx()<left)
+      left=mid.getx();
+    if (mid.getx()>right)
+      right=mid.getx();
+    if (mid.gety()<bottom)
+      bottom=mid.gety();
+    if (mid.gety()>top)
+      top=mid.gety();
+    if (levEdges[i]->length()>lev.maxLength)
+      lev.maxLength=levEdges[i]->length();
+  }
+  lev.origin=xy(left,bottom);
+  lev.cellSize=sqrt((right-left)*(top-bottom)/levEdges.size());
+  if (lev.cellSize<lev.maxLength)
+    lev.cellSize=lev.maxLength;
+  if (lev.cellSize<(right-left)/65536)
+    lev.cellSize=(right-left)/65536;
+  if (lev.cellSize<(top-bottom)/65536)
+    lev.cellSize=(top-bottom)/65536;
+  if (!(lev.cellSize>0))
+    lev.cellSize=1;
+  lev.cols=floor((right-left)/lev.cellSize)+1;
+  lev.rows=floor((top-bottom)/lev.cellSize)+1;
+  lev.cellStart.assign(lev.cols*lev.rows+1,0);
+  for (i=0;i<levEdges.size();i++)
+  {
+    mid=levEdges[i]->midpoint()-lev.origin;
+    cell=min((int)floor(mid.gety()/lev.cellSize),lev.rows-1)*lev.cols+
+         min((int)floor(mid.getx()/lev.cellSize),lev.cols-1);
+    cellOf.push_back(cell);
+    lev.cellStart[cell+1]++;
+  }
+  for (i=0;i<lev.cols*lev.rows;i++)
+    lev.cellStart[i+1]+=lev.cellStart[i];
+  fill=lev.cellStart;
+  lev.edges.resize(levEdges.size());
+  for (i=0;i<levEdges.size();i++)
+    lev.edges[fill[cellOf[i]]++]=levEdges[i];
+}
+
+void EdgeIndex::build(map<int,edge> &edges)
+{
+  map<int,edge>::iterator e;
+  vector<vector<edge *> > byLength;
+  double shortest=INFINITY,len;
+  int lv;
+  levels.clear();
+  for (e=edges.begin();e!=edges.end();++e)
+  {
+    len=e->second.length();
+    if (len>0 && len<shortest)
+      shortest=len;
+  }
+  for (e=edges.begin();e!=edges.end();++e)
+  {
+    len=e->second.length();
+    lv=(len>shortest)?(int)floor(log2(len/shortest)):0;
+    if (lv>=byLength.size())
+      byLength.resize(lv+1);
+    byLength[lv].push_back(&e->second);
+  }
+  for (lv=0;lv<byLength.size();lv++)
+    if (byLength[lv].size())
+    {
+      levels.resize(levels.size()+1);
+      buildLevel(levels.back(),byLength[lv]);
+    }
+  nEdges=edges.size();
+  valid=true;
+}
+
+int cellClamp(double x,int n)
+{
+  if (x<0)
+    return 0;
+  if (x>n-1)
+    return n-1;
+  return floor(x);
+}
+
+vector<edge *> EdgeIndex::find(xy center,double radius,double minLength)
+/* Returns the edges longer than minLength which may come within radius of
+ * center. The caller still has to check each edge against the window.
+ */
+{
+  vector<edge *> ret;
+  int i,j,k,n,col0,col1,row0,row1;
+  double reach,len;
+  edge *e;
+  xy rel;
+  for (i=0;i<levels.size();i++)
+  {
+    EdgeLevel &lev=levels[i];
+    if (lev.maxLength<=minLength)
+      continue;
+    reach=radius+lev.maxLength/2;
+    rel=center-lev.origin;
+    if (rel.getx()+reach<0 || rel.gety()+reach<0 ||
+        rel.getx()-reach>lev.cols*lev.cellSize || rel.gety()-reach>lev.rows*lev.cellSize)
+      continue;
+    col0=cellClamp((rel.getx()-reach)/lev.cellSize,lev.cols);
+    col1=cellClamp((rel.getx()+reach)/lev.cellSize,lev.cols);
+    row0=cellClamp((rel.gety()-reach)/lev.cellSize,lev.rows);
+    row1=cellClamp((rel.gety()+reach)/lev.cellSize,lev.rows);
+    for (j=row0;j<=row1;j++)
+      for (k=col0;k<=col1;k++)
+	for (n=lev.cellStart[j*lev.cols+k];n<lev.cellStart[j*lev.cols+k+1];n++)
+	{
+	  e=lev.edges[n];
+	  len=e->length();
+	  if (len>minLength && dist(e->midpoint(),center)<=radius+len/2)
+	    ret.push_back(e);
+	}
+  }
+  return ret;
+}
@@ -0,0 +1,69 @@
+/******************************************************/
+/*                                                    */
+/* edgeindex.h - multiresolution index of TIN edges   */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef EDGEINDEX_H
+#define EDGEINDEX_H
+#include <map>
+#include <vector>
+#include "xyz.h"
+
+class edge;
+
+struct EdgeLevel
+{
+  double maxLength; // length of the longest edge in this level
+  double cellSize;
+  xy origin; // lower left corner of the grid
+  int cols,rows;
+  std::vector<int> cellStart; // cols*rows+1 entries, indices into edges
+  std::vector<edge *> edges;
+};
+
+class EdgeIndex
+/* When the view of a huge TIN is zoomed out, most edges are shorter than a
+ * pixel and aren't drawn, but looping through all of them to find that out
+ * takes most of the time of painting. The edges are therefore put into
+ * levels by length, each twice as long as the previous one, and each level
+ * is a grid of cells, whose size is at least the longest edge in that level,
+ * listing the edges whose midpoints are in each cell. Painting looks only
+ * at levels whose longest edge is longer than a pixel, and only at the cells
+ * near the window.
+ */
+{
+public:
+  EdgeIndex();
+  void clear();
+  bool isValid(size_t nEdges);
+  void build(std::map<int,edge> &edges);
+  std::vector<edge *> find(xy center,double radius,double minLength);
+  size_t size();
+  int nLevels()
+  {
+    return levels.size();
+  }
+private:
+  std::vector<EdgeLevel> levels;
+  size_t nEdges;
+  bool valid;
+};
+#endif
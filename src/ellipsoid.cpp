@@ -32,6 +32,8 @@
 #include "manysum.h"
 using namespace std;
 
+bool krugerReference=false;
+
 /* Unlike most of the program, which represents angles as integers,
  * ellipsoid and projection require double precision for angles.
  * With integers for angles, 1 ulp is 18.6 mm along the equator
@@ -100,8 +102,62 @@ xyz ellipsoid::geoc(latlongelev lle)
   return geoc(lle.lat,lle.lon,lle.elev);
 }
 
+bool ellipsoid::geodClosed(xyz geocen,double e2,latlongelev &ret)
+/* Vermeille's closed form (Journal of Geodesy 76:451) of the geodetic
+ * coordinates of geocen, which is relative to the center. It's exact except
+ * for roundoff, but doesn't work within about e²×eqr of the center, in
+ * which case it returns false.
+ */
+{
+  double e4=e2*e2,x,y,z,p,q,r,s,t,u,v,w,k,d,cylr;
+  x=geocen.getx();
+  y=geocen.gety();
+  z=geocen.getz();
+  cylr=hypot(x,y);
+  ret.lon=atan2(y,x);
+  p=cylr*cylr/(eqr*eqr);
+  q=(1-e2)*z*z/(eqr*eqr);
+  r=(p+q-e4)/6;
+  s=e4*p*q/(4*r*r*r);
+  if (r<=0 || !(s*(2+s)>=0))
+    return false;
+  t=cbrt(1+s+sqrt(s*(2+s)));
+  u=r*(1+t+1/t);
+  v=sqrt(u*u+e4*q);
+  w=e2*(u+v-q)/(2*v);
+  k=sqrt(u+v+w*w)-w;
+  d=k*cylr/(k+e2);
+  ret.lat=2*atan2(z,d+hypot(d,z));
+  ret.elev=(k+e2-1)/k*hypot(d,z);
+  return true;
+}
+
 latlongelev ellipsoid::geod(xyz geocen)
 // Geodetic coordinates. Inverse of geoc.
+{
+  latlongelev ret;
+  if (!geodClosed(geocen-cen,1-por*por/eqr/eqr,ret))
+    ret=geodIterative(geocen);
+  return ret;
+}
+
+vector<latlongelev> ellipsoid::geod(const vector<xyz> &geocen)
+// Converts many points at once, computing the eccentricity only once.
+{
+  vector<latlongelev> ret(geocen.size());
+  double e2=1-por*por/eqr/eqr;
+  size_t i;
+  for (i=0;i<geocen.size();i++)
+    if (!geodClosed(geocen[i]-cen,e2,ret[i]))
+      ret[i]=geodIterative(geocen[i]);
+  return ret;
+}
+
+latlongelev ellipsoid::geodIterative(xyz geocen)
+/* Geodetic coordinates by successive approximation. This is how geod used
+ * to work; it's kept for points too near the center for the closed form,
+ * and to check the closed form against.
+ */
 {
   latlongelev ret;
   int i;
@@ -234,11 +290,85 @@ void ellipsoid::setTmCoefficients(vector<double> forward,vector<double> reverse)
   tmReverse=reverse;
 }
 
+complex<double> clenshawSin(const vector<double> &coeff,complex<double> z)
+/* Returns z+Σcoeff[i]*sin(i*z), for i from 1, by Clenshaw's recurrence,
+ * which needs only one sine and one cosine. coeff[0] is the scale, not
+ * a coefficient.
+ */
+{
+  int i;
+  complex<double> twocos=2.*cos(z),b1=0,b2=0,b0;
+  for (i=coeff.size()-1;i>0;i--)
+  {
+    b0=twocos*b1-b2+coeff[i];
+    b2=b1;
+    b1=b0;
+  }
+  return z+b1*sin(z);
+}
+
+complex<double> clenshawCosDeriv(const vector<double> &coeff,complex<double> z)
+// Returns 1+Σi*coeff[i]*cos(i*z), the derivative of clenshawSin.
+{
+  int i;
+  complex<double> cosz=cos(z),twocos=2.*cosz,b1=0,b2=0,b0;
+  for (i=coeff.size()-1;i>0;i--)
+  {
+    b0=twocos*b1-b2+(double)i*coeff[i];
+    b2=b1;
+    b1=b0;
+  }
+  return 1.+b1*cosz-b2;
+}
+
 xy ellipsoid::krugerize(xy mapPoint)
 /* Converts a Lambert transverse Mercator projection of a sphere (the sphere
  * having been conformally projected from the ellipsoid) into a Gauss-Krüger
  * transverse Mercator projection of the ellipsoid.
  */
+{
+  complex<double> sum;
+  if (krugerReference)
+    return krugerizeReference(mapPoint);
+  assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
+  sum=clenshawSin(tmForward,complex<double>(mapPoint.gety()*M_PI/tmReverse[0],-mapPoint.getx()*M_PI/tmReverse[0]));
+  return xy(-sum.imag()*tmForward[0]/M_PI,sum.real()*tmForward[0]/M_PI);
+}
+
+xy ellipsoid::dekrugerize(xy mapPoint)
+{
+  complex<double> sum;
+  if (krugerReference)
+    return dekrugerizeReference(mapPoint);
+  assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
+  sum=clenshawSin(tmReverse,complex<double>(mapPoint.gety()*M_PI/tmForward[0],-mapPoint.getx()*M_PI/tmForward[0]));
+  return xy(-sum.imag()*tmReverse[0]/M_PI,sum.real()*tmReverse[0]/M_PI);
+}
+
+xy ellipsoid::krugerizeDeriv(xy mapPoint)
+{
+  complex<double> sum;
+  if (krugerReference)
+    return krugerizeDerivReference(mapPoint);
+  assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
+  sum=clenshawCosDeriv(tmForward,complex<double>(mapPoint.gety()*M_PI/tmReverse[0],-mapPoint.getx()*M_PI/tmReverse[0]));
+  return xy(sum.real()*tmForward[0]/tmReverse[0],sum.imag()*tmForward[0]/tmReverse[0]);
+}
+
+xy ellipsoid::dekrugerizeDeriv(xy mapPoint)
+{
+  complex<double> sum;
+  if (krugerReference)
+    return dekrugerizeDerivReference(mapPoint);
+  assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
+  sum=clenshawCosDeriv(tmReverse,complex<double>(mapPoint.gety()*M_PI/tmForward[0],-mapPoint.getx()*M_PI/tmForward[0]));
+  return xy(sum.real()*tmReverse[0]/tmForward[0],sum.imag()*tmReverse[0]/tmForward[0]);
+}
+
+xy ellipsoid::krugerizeReference(xy mapPoint)
+/* The ...Reference functions add up the terms of the series one by one with
+ * pairwisesum. They are kept to check the Clenshaw sums against.
+ */
 {
   int i;
   assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
@@ -257,7 +387,7 @@ xy ellipsoid::krugerize(xy mapPoint)
   return xy(-pairwisesum(iTerms)*tmForward[0]/M_PI,pairwisesum(rTerms)*tmForward[0]/M_PI);
 }
 
-xy ellipsoid::dekrugerize(xy mapPoint)
+xy ellipsoid::dekrugerizeReference(xy mapPoint)
 {
   int i;
   assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
@@ -276,7 +406,7 @@ xy ellipsoid::dekrugerize(xy mapPoint)
   return xy(-pairwisesum(iTerms)*tmReverse[0]/M_PI,pairwisesum(rTerms)*tmReverse[0]/M_PI);
 }
 
-xy ellipsoid::krugerizeDeriv(xy mapPoint)
+xy ellipsoid::krugerizeDerivReference(xy mapPoint)
 {
   int i;
   assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
@@ -295,7 +425,7 @@ xy ellipsoid::krugerizeDeriv(xy mapPoint)
   return xy(pairwisesum(rTerms)*tmForward[0]/tmReverse[0],pairwisesum(iTerms)*tmForward[0]/tmReverse[0]);
 }
 
-xy ellipsoid::dekrugerizeDeriv(xy mapPoint)
+xy ellipsoid::dekrugerizeDerivReference(xy mapPoint)
 {
   int i;
   assert(tmForward.size() && tmReverse.size()); // If this fails, readTmCoefficients
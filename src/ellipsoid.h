@@ -39,6 +39,7 @@ private:
   xyz cen; // Some ellipsoids are offset. The center of an ellipsoid's sphere is the same as the ellipsoid's center.
   std::string name;
   std::vector<double> tmForward,tmReverse; // for Gauss-Krüger tranverse Mercator
+  bool geodClosed(xyz geocen,double e2,latlongelev &ret);
 public:
   ellipsoid *sphere;
   ellipsoid(double equradius,double polradius,double flattening,xyz center,std::string ename);
@@ -48,6 +49,8 @@ public:
   xyz geoc(latlongelev lle);
   xyz geoc(int lat,int lon,int elev); // elev is in 1/65536 meter; for lat and long see angle.h
   latlongelev geod(xyz geocen);
+  std::vector<latlongelev> geod(const std::vector<xyz> &geocen);
+  latlongelev geodIterative(xyz geocen);
   double avgradius();
   double geteqr()
   {
@@ -82,6 +85,10 @@ public:
   xy dekrugerize(xy mapPoint);
   xy krugerizeDeriv(xy mapPoint);
   xy dekrugerizeDeriv(xy mapPoint);
+  xy krugerizeReference(xy mapPoint);
+  xy dekrugerizeReference(xy mapPoint);
+  xy krugerizeDerivReference(xy mapPoint);
+  xy dekrugerizeDerivReference(xy mapPoint);
   double krugerizeScale(xy mapPoint);
   double dekrugerizeScale(xy mapPoint);
 };
@@ -92,6 +99,11 @@ struct TmNameCoeff
   std::vector<double> tmForward,tmReverse;
 };
 
+extern bool krugerReference;
+/* If true, krugerize, dekrugerize, and their derivatives add up the series term
+ * by term, as they used to, instead of using Clenshaw's recurrence.
+ */
+
 extern ellipsoid Sphere,Clarke,GRS80,HGRS87,WGS84,ITRS,Hayford;
 int countEllipsoids();
 ellipsoid& getEllipsoid(int n);
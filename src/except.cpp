@@ -45,7 +45,8 @@ char exceptionNames[N_EXCEPTIONS][24]=
   QT_TRANSLATE_NOOP("BeziExcept","badbreaklineformat"),
   QT_TRANSLATE_NOOP("BeziExcept","fileerror"),
   QT_TRANSLATE_NOOP("BeziExcept","stationoutofrange"),
-  QT_TRANSLATE_NOOP("BeziExcept","badabsorient")
+  QT_TRANSLATE_NOOP("BeziExcept","badabsorient"),
+  QT_TRANSLATE_NOOP("BeziExcept","actioncanceled")
 };
 vector<QString> translatedExceptions;
 
@@ -86,4 +87,4 @@ BeziExcept singularMatrix(singularmatrix),unsetGeoid(unsetgeoid);
 BeziExcept unsetSource(unsetsource),badUnits(badunits),badNumber(badnumber);
 BeziExcept badBreaklineEnd(badbreaklineend),breaklinesCross(breaklinescross);
 BeziExcept badBreaklineFormat(badbreaklineformat),fileError(fileerror);
-BeziExcept stationOutOfRange(stationoutofrange),badAbsOrient(badabsorient);
+BeziExcept stationOutOfRange(stationoutofrange),badAbsOrient(badabsorient),actionCanceled(actioncanceled);
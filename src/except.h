@@ -21,6 +21,8 @@
  * and Lesser General Public License along with Bezitopo. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#ifndef EXCEPT_H
+#define EXCEPT_H
 #include <QException>
 #include <QString>
 #include <QCoreApplication>
@@ -59,7 +61,9 @@
 // along is out of range in a station function
 #define badabsorient 17
 // insufficient points to compute absolute orientation
-#define N_EXCEPTIONS 18
+#define actioncanceled 18
+// the user canceled reading or writing a file
+#define N_EXCEPTIONS 19
 
 class BeziExcept: public QException
 {
@@ -95,4 +99,5 @@ extern BeziExcept singularMatrix,unsetGeoid;
 extern BeziExcept unsetSource,badUnits,badNumber;
 extern BeziExcept badBreaklineEnd,breaklinesCross;
 extern BeziExcept badBreaklineFormat,fileError;
-extern BeziExcept stationOutOfRange,badAbsOrient;
+extern BeziExcept stationOutOfRange,badAbsOrient,actionCanceled;
+#endif
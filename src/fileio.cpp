@@ -31,6 +31,8 @@
 #include "binio.h"
 #include "angle.h"
 #include "fileio.h"
+#include "manyarc.h"
+#include "cancel.h"
 using namespace std;
 
 char hexdig[16]={'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
@@ -124,6 +126,7 @@ void writeDxf(string outputFile,pointlist &pl,bool asc,double outUnit,int flags)
   DxfLayer layer;
   ContourLayer cl;
   BoundRect br;
+  vector<polyarc> apx;
   ofstream dxfFile(outputFile,ofstream::binary|ofstream::trunc);
   br.include(&pl);
   contourLayers=pl.contourLayers();
@@ -147,19 +150,24 @@ void writeDxf(string outputFile,pointlist &pl,bool asc,double outUnit,int flags)
   tableSection(dxfCodes,dxfLayers);
   openEntitySection(dxfCodes);
   for (i=0;i<pl.triangles.size();i++)
+  {
+    checkCancel(i,pl.triangles.size());
     if (pl.triangles[i].ptValid())
       if (pl.shouldWrite(i,flags,contourLayers.size()))
 	insertTriangle(dxfCodes,pl.triangles[i],outUnit);
       else;
     else
       cerr<<"Invalid triangle "<<i<<endl;
+  }
   cl.ci=pl.contourInterval;
+  apx=manyArc(pl.contours,DXF_ARC_TOLER);
+  checkCancel();
   for (i=0;i<pl.contours.size();i++)
   {
     cl.tp=cl.ci.contourType(pl.contours[i].getElevation());
     n=contourLayers[cl]-1;
     layer=dxfLayers[n];
-    insertPolyline(dxfCodes,pl.contours[i],layer,outUnit);
+    insertPolyline(dxfCodes,apx[i],layer,outUnit);
   }
   closeEntitySection(dxfCodes);
   dxfEnd(dxfCodes);
@@ -175,12 +183,11 @@ void writeStl(string outputFile,pointlist &pl,bool asc,double outUnit,int flags)
  */
 {
   ofstream stlFile(outputFile,asc?ios::trunc:(ios::binary|ios::trunc));
-  double bear;
-  vector<StlTriangle> stltri;
-  //bear=turnFitInPrinter(pl,printer3d);
-  //stltri=stlMesh(printer3d,false,false);
-  /*if (asc)
-    writeStlText(stlFile,stltri);
-  else
-    writeStlBinary(stlFile,stltri);*/
+  StlFrame frame;
+  bool feet=fabs(outUnit-0.3048)<0.001;
+  Printer3dSize printer=printer3d; // the scale is this job's, not shared
+  frame=turnFitInPrinter(pl,printer,feet,flags&1);
+  checkCancel();
+  setStlSplits(pl,printer.resolution*printer.scaleDenom/printer.scaleNum/1000);
+  writeStlMesh(stlFile,pl,frame,asc);
 }
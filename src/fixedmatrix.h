@@ -0,0 +1,254 @@
+/******************************************************/
+/*                                                    */
+/* fixedmatrix.h - matrices of compile-time size      */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FIXEDMATRIX_H
+#define FIXEDMATRIX_H
+#include <cmath>
+#include <utility>
+#include "matrix.h"
+#include "except.h"
+
+/* fixedmatrix is for the small matrices in inner loops, such as the 6×6
+ * autocorrelation of geoquad components and the 2×3 gradient matrix of a
+ * triangle. Its size is part of its type, so it needs no heap allocation,
+ * multiplying matrices of the wrong sizes is a compile error, and the loops
+ * have constant bounds, which the compiler unrolls. Anything whose size is
+ * known only at run time, or which is big, goes in matrix; the two convert
+ * to each other.
+ */
+
+template<unsigned R,unsigned C> class fixedmatrix
+{
+public:
+  double entry[R][C];
+  fixedmatrix()
+  {
+    setzero();
+  }
+  explicit fixedmatrix(matrix b);
+  static constexpr unsigned getrows()
+  {
+    return R;
+  }
+  static constexpr unsigned getcolumns()
+  {
+    return C;
+  }
+  void setzero();
+  void setidentity();
+  double *operator[](unsigned row)
+  {
+    return entry[row];
+  }
+  const double *operator[](unsigned row) const
+  {
+    return entry[row];
+  }
+  fixedmatrix &operator+=(const fixedmatrix &b);
+  fixedmatrix &operator-=(const fixedmatrix &b);
+  fixedmatrix &operator*=(double b);
+  fixedmatrix operator+(const fixedmatrix &b) const
+  {
+    fixedmatrix ret(*this);
+    return ret+=b;
+  }
+  fixedmatrix operator-(const fixedmatrix &b) const
+  {
+    fixedmatrix ret(*this);
+    return ret-=b;
+  }
+  template<unsigned K> fixedmatrix<R,K> operator*(const fixedmatrix<C,K> &b) const;
+  fixedmatrix<C,R> transpose() const;
+  double trace() const;
+  template<unsigned K> bool gausselim(fixedmatrix<R,K> &b);
+  operator matrix() const;
+};
+
+template<unsigned R,unsigned C> fixedmatrix<R,C>::fixedmatrix(matrix b)
+{
+  unsigned i,j;
+  if (b.getrows()!=R || b.getcolumns()!=C)
+    throw BeziExcept(matrixMismatch);
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      entry[i][j]=b[i][j];
+}
+
+template<unsigned R,unsigned C> void fixedmatrix<R,C>::setzero()
+{
+  unsigned i,j;
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      entry[i][j]=0;
+}
+
+template<unsigned R,unsigned C> void fixedmatrix<R,C>::setidentity()
+{
+  unsigned i,j;
+  static_assert(R==C,"Identity matrix must be square");
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      entry[i][j]=i==j;
+}
+
+template<unsigned R,unsigned C> fixedmatrix<R,C> &fixedmatrix<R,C>::operator+=(const fixedmatrix<R,C> &b)
+{
+  unsigned i,j;
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      entry[i][j]+=b.entry[i][j];
+  return *this;
+}
+
+template<unsigned R,unsigned C> fixedmatrix<R,C> &fixedmatrix<R,C>::operator-=(const fixedmatrix<R,C> &b)
+{
+  unsigned i,j;
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      entry[i][j]-=b.entry[i][j];
+  return *this;
+}
+
+template<unsigned R,unsigned C> fixedmatrix<R,C> &fixedmatrix<R,C>::operator*=(double b)
+{
+  unsigned i,j;
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      entry[i][j]*=b;
+  return *this;
+}
+
+template<unsigned R,unsigned C> template<unsigned K>
+fixedmatrix<R,K> fixedmatrix<R,C>::operator*(const fixedmatrix<C,K> &b) const
+{
+  fixedmatrix<R,K> ret;
+  unsigned i,j,k;
+  double sum;
+  for (i=0;i<R;i++)
+    for (k=0;k<K;k++)
+    {
+      sum=0;
+      for (j=0;j<C;j++)
+	sum+=entry[i][j]*b.entry[j][k];
+      ret.entry[i][k]=sum;
+    }
+  return ret;
+}
+
+template<unsigned R,unsigned C> fixedmatrix<C,R> fixedmatrix<R,C>::transpose() const
+{
+  fixedmatrix<C,R> ret;
+  unsigned i,j;
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      ret.entry[j][i]=entry[i][j];
+  return ret;
+}
+
+template<unsigned R,unsigned C> double fixedmatrix<R,C>::trace() const
+{
+  unsigned i;
+  double ret=0;
+  static_assert(R==C,"Trace of nonsquare matrix");
+  for (i=0;i<R;i++)
+    ret+=entry[i][i];
+  return ret;
+}
+
+template<unsigned R,unsigned C> template<unsigned K>
+bool fixedmatrix<R,C>::gausselim(fixedmatrix<R,K> &b)
+/* Gauss-Jordan elimination with partial pivoting. Reduces *this to the
+ * identity, doing the same row operations to b, so that b ends up as
+ * the solution of (old *this)×x=(old b). Returns false if *this is
+ * singular, in which case both are left partly reduced.
+ */
+{
+  unsigned i,j,k,piv;
+  double factor;
+  static_assert(R==C,"Gaussian elimination of nonsquare matrix");
+  for (i=0;i<R;i++)
+  {
+    piv=i;
+    for (j=i+1;j<R;j++)
+      if (std::fabs(entry[j][i])>std::fabs(entry[piv][i]))
+	piv=j;
+    if (entry[piv][i]==0 || !std::isfinite(entry[piv][i]))
+      return false;
+    if (piv!=i)
+    {
+      std::swap(entry[i],entry[piv]);
+      std::swap(b.entry[i],b.entry[piv]);
+    }
+    factor=1/entry[i][i];
+    for (k=0;k<C;k++)
+      entry[i][k]*=factor;
+    for (k=0;k<K;k++)
+      b.entry[i][k]*=factor;
+    entry[i][i]=1;
+    for (j=0;j<R;j++)
+      if (j!=i && entry[j][i]!=0)
+      {
+	factor=entry[j][i];
+	for (k=0;k<C;k++)
+	  entry[j][k]-=factor*entry[i][k];
+	for (k=0;k<K;k++)
+	  b.entry[j][k]-=factor*b.entry[i][k];
+	entry[j][i]=0;
+      }
+  }
+  return true;
+}
+
+template<unsigned R,unsigned C> fixedmatrix<R,C>::operator matrix() const
+{
+  matrix ret(R,C);
+  unsigned i,j;
+  for (i=0;i<R;i++)
+    for (j=0;j<C;j++)
+      ret[i][j]=entry[i][j];
+  return ret;
+}
+
+template<unsigned N> fixedmatrix<N,N> invert(fixedmatrix<N,N> m)
+// Like invert(matrix), a singular matrix gives NaN in the top left corner.
+{
+  fixedmatrix<N,N> ret;
+  ret.setidentity();
+  if (!m.gausselim(ret))
+    ret[0][0]=NAN;
+  return ret;
+}
+
+template<unsigned N,unsigned K> fixedmatrix<N,K> solve(fixedmatrix<N,N> m,fixedmatrix<N,K> b)
+// Solves m×x=b. If m is singular, x is all NaN.
+{
+  unsigned i,j;
+  if (!m.gausselim(b))
+    for (i=0;i<N;i++)
+      for (j=0;j<K;j++)
+	b[i][j]=NAN;
+  return b;
+}
+
+#endif
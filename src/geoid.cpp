@@ -34,6 +34,7 @@
 #include "angle.h"
 #include "ldecimal.h"
 #include "config.h"
+#include "cancel.h"
 using namespace std;
 
 /* face=0: point is the center of the earth
@@ -421,19 +422,27 @@ geoquad::geoquad(const geoquad& b)
 }
 
 geoquad& geoquad::operator=(geoquad b)
+{
+  swap(b);
+  return *this;
+}
+
+void geoquad::swap(geoquad &b)
+/* Exchanges the contents of two geoquads without copying their subtrees.
+ * Used to swap in a geoid read by another thread.
+ */
 {
   if (sizeof(sub)>sizeof(und))
-    swap(sub,b.sub);
+    std::swap(sub,b.sub);
   else
-    swap(und,b.und);
-  swap(center,b.center);
-  swap(scale,b.scale);
-  swap(face,b.face);
+    std::swap(und,b.und);
+  std::swap(center,b.center);
+  std::swap(scale,b.scale);
+  std::swap(face,b.face);
 #ifdef NUMSGEOID
-  swap(nums,b.nums);
-  swap(nans,b.nans);
+  std::swap(nums,b.nums);
+  std::swap(nans,b.nans);
 #endif
-  return *this;
 }
 
 void geoquad::clear()
@@ -803,6 +812,30 @@ gboundary geoquad::gbounds()
   return ret;
 }
 
+void geoquad::boundaryEdges(vector<vsegment> &edges)
+// Appends the edges of all leaves with data, counterclockwise around each.
+{
+  int i;
+  vball corner[4];
+  vsegment side;
+  if (subdivided())
+    for (i=0;i<4;i++)
+      sub[i]->boundaryEdges(edges);
+  else if (!isnan())
+  {
+    corner[0]=vball(face,center+xy(scale,scale));
+    corner[1]=vball(face,center+xy(-scale,scale));
+    corner[2]=vball(face,center+xy(-scale,-scale));
+    corner[3]=vball(face,center+xy(scale,-scale));
+    for (i=0;i<4;i++)
+    {
+      side.start=corner[i];
+      side.end=corner[(i+1)%4];
+      edges.push_back(side);
+    }
+  }
+}
+
 void geoquad::writeBinary(ostream &ofile,int nesting)
 {
   int i;
@@ -1016,6 +1049,24 @@ double cubemap::undulation(xyz dir)
     return faces[v.face-1].undulation(v.x,v.y)*scale;
 }
 
+void cubemap::undulations(const double *x,const double *y,const double *z,double *out,size_t n)
+// Same as undulation(xyz) for n directions, encoded a block at a time.
+{
+  const size_t blocksz=256;
+  vball v[blocksz];
+  size_t i,j,nblock;
+  for (i=0;i<n;i+=nblock)
+  {
+    nblock=min(n-i,blocksz);
+    encodedirs(x+i,y+i,z+i,v,nblock);
+    for (j=0;j<nblock;j++)
+      if (v[j].face<1 || v[j].face>6)
+	out[i+j]=NAN;
+      else
+	out[i+j]=faces[v[j].face-1].undulation(v[j].x,v[j].y)*scale;
+  }
+}
+
 geoquadMatch cubemap::match(geoquad &quad)
 {
   return faces[quad.face-1].match(quad.center.getx(),quad.center.gety());
@@ -1072,6 +1123,19 @@ cylinterval cubemap::boundrect()
 }
 
 gboundary cubemap::gbounds()
+/* Cancels the shared edges of all the leaves at once. This gives the same
+ * boundary as gboundsMerge, which merges boundaries up the quadtrees and
+ * takes much longer on a big geoid.
+ */
+{
+  vector<vsegment> edges;
+  int i;
+  for (i=0;i<6;i++)
+    faces[i].boundaryEdges(edges);
+  return edgeBoundary(edges);
+}
+
+gboundary cubemap::gboundsMerge()
 {
   gboundary ret;
   ret=faces[0].gbounds()+faces[1].gbounds()+faces[2].gbounds()+
@@ -1095,7 +1159,10 @@ void cubemap::readBinary(istream &ifile)
 {
   int i;
   for (i=0;i<6;i++)
+  {
+    checkCancel(i,6);
     faces[i].readBinary(ifile);
+  }
 }
 
 void cubemap::dump(ostream &ofile)
@@ -45,6 +45,7 @@
 
 class gboundary;
 class geoquad;
+struct vsegment;
 
 unsigned byteswap(unsigned n);
 
@@ -90,6 +91,7 @@ public:
   ~geoquad();
   geoquad(const geoquad& b);
   geoquad& operator=(geoquad b);
+  void swap(geoquad &b);
   vball vcenter() const;
   int splitLevel() const;
   void clear();
@@ -113,6 +115,7 @@ public:
   std::vector<double> areas();
   std::array<vball,4> bounds() const;
   gboundary gbounds();
+  void boundaryEdges(std::vector<vsegment> &edges);
   void writeBinary(std::ostream &ofile,int nesting=0);
   void readBinary(std::istream &ifile,int nesting=-1,int depth=0);
   void dump(std::ostream &ofile,int nesting=0);
@@ -132,11 +135,13 @@ public:
   double undulation(int lat,int lon);
   double undulation(latlong ll);
   double undulation(xyz dir);
+  void undulations(const double *x,const double *y,const double *z,double *out,size_t n);
   geoquadMatch match(geoquad &quad);
   std::vector<cylinterval> boundrects();
   std::vector<double> areas();
   cylinterval boundrect();
   gboundary gbounds();
+  gboundary gboundsMerge();
   void writeBinary(std::ostream &ofile);
   void readBinary(std::istream &ifile);
   void dump(std::ostream &ofile);
@@ -24,6 +24,10 @@
 #include <cassert>
 #include <iostream>
 #include <cfloat>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
 #include "geoidboundary.h"
 #include "spolygon.h"
 #include "manysum.h"
@@ -529,6 +533,228 @@ bool overlap(vsegment a,vsegment b)
   return ret;
 }
 
+bool onFace(const vball &v,int f)
+/* Returns true if v is on face f, either because it is in face f's
+ * coordinates or because it is on the edge between its face and f.
+ */
+{
+  bool ret=false;
+  switch (vballcompare[v.face][f])
+  {
+    case 66:
+      ret=true;
+      break;
+    case 12:
+    case 41:
+      ret=v.x==1;
+      break;
+    case 21:
+    case 45:
+      ret=v.y==1;
+      break;
+    case 14:
+    case 63:
+      ret=v.y==-1;
+      break;
+    case 36:
+    case 54:
+      ret=v.x==-1;
+      break;
+  }
+  return ret;
+}
+
+vball canonicalVball(vball v)
+/* A point on an edge of the cube has two or three representations.
+ * This returns the one on the lowest-numbered face, so that equal points
+ * hash equal.
+ */
+{
+  int f;
+  for (f=1;f<7;f++)
+    if (onFace(v,f))
+    {
+      moveToFace(v,f);
+      break;
+    }
+  return v;
+}
+
+struct VballHash
+{
+  size_t operator()(const vball &v) const
+  {
+    return hash<double>()(v.x)*31+hash<double>()(v.y)*7+v.face;
+  }
+};
+
+struct VballSame
+// Exact equality of canonical vballs, unlike operator==.
+{
+  bool operator()(const vball &a,const vball &b) const
+  {
+    return a.face==b.face && a.x==b.x && a.y==b.y;
+  }
+};
+
+struct EdgeLine
+/* The line on a face on which a geoquad edge lies: x=coord if axis is 0,
+ * y=coord if axis is 1.
+ */
+{
+  int face,axis;
+  double coord;
+  bool operator==(const EdgeLine &b) const
+  {
+    return face==b.face && axis==b.axis && coord==b.coord;
+  }
+};
+
+struct EdgeLineHash
+{
+  size_t operator()(const EdgeLine &l) const
+  {
+    return hash<double>()(l.coord)*15+l.face*2+l.axis;
+  }
+};
+
+vball linePoint(const EdgeLine &line,double along)
+{
+  vball ret;
+  ret.face=line.face;
+  if (line.axis)
+  {
+    ret.x=along;
+    ret.y=line.coord;
+  }
+  else
+  {
+    ret.x=line.coord;
+    ret.y=along;
+  }
+  return ret;
+}
+
+gboundary edgeBoundary(const vector<vsegment> &edges)
+/* Makes the boundary of a union of geoquads from their edges, each going
+ * counterclockwise around its geoquad. Edges, or parts of edges, shared by
+ * two geoquads go in opposite directions and cancel. Each edge is hashed
+ * by the line it lies on, and the directions along each line are added up;
+ * what's left is linked into loops, turning left where two loops touch at
+ * a corner. Unlike consolidate, which compares every segment of one loop
+ * with every segment of another, this takes time nearly linear in the
+ * number of edges.
+ */
+{
+  unordered_map<EdgeLine,vector<pair<double,int> >,EdgeLineHash> lines;
+  unordered_map<EdgeLine,vector<pair<double,int> >,EdgeLineHash>::iterator ln;
+  unordered_map<vball,vector<int>,VballHash,VballSame> outgoing;
+  vector<vsegment> pieces;
+  vector<int> next;
+  vector<bool> used;
+  vsegment piece;
+  EdgeLine line;
+  vball a,b;
+  xyz p,v,q;
+  double lo,hi,turn,bestTurn=0,runStart=0;
+  int i,j,f,dir,net,runSign,best;
+  gboundary ret;
+  g1boundary g1;
+  for (i=0;i<edges.size();i++)
+  {
+    a=edges[i].start;
+    b=edges[i].end;
+    for (f=1;f<7 && !(onFace(a,f) && onFace(b,f));f++);
+    assert(f<7);
+    moveToFace(a,f);
+    moveToFace(b,f);
+    line.face=f;
+    if (a.x==b.x)
+    {
+      line.axis=0;
+      line.coord=a.x;
+      lo=a.y;
+      hi=b.y;
+    }
+    else
+    {
+      assert(a.y==b.y);
+      line.axis=1;
+      line.coord=a.y;
+      lo=a.x;
+      hi=b.x;
+    }
+    if (lo==hi)
+      continue;
+    dir=1;
+    if (lo>hi)
+    {
+      swap(lo,hi);
+      dir=-1;
+    }
+    vector<pair<double,int> > &events=lines[line];
+    events.push_back(make_pair(lo,dir));
+    events.push_back(make_pair(hi,-dir));
+  }
+  for (ln=lines.begin();ln!=lines.end();++ln)
+  {
+    vector<pair<double,int> > &events=ln->second;
+    sort(events.begin(),events.end());
+    for (net=runSign=i=0;i<events.size();)
+    {
+      for (j=i;j<events.size() && events[j].first==events[i].first;j++)
+	net+=events[j].second;
+      dir=(net>0)-(net<0);
+      if (dir!=runSign)
+      {
+	if (runSign)
+	{
+	  piece.start=linePoint(ln->first,runSign>0?runStart:events[i].first);
+	  piece.end=linePoint(ln->first,runSign>0?events[i].first:runStart);
+	  pieces.push_back(piece);
+	}
+	runStart=events[i].first;
+	runSign=dir;
+      }
+      i=j;
+    }
+  }
+  for (i=0;i<pieces.size();i++)
+    outgoing[canonicalVball(pieces[i].start)].push_back(i);
+  next.resize(pieces.size());
+  for (i=0;i<pieces.size();i++)
+  {
+    vector<int> &cand=outgoing[canonicalVball(pieces[i].end)];
+    assert(cand.size());
+    p=decodedir(pieces[i].start);
+    v=decodedir(pieces[i].end);
+    for (best=cand[0],j=0;j<cand.size();j++)
+    {
+      q=decodedir(pieces[cand[j]].end);
+      turn=dot(v,cross(v-p,q-v));
+      if (j==0 || turn>bestTurn)
+      {
+	best=cand[j];
+	bestTurn=turn;
+      }
+    }
+    next[i]=best;
+  }
+  used.resize(pieces.size());
+  for (i=0;i<pieces.size();i++)
+    if (!used[i])
+    {
+      g1.clear();
+      for (j=i;!used[j];j=next[j])
+      {
+	used[j]=true;
+	g1.push_back(pieces[j].start);
+      }
+      ret.push_back(g1);
+    }
+  return ret;
+}
+
 void g1boundary::transpose(ellipsoid *from,ellipsoid *to)
 {
   int i;
@@ -536,6 +762,12 @@ void g1boundary::transpose(ellipsoid *from,ellipsoid *to)
     bdy[i]=::transpose(bdy[i],from,to);
 }
 
+gboundary::gboundary()
+{
+  segNum=0;
+  directQueries=gridAfter=0;
+}
+
 void gboundary::push_back(g1boundary g1)
 {
   bdy.push_back(g1);
@@ -733,12 +965,34 @@ void gboundary::deleteEmpty()
 }
 
 void gboundary::erase(int n)
-// When erasing many g1boundaries, erase them in reverse order.
+/* When erasing many g1boundaries, erase them in reverse order.
+ * If the flattened boundaries are up to date, they are erased along with
+ * the g1boundaries, so that extracting regions for KML doesn't flatten
+ * all the rest again each time.
+ */
 {
+  bool flat=flatBdy.size()==bdy.size();
   if (n<bdy.size()-1 && n>=0)
+  {
     swap(bdy[n],bdy[bdy.size()-1]);
+    if (flat)
+    {
+      swap(flatBdy[n],flatBdy[bdy.size()-1]);
+      swap(areaSign[n],areaSign[bdy.size()-1]);
+    }
+  }
   if (n<bdy.size() && n>=0)
+  {
     bdy.resize(bdy.size()-1);
+    if (flat)
+    {
+      gridAfter-=flatBdy.back().size();
+      flatBdy.resize(bdy.size());
+      areaSign.resize(bdy.size());
+    }
+    inGrid.clear();
+    directQueries=0;
+  }
 }
 
 double gboundary::perimeter(bool midpt)
@@ -781,44 +1035,244 @@ gboundary operator+(const gboundary &l,const gboundary &r)
 
 void gboundary::flattenBdy()
 /* Project the g1boundaries onto a plane, so that we can tell whether
- * points are inside or outside them. Used in kml.
+ * points are inside or outside them. Used in kml. The g1boundaries are
+ * flattened in as many threads as the processor has.
  */
 {
   int i;
+  atomic<int> next(0);
+  vector<thread> threads;
   if (flatBdy.size()!=bdy.size())
   {
     flatBdy.clear();
     areaSign.clear();
-    for (i=0;i<bdy.size();i++)
+    inGrid.clear();
+    flatBdy.resize(bdy.size());
+    areaSign.resize(bdy.size());
+    auto work=[&]()
+    {
+      int n;
+      while ((n=next++)<bdy.size())
+      {
+	flatBdy[n]=flatten(bdy[n]);
+	areaSign[n]=signbit(flatBdy[n].area());
+      }
+    };
+    for (i=1;i<thread::hardware_concurrency() && i<bdy.size();i++)
+      threads.push_back(thread(work));
+    work();
+    for (i=0;i<threads.size();i++)
+      threads[i].join();
+    for (gridAfter=i=0;i<flatBdy.size();i++)
+      gridAfter+=flatBdy[i].size();
+    directQueries=0;
+  }
+}
+
+void gboundary::buildInGrid()
+/* Lays a square grid over the bounding circles of all the pieces of the
+ * flattened boundaries. A boundary that doesn't come near a cell has the
+ * same in-bit everywhere in it, so it is checked once, at the center;
+ * along a row, it changes only after a cell the boundary crosses. Outside
+ * the grid, every boundary has winding number 0. Only the first 32
+ * boundaries get bits, as in in().
+ */
+{
+  int i,j,k,b,nb=flatBdy.size(),lox,hix,loy,hiy;
+  double minx=INFINITY,miny=INFINITY,maxx=-INFINITY,maxy=-INFINITY;
+  size_t nPieces=0;
+  bool known;
+  unsigned bit;
+  bcir circ;
+  xy center;
+  if (nb>32)
+    nb=32;
+  vector<vector<bcir> > circles(nb);
+  for (outsideBits=b=0;b<nb;b++)
+  {
+    if (areaSign[b])
+      outsideBits|=1u<<b;
+    for (i=0;i<flatBdy[b].size();i++)
     {
-      flatBdy.push_back(flatten(bdy[i]));
-      areaSign.push_back(signbit(flatBdy.back().area()));
-      //cout<<"bdy#"<<i<<" signbit "<<areaSign.back()<<" bdy size "<<bdy[i].size()<<
-        //" around origin "<<flatBdy.back().in(xy(0,0))<<endl;
+      circ=flatBdy[b].getarc(i).boundCircle();
+      circles[b].push_back(circ);
+      if (circ.center.getx()-circ.radius<minx)
+	minx=circ.center.getx()-circ.radius;
+      if (circ.center.gety()-circ.radius<miny)
+	miny=circ.center.gety()-circ.radius;
+      if (circ.center.getx()+circ.radius>maxx)
+	maxx=circ.center.getx()+circ.radius;
+      if (circ.center.gety()+circ.radius>maxy)
+	maxy=circ.center.gety()+circ.radius;
     }
+    nPieces+=circles[b].size();
+  }
+  gridSide=rint(2*sqrt(nPieces));
+  if (gridSide<16)
+    gridSide=16;
+  if (gridSide>1024)
+    gridSide=1024;
+  if (!nPieces || !(maxx-minx<INFINITY && maxy-miny<INFINITY))
+  {
+    gridSide=1;
+    gridCell=INFINITY;
+    gridCorner=xy(0,0);
+    inGrid.assign(1,FlatBdyCell{0,0});
+    for (b=0;b<nb;b++)
+      inGrid[0].crossing|=1u<<b;
+    return;
+  }
+  gridCell=fmax(maxx-minx,maxy-miny)/gridSide*(1+1e-9);
+  gridCorner=xy(minx,miny);
+  inGrid.assign(gridSide*gridSide,FlatBdyCell{0,0});
+  for (b=0;b<nb;b++)
+  {
+    bit=1u<<b;
+    for (k=0;k<circles[b].size();k++)
+    {
+      circ=circles[b][k];
+      lox=floor((circ.center.getx()-circ.radius-minx)/gridCell);
+      hix=floor((circ.center.getx()+circ.radius-minx)/gridCell);
+      loy=floor((circ.center.gety()-circ.radius-miny)/gridCell);
+      hiy=floor((circ.center.gety()+circ.radius-miny)/gridCell);
+      lox=max(lox,0);
+      loy=max(loy,0);
+      hix=min(hix,gridSide-1);
+      hiy=min(hiy,gridSide-1);
+      for (i=loy;i<=hiy;i++)
+	for (j=lox;j<=hix;j++)
+	  inGrid[i*gridSide+j].crossing|=bit;
+    }
+    for (i=0;i<gridSide;i++)
+      for (known=false,j=0;j<gridSide;j++)
+      {
+	FlatBdyCell &cell=inGrid[i*gridSide+j];
+	if (cell.crossing&bit)
+	  known=false;
+	else if (known)
+	  cell.inside|=inGrid[i*gridSide+j-1].inside&bit;
+	else
+	{
+	  center=gridCorner+xy(j+0.5,i+0.5)*gridCell;
+	  if (flatBdy[b].in(center)+areaSign[b]>0.5)
+	    cell.inside|=bit;
+	  known=true;
+	}
+      }
   }
 }
 
+void gboundary::prepareIn(size_t nQueries)
+/* Builds what in() needs for nQueries more queries, so that after this
+ * in() only reads the boundaries. The grid takes about as long to build
+ * as checking every boundary for as many points as they have pieces, so
+ * it is built only after that many queries since the boundaries changed;
+ * extracting KML regions makes few queries between erasures.
+ */
+{
+  int i;
+  flattenBdy();
+  if (inGrid.empty())
+  {
+    directQueries+=nQueries;
+    if (directQueries>gridAfter)
+      buildInGrid();
+  }
+  for (i=0;i<flatBdy.size() && i<32;i++)
+    if (flatBdy[i].size()>=BCIRTREE_MIN)
+      flatBdy[i].boundTree();
+}
+
+unsigned gboundary::flatIn(xy pntproj)
+{
+  int i,j,b;
+  unsigned ret,cross;
+  if (inGrid.empty())
+  {
+    for (ret=i=0;i<flatBdy.size() && i<32;i++)
+      if (flatBdy[i].in(pntproj)+areaSign[i]>0.5)
+	ret|=1u<<i;
+    return ret;
+  }
+  i=floor((pntproj.gety()-gridCorner.gety())/gridCell);
+  j=floor((pntproj.getx()-gridCorner.getx())/gridCell);
+  if (gridSide==1)
+    i=j=0;
+  if (i<0 || j<0 || i>=gridSide || j>=gridSide)
+    return outsideBits;
+  FlatBdyCell &cell=inGrid[i*gridSide+j];
+  ret=cell.inside;
+  for (cross=cell.crossing,b=0;cross;b++,cross>>=1)
+    if ((cross&1) && flatBdy[b].in(pntproj)+areaSign[b]>0.5)
+      ret|=1u<<b;
+  return ret;
+}
+
 unsigned int gboundary::in(xyz pnt)
 /* Returns a bit vector telling whether pnt is inside each of the g1boundaries.
  * pnt must be on the spherical earth's surface. The number of g1boundaries
  * must be at most 32, else it will lose information.
  */
+{
+  prepareIn(1);
+  return flatIn(sphereStereoArabianSea.geocentricToGrid(pnt));
+}
+
+unsigned int gboundary::inDirect(xyz pnt)
 {
   int i;
   unsigned int ret=0;
   double bdyin;
   xy pntproj=sphereStereoArabianSea.geocentricToGrid(pnt);
   flattenBdy();
-  for (i=0;i<flatBdy.size();i++)
+  for (i=0;i<flatBdy.size() && i<32;i++)
   {
     bdyin=flatBdy[i].in(pntproj)+areaSign[i];
     if (bdyin>0.5)
-      ret|=1<<i;
+      ret|=1u<<i;
   }
   return ret;
 }
 
+vector<unsigned int> gboundary::in(const vector<xyz> &pnts,int nthreads)
+{
+  vector<unsigned int> ret(pnts.size());
+  atomic<size_t> nextChunk(0);
+  vector<thread> threads;
+  const size_t chunkSize=1024;
+  size_t nChunks=(pnts.size()+chunkSize-1)/chunkSize;
+  int i;
+  prepareIn(pnts.size());
+  auto work=[&]()
+  {
+    size_t chunk,j,end;
+    while ((chunk=nextChunk++)<nChunks)
+    {
+      end=min(pnts.size(),(chunk+1)*chunkSize);
+      for (j=chunk*chunkSize;j<end;j++)
+	ret[j]=flatIn(sphereStereoArabianSea.geocentricToGrid(pnts[j]));
+    }
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
+  for (i=1;i<nthreads && i<nChunks;i++)
+    threads.push_back(thread(work));
+  work();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+  return ret;
+}
+
+vector<unsigned int> gboundary::in(const vector<latlong> &pnts,int nthreads)
+{
+  vector<xyz> geoc;
+  int i;
+  geoc.reserve(pnts.size());
+  for (i=0;i<pnts.size();i++)
+    geoc.push_back(Sphere.geoc(pnts[i],0));
+  return in(geoc,nthreads);
+}
+
 unsigned int gboundary::in(latlong pnt)
 {
   return in(Sphere.geoc(pnt,0));
@@ -75,14 +75,34 @@ public:
 
 bool overlap(vsegment a,vsegment b);
 
+struct FlatBdyCell
+/* A cell of the grid over the flattened boundaries. inside has the bits of
+ * the g1boundaries whose in-bit is the same everywhere in the cell;
+ * crossing has the bits of those which pass through the cell, for which
+ * points in it have to be checked against the boundary.
+ */
+{
+  unsigned inside,crossing;
+};
+
 class gboundary
 {
 private:
   std::vector<g1boundary> bdy;
   std::vector<polyarc> flatBdy; // for kml
   std::vector<int> areaSign; // for kml
+  std::vector<FlatBdyCell> inGrid;
+  xy gridCorner;
+  double gridCell;
+  int gridSide;
+  unsigned outsideBits;
+  int directQueries,gridAfter;
   int segNum;
+  void buildInGrid();
+  void prepareIn(size_t nQueries);
+  unsigned flatIn(xy pntproj);
 public:
+  gboundary();
   void push_back(g1boundary g1);
   g1boundary operator[](int n);
   polyarc getFlatBdy(int n);
@@ -108,9 +128,17 @@ public:
   unsigned int in(xyz pnt);
   unsigned int in(latlong pnt);
   unsigned int in(vball pnt);
+  /* The batch forms do the same for many points in nthreads threads (all
+   * the processor has if 0). inDirect checks every boundary, without the grid.
+   */
+  std::vector<unsigned int> in(const std::vector<xyz> &pnts,int nthreads=0);
+  std::vector<unsigned int> in(const std::vector<latlong> &pnts,int nthreads=0);
+  unsigned int inDirect(xyz pnt);
   void transpose(ellipsoid *from,ellipsoid *to);
 };
 
+gboundary edgeBoundary(const std::vector<vsegment> &edges);
+
 class gpolyline
 {
 private:
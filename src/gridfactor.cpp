@@ -0,0 +1,119 @@
+/******************************************************/
+/*                                                    */
+/* gridfactor.cpp - batch grid and elevation factors  */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <atomic>
+#include "gridfactor.h"
+
+using namespace std;
+
+const size_t factorChunk=1024;
+
+double elevationFactor(ellipsoid *ellip,latlong ll,double elevation,double separation)
+/* The ratio of a distance on the ellipsoid to the same distance at the
+ * elevation of the point, using the average radius of curvature.
+ */
+{
+  double radius=ellip->radiusAtLatitude(ll,DEG45);
+  return radius/(radius+elevation+separation);
+}
+
+void finishFactors(Projection &proj,cubemap &geoid,PointFactors &pf)
+// Fills in what's common to both directions, once grid and ll are known.
+{
+  pf.separation=geoid.undulation(pf.ll);
+  pf.gridFactor=proj.scaleFactor(pf.ll);
+  pf.convergence=proj.convergence(pf.ll);
+  pf.elevFactor=elevationFactor(proj.ellip,pf.ll,pf.elevation,pf.separation);
+  pf.combined=pf.gridFactor*pf.elevFactor;
+}
+
+PointFactors gridFactors(Projection &proj,cubemap &geoid,xyz grid)
+{
+  PointFactors ret;
+  ret.grid=xy(grid);
+  ret.elevation=grid.getz();
+  ret.ll=proj.gridToLatlong(ret.grid);
+  finishFactors(proj,geoid,ret);
+  return ret;
+}
+
+PointFactors latlongFactors(Projection &proj,cubemap &geoid,latlong ll,double elevation)
+{
+  PointFactors ret;
+  ret.ll=ll;
+  ret.elevation=elevation;
+  ret.grid=proj.latlongToGrid(ll);
+  finishFactors(proj,geoid,ret);
+  return ret;
+}
+
+template<typename F> void splitPoints(size_t n,int nthreads,F convert)
+/* Calls convert(i) for every i in [0,n), in chunks handed out to threads.
+ * Each i is done by one thread, so results don't depend on the number
+ * of threads.
+ */
+{
+  atomic<size_t> nextChunk(0);
+  vector<thread> threads;
+  size_t nChunks=(n+factorChunk-1)/factorChunk;
+  int i;
+  auto work=[&]()
+  {
+    size_t chunk,j,end;
+    while ((chunk=nextChunk++)<nChunks)
+    {
+      end=min(n,(chunk+1)*factorChunk);
+      for (j=chunk*factorChunk;j<end;j++)
+	convert(j);
+    }
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
+  for (i=1;i<nthreads && i<nChunks;i++)
+    threads.push_back(thread(work));
+  work();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+}
+
+vector<PointFactors> gridFactors(Projection &proj,cubemap &geoid,const vector<xyz> &grid,int nthreads)
+{
+  vector<PointFactors> ret(grid.size());
+  splitPoints(grid.size(),nthreads,[&](size_t i)
+  {
+    ret[i]=gridFactors(proj,geoid,grid[i]);
+  });
+  return ret;
+}
+
+vector<PointFactors> latlongFactors(Projection &proj,cubemap &geoid,const vector<latlong> &ll,const vector<double> &elevation,int nthreads)
+{
+  vector<PointFactors> ret(ll.size());
+  splitPoints(ll.size(),nthreads,[&](size_t i)
+  {
+    ret[i]=latlongFactors(proj,geoid,ll[i],elevation[i]);
+  });
+  return ret;
+}
@@ -0,0 +1,55 @@
+/******************************************************/
+/*                                                    */
+/* gridfactor.h - batch grid and elevation factors    */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRIDFACTOR_H
+#define GRIDFACTOR_H
+#include <vector>
+#include "projection.h"
+#include "geoid.h"
+
+struct PointFactors
+/* Everything needed to go between ground and grid at one point. A distance
+ * on the ground times combined is the distance on the grid. separation is the
+ * height of the geoid above the ellipsoid; where the geoid is unknown, it,
+ * elevFactor, and combined are NaN.
+ */
+{
+  xy grid;
+  latlong ll;
+  double elevation; // above the geoid
+  double separation;
+  double gridFactor,elevFactor,combined;
+  int convergence;
+};
+
+double elevationFactor(ellipsoid *ellip,latlong ll,double elevation,double separation);
+PointFactors gridFactors(Projection &proj,cubemap &geoid,xyz grid);
+PointFactors latlongFactors(Projection &proj,cubemap &geoid,latlong ll,double elevation);
+/* The batch forms do the same for many points, split among nthreads threads
+ * (all the processor has if 0), and give the same results as the one-point
+ * forms. The projection and geoid are only read.
+ */
+std::vector<PointFactors> gridFactors(Projection &proj,cubemap &geoid,const std::vector<xyz> &grid,int nthreads=0);
+std::vector<PointFactors> latlongFactors(Projection &proj,cubemap &geoid,const std::vector<latlong> &ll,const std::vector<double> &elevation,int nthreads=0);
+#endif
@@ -25,6 +25,11 @@
  * so that it can be seen on a map.
  */
 #include <climits>
+#include <sstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "kml.h"
 #include "projection.h"
 #include "halton.h"
@@ -153,7 +158,7 @@ void openkml(ofstream &file,string filename)
       <<"<Document>\n";
 }
 
-void kmlBoundary(ofstream &file,g1boundary g)
+void kmlBoundary(ostream &file,g1boundary g)
 {
   bool inner=g.isInner();
   int i;
@@ -176,31 +181,55 @@ void kmlBoundary(ofstream &file,g1boundary g)
   file<<"</coordinates></LinearRing>"<<(inner?"</innerBoundaryIs>":"</outerBoundaryIs>")<<endl;
 }
 
+void refineSeg(vsegment vseg,g1boundary &out)
+// Appends the points strictly between the ends of vseg.
+{
+  vball mid;
+  if (middleOrdinate(vseg)>MAXMIDORD)
+  {
+    mid=vseg.midpoint();
+    refineSeg(vsegment{vseg.start,mid},out);
+    out.push_back(mid);
+    refineSeg(vsegment{mid,vseg.end},out);
+  }
+}
+
 void refine(g1boundary &g1)
+/* Halves segments until no middle ordinate is more than MAXMIDORD. Each
+ * segment is halved independently, so this is done in one pass, and g1
+ * keeps its starting point.
+ */
 {
   int i;
-  double mo;
+  g1boundary out;
+  out.setInner(g1.isInner());
   for (i=0;i<g1.size();i++)
-    if ((mo=middleOrdinate(g1.seg(i)))>MAXMIDORD)
-    {
-      //cout<<"midord "<<mo<<endl;
-      g1.halve(i);
-      i=-1;
-    }
+  {
+    out.push_back(g1[i]);
+    refineSeg(g1.seg(i),out);
+  }
+  g1=out;
 }
 
-void kmlPolygon(ofstream &file,gboundary g)
+string kmlPolygonText(gboundary g)
 {
   int i;
   g1boundary g1;
-  file<<"<Placemark><Polygon>\n";
+  ostringstream text;
+  text<<"<Placemark><Polygon>\n";
   for (i=0;i<g.size();i++)
   {
     g1=g[i];
     refine(g1);
-    kmlBoundary(file,g1);
+    kmlBoundary(text,g1);
   }
-  file<<"</Polygon></Placemark>"<<endl;
+  text<<"</Polygon></Placemark>"<<endl;
+  return text.str();
+}
+
+void kmlPolygon(ofstream &file,gboundary g)
+{
+  file<<kmlPolygonText(g);
 }
 
 void closekml(ofstream &file)
@@ -225,23 +254,29 @@ KmlRegionList kmlRegions(gboundary &gb)
  * one more regions than g1boundaries. If gb.size() is more than 32, they
  * cannot all be distinguished; in this case, or if a region is empty,
  * it continues for 30 iterations per segment of boundary before giving up.
+ *
+ * The points are tested in batches, in threads. The first batch is just
+ * big enough to find all regions; each later batch is twice as big.
  */
 {
-  int i,r;
-  map<unsigned int,xyz>::iterator j;
-  latlong ll;
-  xyz pnt;
+  int i,j,total=gb.totalSegments()*30,batch=2*(gb.size()+1);
+  map<unsigned int,xyz>::iterator k;
+  vector<xyz> pnts;
+  vector<unsigned int> bits;
   KmlRegionList ret;
-  for (i=0;i<gb.totalSegments()*30 && ret.regionMap.size()<=gb.size();i++)
+  for (i=0;i<total && ret.regionMap.size()<=gb.size();batch*=2)
   {
-    pnt=gb.nearPoint();
-    r=gb.in(pnt);
-    ret.regionMap[r]=pnt;
+    pnts.clear();
+    for (j=0;j<batch && i+j<total;j++)
+      pnts.push_back(gb.nearPoint());
+    bits=gb.in(pnts);
+    for (j=0;j<pnts.size() && ret.regionMap.size()<=gb.size();j++,i++)
+      ret.regionMap[bits[j]]=pnts[j];
   }
   ret.blankBitCount=INT_MAX;
-  for (j=ret.regionMap.begin();j!=ret.regionMap.end();j++)
-    if (bitcount(j->first)<ret.blankBitCount)
-      ret.blankBitCount=bitcount(j->first);
+  for (k=ret.regionMap.begin();k!=ret.regionMap.end();k++)
+    if (bitcount(k->first)<ret.blankBitCount)
+      ret.blankBitCount=bitcount(k->first);
   return ret;
 }
 
@@ -331,15 +366,85 @@ gboundary extractRegion(gboundary &gb)
   return ret;
 }
 
-void outKml(gboundary gb,string filename)
+void outKml(gboundary gb,string filename,int nthreads)
+/* Regions are extracted one at a time in this thread, since each depends on
+ * what's left after the previous one. Worker threads refine and format the
+ * regions as they come out and write them to the file in order, so the
+ * document is never all in memory. Extraction waits if the workers fall
+ * behind by two regions each. If extraction throws, the workers finish what
+ * they have and are joined before the exception goes on.
+ */
 {
   ofstream file;
   gboundary poly;
+  deque<gboundary> regions;
+  size_t i,nextRegion=0,nextToWrite=0,maxPending;
+  bool done=false;
+  mutex regionMutex,writeMutex;
+  condition_variable extracted,taken,written;
+  vector<thread> threads;
+  auto work=[&]()
+  {
+    size_t n;
+    gboundary region;
+    string text;
+    while (true)
+    {
+      {
+	unique_lock<mutex> lock(regionMutex);
+	extracted.wait(lock,[&]{return regions.size() || done;});
+	if (regions.empty())
+	  break;
+	region=regions.front();
+	regions.pop_front();
+	n=nextRegion++;
+	taken.notify_one();
+      }
+      text=kmlPolygonText(region);
+      unique_lock<mutex> lock(writeMutex);
+      written.wait(lock,[&]{return nextToWrite==n;});
+      file<<text;
+      nextToWrite++;
+      written.notify_all();
+    }
+  };
+  auto joinWorkers=[&]()
+  {
+    {
+      lock_guard<mutex> lock(regionMutex);
+      done=true;
+      extracted.notify_all();
+    }
+    for (i=0;i<threads.size();i++)
+      threads[i].join();
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
   openkml(file,filename);
-  while (gb.size())
+  try
+  {
+    for (i=1;i<nthreads;i++)
+      threads.push_back(thread(work));
+    maxPending=2*threads.size();
+    while (gb.size())
+    {
+      poly=extractRegion(gb);
+      if (threads.empty())
+	file<<kmlPolygonText(poly);
+      else
+      {
+	unique_lock<mutex> lock(regionMutex);
+	taken.wait(lock,[&]{return regions.size()<maxPending;});
+	regions.push_back(poly);
+	extracted.notify_one();
+      }
+    }
+  }
+  catch (...)
   {
-    poly=extractRegion(gb);
-    kmlPolygon(file,poly);
+    joinWorkers();
+    throw;
   }
+  joinWorkers();
   closekml(file);
 }
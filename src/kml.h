@@ -56,4 +56,5 @@ gboundary gbounds(geoid &geo);
 gboundary regionBoundary(KmlRegionList& regionList,gboundary& allBdy,unsigned reg);
 KmlRegionList kmlRegions(gboundary &gb);
 gboundary extractRegion(gboundary &gb);
-void outKml(gboundary gb,std::string filename);
+std::string kmlPolygonText(gboundary g);
+void outKml(gboundary gb,std::string filename,int nthreads=0);
@@ -70,3 +70,13 @@ vector<double> minimumNorm(matrix m,vector<double> v)
   mtv=mt*vmat;
   return mtv;
 }
+
+vector<double> sparseLeastSquares(const SparseMatrix &m,const vector<double> &v)
+/* Same as linearLeastSquares, but for the large, sparse matrices of survey
+ * networks, where each observation involves only a few unknowns. The normal
+ * equations are solved by sparse Cholesky factorization.
+ */
+{
+  SparseCholesky chol(m.normalMatrix());
+  return chol.solve(m.transposeTimes(v));
+}
@@ -24,6 +24,7 @@
 
 #include <vector>
 #include "matrix.h"
+#include "sparse.h"
 #include "quaternion.h"
 #include "xyz.h"
 
@@ -49,3 +50,4 @@ public:
 
 std::vector<double> linearLeastSquares(matrix m,std::vector<double> v);
 std::vector<double> minimumNorm(matrix m,std::vector<double> v);
+std::vector<double> sparseLeastSquares(const SparseMatrix &m,const std::vector<double> &v);
@@ -0,0 +1,155 @@
+/******************************************************/
+/*                                                    */
+/* lengthtree.cpp - cumulative lengths of pieces      */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include "lengthtree.h"
+
+using namespace std;
+
+LengthTree::LengthTree()
+{
+  topBit=0;
+  setsSinceBuild=0;
+}
+
+void LengthTree::clear()
+{
+  lens.clear();
+  tree.clear();
+  topBit=0;
+  setsSinceBuild=0;
+}
+
+void LengthTree::build()
+{
+  int k,parent;
+  tree.resize(lens.size()+1);
+  tree[0]=0;
+  for (k=1;k<tree.size();k++)
+    tree[k]=lens[k-1];
+  for (k=1;k<tree.size();k++)
+  {
+    parent=k+(k&-k);
+    if (parent<tree.size())
+      tree[parent]+=tree[k];
+  }
+  for (topBit=1;topBit*2<tree.size();topBit*=2);
+  if (tree.size()<2)
+    topBit=0;
+  setsSinceBuild=0;
+}
+
+void LengthTree::assign(const vector<double> &lengths)
+{
+  lens=lengths;
+  build();
+}
+
+void LengthTree::resize(size_t n)
+{
+  lens.resize(n,0);
+  build();
+}
+
+void LengthTree::set(int i,double len)
+/* Adds the change in length to the partial sums that include piece i. If
+ * either length is NaN or infinite, the tree is rebuilt instead, so that the
+ * NaN doesn't stay in the sums after the length is fixed. It is also rebuilt
+ * once every n calls, so that rounding errors in the changes don't pile up.
+ */
+{
+  double diff=len-lens[i];
+  int k;
+  lens[i]=len;
+  if (std::isfinite(diff) && ++setsSinceBuild<=lens.size())
+    for (k=i+1;k<tree.size();k+=k&-k)
+      tree[k]+=diff;
+  else
+    build();
+}
+
+void LengthTree::insert(int i,double len)
+{
+  lens.insert(lens.begin()+i,len);
+  build();
+}
+
+void LengthTree::erase(int i)
+{
+  lens.erase(lens.begin()+i);
+  build();
+}
+
+double LengthTree::operator[](int i) const
+/* Returns the total length of pieces 0 through i, like cumLengths[i] did.
+ * The partial sums are added largest first, in the same order as find adds
+ * them, so that a station exactly at the end of a piece is found to be in
+ * the next piece, not this one.
+ */
+{
+  int path[64],n=0,k;
+  double ret=0;
+  for (k=i+1;k>0;k-=k&-k)
+    path[n++]=k;
+  while (n)
+    ret+=tree[path[--n]];
+  return ret;
+}
+
+double LengthTree::back() const
+{
+  return (*this)[lens.size()-1];
+}
+
+int LengthTree::find(double along) const
+/* Returns the number of pieces whose cumulative lengths are at most along.
+ * This is the number of the piece along is in, or size() if it's past the
+ * end or NaN.
+ */
+{
+  int k=0,step;
+  double sum=0;
+  for (step=topBit;step;step/=2)
+    if (k+step<tree.size() && !(sum+tree[k+step]>along))
+    {
+      k+=step;
+      sum+=tree[k];
+    }
+  return k;
+}
+
+void LengthTree::prefixSums(vector<double> &cum) const
+/* Sets cum to the cumulative lengths, cum[i] being the same as (*this)[i],
+ * in O(n) time instead of O(n log n). The sum up to k is the sum up to
+ * k-lowbit(k), which is already computed, plus tree[k], added in the same
+ * order as operator[] adds them.
+ */
+{
+  int k,lower;
+  cum.resize(lens.size());
+  for (k=1;k<tree.size();k++)
+  {
+    lower=k-(k&-k);
+    cum[k-1]=(lower?cum[lower-1]:0)+tree[k];
+  }
+}
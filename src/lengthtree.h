@@ -0,0 +1,71 @@
+/******************************************************/
+/*                                                    */
+/* lengthtree.h - cumulative lengths of pieces        */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef LENGTHTREE_H
+#define LENGTHTREE_H
+#include <vector>
+#include <cstddef>
+
+class LengthTree
+/* A Fenwick tree of the lengths of the pieces of a polyline. It replaces
+ * the vector of cumulative lengths, so that changing the length of one piece,
+ * as when a point is inserted or a spiral is reshaped, takes O(log n) time
+ * instead of adding up the lengths of all the pieces after it. tree[k] is the
+ * sum of the lengths of pieces k-lowbit(k) through k-1.
+ *
+ * Inserting or erasing a piece moves the lengths after it, so it rebuilds
+ * the tree in O(n) additions. The polyline moves its vectors of pieces in
+ * O(n) anyway, and this is still much faster than recomputing the lengths
+ * of the pieces.
+ *
+ * The sums are not compensated, as the cumulative sums added with manysum
+ * were. A sum is made of at most log2(n) partial sums, each added pairwise,
+ * so its relative error is about log2(n) ulps, instead of one. Each call to
+ * set adds a rounded difference to log2(n) partial sums, so after n calls to
+ * set without inserting or erasing, the tree is rebuilt from the lengths,
+ * which bounds the drift at n roundings of the changes.
+ */
+{
+public:
+  LengthTree();
+  void clear();
+  void assign(const std::vector<double> &lengths);
+  size_t size() const
+  {
+    return lens.size();
+  }
+  void resize(size_t n);
+  void set(int i,double len);
+  void insert(int i,double len);
+  void erase(int i);
+  double operator[](int i) const;
+  double back() const;
+  int find(double along) const;
+  void prefixSums(std::vector<double> &cum) const;
+private:
+  std::vector<double> lens,tree;
+  int topBit;
+  int setsSinceBuild;
+  void build();
+};
+#endif
@@ -0,0 +1,105 @@
+/******************************************************/
+/*                                                    */
+/* lrucache.h - least-recently-used cache             */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+#include <list>
+#include <map>
+#include <utility>
+
+/* Holds up to capacity values. The list is in order of use, most recent
+ * first; the map finds a key's place in the list. Putting a value when the
+ * cache is full throws out the least recently used one. Not thread-safe.
+ */
+
+template<typename K,typename V> class LruCache
+{
+public:
+  LruCache(size_t cap=16)
+  {
+    capacity=cap;
+  }
+  size_t size() const
+  {
+    return items.size();
+  }
+  bool get(const K &key,V &value);
+  template<typename P> bool findIf(P pred,V &value);
+  void put(const K &key,const V &value);
+  void clear()
+  {
+    items.clear();
+    index.clear();
+  }
+private:
+  typedef std::list<std::pair<K,V> > ItemList;
+  size_t capacity;
+  ItemList items;
+  std::map<K,typename ItemList::iterator> index;
+};
+
+template<typename K,typename V> bool LruCache<K,V>::get(const K &key,V &value)
+{
+  typename std::map<K,typename ItemList::iterator>::iterator i=index.find(key);
+  if (i==index.end())
+    return false;
+  items.splice(items.begin(),items,i->second);
+  value=i->second->second;
+  return true;
+}
+
+template<typename K,typename V> template<typename P>
+bool LruCache<K,V>::findIf(P pred,V &value)
+// Looks for a value, most recently used first, for which pred(key,value) is true.
+{
+  typename ItemList::iterator i;
+  for (i=items.begin();i!=items.end();++i)
+    if (pred(i->first,i->second))
+    {
+      items.splice(items.begin(),items,i);
+      value=i->second;
+      return true;
+    }
+  return false;
+}
+
+template<typename K,typename V> void LruCache<K,V>::put(const K &key,const V &value)
+{
+  typename std::map<K,typename ItemList::iterator>::iterator i=index.find(key);
+  if (i!=index.end())
+  {
+    i->second->second=value;
+    items.splice(items.begin(),items,i->second);
+    return;
+  }
+  items.push_front(std::make_pair(key,value));
+  index[key]=items.begin();
+  while (items.size()>capacity && items.size())
+  {
+    index.erase(items.back().first);
+    items.pop_back();
+  }
+}
+
+#endif
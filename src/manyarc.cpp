@@ -24,6 +24,8 @@
 #include <iostream>
 #include <cassert>
 #include <array>
+#include <thread>
+#include <atomic>
 #include "manyarc.h"
 #include "rootfind.h"
 #include "ps.h"
@@ -48,7 +50,6 @@
  */
 
 using namespace std;
-bool showThisMethod=false;
 
 /* Spiralarcs are used for centerlines of highways. A property line or easement
  * may be defined as a distance offset from the centerline of a highway or
@@ -731,8 +732,11 @@ void showMethod3(spiralarc a,vector<Circle> lines,vector<double> offs)
 }
 
 polyarc manyArc(spiralarc a,int narcs)
+/* showThisMethod is local, so that several threads can approximate
+ * spiralarcs at once.
+ */
 {
-  showThisMethod=SHOW_METHOD && narcs==5 && a.chordbearing()==0 && a.getdelta()>DEG30;
+  bool showThisMethod=SHOW_METHOD && narcs==5 && a.chordbearing()==0 && a.getdelta()>DEG30;
   if (showThisMethod)
     cout<<"This is the curve to show the method of\n";
 #if APX_METHOD==1
@@ -799,3 +803,175 @@ double maxError(polyarc apx,spiralarc a)
   }
   return firstError;
 }
+
+polyarc manyArcWithin(spiralarc a,double toler,bool *met)
+/* Approximates a with the fewest arcs, starting with two, whose maximum
+ * error is at most toler. If toler can't be met, it gives up and returns the
+ * approximation with the least error, setting *met to false. It gives up
+ * when adding an arc doesn't reduce the error, as happens when toler is
+ * below the rounding error of the coordinates. The error goes as the inverse
+ * cube of the number of arcs; as soon as it shows that toler would take more
+ * than twice MANYARC_MAX arcs, it skips to MANYARC_MAX arcs instead of trying
+ * every number up to it.
+ */
+{
+  int narcs;
+  polyarc ret,best;
+  double err,bestErr=INFINITY;
+  bool ok=false;
+  for (narcs=2;narcs<=MANYARC_MAX;narcs++)
+  {
+    ret=manyArc(a,narcs);
+    err=maxError(ret,a);
+    if (err<=toler)
+    {
+      ok=true;
+      break;
+    }
+    if (narcs>2 && !(err<bestErr))
+      break;
+    best=ret;
+    bestErr=err;
+    if (narcs<MANYARC_MAX-1 && narcs*cbrt(err/toler)>2*MANYARC_MAX)
+      narcs=MANYARC_MAX-1;
+  }
+  if (!ok)
+    ret=best;
+  if (met)
+    *met=ok;
+  return ret;
+}
+
+ManyArcCache::ManyArcCache()
+{
+  hits=misses=unmet=0;
+}
+
+void ManyArcCache::clear()
+{
+  lock_guard<mutex> lock(cacheMutex);
+  shapes.clear();
+  hits=misses=unmet=0;
+}
+
+size_t ManyArcCache::size()
+{
+  lock_guard<mutex> lock(cacheMutex);
+  return shapes.size();
+}
+
+int ManyArcCache::getHits()
+{
+  lock_guard<mutex> lock(cacheMutex);
+  return hits;
+}
+
+int ManyArcCache::getMisses()
+{
+  lock_guard<mutex> lock(cacheMutex);
+  return misses;
+}
+
+int ManyArcCache::getUnmet()
+{
+  lock_guard<mutex> lock(cacheMutex);
+  return unmet;
+}
+
+array<double,3> ManyArcCache::shapeKey(spiralarc &a,double toler)
+/* The shape is quantized relative to the tolerance. An error in the total
+ * curvature of dk radians moves the middle of the spiralarc about len*dk/8,
+ * so quantizing curvature*len and clothance*len² in steps of toler/len moves
+ * it by a small fraction of toler. toler/len is quantized in quarter octaves.
+ */
+{
+  double len=a.length();
+  double relToler=toler/len,step;
+  array<double,3> ret;
+  ret[0]=nearbyint(log2(relToler)*4);
+  step=exp2(ret[0]/4);
+  ret[1]=nearbyint(a.curvature(len/2)*len/step);
+  ret[2]=nearbyint(a.clothance()*len*len/step);
+  return ret;
+}
+
+polyarc ManyArcCache::approx(spiralarc a,double toler)
+/* The first spiralarc of a shape is approximated with manyArcWithin, and its
+ * approximation is stored with its chord moved to (0,0)-(1,0). Later
+ * spiralarcs whose key is the same get the stored approximation, rotated and
+ * scaled onto their chords, if its maximum error from them is within toler;
+ * if not, they are approximated themselves. The approximation is computed
+ * without holding the lock, so two threads may compute the same shape at
+ * once; the second result is thrown away.
+ */
+{
+  xy start=a.getstart(),chord=xy(a.getend())-start,unitChord;
+  double chordLen=chord.length();
+  array<double,3> key;
+  map<array<double,3>,polyarc>::iterator found;
+  polyarc ret,shape;
+  bool have,met;
+  if (!(chordLen>0) || !std::isfinite(chordLen) || !(toler>0))
+    return manyArcWithin(a,toler);
+  key=shapeKey(a,toler);
+  {
+    lock_guard<mutex> lock(cacheMutex);
+    found=shapes.find(key);
+    have=found!=shapes.end();
+    if (have)
+      ret=found->second;
+  }
+  if (have)
+  {
+    ret._roscat(xy(0,0),atan2i(chord),chordLen,chord,start);
+    have=maxError(ret,a)<=toler;
+  }
+  if (have)
+  {
+    lock_guard<mutex> lock(cacheMutex);
+    hits++;
+  }
+  else
+  {
+    ret=manyArcWithin(a,toler,&met);
+    unitChord=xy(chord.getx(),-chord.gety())/(chordLen*chordLen);
+    shape=ret;
+    shape._roscat(start,-atan2i(chord),1/chordLen,unitChord,xy(0,0));
+    lock_guard<mutex> lock(cacheMutex);
+    if (met && !shapes.count(key))
+      shapes[key]=shape;
+    misses++;
+    if (!met)
+      unmet++;
+  }
+  return ret;
+}
+
+vector<polyarc> manyArc(vector<polyspiral> &curves,double toler,int nthreads)
+/* Converts all the curves to polyarcs within toler, in several threads,
+ * sharing a cache of spiralarc shapes. If nthreads is 0, uses one thread
+ * per core.
+ */
+{
+  vector<polyarc> ret(curves.size());
+  vector<thread> threads;
+  ManyArcCache cache;
+  atomic<size_t> nextCurve(0);
+  size_t i;
+  auto work=[&]()
+  {
+    size_t n;
+    while ((n=nextCurve++)<curves.size())
+      ret[n]=polyarc(curves[n],toler,&cache);
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
+  for (i=1;i<nthreads && i<curves.size();i++)
+    threads.push_back(thread(work));
+  work();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+  if (cache.getUnmet())
+    cerr<<cache.getUnmet()<<" spiralarcs could not be approximated within "<<toler<<endl;
+  return ret;
+}
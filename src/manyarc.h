@@ -21,9 +21,43 @@
  * and Lesser General Public License along with Bezitopo. If not, see
  * <http://www.gnu.org/licenses/>.
  */
-
+#ifndef MANYARC_H
+#define MANYARC_H
+#include <map>
+#include <mutex>
+#include <array>
 #include "polyline.h"
 
+#define MANYARC_MAX 64
+/* manyArcWithin gives up if the tolerance can't be met with this many arcs,
+ * or sooner if adding arcs stops reducing the error.
+ */
+
+class ManyArcCache
+/* Contours and other smoothed polyspirals have many spiralarcs of nearly the
+ * same shape. The approximation of a spiralarc within a tolerance depends
+ * only on its shape, that is its curvature and clothance at the middle times
+ * its length and length squared, and the tolerance divided by its length.
+ * These are quantized into a key, and the approximation is computed once per
+ * key, then rotated and scaled onto each spiralarc of that shape and checked
+ * against it. It can be shared by several threads.
+ */
+{
+public:
+  ManyArcCache();
+  polyarc approx(spiralarc a,double toler);
+  void clear();
+  size_t size();
+  int getHits();
+  int getMisses();
+  int getUnmet(); // spiralarcs whose approximations aren't within tolerance
+private:
+  std::mutex cacheMutex;
+  std::map<std::array<double,3>,polyarc> shapes;
+  int hits,misses,unmet;
+  std::array<double,3> shapeKey(spiralarc &a,double toler);
+};
+
 segment spiralToCubic(spiralarc a);
 double manyArcTrimFunc(double p,double n);
 double manyArcTrimDeriv(double p,double n);
@@ -35,3 +69,6 @@ std::vector<double> weightedDistance(polyarc apx,spiralarc a);
 polyarc manyArcUnadjusted(spiralarc a,int narcs);
 polyarc manyArc(spiralarc a,int narcs);
 double maxError(polyarc apx,spiralarc a);
+polyarc manyArcWithin(spiralarc a,double toler,bool *met=nullptr);
+std::vector<polyarc> manyArc(std::vector<polyspiral> &curves,double toler,int nthreads=0);
+#endif
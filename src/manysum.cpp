@@ -69,6 +69,47 @@ double pairwisesum(double *a,unsigned n)
   return sum;
 }
 
+double pairwisedot(const double *a,const double *b,unsigned n)
+/* Same as pairwisesum of the products a[i]*b[i], adding them in the same
+ * order, without storing them. Used for matrix multiplication.
+ */
+{
+  unsigned i,j,bits;
+  double sums[32],sum=0;
+  for (i=0;i+7<n;i+=8)
+  {
+    bits=i^(i+8);
+    if (bits==8)
+      sums[3]=(((a[i]*b[i]+a[i+1]*b[i+1])+(a[i+2]*b[i+2]+a[i+3]*b[i+3]))+
+	       ((a[i+4]*b[i+4]+a[i+5]*b[i+5])+(a[i+6]*b[i+6]+a[i+7]*b[i+7])));
+    else
+    {
+      sums[3]+=(((a[i]*b[i]+a[i+1]*b[i+1])+(a[i+2]*b[i+2]+a[i+3]*b[i+3]))+
+		((a[i+4]*b[i+4]+a[i+5]*b[i+5])+(a[i+6]*b[i+6]+a[i+7]*b[i+7])));
+      for (j=4;bits>>(j+1);j++)
+	sums[j]+=sums[j-1];
+      sums[j]=sums[j-1];
+    }
+  }
+  for (;i<n;i++)
+  {
+    bits=i^(i+1);
+    if (bits==1)
+      sums[0]=a[i]*b[i];
+    else
+    {
+      sums[0]+=a[i]*b[i];
+      for (j=1;bits>>(j+1);j++)
+	sums[j]+=sums[j-1];
+      sums[j]=sums[j-1];
+    }
+  }
+  for (i=0;i<32;i++)
+    if ((n>>i)&1)
+      sum+=sums[i];
+  return sum;
+}
+
 long double pairwisesum(long double *a,unsigned n)
 {
   unsigned i,j,b;
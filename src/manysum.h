@@ -35,6 +35,7 @@
 
 double pairwisesum(double *a,unsigned n);
 double pairwisesum(std::vector<double> &a);
+double pairwisedot(const double *a,const double *b,unsigned n);
 long double pairwisesum(long double *a,unsigned n);
 long double pairwisesum(std::vector<long double> &a);
 
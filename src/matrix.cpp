@@ -27,6 +27,9 @@
 #include <utility>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 #include "matrix.h"
 #include "except.h"
 #include "manysum.h"
@@ -35,6 +38,35 @@
 
 using namespace std;
 
+int matrixThreads=0;
+
+template<class F> void splitRows(unsigned lo,unsigned hi,double work,F rowsDo)
+/* Calls rowsDo(first,last) on blocks of MATRIX_BLOCK rows from lo to hi-1,
+ * on several threads if work, the number of multiplications, is enough to be
+ * worth starting them.
+ */
+{
+  const double minThreadWork=1e6;
+  atomic<unsigned> next(lo);
+  vector<thread> threads;
+  int i,nthreads=matrixThreads;
+  auto work1=[&]()
+  {
+    unsigned first;
+    while ((first=next.fetch_add(MATRIX_BLOCK))<hi)
+      rowsDo(first,min(first+MATRIX_BLOCK,hi));
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
+  if (work<minThreadWork)
+    nthreads=1;
+  for (i=1;i<nthreads && lo+i*MATRIX_BLOCK<hi;i++)
+    threads.push_back(thread(work1));
+  work1();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+}
+
 matrix::matrix()
 {
   rows=columns=0;
@@ -171,23 +203,74 @@ matrix matrix::operator-(matrix& b)
   return ret;
 }
 
+matrix &matrix::operator+=(const matrix &b)
+{
+  if (rows!=b.rows || columns!=b.columns)
+    throw BeziExcept(matrixMismatch);
+  int i;
+  for (i=0;i<rows*columns;i++)
+    entry[i]+=b.entry[i];
+  return *this;
+}
+
+matrix &matrix::operator-=(const matrix &b)
+{
+  if (rows!=b.rows || columns!=b.columns)
+    throw BeziExcept(matrixMismatch);
+  int i;
+  for (i=0;i<rows*columns;i++)
+    entry[i]-=b.entry[i];
+  return *this;
+}
+
+matrix &matrix::operator*=(double b)
+{
+  int i;
+  for (i=0;i<rows*columns;i++)
+    entry[i]*=b;
+  return *this;
+}
+
 matrix matrix::operator*(matrix &b)
 {
-  if (columns!=b.rows)
+  matrix ret;
+  ret.mult(*this,b);
+  return ret;
+}
+
+void matrix::mult(matrix &a,matrix &b)
+/* Sets this to a*b, reusing this's entries if it is already the right size.
+ * Each entry is the pairwise sum of the products, as in pairwisesum. The
+ * columns of b are copied into rows so that they are contiguous, and blocks
+ * of MATRIX_BLOCK columns are done together, so that they stay in cache while
+ * a block of rows of a passes by. Big products are split among threads.
+ */
+{
+  if (a.columns!=b.rows)
     throw BeziExcept(matrixMismatch);
-  matrix ret(rows,b.columns);
-  int h,i,j,k;
-  double *sum;
-  sum=new double[columns];
-  for (i=0;i<rows;i++)
-    for (j=0;j<b.columns;j++)
+  if (this==&a || this==&b)
+  {
+    matrix ret;
+    ret.mult(a,b);
+    *this=move(ret);
+    return;
+  }
+  matrix bt=b.transpose();
+  if (rows!=a.rows || columns!=b.columns)
+  {
+    delete[] entry;
+    rows=a.rows;
+    columns=b.columns;
+    entry=new double[rows*columns];
+  }
+  splitRows(0,rows,(double)rows*columns*a.columns,[&](unsigned first,unsigned last)
     {
-      for (k=0;k<columns;k++)
-	sum[k]=(*this)[i][k]*b[k][j];
-      ret[i][j]=pairwisesum(sum,columns);
-    }
-  delete[] sum;
-  return ret;
+      unsigned h,i,j;
+      for (h=0;h<columns;h+=MATRIX_BLOCK)
+	for (i=first;i<last;i++)
+	  for (j=h;j<columns && j<h+MATRIX_BLOCK;j++)
+	    entry[i*columns+j]=pairwisedot(a.entry+i*a.columns,bt.entry+j*bt.columns,a.columns);
+    });
 }
 
 double matrix::trace()
@@ -212,30 +295,23 @@ matrix matrix::transpose()
 }
 
 matrix matrix::transmult()
+// Returns this times its transpose.
 {
   matrix ret(rows,rows);
-  int i,j,k;
-  double *sum;
-  sum=new double[columns];
-  for (i=0;i<rows;i++)
-    for (j=0;j<=i;j++)
+  splitRows(0,rows,(double)rows*rows*columns/2,[&](unsigned first,unsigned last)
     {
-      for (k=0;k<columns;k++)
-	sum[k]=(*this)[i][k]*(*this)[j][k];
-      ret[i][j]=ret[j][i]=pairwisesum(sum,columns);
-    }
-  delete[] sum;
+      unsigned h,i,j;
+      for (h=0;h<last;h+=MATRIX_BLOCK)
+	for (i=first;i<last;i++)
+	  for (j=h;j<=i && j<h+MATRIX_BLOCK;j++)
+	    ret.entry[i*rows+j]=ret.entry[j*rows+i]=pairwisedot(entry+i*columns,entry+j*columns,columns);
+    });
   return ret;
 }
 
 void matrix::swaprows(unsigned r0,unsigned r1)
 {
-  double *temp;
-  temp=new double[columns];
-  memcpy(temp,(*this)[r0],sizeof(double)*columns);
-  memcpy((*this)[r0],(*this)[r1],sizeof(double)*columns);
-  memcpy((*this)[r1],temp,sizeof(double)*columns);
-  delete[] temp;
+  swap_ranges((*this)[r0],(*this)[r0]+columns,(*this)[r1]);
 }
 
 void matrix::swapcolumns(unsigned c0,unsigned c1)
@@ -266,12 +342,8 @@ rowsult matrix::rowop(matrix &b,int row0,int row1,int piv)
 {
   rowsult ret;
   int i;
-  double *temp,*rw0,*rw1,*rwb0,*rwb1;
+  double *rw0,*rw1,*rwb0,*rwb1;
   double slope,minslope=INFINITY;
-  i=columns;
-  if (b.columns>i)
-    i=b.columns;
-  temp=new double[i];
   rw0=(*this)[row0];
   rw1=(*this)[row1];
   if (this==&b)
@@ -310,15 +382,9 @@ rowsult matrix::rowop(matrix &b,int row0,int row1,int piv)
   ret.flags&=1;
   if (ret.flags)
   {
-    memcpy(temp,rw0,sizeof(double)*columns);
-    memcpy(rw0,rw1,sizeof(double)*columns);
-    memcpy(rw1,temp,sizeof(double)*columns);
+    swap_ranges(rw0,rw0+columns,rw1);
     if (rwb0)
-    {
-      memcpy(temp,rwb0,sizeof(double)*b.columns);
-      memcpy(rwb0,rwb1,sizeof(double)*b.columns);
-      memcpy(rwb1,temp,sizeof(double)*b.columns);
-    }
+      swap_ranges(rwb0,rwb0+b.columns,rwb1);
   }
   if (ret.pivot<0)
     ret.detfactor=0;
@@ -344,35 +410,86 @@ rowsult matrix::rowop(matrix &b,int row0,int row1,int piv)
   }
   if (ret.flags&1)
     ret.detfactor=-ret.detfactor;
-  delete[] temp;
   return ret;
 }
 
+void subtractMultiple(double *dst,const double *src,double factor,unsigned n)
+/* dst[i]-=src[i]*factor, for i<n. dst and src are different rows. Loading
+ * four of src before storing any of dst lets the compiler use vector
+ * instructions without checking whether they overlap.
+ */
+{
+  unsigned i;
+  double s0,s1,s2,s3;
+  for (i=0;i+3<n;i+=4)
+  {
+    s0=src[i];
+    s1=src[i+1];
+    s2=src[i+2];
+    s3=src[i+3];
+    dst[i]-=s0*factor;
+    dst[i+1]-=s1*factor;
+    dst[i+2]-=s2*factor;
+    dst[i+3]-=s3*factor;
+  }
+  for (;i<n;i++)
+    dst[i]-=src[i]*factor;
+}
+
+void matrix::eliminate(matrix &b,int row)
+/* Does the same as rowop(b,row,j,row) for all j, when the pivot is nonzero:
+ * divides row by the pivot and subtracts it from all other rows. The
+ * subtraction starts at row's first nonzero entry, which in Gauss-Jordan
+ * elimination is usually the pivot, and big matrices are split among
+ * threads.
+ */
+{
+  double *rw0=(*this)[row],*rwb0=(this==&b)?nullptr:b[row];
+  double pivot=rw0[row];
+  unsigned i,start;
+  if (pivot!=1)
+  {
+    for (i=0;i<columns;i++)
+      rw0[i]/=pivot;
+    for (i=0;rwb0 && i<b.columns;i++)
+      rwb0[i]/=pivot;
+  }
+  for (start=0;start<columns && rw0[start]==0;start++);
+  splitRows(0,rows,(double)rows*(columns-start+(rwb0?b.columns:0)),[&](unsigned first,unsigned last)
+    {
+      unsigned j;
+      double slope;
+      for (j=first;j<last;j++)
+	if (j!=row && (slope=(*this)[j][row])!=0)
+	{
+	  subtractMultiple((*this)[j]+start,rw0+start,slope,columns-start);
+	  if (rwb0)
+	    subtractMultiple(b[j],rwb0,slope,b.columns);
+	}
+    });
+}
+
 void matrix::gausselim(matrix &b)
+/* Reduces this to the identity, if it is nonsingular, and does the same row
+ * operations to b. Columns with a nonzero pivot are eliminated by eliminate;
+ * the others, and the back substitution, which has nothing to do unless a
+ * pivot was 0, are done by rowop.
+ */
 {
   int i,j;
-  //dump();
-  /*for (i=1;i<rows;i*=2)
-    for (j=0;j+i<rows;j++)
-      if ((j&i)==0)
-	rowop(b,j,j+i,-1);*/
   for (i=0;i<rows;i++)
   {
     findpivot(b,i,i);
-    for (j=0;j<rows;j++)
-      rowop(b,i,j,i);
-    //cout<<endl;
-    //dump();
+    if (i<columns && (*this)[i][i]!=0)
+      eliminate(b,i);
+    else
+      for (j=0;j<rows;j++)
+	rowop(b,i,j,i);
   }
   for (i=rows-1;i>=0;i--)
-  {
     for (j=0;j<i;j++)
-      rowop(b,i,j,i);
-    //cout<<endl;
-    //dump();
-  }
-  //cout<<endl;
-  //b.dump();
+      if (i>=columns || (*this)[i][i]!=1 || (*this)[j][i]!=0)
+	rowop(b,i,j,i);
 }
 
 bool matrix::findpivot(matrix &b,int row,int column)
@@ -382,26 +499,31 @@ bool matrix::findpivot(matrix &b,int row,int column)
  * This tells _determinant to multiply by -1.
  */
 {
-  int i,j,k,pivotrow;
-  double *squares,*ratios,*thisrow,maxratio;
-  squares=new double[columns];
-  ratios=new double[rows];
+  int i,pivotrow;
+  double maxratio;
+  vector<double> ratios(rows);
   for (pivotrow=-1,maxratio=0;pivotrow<row && column<columns;column++)
   {
-    memset(ratios,0,rows*sizeof(double));
+    splitRows(row,rows,(double)(rows-row)*(columns-column),[&](unsigned first,unsigned last)
+      {
+	vector<double> squares(columns-column);
+	unsigned i,j;
+	double *thisrow;
+	for (i=first;i<last;i++)
+	{
+	  thisrow=(*this)[i];
+	  for (j=column+1;j<columns;j++)
+	    squares[j-column-1]=thisrow[j]*thisrow[j];
+	  squares[columns-column-1]=0;
+	  ratios[i]=sqr(thisrow[column])/pairwisesum(&squares[0],columns-column);
+	}
+      });
     for (i=row;i<rows;i++)
-    {
-      thisrow=(*this)[i];
-      memset(squares,0,columns*sizeof(double));
-      for (j=column+1;j<columns;j++)
-	squares[j-column-1]=sqr(thisrow[j]);
-      ratios[i]=sqr(thisrow[column])/pairwisesum(squares,columns-column);
       if (ratios[i]>maxratio)
       {
 	pivotrow=i;
 	maxratio=ratios[i];
       }
-    }
   }
   if (pivotrow>row)
   {
@@ -409,8 +531,6 @@ bool matrix::findpivot(matrix &b,int row,int column)
     if (&b!=this)
       b.swaprows(pivotrow,row);
   }
-  delete[] ratios;
-  delete[] squares;
   return pivotrow>row;
 }
 
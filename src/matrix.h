@@ -30,6 +30,15 @@
 /* square root of 10922.5, which is the root-mean-square of a random byte
  * doubled and offset to center
  */
+#define MATRIX_BLOCK 16
+/* Number of rows or columns handled together in multiplication, and
+ * given to a thread at once.
+ */
+
+extern int matrixThreads;
+/* Number of threads used for big products and eliminations. If 0 or
+ * negative, uses as many threads as the processor has.
+ */
 
 
 struct rowsult
@@ -47,6 +56,7 @@ protected:
   rowsult rowop(matrix &b,int row0,int row1,int piv);
   double _determinant();
   bool findpivot(matrix &b,int row,int column);
+  void eliminate(matrix &b,int row);
 public:
   matrix();
   matrix(unsigned r,unsigned c);
@@ -71,6 +81,10 @@ public:
   matrix operator+(matrix& b);
   matrix operator-(matrix& b);
   matrix operator*(matrix& b);
+  matrix &operator+=(const matrix &b);
+  matrix &operator-=(const matrix &b);
+  matrix &operator*=(double b);
+  void mult(matrix &a,matrix &b);
   double trace();
   matrix transpose();
   matrix transmult();
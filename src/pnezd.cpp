@@ -33,6 +33,7 @@
 #include "ldecimal.h"
 #include "document.h"
 #include "csv.h"
+#include "cancel.h"
 using namespace std;
 
 /* The file produced by Total Open Station has a first line consisting of column
@@ -51,16 +52,19 @@ int readpnezd(document *doc,string fname,Measure ms,bool overwrite)
   size_t size=0,pos1,pos2;
   ssize_t len;
   int p,npoints;
-  double n,e,z;
+  double n,e,z,fileBytes,bytesRead=0;
   vector<string> words;
   string line,pstr,nstr,estr,zstr,d;
   infile.open(fname);
   npoints=-(!infile.is_open());
   if (infile.is_open())
   {
+    fileBytes=streamSize(infile);
     do
     {
+      checkCancel(bytesRead,fileBytes);
       getline(infile,line);
+      bytesRead+=line.length()+1;
       while (line.length() && (line.back()=='\n' || line.back()=='\r'))
 	line.pop_back();
       words=parsecsvline(line);
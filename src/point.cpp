@@ -459,6 +459,7 @@ point::point()
 {
   x=y=z=0;
   line=NULL;
+  stamp=0;
   flags=0;
   note="";
 }
@@ -469,6 +470,7 @@ point::point(double e,double n,double h,string desc)
   y=n;
   z=h;
   line=0;
+  stamp=0;
   note=desc;
 }
 
@@ -478,6 +480,7 @@ point::point(xy pnt,double h,string desc)
   y=pnt.y;
   z=h;
   line=0;
+  stamp=0;
   note=desc;
 }
 
@@ -487,6 +490,7 @@ point::point(xyz pnt,string desc)
   y=pnt.y;
   z=pnt.z;
   line=0;
+  stamp=0;
   note=desc;
 }
 
@@ -496,6 +500,7 @@ point::point(const point &rhs)
   y=rhs.y;
   z=rhs.z;
   line=rhs.line;
+  stamp=0;
   note=rhs.note;
 }
 
@@ -545,11 +550,11 @@ vector<edge *> point::incidentEdges()
 {
   int i;
   vector<edge *> ret;
-  edge *oldline;
-  for (i=0,oldline=line;line && (!i || oldline!=line);i++)
-  {
-    line=line->next(this);
-    ret.push_back(line);
+  edge *thisline;
+  for (i=0,thisline=line;thisline && (!i || thisline!=line);i++)
+  { // Don't rotate line, so that this can be called while another thread reads the TIN.
+    thisline=thisline->next(this);
+    ret.push_back(thisline);
   }
   return ret;
 }
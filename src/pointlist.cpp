@@ -32,6 +32,7 @@
 #include "except.h"
 #include "stl.h"
 #include "dxf.h"
+#include "cancel.h"
 
 using namespace std;
 
@@ -67,13 +68,18 @@ void criterion::writeXml(ostream &ofile)
 pointlist::pointlist()
 {
   initStlTable();
+  localSetsAll=true;
+  localRadius=0;
+  localOwner=nullptr;
 }
 
 void pointlist::clear()
 {
   contours.clear();
+  clearLocalSets();
   triangles.clear();
   edges.clear();
+  edgeIndex.clear();
   points.clear();
   revpoints.clear();
   triPolyLog.clear();
@@ -81,8 +87,10 @@ void pointlist::clear()
 
 void pointlist::clearTin()
 {
+  clearLocalSets();
   triangles.clear();
   edges.clear();
+  edgeIndex.clear();
 }
 
 map<ContourLayer,int> pointlist::contourLayers()
@@ -738,77 +746,164 @@ string pointlist::hitTestPointString(xy pnt,double radius)
   return ret;
 }
 
-void pointlist::addIfIn(triangle *t,set<triangle *> &addenda,xy pnt,double radius)
+unsigned localGeneration=0;
+/* Each call to setLocalSets starts a new generation. A point, edge, or
+ * triangle is in the local sets if its stamp equals localGeneration. This is
+ * global, not per pointlist, so that a triangle copied from one pointlist to
+ * another can't be mistaken for one already found.
+ */
+
+void pointlist::addLocal(point *p)
+{
+  if (p->stamp!=localGeneration)
+  {
+    p->stamp=localGeneration;
+    localPoints.push_back(p);
+  }
+}
+
+void pointlist::addLocal(edge *e)
+{
+  if (e->stamp!=localGeneration)
+  {
+    e->stamp=localGeneration;
+    localEdges.push_back(e);
+  }
+}
+
+void pointlist::addLocal(triangle *t)
+{
+  if (t->stamp!=localGeneration)
+  {
+    t->stamp=localGeneration;
+    localTriangles.push_back(t);
+  }
+}
+
+void pointlist::addIfIn(triangle *t,xy pnt,double radius)
+{
+  if (t && t->stamp!=localGeneration && t->inCircle(pnt,radius))
+    addLocal(t);
+}
+
+void pointlist::clearLocalSets()
+/* Called when the triangles are about to be destroyed, so that
+ * setLocalSets doesn't start from dangling pointers.
+ */
 {
-  if (t && !localTriangles.count(t) && t->inCircle(pnt,radius))
-    addenda.insert(t);
+  localPoints.clear();
+  localEdges.clear();
+  localTriangles.clear();
+  localSetsAll=true;
+  localRadius=0;
 }
 
 void pointlist::setLocalSets(xy pnt,double radius)
-/* If the sets are set to {nullptr}, this means one of two things:
+/* If localSetsAll is set, this means one of two things:
  * • The area in the window is too large; it would be faster to loop through
  *   all the edges.
  * • There are no triangles. A qindex is an index of triangles.
- * An empty qindex would produce {}, so this condition has to be checked.
+ * If the view has moved only a little since the last call, the triangles
+ * found then that are still in the circle are kept, and the flood fill
+ * starts only from those of them on the frontier, those with a neighbor that
+ * wasn't in the old set; the others' neighbors are all either kept or out of
+ * the circle. Otherwise the qindex provides the seeds. The points and edges
+ * are gathered again from all the triangles either way. The flood fill goes
+ * through neighbors, so when panning a concave TIN, a piece coming into view
+ * that isn't connected within the circle to what was already in view is
+ * found only at the next zoom.
  */
 {
-  set<point *>::iterator i;
-  set<edge *>::iterator j;
-  set<triangle *>::iterator k;
-  int n;
-  vector<edge *> pointEdges;
-  set<triangle *> addenda;
+  vector<triangle *> seeds,frontier;
+  size_t i,start=0;
+  point *p;
+  edge *e;
+  triangle *t;
+  bool pan=!localSetsAll && localOwner==&triangles && localTriangles.size() &&
+	   radius==localRadius && dist(pnt,localCenter)<radius/8;
+  if (pan)
+    for (i=0;i<localTriangles.size();i++)
+    { // Stamps still hold the old generation here.
+      t=localTriangles[i];
+      if (t->inCircle(pnt,radius))
+      {
+	if ((t->aneigh && t->aneigh->stamp!=localGeneration) ||
+	    (t->bneigh && t->bneigh->stamp!=localGeneration) ||
+	    (t->cneigh && t->cneigh->stamp!=localGeneration))
+	  frontier.push_back(t);
+	else
+	  seeds.push_back(t);
+      }
+    }
+  if (++localGeneration==0)
+  { // Wrapped around. Clear the stamps so that old ones can't match.
+    for (ptlist::iterator j=points.begin();j!=points.end();++j)
+      j->second.stamp=0;
+    for (map<int,edge>::iterator j=edges.begin();j!=edges.end();++j)
+      j->second.stamp=0;
+    for (map<int,triangle>::iterator j=triangles.begin();j!=triangles.end();++j)
+      j->second.stamp=0;
+    localGeneration=1;
+  }
+  if (pan)
+  { // The interior ones go first, so that the flood fill can skip them.
+    start=seeds.size();
+    seeds.insert(seeds.end(),frontier.begin(),frontier.end());
+  }
+  if (seeds.empty())
+  {
+    pan=false;
+    start=0;
+    localSetsAll=!triangles.size() || !qinx.localTriangles(pnt,radius,triangles.size()/64+100,seeds);
+  }
   localTriangles.clear();
   localEdges.clear();
   localPoints.clear();
-  if (triangles.size())
-    localTriangles=qinx.localTriangles(pnt,radius,triangles.size()/64+100);
-  else
-    localTriangles.insert(nullptr);
-  if (localTriangles.count(nullptr))
+  localCenter=pnt;
+  localRadius=radius;
+  localOwner=&triangles;
+  if (localSetsAll)
   {
-    localEdges.insert(nullptr);
-    localPoints.insert(nullptr);
+    localRadius=0;
     //cout<<"No triangles or view is too big\n";
   }
   else
   {
-    do
-    {
-      addenda.clear();
-      for (k=localTriangles.begin();k!=localTriangles.end();++k)
-      {
-	addIfIn((*k)->aneigh,addenda,pnt,radius);
-	addIfIn((*k)->bneigh,addenda,pnt,radius);
-	addIfIn((*k)->cneigh,addenda,pnt,radius);
-      }
-      for (k=addenda.begin();k!=addenda.end();++k)
-	localTriangles.insert(*k);
-    } while (addenda.size());
-    for (k=localTriangles.begin();k!=localTriangles.end();++k)
-    {
-      localPoints.insert((*k)->a);
-      localPoints.insert((*k)->b);
-      localPoints.insert((*k)->c);
+    for (i=0;i<seeds.size();i++)
+      addLocal(seeds[i]);
+    for (i=start;i<localTriangles.size();i++)
+    { // localTriangles grows as neighbors are added.
+      addIfIn(localTriangles[i]->aneigh,pnt,radius);
+      addIfIn(localTriangles[i]->bneigh,pnt,radius);
+      addIfIn(localTriangles[i]->cneigh,pnt,radius);
     }
-    for (i=localPoints.begin();i!=localPoints.end();++i)
+    for (i=0;i<localTriangles.size();i++)
     {
-      pointEdges=(*i)->incidentEdges();
-      for (n=0;n<pointEdges.size();n++)
-	localEdges.insert(pointEdges[n]);
+      addLocal(localTriangles[i]->a);
+      addLocal(localTriangles[i]->b);
+      addLocal(localTriangles[i]->c);
+    }
+    for (i=0;i<localPoints.size();i++)
+    { // Walk around the point instead of calling incidentEdges, which allocates.
+      p=localPoints[i];
+      e=p->line;
+      if (e)
+	do
+	{
+	  addLocal(e);
+	  e=e->next(p);
+	} while (e!=p->line);
     }
-    for (j=localEdges.begin();j!=localEdges.end();++j)
+    for (i=0;i<localEdges.size();i++)
     { // localTriangles() usually doesn't find all triangles, and may even miss a point.
-      if ((*j)->tria)
-	localTriangles.insert((*j)->tria);
-      if ((*j)->trib)
-	localTriangles.insert((*j)->trib);
-      localPoints.insert((*j)->a);
-      localPoints.insert((*j)->b);
+      e=localEdges[i];
+      if (e->tria)
+	addLocal(e->tria);
+      if (e->trib)
+	addLocal(e->trib);
+      addLocal(e->a);
+      addLocal(e->b);
     }
-    assert(!localPoints.count(nullptr));
-    assert(!localEdges.count(nullptr));
-    assert(!localTriangles.count(nullptr));
     //cout<<localPoints.size()<<" points "<<localEdges.size()<<" edges "<<localTriangles.size()<<" triangles\n";
   }
 }
@@ -824,6 +919,7 @@ void pointlist::writeXml(ofstream &ofile)
   ofile<<"</Criteria><Points>";
   for (p=points.begin(),i=0;p!=points.end();p++,i++)
   {
+    checkCancel(i,points.size()+triangles.size());
     if (i && (i%1)==0)
       ofile<<endl;
     p->second.writeXml(ofile,*this);
@@ -832,6 +928,7 @@ void pointlist::writeXml(ofstream &ofile)
   ofile<<"<TIN>";
   for (t=triangles.begin(),i=0;t!=triangles.end();t++,i++)
   {
+    checkCancel(points.size()+i,points.size()+triangles.size());
     if (i && (i%1)==0)
       ofile<<endl;
     t->second.writeXml(ofile,*this);
@@ -33,6 +33,7 @@
 #include "tin.h"
 #include "bezier.h"
 #include "qindex.h"
+#include "edgeindex.h"
 #include "polyline.h"
 #include "contour.h"
 #include "breakline.h"
@@ -84,11 +85,13 @@ public:
    * when a vector is resized.
    */
   std::vector<polyspiral> contours;
-  std::set<point *> localPoints;
-  std::set<edge *> localEdges;
-  std::set<triangle *> localTriangles;
+  std::vector<point *> localPoints;
+  std::vector<edge *> localEdges;
+  std::vector<triangle *> localTriangles;
+  bool localSetsAll;
   /* localPoints, localEdges, and localTriangles are used to speed up repainting
-   * when the view is of a small fraction of a huge TIN.
+   * when the view is of a small fraction of a huge TIN. If localSetsAll is true,
+   * they are empty and everything should be looked at.
    */
   criteria crit;
   ContourInterval contourInterval;
@@ -101,7 +104,16 @@ public:
    * 3: both are valid (you just made a TIN, or you just saved breaklines to a file).
    */
   qindex qinx;
+  EdgeIndex edgeIndex; // for painting zoomed-out views; cleared when edges change
   std::vector<TriPolyLogEntry> triPolyLog;
+private:
+  xy localCenter;
+  double localRadius; // of the last setLocalSets, 0 if they can't be reused
+  std::map<int,triangle> *localOwner; // detects that the pointlist was copied
+  void addLocal(point *p);
+  void addLocal(edge *e);
+  void addLocal(triangle *t);
+public:
   pointlist();
   void addpoint(int numb,point pnt,bool overwrite=false);
   int addtriangle(int n=1);
@@ -133,8 +145,9 @@ public:
   void readBreaklines(std::string filename);
   std::string hitTestString(triangleHit hit);
   std::string hitTestPointString(xy pnt,double radius);
-  void addIfIn(triangle *t,std::set<triangle *> &addenda,xy pnt,double radius);
+  void addIfIn(triangle *t,xy pnt,double radius);
   void setLocalSets(xy pnt,double radius);
+  void clearLocalSets();
   virtual void writeXml(std::ofstream &ofile);
   // the following methods are in tin.cpp
 private:
@@ -31,6 +31,7 @@
  */
 
 #include <cassert>
+#include <algorithm>
 #include <iostream>
 #include "polyline.h"
 #include "manysum.h"
@@ -113,7 +114,10 @@ polyspiral::polyspiral(polyline &p)
   curvy=false;
 }
 
-polyarc::polyarc(polyspiral &r,double toler)
+polyarc::polyarc(polyspiral &r,double toler,ManyArcCache *cache)
+/* Replaces each spiralarc with the fewest arcs that are within toler of it.
+ * If a cache is given, spiralarcs of the same shape are approximated once.
+ */
 {
   int i,j;
   polyarc piece;
@@ -127,17 +131,20 @@ polyarc::polyarc(polyspiral &r,double toler)
     }
     else
     {
-      piece=manyArc(r.getspiralarc(i),2);
+      if (cache)
+	piece=cache->approx(r.getspiralarc(i),toler);
+      else
+	piece=manyArcWithin(r.getspiralarc(i),toler);
       for (j=0;j<piece.size();j++)
       {
-	endpoints.push_back(piece.endpoints[j]);
+	endpoints.push_back(j?piece.endpoints[j]:r.endpoints[i]);
 	lengths.push_back(piece.lengths[j]);
 	deltas.push_back(piece.deltas[j]);
       }
     }
   if (r.isopen())
     endpoints.push_back(r.endpoints[i]);
-  cumLengths=lengths;
+  cumLengths.assign(lengths);
   boundCircles.resize(lengths.size());
   setlengths();
 }
@@ -170,18 +177,26 @@ int polyline::size()
 unsigned polyline::hash()
 {
   return memHash(&lengths[0],lengths.size()*sizeof(double),
-         memHash(&cumLengths[0],cumLengths.size()*sizeof(double),
          memHash(&endpoints[0],endpoints.size()*sizeof(xy),
-         memHash(&elevation,sizeof(double)))));
+         memHash(&elevation,sizeof(double))));
+}
+
+drawobj *polyline::clone()
+{
+  return new polyline(*this);
 }
 
 unsigned polyarc::hash()
 {
   return memHash(&deltas[0],deltas.size()*sizeof(int),
          memHash(&lengths[0],lengths.size()*sizeof(double),
-         memHash(&cumLengths[0],cumLengths.size()*sizeof(double),
          memHash(&endpoints[0],endpoints.size()*sizeof(xy),
-         memHash(&elevation,sizeof(double))))));
+         memHash(&elevation,sizeof(double)))));
+}
+
+drawobj *polyarc::clone()
+{
+  return new polyarc(*this);
 }
 
 unsigned polyspiral::hash()
@@ -194,9 +209,13 @@ unsigned polyspiral::hash()
          memHash(&clothances[0],clothances.size()*sizeof(double),
          memHash(&deltas[0],deltas.size()*sizeof(int),
          memHash(&lengths[0],lengths.size()*sizeof(double),
-         memHash(&cumLengths[0],cumLengths.size()*sizeof(double),
          memHash(&endpoints[0],endpoints.size()*sizeof(xy),
-         memHash(&elevation,sizeof(double))))))))))));
+         memHash(&elevation,sizeof(double)))))))))));
+}
+
+drawobj *polyspiral::clone()
+{
+  return new polyspiral(*this);
 }
 
 segment polyline::getsegment(int i)
@@ -325,10 +344,10 @@ void polyline::dedup()
       lenit=lengths.begin()+i;
       endpoints.erase(ptit);
       lengths.erase(lenit);
-      lenit=cumLengths.begin()+i;
-      cumLengths.erase(lenit);
+      cumLengths.erase(i);
       bcit=boundCircles.begin()+i;
       boundCircles.erase(bcit);
+      bcirTree.clear();
       if (h>i)
 	h--;
       if (k>i)
@@ -340,9 +359,15 @@ void polyline::dedup()
       if (avg.isfinite())
 	endpoints[i]=avg;
       if (i!=h)
+      {
 	lengths[h]=dist(endpoints[h],endpoints[i]);
+	cumLengths.set(h,lengths[h]);
+      }
       if (j!=k)
+      {
 	lengths[j]=dist(endpoints[k],endpoints[j]);
+	cumLengths.set(j,lengths[j]);
+      }
       i--; // in case three in a row are the same
     }
   }
@@ -375,11 +400,8 @@ void polyline::insert(xy newpoint,int pos)
   lengths.insert(lenit,0);
   bcit=boundCircles.begin()+pos;
   boundCircles.insert(bcit,{xy(0,0),0});
-  lenit=cumLengths.begin()+pos;
-  if (pos<cumLengths.size())
-    cumLengths.insert(lenit,cumLengths[pos]);
-  else
-    cumLengths.insert(lenit,0);
+  bcirTree.clear();
+  cumLengths.insert(pos,0);
   pos--;
   if (pos<0)
     if (wasopen)
@@ -388,10 +410,12 @@ void polyline::insert(xy newpoint,int pos)
       pos+=endpoints.size();
   for (i=0;i<2;i++)
   {
-    if (pos+1<endpoints.size())
-      lengths[pos]=dist(endpoints[pos],endpoints[pos+1]);
-    if (pos+1==endpoints.size() && !wasopen)
-      lengths[pos]=dist(endpoints[pos],endpoints[0]);
+    if (pos+1<endpoints.size() || (pos+1==endpoints.size() && !wasopen))
+    {
+      lengths[pos]=dist(endpoints[pos],endpoints[(pos+1)%endpoints.size()]);
+      cumLengths.set(pos,lengths[pos]);
+      boundCircles[pos]=getsegment(pos).boundCircle();
+    }
     pos++;
     if (pos>=lengths.size())
       pos=0;
@@ -422,11 +446,8 @@ void polyarc::insert(xy newpoint,int pos)
   lengths.insert(lenit,0);
   bcit=boundCircles.begin()+pos;
   boundCircles.insert(bcit,{xy(0,0),0});
-  lenit=cumLengths.begin()+pos;
-  if (pos<cumLengths.size())
-    cumLengths.insert(lenit,cumLengths[pos]);
-  else
-    cumLengths.insert(lenit,0);
+  bcirTree.clear();
+  cumLengths.insert(pos,0);
   pos--;
   if (pos<0)
     if (wasopen)
@@ -468,7 +489,9 @@ void polyarc::insert(xy newpoint,int pos)
     if (pos+1<endpoints.size() || !wasopen)
     {
       deltas[pos]=newdelta[i];
-      lengths[pos]=getarc(i).length();
+      lengths[pos]=getarc(pos).length();
+      cumLengths.set(pos,lengths[pos]);
+      boundCircles[pos]=getarc(pos).boundCircle();
     }
     pos++;
     if (pos>=lengths.size())
@@ -476,58 +499,57 @@ void polyarc::insert(xy newpoint,int pos)
   }
 }
 
-/* After inserting, opening, or closing, call setlengths before calling
- * length or station. If insert called setlengths, manipulation would take
- * too long. So do a lot of inserts, then call setlengths.
+/* After opening or closing, call setlengths before calling length or
+ * station. Inserting updates the lengths of the pieces next to the new point,
+ * and cumLengths is a tree in which changing one length takes O(log n) time,
+ * so length and station work right after inserting, but setlengths
+ * recomputes every piece, so do a lot of inserts, then call setlengths.
  */
 void polyline::setlengths()
 {
   int i;
-  manysum m;
   segment seg;
   assert(lengths.size()==cumLengths.size());
+  bcirTree.clear();
   for (i=0;i<lengths.size();i++)
   {
     seg=getsegment(i);
     lengths[i]=seg.length();
     boundCircles[i]=seg.boundCircle();
-    m+=lengths[i];
-    cumLengths[i]=m.total();
   }
+  cumLengths.assign(lengths);
 }
 
 void polyarc::setlengths()
 {
   int i;
-  manysum m;
   arc seg;
   assert(lengths.size()==cumLengths.size());
   assert(lengths.size()==deltas.size());
+  bcirTree.clear();
   for (i=0;i<deltas.size();i++)
   {
     seg=getarc(i);
     lengths[i]=seg.length();
     boundCircles[i]=seg.boundCircle();
-    m+=lengths[i];
-    cumLengths[i]=m.total();
   }
+  cumLengths.assign(lengths);
 }
 
 void polyspiral::setlengths()
 {
   int i;
-  manysum m;
   spiralarc seg;
   assert(lengths.size()==cumLengths.size());
   assert(lengths.size()==deltas.size());
+  bcirTree.clear();
   for (i=0;i<deltas.size();i++)
   {
     seg=getspiralarc(i);
     lengths[i]=seg.length();
     boundCircles[i]=seg.boundCircle();
-    m+=lengths[i];
-    cumLengths[i]=m.total();
   }
+  cumLengths.assign(lengths);
 }
 
 void polyarc::setdelta(int i,int delta)
@@ -537,50 +559,102 @@ void polyarc::setdelta(int i,int delta)
     i+=deltas.size();
   deltas[i]=delta;
   lengths[i]=getarc(i).length();
+  cumLengths.set(i,lengths[i]);
+  boundCircles[i]=getarc(i).boundCircle();
+  bcirTree.clear();
 }
 
-double polyline::in(xy point)
-/* Returns 1 if the polyline winds once counterclockwise around point.
- * Returns 1/2 or -1/2 if point is on polyline's boundary, unless it
- * is a corner, in which case it returns another fraction.
+BcirTree &polyline::boundTree()
+/* Builds the tree of bounding circles if it has been cleared since it was
+ * last built. setlengths must have been called since the last insert.
  */
 {
-  double ret=0,subtarea;
-  int i,subtended,sz=endpoints.size();
-  for (i=0;i<lengths.size();i++)
+  if (!bcirTree.isValid(boundCircles.size()))
+    bcirTree.build(boundCircles);
+  return bcirTree;
+}
+
+double polyline::chordIn(xy point,int i)
+// Winding number of the chord of the ith piece around point.
+{
+  int subtended,sz=endpoints.size();
+  double subtarea,ret=0;
+  if (point!=endpoints[i] && point!=endpoints[(i+1)%sz])
   {
-    if (point!=endpoints[i] && point!=endpoints[(i+1)%sz])
+    subtended=foldangle(dir(point,endpoints[(i+1)%sz])-dir(point,endpoints[i]));
+    if (subtended==-DEG180)
     {
-      subtended=foldangle(dir(point,endpoints[(i+1)%sz])-dir(point,endpoints[i]));
-      if (subtended==-DEG180)
-      {
-        subtarea=area3(endpoints[(i+1)%sz],point,endpoints[i]);
-        if (subtarea>0)
-          subtended=DEG180;
-        if (subtarea==0)
-          subtended=0;
-      }
-      ret+=bintorot(subtended);
+      subtarea=area3(endpoints[(i+1)%sz],point,endpoints[i]);
+      if (subtarea>0)
+        subtended=DEG180;
+      if (subtarea==0)
+        subtended=0;
     }
+    ret=bintorot(subtended);
   }
   return ret;
 }
 
+double polyline::spanIn(xy point,int lo,int hi)
+/* Winding number of the pieces from lo to hi-1 around point, which is
+ * outside a circle enclosing them all, so it is the winding number of
+ * the chord from the start of lo to the end of hi-1. If point is on the
+ * chord, the tree has to look at the pieces.
+ */
+{
+  int subtended,sz=endpoints.size();
+  xy a=endpoints[lo],b=endpoints[hi%sz];
+  if (point==a || point==b)
+    return NAN;
+  subtended=foldangle(dir(point,b)-dir(point,a));
+  if (subtended==-DEG180)
+    return NAN;
+  return bintorot(subtended);
+}
+
+double polyline::in(xy point)
+/* Returns 1 if the polyline winds once counterclockwise around point.
+ * Returns 1/2 or -1/2 if point is on polyline's boundary, unless it
+ * is a corner, in which case it returns another fraction.
+ */
+{
+  double ret=0;
+  int i;
+  if (lengths.size()<BCIRTREE_MIN)
+    for (i=0;i<lengths.size();i++)
+      ret+=chordIn(point,i);
+  else
+    ret=boundTree().in(point,[&](int n){return chordIn(point,n);},
+		       [&](int lo,int hi){return spanIn(point,lo,hi);});
+  return ret;
+}
+
 double polyarc::in(xy point)
+/* Outside a piece's bounding circle, getarc(i).in(point) is 0, so the
+ * tree needs only the chords there.
+ */
 {
-  double ret=polyline::in(point);
+  double ret=0;
   int i;
-  for (i=0;i<lengths.size();i++)
-    ret+=getarc(i).in(point);
+  if (lengths.size()<BCIRTREE_MIN)
+    for (i=0;i<lengths.size();i++)
+      ret+=chordIn(point,i)+getarc(i).in(point);
+  else
+    ret=boundTree().in(point,[&](int n){return chordIn(point,n)+getarc(n).in(point);},
+		       [&](int lo,int hi){return spanIn(point,lo,hi);});
   return ret;
 }
 
 double polyspiral::in(xy point)
 {
-  double ret=polyline::in(point);
+  double ret=0;
   int i;
-  for (i=0;i<lengths.size();i++)
-    ret+=getspiralarc(i).in(point);
+  if (lengths.size()<BCIRTREE_MIN)
+    for (i=0;i<lengths.size();i++)
+      ret+=chordIn(point,i)+getspiralarc(i).in(point);
+  else
+    ret=boundTree().in(point,[&](int n){return chordIn(point,n)+getspiralarc(n).in(point);},
+		       [&](int lo,int hi){return spanIn(point,lo,hi);});
   return ret;
 }
 
@@ -606,24 +680,7 @@ double polyline::getCumLength(int i)
 
 int polyline::stationSegment(double along)
 {
-  int before=-1,after=cumLengths.size();
-  int middle,i=0;
-  double midalong;
-  while (before<after-1)
-  {
-    middle=(before+after+(i&1))/2;
-    if (middle>=cumLengths.size())
-      midalong=length();
-    else if (middle<0)
-      midalong=0;
-    else
-      midalong=cumLengths[middle];
-    if (midalong>along)
-      after=middle;
-    else
-      before=middle;
-    ++i;
-  }
+  int after=cumLengths.find(along);
   if (after==cumLengths.size() && after && along==cumLengths.back())
     after--; // station(length()) should return the endpoint, not NaN
   return after;
@@ -656,6 +713,100 @@ xyz polyspiral::station(double along)
     return getspiralarc(seg).station(along-(cumLengths[seg]-lengths[seg]));
 }
 
+vector<int> alongOrder(const double *alongs,int n)
+// Returns the indices of the alongs which are not NaN, sorted by along.
+{
+  vector<int> ret;
+  int i;
+  for (i=0;i<n;i++)
+    if (!std::isnan(alongs[i]))
+      ret.push_back(i);
+  sort(ret.begin(),ret.end(),[alongs](int a,int b){return alongs[a]<alongs[b];});
+  return ret;
+}
+
+vector<int> walkAlongs(const vector<double> &cum,const double *alongs,const vector<int> &order)
+/* For each along, in order, returns how many of cum are less than or equal to
+ * it, except that the end of the last piece counts as being in it, as in
+ * stationSegment. Since the alongs are sorted, this is one pass through cum.
+ */
+{
+  vector<int> ret;
+  int i,n=0;
+  double along;
+  for (i=0;i<order.size();i++)
+  {
+    along=alongs[order[i]];
+    while (n<cum.size() && cum[n]<=along)
+      n++;
+    if (n==cum.size() && n && along==cum.back())
+      ret.push_back(n-1);
+    else
+      ret.push_back(n);
+  }
+  return ret;
+}
+
+void polyline::pieceStations(int i,const double *alongs,xyz *out,int n)
+{
+  getsegment(i).stations(alongs,out,n);
+}
+
+void polyarc::pieceStations(int i,const double *alongs,xyz *out,int n)
+{
+  getarc(i).stations(alongs,out,n);
+}
+
+void polyspiral::pieceStations(int i,const double *alongs,xyz *out,int n)
+{
+  getspiralarc(i).stations(alongs,out,n);
+}
+
+void polyline::stations(const double *alongs,xyz *out,int n)
+/* Computes station(alongs[i]) into out[i] for n alongs, which need not be
+ * in order. The alongs are sorted and the pieces walked once, so that each
+ * piece is constructed only once, and all the stations on a piece are
+ * computed together.
+ *
+ * If there are few alongs on a long polyline, each is looked up in the tree
+ * in O(log n), rather than exporting all n cumulative lengths.
+ */
+{
+  vector<int> order=alongOrder(alongs,n);
+  vector<double> cum;
+  vector<int> segs;
+  vector<double> pieceAlongs;
+  vector<xyz> pieceOut;
+  int i,j,k,seg;
+  double start;
+  if (order.size()*log2(cumLengths.size()+1)<cumLengths.size())
+    for (i=0;i<order.size();i++)
+      segs.push_back(stationSegment(alongs[order[i]]));
+  else
+  {
+    cumLengths.prefixSums(cum);
+    segs=walkAlongs(cum,alongs,order);
+  }
+  for (i=0;i<n;i++)
+    out[i]=xyz(NAN,NAN,NAN);
+  for (i=0;i<order.size();i=j)
+  {
+    seg=segs[i];
+    for (j=i;j<order.size() && segs[j]==seg;j++);
+    if (seg<lengths.size())
+    {
+      start=(cum.size()?cum[seg]:cumLengths[seg])-lengths[seg];
+      pieceAlongs.clear();
+      for (k=i;k<j;k++)
+	pieceAlongs.push_back(alongs[order[k]]-start);
+      pieceOut.resize(j-i);
+      pieceStations(seg,&pieceAlongs[0],&pieceOut[0],j-i);
+      for (k=i;k<j;k++)
+	out[order[k]]=pieceOut[k-i];
+    }
+  }
+}
+
 int polyline::bearing(double along)
 {
   int seg=stationSegment(along);
@@ -686,6 +837,10 @@ int polyspiral::bearing(double along)
 double polyline::closest(xy topoint,bool offends)
 /* offends is currently ignored. It has to be true when calling segment::closest
  * because of angle points.
+ *
+ * A long polyline is searched with the tree of bounding circles, nearest
+ * circle first, which looks at O(log n) pieces unless many are about as far
+ * from topoint as the closest.
  */
 {
   int i,n,step,sz;
@@ -695,21 +850,32 @@ double polyline::closest(xy topoint,bool offends)
   double alo,ret;
   sz=lengths.size();
   step=relprime(sz);
-  for (i=n=0;i<sz;i++,n=(n+step)%sz)
-  {
-    if (dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
+  if (sz<BCIRTREE_MIN)
+    for (i=n=0;i<sz;i++,n=(n+step)%sz)
     {
-      si=getsegment(n);
-      alo=si.closest(topoint,closesofar,true);
-      sta=si.station(alo);
-      segclose=dist(sta,topoint);
-      if (segclose<closesofar)
+      if (dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
       {
-	closesofar=segclose;
-	ret=alo+(cumLengths[n]-lengths[n]);
+	si=getsegment(n);
+	alo=si.closest(topoint,closesofar,true);
+	sta=si.station(alo);
+	segclose=dist(sta,topoint);
+	if (segclose<closesofar)
+	{
+	  closesofar=segclose;
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	}
       }
     }
-  }
+  else
+    boundTree().closest(topoint,closesofar,[&](int n,double sofar)
+      {
+	si=getsegment(n);
+	alo=si.closest(topoint,sofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<sofar)
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	return segclose;
+      });
   return ret;
 }
 
@@ -722,21 +888,88 @@ double polyarc::closest(xy topoint,bool offends)
   double alo,ret;
   sz=lengths.size();
   step=relprime(sz);
-  for (i=n=0;i<sz;i++,n=(n+step)%sz)
-  {
-    if (dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
+  if (sz<BCIRTREE_MIN)
+    for (i=n=0;i<sz;i++,n=(n+step)%sz)
     {
-      si=getarc(n);
-      alo=si.closest(topoint,closesofar,true);
-      sta=si.station(alo);
-      segclose=dist(sta,topoint);
-      if (segclose<closesofar)
+      if (dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
       {
-	closesofar=segclose;
-	ret=alo+(cumLengths[n]-lengths[n]);
+	si=getarc(n);
+	alo=si.closest(topoint,closesofar,true);
+	sta=si.station(alo);
+	segclose=dist(sta,topoint);
+	if (segclose<closesofar)
+	{
+	  closesofar=segclose;
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	}
       }
     }
+  else
+    boundTree().closest(topoint,closesofar,[&](int n,double sofar)
+      {
+	si=getarc(n);
+	alo=si.closest(topoint,sofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<sofar)
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	return segclose;
+      });
+  return ret;
+}
+
+double polyarc::closestNear(xy topoint,int &piece)
+/* Like closest, but tries piece first. If piece was the closest on a polyarc
+ * that differs only a little from this one, as in curve fitting, it usually
+ * is again, and the bounding circles of most other pieces are too far to
+ * look at. On return, piece is the piece with the closest point.
+ *
+ * Several threads may call this at once, but only after boundTree is built.
+ */
+{
+  int i,n,step,sz,hint=piece;
+  double segclose,closesofar=INFINITY;
+  arc si;
+  double alo,ret=NAN;
+  sz=lengths.size();
+  if (piece>=0 && piece<sz)
+  {
+    si=getarc(piece);
+    alo=si.closest(topoint,closesofar,true);
+    closesofar=dist(si.station(alo),topoint);
+    ret=alo+(cumLengths[piece]-lengths[piece]);
   }
+  step=relprime(sz);
+  if (sz<BCIRTREE_MIN)
+    for (i=n=0;i<sz;i++,n=(n+step)%sz)
+    {
+      if (n!=hint && dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
+      {
+	si=getarc(n);
+	alo=si.closest(topoint,closesofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<closesofar)
+	{
+	  closesofar=segclose;
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	  piece=n;
+	}
+      }
+    }
+  else
+    boundTree().closest(topoint,closesofar,[&](int n,double sofar)
+      {
+	if (n==hint)
+	  return sofar;
+	si=getarc(n);
+	alo=si.closest(topoint,sofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<sofar)
+	{
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	  piece=n;
+	}
+	return segclose;
+      });
   return ret;
 }
 
@@ -749,21 +982,32 @@ double polyspiral::closest(xy topoint,bool offends)
   double alo,ret;
   sz=lengths.size();
   step=relprime(sz);
-  for (i=n=0;i<sz;i++,n=(n+step)%sz)
-  {
-    if (dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
+  if (sz<BCIRTREE_MIN)
+    for (i=n=0;i<sz;i++,n=(n+step)%sz)
     {
-      si=getspiralarc(n);
-      alo=si.closest(topoint,closesofar,true);
-      sta=si.station(alo);
-      segclose=dist(sta,topoint);
-      if (segclose<closesofar)
+      if (dist(boundCircles[n].center,topoint)-boundCircles[n].radius<closesofar)
       {
-	closesofar=segclose;
-	ret=alo+(cumLengths[n]-lengths[n]);
+	si=getspiralarc(n);
+	alo=si.closest(topoint,closesofar,true);
+	sta=si.station(alo);
+	segclose=dist(sta,topoint);
+	if (segclose<closesofar)
+	{
+	  closesofar=segclose;
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	}
       }
     }
-  }
+  else
+    boundTree().closest(topoint,closesofar,[&](int n,double sofar)
+      {
+	si=getspiralarc(n);
+	alo=si.closest(topoint,sofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<sofar)
+	  ret=alo+(cumLengths[n]-lengths[n]);
+	return segclose;
+      });
   return ret;
 }
 
@@ -824,12 +1068,18 @@ double polyline::dirbound(int angle,double boundsofar)
 {
   int i;
   double bound;
-  for (i=0;i<lengths.size();i++)
-  {
-    bound=getsegment(i).dirbound(angle,boundsofar);
-    if (bound<boundsofar)
-      boundsofar=bound;
-  }
+  if (lengths.size()<BCIRTREE_MIN)
+    for (i=0;i<lengths.size();i++)
+    {
+      bound=getsegment(i).dirbound(angle,boundsofar);
+      if (bound<boundsofar)
+	boundsofar=bound;
+    }
+  else
+    boundsofar=boundTree().dirbound(angle,boundsofar,[&](int n,double sofar)
+      {
+	return getsegment(n).dirbound(angle,sofar);
+      });
   return boundsofar;
 }
 
@@ -837,12 +1087,18 @@ double polyarc::dirbound(int angle,double boundsofar)
 {
   int i;
   double bound;
-  for (i=0;i<lengths.size();i++)
-  {
-    bound=getarc(i).dirbound(angle,boundsofar);
-    if (bound<boundsofar)
-      boundsofar=bound;
-  }
+  if (lengths.size()<BCIRTREE_MIN)
+    for (i=0;i<lengths.size();i++)
+    {
+      bound=getarc(i).dirbound(angle,boundsofar);
+      if (bound<boundsofar)
+	boundsofar=bound;
+    }
+  else
+    boundsofar=boundTree().dirbound(angle,boundsofar,[&](int n,double sofar)
+      {
+	return getarc(n).dirbound(angle,sofar);
+      });
   return boundsofar;
 }
 
@@ -850,12 +1106,18 @@ double polyspiral::dirbound(int angle,double boundsofar)
 {
   int i;
   double bound;
-  for (i=0;i<lengths.size();i++)
-  {
-    bound=getspiralarc(i).dirbound(angle,boundsofar);
-    if (bound<boundsofar)
-      boundsofar=bound;
-  }
+  if (lengths.size()<BCIRTREE_MIN)
+    for (i=0;i<lengths.size();i++)
+    {
+      bound=getspiralarc(i).dirbound(angle,boundsofar);
+      if (bound<boundsofar)
+	boundsofar=bound;
+    }
+  else
+    boundsofar=boundTree().dirbound(angle,boundsofar,[&](int n,double sofar)
+      {
+	return getspiralarc(n).dirbound(angle,sofar);
+      });
   return boundsofar;
 }
 
@@ -864,6 +1126,7 @@ void polyline::open()
   lengths.resize(endpoints.size()-1);
   cumLengths.resize(endpoints.size()-1);
   boundCircles.resize(endpoints.size()-1);
+  bcirTree.clear();
 }
 
 void polyarc::open()
@@ -872,6 +1135,7 @@ void polyarc::open()
   lengths.resize(endpoints.size()-1);
   cumLengths.resize(endpoints.size()-1);
   boundCircles.resize(endpoints.size()-1);
+  bcirTree.clear();
 }
 
 void polyspiral::open()
@@ -885,6 +1149,7 @@ void polyspiral::open()
   lengths.resize(endpoints.size()-1);
   cumLengths.resize(endpoints.size()-1);
   boundCircles.resize(endpoints.size()-1);
+  bcirTree.clear();
 }
 
 void polyline::close()
@@ -892,11 +1157,7 @@ void polyline::close()
   lengths.resize(endpoints.size());
   cumLengths.resize(endpoints.size());
   boundCircles.resize(endpoints.size());
-  if (lengths.size())
-    if (lengths.size()>1)
-      cumLengths[lengths.size()-1]=cumLengths[lengths.size()-2]+lengths[lengths.size()-1];
-    else
-      cumLengths[0]=lengths[0];
+  bcirTree.clear();
 }
 
 void polyarc::close()
@@ -905,11 +1166,7 @@ void polyarc::close()
   lengths.resize(endpoints.size());
   cumLengths.resize(endpoints.size());
   boundCircles.resize(endpoints.size());
-  if (lengths.size())
-    if (lengths.size()>1)
-      cumLengths[lengths.size()-1]=cumLengths[lengths.size()-2]+lengths[lengths.size()-1];
-    else
-      cumLengths[0]=lengths[0];
+  bcirTree.clear();
 }
 
 void polyspiral::close()
@@ -923,11 +1180,7 @@ void polyspiral::close()
   lengths.resize(endpoints.size());
   cumLengths.resize(endpoints.size());
   boundCircles.resize(endpoints.size());
-  if (lengths.size())
-    if (lengths.size()>1)
-      cumLengths[lengths.size()-1]=cumLengths[lengths.size()-2]+lengths[lengths.size()-1];
-    else
-      cumLengths[0]=lengths[0];
+  bcirTree.clear();
 }
 
 void polyspiral::insert(xy newpoint,int pos)
@@ -984,10 +1237,10 @@ void polyspiral::insert(xy newpoint,int pos)
   midbearings.insert(mbrit,0);
   curvatures.insert(crvit,0);
   clothances.insert(cloit,0);
-  lenit=cumLengths.begin()+pos;
-  cumLengths.insert(lenit,0);
+  cumLengths.insert(pos,1);
   bcit=boundCircles.begin()+pos;
   boundCircles.insert(bcit,{xy(0,0),0});
+  bcirTree.clear();
   pos=savepos;
   for (i=-1;i<2;i++)
     setbear((pos+i+endpoints.size())%endpoints.size());
@@ -1001,7 +1254,13 @@ void polyline::_roscat(xy tfrom,int ro,double sca,xy cis,xy tto)
   for (i=0;i<endpoints.size();i++)
     endpoints[i]._roscat(tfrom,ro,sca,cis,tto);
   for (i=0;i<lengths.size();i++)
+  {
     lengths[i]*=sca;
+    boundCircles[i].center._roscat(tfrom,ro,sca,cis,tto);
+    boundCircles[i].radius*=sca;
+  }
+  cumLengths.assign(lengths);
+  bcirTree.clear();
 }
 
 void polyspiral::_roscat(xy tfrom,int ro,double sca,xy cis,xy tto)
@@ -1015,11 +1274,15 @@ void polyspiral::_roscat(xy tfrom,int ro,double sca,xy cis,xy tto)
   for (i=0;i<lengths.size();i++)
   {
     lengths[i]*=sca;
-    cumLengths[i]*=sca;
     midbearings[i]+=ro;
+    midpoints[i]._roscat(tfrom,ro,sca,cis,tto);
     curvatures[i]/=sca;
     clothances[i]/=sqr(sca);
+    boundCircles[i].center._roscat(tfrom,ro,sca,cis,tto);
+    boundCircles[i].radius*=sca;
   }
+  cumLengths.assign(lengths);
+  bcirTree.clear();
 }
 
 void polyspiral::setbear(int i)
@@ -1093,6 +1356,9 @@ void polyspiral::setspiral(int i)
   deltas[i]=s.getdelta();
   delta2s[i]=s.getdelta2();
   lengths[i]=s.length();
+  cumLengths.set(i,lengths[i]);
+  boundCircles[i]=s.boundCircle();
+  bcirTree.clear();
   //if (std::isnan(lengths[i]))
     //cerr<<"length["<<i<<"]=nan"<<endl;
   midbearings[i]=s.bearing(lengths[i]/2);
@@ -1216,7 +1482,8 @@ void alignment::setVLength()
     vCumLengths.push_back(hCumLengths[0]);
   if (hCumLengths.size()>1 && vCumLengths.size()==1)
     vCumLengths.push_back(hCumLengths.back());
-  for (i=0;i<vCumLengths.size() && vCumLengths[i]<hCumLengths.back();i++);
+  // Appending changes only the end, so look from the end.
+  for (i=vCumLengths.size();i>0 && vCumLengths[i-1]>=hCumLengths.back();i--);
   newlast=i;
   if (newlast>=origsize)
     vCumLengths.push_back(hCumLengths.back());
@@ -1226,15 +1493,20 @@ void alignment::setVLength()
   controlPoints.resize(3*newlast+1);
 }
 
-void alignment::setlengths()
+void alignment::setlengths(double from)
 /* Sets cumLengths, which contains all elements of both vCumLengths and hCumLengths,
- * and sets lengths to the differences between them.
+ * and sets lengths to the differences between them. Only the stations at or
+ * after from are merged again; appending a curve passes the old end station,
+ * so that building an alignment of n curves doesn't take O(n²) time.
  */
 {
   int i,j;
-  cumLengths.clear();
-  lengths.clear();
-  for (i=j=0;i<hCumLengths.size() && j<vCumLengths.size();)
+  i=lower_bound(cumLengths.begin(),cumLengths.end(),from)-cumLengths.begin();
+  cumLengths.resize(i);
+  lengths.resize(i?i-1:0);
+  i=lower_bound(hCumLengths.begin(),hCumLengths.end(),from)-hCumLengths.begin();
+  j=lower_bound(vCumLengths.begin(),vCumLengths.end(),from)-vCumLengths.begin();
+  while (i<hCumLengths.size() && j<vCumLengths.size())
     if (hCumLengths[i]<vCumLengths[j])
       cumLengths.push_back(hCumLengths[i++]);
     else if (hCumLengths[i]==vCumLengths[j])
@@ -1244,7 +1516,7 @@ void alignment::setlengths()
     }
     else
       cumLengths.push_back(vCumLengths[j++]);
-  for (i=0;i<cumLengths.size()-1;i++)
+  for (i=lengths.size();i<(int)cumLengths.size()-1;i++)
     lengths.push_back(cumLengths[i+1]-cumLengths[i]);
 }
 
@@ -1272,6 +1544,7 @@ void alignment::clear()
   cumLengths.clear();
   controlPoints.clear();
   boundCircles.clear();
+  bcirTree.clear();
   hCumLengths.push_back(0);
   vCumLengths.push_back(0);
   cumLengths.push_back(0);
@@ -1309,6 +1582,7 @@ void alignment::appendPoint(xy pnt)
 {
   xy last;
   bcir boundCircle;
+  double oldEnd=hCumLengths.back();
   if (endpoints.size())
     last=endpoints.back();
   endpoints.push_back(pnt);
@@ -1319,14 +1593,17 @@ void alignment::appendPoint(xy pnt)
     delta2s.push_back(0);
     midbearings.push_back(dir(last,pnt));
     midpoints.push_back((last+pnt)/2);
+    curvatures.push_back(0);
+    clothances.push_back(0);
     hLengths.push_back(dist(last,pnt));
     hCumLengths.push_back(hCumLengths.back()+hLengths.back());
     boundCircle.center=midpoints.back();
     boundCircle.radius=hLengths.back()/2;
     boundCircles.push_back(boundCircle);
+    bcirTree.clear();
   }
   setVLength();
-  setlengths();
+  setlengths(oldEnd);
 }
 
 void alignment::prependPoint(xy pnt)
@@ -1343,11 +1620,14 @@ void alignment::prependPoint(xy pnt)
     delta2s.insert(delta2s.begin(),0);
     midbearings.insert(midbearings.begin(),dir(pnt,first));
     midpoints.insert(midpoints.begin(),(pnt+first)/2);
+    curvatures.insert(curvatures.begin(),0);
+    clothances.insert(clothances.begin(),0);
     hLengths.insert(hLengths.begin(),dist(pnt,first));
     hCumLengths.insert(hCumLengths.begin(),hCumLengths[0]-hLengths[0]);
     boundCircle.center=midpoints[0];
     boundCircle.radius=hLengths[0]/2;
     boundCircles.insert(boundCircles.begin(),boundCircle);
+    bcirTree.clear();
   }
   setVLength();
   setlengths();
@@ -1360,18 +1640,23 @@ void alignment::appendTangentCurve(double startCurvature,double length,double en
   int startBearing=bearing(along);
   spiralarc newSpiral(startPoint,startBearing,startCurvature,endCurvature,length,0);
   bcir boundCircle;
+  double oldEnd;
   appendPoint(newSpiral.getend());
   deltas.back()=newSpiral.getdelta();
   delta2s.back()=newSpiral.getdelta2();
   midbearings.back()=newSpiral.bearing(length/2);
   midpoints.back()=newSpiral.station(length/2);
+  curvatures.back()=newSpiral.curvature(length/2);
+  clothances.back()=newSpiral.clothance();
   hLengths.back()=length;
+  oldEnd=hCumLengths[hCumLengths.size()-2];
   hCumLengths.back()+=length-newSpiral.chordlength();
   boundCircle.center=midpoints.back();
   boundCircle.radius=length/2;
   boundCircles.back()=boundCircle;
+  bcirTree.clear();
   setVLength();
-  setlengths();
+  setlengths(oldEnd);
 }
 
 void alignment::prependTangentCurve(double startCurvature,double length,double endCurvature)
@@ -1386,11 +1671,14 @@ void alignment::prependTangentCurve(double startCurvature,double length,double e
   delta2s[0]=newSpiral.getdelta2();
   midbearings[0]=newSpiral.bearing(length/2)-DEG180;
   midpoints[0]=newSpiral.station(length/2);
+  curvatures[0]=-newSpiral.curvature(length/2);
+  clothances[0]=newSpiral.clothance();
   hLengths[0]=length;
   hCumLengths[0]-=length-newSpiral.chordlength();
   boundCircle.center=midpoints[0];
   boundCircle.radius=length/2;
   boundCircles[0]=boundCircle;
+  bcirTree.clear();
   setVLength();
   setlengths();
 }
@@ -1469,6 +1757,7 @@ void alignment::setHLengths()
   spiralarc seg;
   assert(hLengths.size()==hCumLengths.size()-1);
   assert(hLengths.size()==deltas.size());
+  bcirTree.clear();
   m+=hCumLengths[0];
   for (i=0;i<deltas.size();i++)
   {
@@ -1492,7 +1781,7 @@ void alignment::setHLengths()
 int alignment::xyStationSegment(double along)
 {
   int before=-1,after=hCumLengths.size();
-  int middle,i;
+  int middle,i=0;
   double midalong;
   while (before<after-1)
   {
@@ -1509,13 +1798,15 @@ int alignment::xyStationSegment(double along)
       before=middle;
     ++i;
   }
+  if (before==hCumLengths.size()-1 && before && along==hCumLengths.back())
+    before--; // xyStation(endStation()) should return the endpoint, not NaN
   return before; // Unlike polylines, hCumLengths and vCumLengths have an extra number at the beginning.
 }
 
 int alignment::zStationSegment(double along)
 {
   int before=-1,after=vCumLengths.size();
-  int middle,i;
+  int middle,i=0;
   double midalong;
   while (before<after-1)
   {
@@ -1532,6 +1823,8 @@ int alignment::zStationSegment(double along)
       before=middle;
     ++i;
   }
+  if (before==vCumLengths.size()-1 && before && along==vCumLengths.back())
+    before--;
   return before;
 }
 
@@ -1541,16 +1834,16 @@ xy alignment::xyStation(double along)
   if (seg<0 || seg>=hLengths.size())
     return xy(NAN,NAN);
   else
-    return getHorizontalCurve(seg).station(along-cumLengths[seg]);
+    return getHorizontalCurve(seg).station(along-hCumLengths[seg]);
 }
 
 double alignment::zStation(double along)
 {
   int seg=zStationSegment(along);
-  if (seg<0 || seg>=hLengths.size())
+  if (seg<0 || seg>=vLengths.size())
     return NAN;
   else
-    return getVerticalCurve(seg).station(along-cumLengths[seg]).elev();
+    return getVerticalCurve(seg).station(along-vCumLengths[seg]).elev();
 }
 
 xyz alignment::station(double along)
@@ -1558,22 +1851,66 @@ xyz alignment::station(double along)
   return xyz(xyStation(along),zStation(along));
 }
 
+void alignment::stations(const double *alongs,xyz *out,int n)
+/* Computes station(alongs[i]) into out[i] for n alongs in any order. The
+ * horizontal and vertical curves are each walked once.
+ */
+{
+  vector<int> order=alongOrder(alongs,n);
+  vector<int> hSegs=walkAlongs(hCumLengths,alongs,order);
+  vector<int> vSegs=walkAlongs(vCumLengths,alongs,order);
+  vector<double> pieceAlongs;
+  vector<xyz> pieceOut;
+  spiralarc hCurve;
+  segment vCurve;
+  int i,j,k,seg;
+  for (i=0;i<n;i++)
+    out[i]=xyz(NAN,NAN,NAN);
+  for (i=0;i<order.size();i=j)
+  {
+    seg=hSegs[i]-1; // hCumLengths has the start station at the beginning
+    for (j=i;j<order.size() && hSegs[j]==hSegs[i];j++);
+    if (seg>=0 && seg<hLengths.size())
+    {
+      pieceAlongs.clear();
+      for (k=i;k<j;k++)
+	pieceAlongs.push_back(alongs[order[k]]-hCumLengths[seg]);
+      pieceOut.resize(j-i);
+      hCurve=getHorizontalCurve(seg);
+      hCurve.stations(&pieceAlongs[0],&pieceOut[0],j-i);
+      for (k=i;k<j;k++)
+	out[order[k]]=xyz(xy(pieceOut[k-i]),NAN);
+    }
+  }
+  for (i=0;i<order.size();i=j)
+  {
+    seg=vSegs[i]-1;
+    for (j=i;j<order.size() && vSegs[j]==vSegs[i];j++);
+    if (seg>=0 && seg<vLengths.size())
+    {
+      vCurve=getVerticalCurve(seg);
+      for (k=i;k<j;k++)
+	out[order[k]]=xyz(xy(out[order[k]]),vCurve.elev(alongs[order[k]]-vCumLengths[seg]));
+    }
+  }
+}
+
 int alignment::bearing(double along)
 {
   int seg=xyStationSegment(along);
   if (seg<0 || seg>=hLengths.size())
     return 0;
   else
-    return getHorizontalCurve(seg).bearing(along-cumLengths[seg]);
+    return getHorizontalCurve(seg).bearing(along-hCumLengths[seg]);
 }
 
 double alignment::slope(double along)
 {
   int seg=zStationSegment(along);
-  if (seg<0 || seg>=hLengths.size())
+  if (seg<0 || seg>=vLengths.size())
     return NAN;
   else
-    return getVerticalCurve(seg).slope(along-cumLengths[seg]);
+    return getVerticalCurve(seg).slope(along-vCumLengths[seg]);
 }
 
 double alignment::curvature(double along)
@@ -1582,16 +1919,16 @@ double alignment::curvature(double along)
   if (seg<0 || seg>=hLengths.size())
     return NAN;
   else
-    return getHorizontalCurve(seg).curvature(along-cumLengths[seg]);
+    return getHorizontalCurve(seg).curvature(along-hCumLengths[seg]);
 }
 
 double alignment::accel(double along)
 {
   int seg=zStationSegment(along);
-  if (seg<0 || seg>=hLengths.size())
+  if (seg<0 || seg>=vLengths.size())
     return NAN;
   else
-    return getVerticalCurve(seg).accel(along-cumLengths[seg]);
+    return getVerticalCurve(seg).accel(along-vCumLengths[seg]);
 }
 
 double alignment::clothance(double along)
@@ -1606,8 +1943,70 @@ double alignment::clothance(double along)
 double alignment::jerk(double along)
 {
   int seg=zStationSegment(along);
-  if (seg<0 || seg>=hLengths.size())
+  if (seg<0 || seg>=vLengths.size())
     return NAN;
   else
     return getVerticalCurve(seg).jerk();
 }
+
+BcirTree &alignment::boundTree()
+{
+  if (!bcirTree.isValid(boundCircles.size()))
+    bcirTree.build(boundCircles);
+  return bcirTree;
+}
+
+double alignment::closest(xy topoint)
+/* Returns the station of the closest point on the horizontal curves to
+ * topoint. This is how survey shots are stationed against a road.
+ */
+{
+  int i;
+  double segclose,alo,ret=NAN,closesofar=INFINITY;
+  spiralarc si;
+  if (hLengths.size()<BCIRTREE_MIN)
+    for (i=0;i<hLengths.size();i++)
+    {
+      if (dist(boundCircles[i].center,topoint)-boundCircles[i].radius<closesofar)
+      {
+	si=getHorizontalCurve(i);
+	alo=si.closest(topoint,closesofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<closesofar)
+	{
+	  closesofar=segclose;
+	  ret=alo+hCumLengths[i];
+	}
+      }
+    }
+  else
+    boundTree().closest(topoint,closesofar,[&](int n,double sofar)
+      {
+	si=getHorizontalCurve(n);
+	alo=si.closest(topoint,sofar,true);
+	segclose=dist(si.station(alo),topoint);
+	if (segclose<sofar)
+	  ret=alo+hCumLengths[n];
+	return segclose;
+      });
+  return ret;
+}
+
+double alignment::dirbound(int angle,double boundsofar)
+{
+  int i;
+  double bound;
+  if (hLengths.size()<BCIRTREE_MIN)
+    for (i=0;i<hLengths.size();i++)
+    {
+      bound=getHorizontalCurve(i).dirbound(angle,boundsofar);
+      if (bound<boundsofar)
+	boundsofar=bound;
+    }
+  else
+    boundsofar=boundTree().dirbound(angle,boundsofar,[&](int n,double sofar)
+      {
+	return getHorizontalCurve(n).dirbound(angle,sofar);
+      });
+  return boundsofar;
+}
@@ -30,6 +30,8 @@
 #include "arc.h"
 #include "bezier3d.h"
 #include "spiral.h"
+#include "bcirtree.h"
+#include "lengthtree.h"
 
 extern int bendlimit;
 /* The maximum angle through which a segment of polyspiral can bend. If the bend
@@ -47,25 +49,33 @@ extern int bendlimit;
 int midarcdir(xy a,xy b,xy c);
 
 class polyspiral;
+class ManyArcCache;
 
 class polyline: public drawobj
 {
 protected:
   double elevation;
   std::vector<xy> endpoints;
-  std::vector<double> lengths,cumLengths;
+  std::vector<double> lengths;
+  LengthTree cumLengths;
   std::vector<bcir> boundCircles;
+  BcirTree bcirTree;
+  double chordIn(xy point,int i);
+  double spanIn(xy point,int lo,int hi);
+  virtual void pieceStations(int i,const double *alongs,xyz *out,int n);
 public:
   friend class polyarc;
   friend class polyspiral;
   polyline();
   explicit polyline(double e);
   virtual int type();
+  BcirTree &boundTree();
   double getElevation()
   {
     return elevation;
   }
   virtual unsigned hash();
+  virtual drawobj *clone();
   bool isopen();
   int size();
   segment getsegment(int i);
@@ -84,6 +94,7 @@ public:
   double getCumLength(int i);
   int stationSegment(double along);
   virtual xyz station(double along);
+  void stations(const double *alongs,xyz *out,int n);
   virtual int bearing(double along);
   virtual double closest(xy topoint,bool offends=false);
   virtual double area();
@@ -97,14 +108,16 @@ class polyarc: public polyline
 {
 protected:
   std::vector<int> deltas;
+  virtual void pieceStations(int i,const double *alongs,xyz *out,int n);
 public:
   friend class polyspiral;
   polyarc();
   explicit polyarc(double e);
   polyarc(polyline &p);
-  polyarc(polyspiral &r,double toler);
+  polyarc(polyspiral &r,double toler,ManyArcCache *cache=nullptr);
   virtual int type();
   virtual unsigned hash();
+  virtual drawobj *clone();
   arc getarc(int i);
   virtual bezier3d approx3d(double precision);
   virtual void insert(xy newpoint,int pos=-1);
@@ -116,6 +129,7 @@ public:
   virtual xyz station(double along);
   virtual int bearing(double along);
   virtual double closest(xy topoint,bool offends=false);
+  double closestNear(xy topoint,int &piece);
   virtual double area();
   virtual double dirbound(int angle,double boundsofar=INFINITY);
   virtual void writeXml(std::ofstream &ofile);
@@ -130,6 +144,7 @@ protected:
   std::vector<xy> midpoints;
   std::vector<double> clothances,curvatures;
   bool curvy;
+  virtual void pieceStations(int i,const double *alongs,xyz *out,int n);
 public:
   friend class polyarc;
   polyspiral();
@@ -137,6 +152,7 @@ public:
   polyspiral(polyline &p);
   virtual int type();
   virtual unsigned hash();
+  virtual drawobj *clone();
   spiralarc getspiralarc(int i);
   virtual bezier3d approx3d(double precision);
   virtual void insert(xy newpoint,int pos=-1);
@@ -180,11 +196,13 @@ protected:
   std::vector<double> clothances,curvatures;
   std::vector<double> hLengths,hCumLengths;
   std::vector<bcir> boundCircles;
+  BcirTree bcirTree;
   std::vector<double> vLengths,vCumLengths;
   std::vector<double> controlPoints;
   std::vector<double> lengths,cumLengths;
+  BcirTree &boundTree();
   void setVLength();
-  void setlengths();
+  void setlengths(double from=-INFINITY);
   int xyStationSegment(double along);
   int zStationSegment(double along);
 public:
@@ -207,12 +225,15 @@ public:
   xy xyStation(double along);
   double zStation(double along);
   xyz station(double along);
+  void stations(const double *alongs,xyz *out,int n);
   int bearing(double along);
   double slope(double along);
   double curvature(double along);
   double accel(double along);
   double clothance(double along);
   double jerk(double along);
+  double closest(xy topoint);
+  virtual double dirbound(int angle,double boundsofar=INFINITY);
 };
 
 #endif
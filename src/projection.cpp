@@ -85,6 +85,11 @@ g1boundary Projection::getBoundary()
   return spherize(flatBdy);
 }
 
+polyarc Projection::getFlatBoundary()
+{
+  return flatBdy;
+}
+
 void Projection::setFoot(int which)
 /* Sets the foot (international, US survey, or Indian survey)
  * used in this projection.
@@ -1137,28 +1142,167 @@ void ProjectionList::insert(ProjectionLabel label,Projection *proj)
  */
 {
   projList[label]=shared_ptr<Projection>(proj);
+  reindex();
+  cellInside.clear();
+  cellCrossing.clear();
 }
 
-Projection *ProjectionList::operator[](int n)
+void ProjectionList::reindex()
+// Copies the map into vectors so that the nth projection can be found at once.
 {
-  Projection *ret=nullptr;
   map<ProjectionLabel,shared_ptr<Projection> >::iterator i;
-  int j;
-  for (i=projList.begin(),j=0;i!=projList.end();i++,j++)
-    if (j==n)
-      ret=i->second.get();
-  return ret;
+  labels.clear();
+  projs.clear();
+  for (i=projList.begin();i!=projList.end();i++)
+  {
+    labels.push_back(i->first);
+    projs.push_back(i->second);
+  }
+}
+
+int projCell(vball v)
+{
+  int x,y;
+  x=floor((v.x+1)*PROJ_CELL_SIDE/2);
+  y=floor((v.y+1)*PROJ_CELL_SIDE/2);
+  if (x<0)
+    x=0;
+  if (x>=PROJ_CELL_SIDE)
+    x=PROJ_CELL_SIDE-1;
+  if (y<0)
+    y=0;
+  if (y>=PROJ_CELL_SIDE)
+    y=PROJ_CELL_SIDE-1;
+  return ((v.face-1)*PROJ_CELL_SIDE+y)*PROJ_CELL_SIDE+x;
+}
+
+vball projCellCenter(int face,int x,int y)
+{
+  return vball(face,xy((2*x+1.)/PROJ_CELL_SIDE-1,(2*y+1.)/PROJ_CELL_SIDE-1));
+}
+
+void ProjectionList::buildCells()
+/* The boundary of each projection is followed in steps of an eighth of a
+ * cell, and the cells around each step are marked as crossed. Any other
+ * cell is wholly inside or outside, and so is any group of such cells
+ * connected on a face, so only one center in each group is tested. A face
+ * is not enough: if a zone straddles the edge of a face, the boundary on
+ * the other face can cut off a strip along the edge.
+ *
+ * The walk is along the flattened boundary, which Projection::in tests
+ * against, not along great circles between the vertices, from which a long
+ * edge can stray by more than a cell. The step in the plane is multiplied by
+ * the stereographic scale factor so that it's the same angle on the sphere.
+ * A neighbor beyond the edge of a face is found on the next face.
+ */
+{
+  int i,k,x,y,dx,dy,cell,ncell;
+  const int ncells=6*PROJ_CELL_SIDE*PROJ_CELL_SIDE;
+  double step=M_PI/2/PROJ_CELL_SIDE/8,por=sphereStereoArabianSea.ellip->getpor();
+  double along,len;
+  bool last;
+  char inOut;
+  vector<char> marked; // 0 not yet known, 1 crossed, 2 inside, 3 outside
+  vector<int> group;
+  polyarc flat;
+  arc side;
+  xy pnt;
+  vball v;
+  cellInside.clear();
+  cellCrossing.clear();
+  cellInside.resize(ncells);
+  cellCrossing.resize(ncells);
+  for (k=0;k<projs.size();k++)
+  {
+    flat=projs[k]->getFlatBoundary();
+    if (flat.size()==0)
+    {
+      for (cell=0;cell<ncells;cell++)
+	cellCrossing[cell].push_back(k);
+      continue;
+    }
+    marked.assign(ncells,0);
+    for (i=0;i<flat.size();i++)
+    {
+      side=flat.getarc(i);
+      len=side.length();
+      for (along=0,last=false;!last;along+=step*por*sphereStereoArabianSea.scaleFactor(pnt))
+      {
+	if (along>=len)
+	{
+	  along=len;
+	  last=true;
+	}
+	pnt=side.station(along);
+	v=encodedir(sphereStereoArabianSea.gridToGeocentric(pnt));
+	cell=projCell(v);
+	x=cell%PROJ_CELL_SIDE;
+	y=cell/PROJ_CELL_SIDE%PROJ_CELL_SIDE;
+	for (dx=-1;dx<2;dx++)
+	  for (dy=-1;dy<2;dy++)
+	    if (x+dx>=0 && x+dx<PROJ_CELL_SIDE && y+dy>=0 && y+dy<PROJ_CELL_SIDE)
+	      marked[cell+dy*PROJ_CELL_SIDE+dx]=1;
+	    else // The center of a cell off the face is a point on the next face.
+	      marked[projCell(encodedir(decodedir(projCellCenter(v.face,x+dx,y+dy))))]=1;
+      }
+    }
+    for (cell=0;cell<ncells;cell++)
+      if (marked[cell]==0)
+      {
+	inOut=projs[k]->in(projCellCenter(cell/PROJ_CELL_SIDE/PROJ_CELL_SIDE+1,
+	  cell%PROJ_CELL_SIDE,cell/PROJ_CELL_SIDE%PROJ_CELL_SIDE))?2:3;
+	marked[cell]=inOut;
+	group.push_back(cell);
+	while (group.size())
+	{
+	  ncell=group.back();
+	  group.pop_back();
+	  x=ncell%PROJ_CELL_SIDE;
+	  y=ncell/PROJ_CELL_SIDE%PROJ_CELL_SIDE;
+	  if (x>0 && marked[ncell-1]==0)
+	  {
+	    marked[ncell-1]=inOut;
+	    group.push_back(ncell-1);
+	  }
+	  if (x<PROJ_CELL_SIDE-1 && marked[ncell+1]==0)
+	  {
+	    marked[ncell+1]=inOut;
+	    group.push_back(ncell+1);
+	  }
+	  if (y>0 && marked[ncell-PROJ_CELL_SIDE]==0)
+	  {
+	    marked[ncell-PROJ_CELL_SIDE]=inOut;
+	    group.push_back(ncell-PROJ_CELL_SIDE);
+	  }
+	  if (y<PROJ_CELL_SIDE-1 && marked[ncell+PROJ_CELL_SIDE]==0)
+	  {
+	    marked[ncell+PROJ_CELL_SIDE]=inOut;
+	    group.push_back(ncell+PROJ_CELL_SIDE);
+	  }
+	}
+      }
+    for (cell=0;cell<ncells;cell++)
+      if (marked[cell]==1)
+	cellCrossing[cell].push_back(k);
+      else if (marked[cell]==2)
+	cellInside[cell].push_back(k);
+  }
+}
+
+Projection *ProjectionList::operator[](int n)
+{
+  if (n>=0 && n<projs.size())
+    return projs[n].get();
+  else
+    return nullptr;
 }
 
 ProjectionLabel ProjectionList::nthLabel(int n)
 {
-  ProjectionLabel ret;
-  map<ProjectionLabel,shared_ptr<Projection> >::iterator i;
-  int j;
-  for (i=projList.begin(),j=0;i!=projList.end();i++,j++)
-    if (j==n)
-      ret=i->first;
-  return ret;
+  if (n>=0 && n<labels.size())
+    return labels[n];
+  else
+    return ProjectionLabel();
 }
 
 ProjectionList ProjectionList::matches(ProjectionLabel pattern)
@@ -1168,6 +1312,7 @@ ProjectionList ProjectionList::matches(ProjectionLabel pattern)
   for (i=projList.begin();i!=projList.end();i++)
     if (pattern.match(i->first))
       ret.projList[i->first]=i->second;
+  ret.reindex();
   return ret;
 }
 
@@ -1176,9 +1321,21 @@ ProjectionList ProjectionList::cover(latlong ll)
 {
   ProjectionList ret;
   map<ProjectionLabel,shared_ptr<Projection> >::iterator i;
-  for (i=projList.begin();i!=projList.end();i++)
-    if (i->second->in(ll))
-      ret.projList[i->first]=i->second;
+  int j,cell;
+  if (cellInside.size())
+  {
+    cell=projCell(encodedir(Sphere.geoc(ll,0)));
+    for (j=0;j<cellInside[cell].size();j++)
+      ret.projList[labels[cellInside[cell][j]]]=projs[cellInside[cell][j]];
+    for (j=0;j<cellCrossing[cell].size();j++)
+      if (projs[cellCrossing[cell][j]]->in(ll))
+	ret.projList[labels[cellCrossing[cell][j]]]=projs[cellCrossing[cell][j]];
+  }
+  else
+    for (i=projList.begin();i!=projList.end();i++)
+      if (i->second->in(ll))
+	ret.projList[i->first]=i->second;
+  ret.reindex();
   return ret;
 }
 
@@ -1186,9 +1343,21 @@ ProjectionList ProjectionList::cover(vball v)
 {
   ProjectionList ret;
   map<ProjectionLabel,shared_ptr<Projection> >::iterator i;
-  for (i=projList.begin();i!=projList.end();i++)
-    if (i->second->in(v))
-      ret.projList[i->first]=i->second;
+  int j,cell;
+  if (cellInside.size() && v.face>0 && v.face<7)
+  {
+    cell=projCell(v);
+    for (j=0;j<cellInside[cell].size();j++)
+      ret.projList[labels[cellInside[cell][j]]]=projs[cellInside[cell][j]];
+    for (j=0;j<cellCrossing[cell].size();j++)
+      if (projs[cellCrossing[cell][j]]->in(v))
+	ret.projList[labels[cellCrossing[cell][j]]]=projs[cellCrossing[cell][j]];
+  }
+  else
+    for (i=projList.begin();i!=projList.end();i++)
+      if (i->second->in(v))
+	ret.projList[i->first]=i->second;
+  ret.reindex();
   return ret;
 }
 
@@ -1201,8 +1370,10 @@ void ProjectionList::readFile(istream &file)
     label=readProjectionLabel(file);
     proj=readProjection(file);
     if (proj)
-      insert(label,proj);
+      projList[label]=shared_ptr<Projection>(proj);
   }
+  reindex();
+  buildCells();
 }
 
 vector<string> setToVector(set<string> s)
@@ -82,6 +82,7 @@ public:
   ellipsoid *ellip;
   void setBoundary(g1boundary boundary);
   g1boundary getBoundary();
+  polyarc getFlatBoundary(); // in sphereStereoArabianSea
   void setFoot(int which); // see measure.h
   int getFoot();
   bool in(xyz geoc); // geoc is on the sphere
@@ -244,10 +245,25 @@ public:
 ProjectionLabel readProjectionLabel(std::istream &file);
 Projection *readProjection(std::istream &file);
 
+#define PROJ_CELL_SIDE 64
+/* Each face of the cube is divided into PROJ_CELL_SIDE² cells, about 1.4°
+ * across, for looking up which projections cover a point.
+ */
+
 class ProjectionList
 {
 private:
   std::map<ProjectionLabel,std::shared_ptr<Projection> > projList;
+  std::vector<ProjectionLabel> labels; // in the same order as projList
+  std::vector<std::shared_ptr<Projection> > projs;
+  std::vector<std::vector<int> > cellInside,cellCrossing;
+  /* cellInside lists, by index into projs, the projections that contain the
+   * whole cell; cellCrossing lists those whose boundaries may pass through
+   * the cell. A projection in neither doesn't touch the cell. Empty unless
+   * built by readFile.
+   */
+  void reindex();
+  void buildCells();
 public:
   void insert(ProjectionLabel label,Projection *proj);
   int size()
@@ -372,3 +372,25 @@ set<triangle *> qindex::localTriangles(xy center,double radius,int max)
     list.insert(tri);
   return list;
 }
+
+bool qindex::localTriangles(xy center,double radius,int max,vector<triangle *> &list)
+/* Same as above, but appends the triangles to list, which may then contain
+ * duplicates, and counts leaves rather than distinct triangles. Returns false
+ * if there are more than max, in which case list is incomplete.
+ */
+{
+  int i;
+  bool ret=true;
+  if (sub[3])
+  {
+    if (dist(middle(),center)<=radius+side/M_SQRT2)
+      for (i=0;ret && i<4;i++)
+	ret=sub[i]->localTriangles(center,radius,max,list);
+  }
+  else if (tri && dist(middle(),center)<=radius)
+  {
+    list.push_back(tri);
+    ret=list.size()<=max;
+  }
+  return ret;
+}
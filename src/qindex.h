@@ -60,6 +60,7 @@ public:
   std::vector<qindex*> traverse(int dir=0);
   void settri(triangle *starttri);
   std::set<triangle *> localTriangles(xy center,double radius,int max);
+  bool localTriangles(xy center,double radius,int max,std::vector<triangle *> &list);
   qindex();
   ~qindex();
   int size(); // This returns the total number of nodes, which is 4n+1. The number of leaves is 3n+1.
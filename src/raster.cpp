@@ -198,7 +198,8 @@ void drawglobecube(int side,double zscale,double zmid,geoid *source,int imagetyp
   string pixel;
   double x,y,z,max,min;
   xyz sphloc;
-  vball v;
+  vector<vball> v(4*side);
+  vector<double> sx(4*side),sy(4*side),sz(4*side);
   //hvec bend,dir,center,lastcenter,jump;
   char letter;
   max=-INFINITY;
@@ -212,10 +213,14 @@ void drawglobecube(int side,double zscale,double zmid,geoid *source,int imagetyp
     {
       x=(((j%side)+0.5)/side)*2-1;
       panel=(i/side)*4+(j/side);
-      v=foldcube(panel,x,y);
-      if (v.face)
+      v[j]=foldcube(panel,x,y);
+    }
+    decodedirs(&v[0],&sx[0],&sy[0],&sz[0],4*side);
+    for (j=0;j<4*side;j++)
+    {
+      if (v[j].face)
       {
-	sphloc=decodedir(v);
+	sphloc=xyz(sx[j],sy[j],sz[j]);
 	if (source)
 	{
 	  z=source->elev(sphloc);
@@ -253,7 +258,8 @@ void drawglobemicro(int side,xy center,double size,int source,int imagetype,stri
   string pixel;
   double x,y,z,max,min,zmid,zscale;
   xyz sphloc;
-  vball v;
+  vector<vball> v(side>16?side:16);
+  vector<double> sx(v.size()),sy(v.size()),sz(v.size());
   char letter;
   max=-INFINITY;
   min=INFINITY;
@@ -266,10 +272,14 @@ void drawglobemicro(int side,xy center,double size,int source,int imagetype,stri
     {
       x=(((j+0.5)/16)*2-1)*size+center.getx();
       panel=floor(y)*4+floor(x);
-      v=foldcube(panel,(x-floor(x))*2-1,(floor(y)-y)*2+1);
-      if (v.face)
+      v[j]=foldcube(panel,(x-floor(x))*2-1,(floor(y)-y)*2+1);
+    }
+    decodedirs(&v[0],&sx[0],&sy[0],&sz[0],16);
+    for (j=0;j<16;j++)
+    {
+      if (v[j].face)
       {
-	sphloc=decodedir(v);
+	sphloc=xyz(sx[j],sy[j],sz[j]);
 	if (source)
 	{
 	  z=0;
@@ -296,10 +306,14 @@ void drawglobemicro(int side,xy center,double size,int source,int imagetype,stri
     {
       x=(((j+0.5)/side)*2-1)*size+center.getx();
       panel=floor(y)*4+floor(x);
-      v=foldcube(panel,(x-floor(x))*2-1,(floor(y)-y)*2+1);
-      if (v.face)
+      v[j]=foldcube(panel,(x-floor(x))*2-1,(floor(y)-y)*2+1);
+    }
+    decodedirs(&v[0],&sx[0],&sy[0],&sz[0],side);
+    for (j=0;j<side;j++)
+    {
+      if (v[j].face)
       {
-	sphloc=decodedir(v);
+	sphloc=xyz(sx[j],sy[j],sz[j]);
 	if (source)
 	{
 	  z=0;
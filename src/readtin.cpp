@@ -27,6 +27,7 @@
 #include "ptin.h"
 #include "tintext.h"
 #include "carlsontin.h"
+#include "cancel.h"
 
 using namespace std;
 
@@ -74,6 +75,7 @@ int readTinFile(pointlist &pl,string fileName,double unit)
       status=0;
     }
   }
+  checkCancel(); // Each format is tried in a try block which would swallow it.
   if (status==0)
   {
     ptinHeader=readPtin(fileName,pl);
@@ -91,6 +93,7 @@ int readTinFile(pointlist &pl,string fileName,double unit)
     pl.makeqindex();
     status=2;
   }
+  checkCancel();
   if (status==0)
   {
     status=readCarlsonTin(fileName,pl,unit);
@@ -116,6 +119,7 @@ int readTinFile(pointlist &pl,string fileName,double unit)
       status=0;
     }
   }
+  checkCancel();
   if (status==0)
   {
     try
@@ -148,6 +152,7 @@ int readTinFile(pointlist &pl,string fileName,double unit)
       status=0;
     }
   }
+  checkCancel();
   if (status==0 && anytin)
     status=1;
   return status;
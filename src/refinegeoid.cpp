@@ -37,6 +37,7 @@ manysum dataArea,totalArea;
 time_t progressTime;
 int avgelev_interrocount=0,avgelev_refinecount=0;
 histogram correctionHist(1,2);
+const int interroBlock=256;
 
 void outProgress()
 {
@@ -87,10 +88,10 @@ void progress(geoquad &quad)
 void interroquad(geoquad &quad,double spacing)
 {
   xyz corner(3678298.565,3678298.565,3678298.565),ctr,xvec,yvec,tmp,pt;
-  vball v;
+  vball v,bv[interroBlock];
   hvec h;
-  int radius,i,n,rp;
-  double qlen,hradius;
+  int radius,i,j,n,rp,blocksz;
+  double qlen,hradius,bx[interroBlock],by[interroBlock],bz[interroBlock];
   ctr=quad.centeronearth();
   xvec=corner*ctr;
   yvec=xvec*ctr;
@@ -120,22 +121,38 @@ void interroquad(geoquad &quad,double spacing)
   xvec*=spacing;
   yvec*=spacing;
   rp=relprime(hlat.nelts);
-  for (i=n=0;i<hlat.nelts && !(quad.nums.size() && quad.nans.size());i++)
+  /* The lattice points are converted to and from vball a block at a time.
+   * The block after the one in which the loop stops is not computed; the
+   * rest of the block is wasted, but that's small next to avgelev.
+   */
+  for (i=n=0;i<hlat.nelts && !(quad.nums.size() && quad.nans.size());)
   {
-    h=hlat.nthhvec(n);
-    v=encodedir(ctr+h.getx()*xvec+h.gety()*yvec);
-    pt=decodedir(v);
-    if (quad.in(v))
+    blocksz=min(interroBlock,hlat.nelts-i);
+    for (j=0;j<blocksz;j++)
+    {
+      h=hlat.nthhvec(n);
+      pt=ctr+h.getx()*xvec+h.gety()*yvec;
+      bx[j]=pt.getx();
+      by[j]=pt.gety();
+      bz[j]=pt.getz();
+      n-=rp;
+      if (n<0)
+	n+=hlat.nelts;
+    }
+    encodedirs(bx,by,bz,bv,blocksz);
+    decodedirs(bv,bx,by,bz,blocksz);
+    for (j=0;j<blocksz && !(quad.nums.size() && quad.nans.size());j++,i++)
     {
-      if (std::isfinite(avgelev(pt)))
-	quad.nums.push_back(v.getxy());
-      else
-	quad.nans.push_back(v.getxy());
-      avgelev_interrocount++;
+      v=bv[j];
+      if (quad.in(v))
+      {
+	if (std::isfinite(avgelev(xyz(bx[j],by[j],bz[j]))))
+	  quad.nums.push_back(v.getxy());
+	else
+	  quad.nans.push_back(v.getxy());
+	avgelev_interrocount++;
+      }
     }
-    n-=rp;
-    if (n<0)
-      n+=hlat.nelts;
   }
 }
 
@@ -21,12 +21,169 @@
  * and Lesser General Public License along with Bezitopo. If not, see
  * <http://www.gnu.org/licenses/>.
  */
+#include <cmath>
+#include <algorithm>
 #include "rendercache.h"
 using namespace std;
 
+RenderStats::RenderStats()
+{
+  paintTime=renderTime=pathTime=strokeTime=0;
+  nItems=syncRenders=aheadHits=queued=0;
+}
+
+RenderCache::RenderCache()
+{
+  generation=running=0;
+  stopping=prerenderUnfinished=false;
+  next=renderMap.end();
+  prerenderFrom=nullptr;
+}
+
+RenderCache::~RenderCache()
+{
+  stopThreads();
+}
+
+void RenderCache::startThreads(function<void()> doneCallback,int n)
+/* Starts n worker threads, by default one fewer than the number of cores,
+ * leaving one for the GUI. doneCallback is called in a worker thread when
+ * a rerendering for the displayed scale is ready, and should cause a repaint.
+ */
+{
+  int i;
+  if (n<=0)
+    n=thread::hardware_concurrency()-1;
+  if (n<1)
+    n=1;
+  onDone=doneCallback;
+  stopping=false;
+  for (i=0;i<n;i++)
+    workers.push_back(thread(&RenderCache::workerLoop,this));
+}
+
+void RenderCache::stopThreads()
+{
+  int i;
+  jobMutex.lock();
+  stopping=true;
+  jobQueue.clear();
+  jobsPending.clear();
+  jobCond.notify_all();
+  jobMutex.unlock();
+  for (i=0;i<workers.size();i++)
+    workers[i].join();
+  workers.clear();
+}
+
+void RenderCache::workerLoop()
+{
+  RenderJob job;
+  bool notify;
+  int i;
+  unique_lock<mutex> lock(jobMutex);
+  while (true)
+  {
+    jobCond.wait(lock,[this]{return stopping || jobQueue.size();});
+    if (stopping)
+      break;
+    job=jobQueue.front();
+    jobQueue.pop_front();
+    running++;
+    lock.unlock();
+    job.renderings.resize(job.pixelScales.size());
+    for (i=0;i<job.pixelScales.size();i++)
+      job.renderings[i]=job.copy->render3d(job.pixelScales[i],job.layr,job.colr,job.thik,job.ltype);
+    job.copy.reset();
+    lock.lock();
+    running--;
+    for (i=0;i<job.pixelScales.size();i++)
+      jobsPending.erase(make_pair(job.obj,job.pixelScales[i]));
+    notify=false;
+    if (job.generation==generation)
+    {
+      jobsDone.push_back(job);
+      notify=job.current && (jobQueue.empty() || !jobQueue.front().current);
+      /* When the queue runs dry before prerendering is done, a paint
+       * queues the next batch.
+       */
+      if (jobQueue.empty() && running==0 && prerenderUnfinished)
+      {
+	prerenderUnfinished=false;
+	notify=true;
+      }
+    }
+    if (notify && onDone)
+    {
+      lock.unlock();
+      onDone();
+      lock.lock();
+    }
+  }
+}
+
+bool RenderCache::queueJob(drawobj *obj,RenderItem &item,vector<double> pixelScales,bool current)
+/* Returns false if the object can't be rendered in the background.
+ * Renderings for the displayed scale go ahead of prerenderings. The scales
+ * are reserved in jobsPending while the object is cloned, which is done
+ * without holding the lock so that the workers aren't held up.
+ */
+{
+  RenderJob job;
+  vector<double> scales;
+  int i,gen;
+  bool ret=workers.size()>0;
+  if (ret)
+  {
+    {
+      lock_guard<mutex> lock(jobMutex);
+      for (i=0;i<pixelScales.size();i++)
+	if (jobsPending.insert(make_pair(obj,pixelScales[i])).second)
+	  scales.push_back(pixelScales[i]);
+      gen=generation;
+    }
+    if (scales.size())
+    {
+      job.copy=shared_ptr<drawobj>(obj->clone());
+      ret=job.copy!=nullptr;
+      lock_guard<mutex> lock(jobMutex);
+      if (ret && gen==generation)
+      {
+	job.obj=obj;
+	job.hash=item.hash;
+	job.generation=generation;
+	job.pixelScales=scales;
+	job.layr=item.layr;
+	job.colr=item.colr;
+	job.thik=item.thik;
+	job.ltype=item.ltype;
+	job.current=current;
+	if (current)
+	  jobQueue.push_front(job);
+	else
+	  jobQueue.push_back(job);
+	jobCond.notify_one();
+      }
+      else if (gen==generation)
+	for (i=0;i<scales.size();i++)
+	  jobsPending.erase(make_pair(obj,scales[i]));
+    }
+  }
+  return ret;
+}
+
 void RenderCache::clear()
 {
+  jobMutex.lock();
+  generation++;
+  jobQueue.clear();
+  jobsPending.clear();
+  jobsDone.clear();
+  prerenderUnfinished=false;
+  jobMutex.unlock();
   renderMap.clear();
+  next=renderMap.end();
+  prerenderFrom=nullptr;
 }
 
 void RenderCache::clearPresent()
@@ -38,6 +195,8 @@ void RenderCache::clearPresent()
   nsteps=rng.ucrandom();
   for (j=0;j<nsteps;j++)
     subrand.scalar(1);
+  stats.syncRenders=stats.aheadHits=0;
+  collectDone();
 }
 
 void RenderCache::deleteAbsent()
@@ -51,6 +210,34 @@ void RenderCache::deleteAbsent()
   for (j=0;j<delenda.size();j++)
     renderMap.erase(delenda[j]);
   next=renderMap.begin();
+  stats.nItems=renderMap.size();
+  stats.queued=jobsQueued();
+}
+
+void RenderCache::collectDone()
+/* Swaps in the renderings finished by the worker threads. Runs in the GUI
+ * thread, so painting never sees a half-finished rendering.
+ */
+{
+  vector<RenderJob> done;
+  map<drawobj *,RenderItem>::iterator item;
+  int i,j;
+  jobMutex.lock();
+  swap(done,jobsDone);
+  jobMutex.unlock();
+  for (i=0;i<done.size();i++)
+  {
+    item=renderMap.find(done[i].obj);
+    if (item!=renderMap.end() && item->second.hash==done[i].hash)
+      if (done[i].current)
+      {
+	item->second.rendering.swap(done[i].renderings[0]);
+	item->second.pixelScale=done[i].pixelScales[0];
+      }
+      else
+	for (j=0;j<done[i].pixelScales.size();j++)
+	  item->second.ahead[done[i].pixelScales[j]].swap(done[i].renderings[j]);
+  }
 }
 
 bool RenderCache::shouldRerender(double oldScale,double newScale)
@@ -63,22 +250,96 @@ bool RenderCache::shouldRerender(double oldScale,double newScale)
 void RenderCache::checkInObject(drawobj *obj,double pixelScale,int layr,int colr,int thik,int ltype)
 {
   unsigned objHash;
-  if (!renderMap.count(obj))
-    renderMap[obj].pixelScale=INFINITY;
-  renderMap[obj].colr=colr;
-  renderMap[obj].thik=thik;
-  renderMap[obj].ltype=ltype;
-  renderMap[obj].present=true;
+  map<double,vector<drawingElement> >::iterator a;
+  vector<drawingElement> old;
+  bool isNew=!renderMap.count(obj);
+  RenderItem &item=renderMap[obj];
+  if (isNew)
+    item.pixelScale=INFINITY;
+  item.colr=colr;
+  item.thik=thik;
+  item.ltype=ltype;
+  item.layr=layr;
+  item.present=true;
   objHash=obj->hash(); // Computing the hash of a large polyspiral takes 1/20 as much time as rendering it.
-  if (shouldRerender(renderMap[obj].pixelScale,pixelScale) ||
-      objHash!=renderMap[obj].hash)
+  if (isNew || objHash!=item.hash)
+  { // A new or changed object has no usable rendering, so render it now.
+    item.ahead.clear();
+    item.rendering=obj->render3d(pixelScale,layr,colr,thik,ltype);
+    item.pixelScale=pixelScale;
+    item.hash=objHash;
+    stats.syncRenders++;
+  }
+  else if (pixelScale!=item.pixelScale)
   {
-    renderMap[obj].rendering=obj->render3d(pixelScale,layr,colr,thik,ltype);
-    renderMap[obj].pixelScale=pixelScale;
-    renderMap[obj].hash=objHash;
+    a=item.ahead.find(pixelScale);
+    if (a!=item.ahead.end())
+    { // Zoomed to a prerendered scale. Keep the old one in case of zooming back.
+      old.swap(item.rendering);
+      item.rendering.swap(a->second);
+      item.ahead.erase(a);
+      item.ahead[item.pixelScale].swap(old);
+      item.pixelScale=pixelScale;
+      stats.aheadHits++;
+    }
+    else if (shouldRerender(item.pixelScale,pixelScale) &&
+             !queueJob(obj,item,vector<double>(1,pixelScale),true))
+    {
+      item.rendering=obj->render3d(pixelScale,layr,colr,thik,ltype);
+      item.pixelScale=pixelScale;
+      stats.syncRenders++;
+    }
   }
 }
 
+void RenderCache::prerender(vector<double> pixelScales)
+/* Called after painting with the pixel scales the user is likely to zoom to
+ * next. Prerenderings at other scales are discarded to save memory. At most
+ * prerenderBatch objects are cloned per call; the rest are done by later
+ * calls, starting where this one left off. If any are left, the workers ask
+ * for a paint when they run out of jobs.
+ */
+{
+  const int prerenderBatch=1024;
+  map<drawobj *,RenderItem>::iterator i;
+  map<double,vector<drawingElement> >::iterator a;
+  vector<double> stale,wanted;
+  int j,nQueued=0;
+  bool unfinished=false;
+  if (pixelScales!=prerenderScales)
+  {
+    prerenderScales=pixelScales;
+    prerenderFrom=nullptr;
+  }
+  for (i=renderMap.lower_bound(prerenderFrom);i!=renderMap.end();i++)
+  {
+    if (nQueued>=prerenderBatch)
+    {
+      prerenderFrom=i->first;
+      unfinished=true;
+      break;
+    }
+    stale.clear();
+    for (a=i->second.ahead.begin();a!=i->second.ahead.end();++a)
+      if (find(pixelScales.begin(),pixelScales.end(),a->first)==pixelScales.end())
+	stale.push_back(a->first);
+    for (j=0;j<stale.size();j++)
+      i->second.ahead.erase(stale[j]);
+    wanted.clear();
+    for (j=0;j<pixelScales.size();j++)
+      if (pixelScales[j]!=i->second.pixelScale && !i->second.ahead.count(pixelScales[j]))
+	wanted.push_back(pixelScales[j]);
+    if (wanted.size() && queueJob(i->first,i->second,wanted,false))
+      nQueued++; // false if it can't be cloned, or there are no threads
+  }
+  if (!unfinished)
+    prerenderFrom=nullptr;
+  jobMutex.lock();
+  prerenderUnfinished=unfinished;
+  jobMutex.unlock();
+  stats.queued=jobsQueued();
+}
+
 RenderItem RenderCache::nextRenderItem()
 {
   RenderItem ret;
@@ -86,8 +347,21 @@ RenderItem RenderCache::nextRenderItem()
     ret.present=false;
   else
   {
-    ret=next->second;
+    ret.colr=next->second.colr;
+    ret.thik=next->second.thik;
+    ret.ltype=next->second.ltype;
+    ret.layr=next->second.layr;
+    ret.present=next->second.present;
+    ret.hash=next->second.hash;
+    ret.pixelScale=next->second.pixelScale;
+    ret.rendering=next->second.rendering; // not ahead, which may be big
     ++next;
   }
   return ret;
 }
+
+int RenderCache::jobsQueued()
+{
+  lock_guard<mutex> lock(jobMutex);
+  return jobQueue.size()+running;
+}
@@ -3,7 +3,7 @@
 /* rendercache.h - cache of renderings of drawobjs    */
 /*                                                    */
 /******************************************************/
-/* Copyright 2017,2019 Pierre Abbat.
+/* Copyright 2017,2019,2022 Pierre Abbat.
  * This file is part of Bezitopo.
  *
  * Bezitopo is free software: you can redistribute it and/or modify
@@ -24,6 +24,13 @@
 #ifndef RENDERCACHE_H
 #define RENDERCACHE_H
 #include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include "drawobj.h"
 #include "halton.h"
 #include "random.h"
@@ -40,6 +47,14 @@
  * drawing layer has a line in the setback layer, and you hide the setback
  * layer, the line will remain visible until you rerender everything or the
  * block is rerendered because the scale changes.
+ *
+ * Objects which can clone themselves are rerendered for a new scale in
+ * worker threads, while the old rendering is drawn; new or changed objects
+ * are still rendered at once. After painting, the canvas can ask for
+ * renderings at the scales of the next zoom steps, which are kept in
+ * ahead and swapped in when the view is zoomed to that scale. Objects are
+ * cloned for prerendering a batch at a time, one clone for all the scales,
+ * so that a paint doesn't copy every contour.
  */
 
 class RenderItem
@@ -48,10 +63,34 @@ public:
   unsigned short colr;
   short thik;
   unsigned short ltype;
+  short layr;
   bool present;
   unsigned hash;
   double pixelScale;
   std::vector<drawingElement> rendering;
+  std::map<double,std::vector<drawingElement> > ahead; // prerendered at other scales
+};
+
+struct RenderJob
+{
+  drawobj *obj; // key in renderMap; the object itself may be gone
+  std::shared_ptr<drawobj> copy;
+  unsigned hash;
+  int generation;
+  std::vector<double> pixelScales; // one if current
+  int layr,colr,thik,ltype;
+  bool current; // for the scale being displayed, not a prerendering
+  std::vector<std::vector<drawingElement> > renderings; // one per scale
+};
+
+struct RenderStats
+{
+  int paintTime,renderTime,pathTime,strokeTime; // milliseconds, last paint
+  int nItems; // objects in the cache
+  int syncRenders; // rendered while painting, last paint
+  int aheadHits; // prerenderings swapped in, last paint
+  int queued; // jobs waiting or running
+  RenderStats();
 };
 
 class RenderCache
@@ -61,11 +100,33 @@ private:
   std::map<drawobj *,RenderItem> renderMap;
   bool shouldRerender(double oldScale,double newScale);
   std::map<drawobj *,RenderItem>::iterator next;
+  drawobj *prerenderFrom; // where the next batch of prerendering starts
+  std::vector<double> prerenderScales;
+  // The following are shared with the worker threads.
+  std::mutex jobMutex;
+  std::condition_variable jobCond;
+  std::deque<RenderJob> jobQueue;
+  std::vector<RenderJob> jobsDone;
+  std::set<std::pair<drawobj *,double> > jobsPending;
+  std::vector<std::thread> workers;
+  int generation,running;
+  bool stopping,prerenderUnfinished;
+  std::function<void()> onDone;
+  void workerLoop();
+  bool queueJob(drawobj *obj,RenderItem &item,std::vector<double> pixelScales,bool current);
 public:
+  RenderStats stats;
+  RenderCache();
+  ~RenderCache();
+  void startThreads(std::function<void()> doneCallback,int n=0);
+  void stopThreads();
   void clear();
   void clearPresent();
   void deleteAbsent();
+  void collectDone();
   void checkInObject(drawobj *obj,double pixelScale,int layr,int colr,int thik,int ltype);
+  void prerender(std::vector<double> pixelScales);
   RenderItem nextRenderItem();
+  int jobsQueued();
 };
 #endif
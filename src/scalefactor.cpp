@@ -25,12 +25,17 @@
 #include <cstring>
 #include <iostream>
 #include <cstdlib>
+#include <fstream>
+#include <chrono>
 #include <vector>
 #include "point.h"
 #include "geoid.h"
 #include "angle.h"
 #include "ldecimal.h"
 #include "projection.h"
+#include "gridfactor.h"
+#include "csv.h"
+#include "firstarg.h"
 #include "icommon.h"
 #include "globals.h"
 #include "except.h"
@@ -122,7 +127,7 @@ void scalefactorll_i(string args)
 		ellip=chosenProjection->ellip;
               radius=ellip->radiusAtLatitude(ll,DEG45);
               cout<<"Average radius of curvature is "<<doc.ms.formatMeasurementUnit(radius,LENGTH)<<endl;
-              elevfactor=radius/(radius+elevation+separation);
+              elevfactor=elevationFactor(ellip,ll,elevation,separation);
               cout<<"Elevation factor is "<<ldecimal(elevfactor)<<endl;
             }
             catch (BeziExcept e)
@@ -209,7 +214,7 @@ void scalefactorxy_i(string args)
 		ellip=chosenProjection->ellip;
               radius=ellip->radiusAtLatitude(ll,DEG45);
               cout<<"Average radius of curvature is "<<doc.ms.formatMeasurementUnit(radius,LENGTH)<<endl;
-              elevfactor=radius/(radius+elevation+separation);
+              elevfactor=elevationFactor(ellip,ll,elevation,separation);
               cout<<"Elevation factor is "<<ldecimal(elevfactor)<<endl;
             }
             catch (BeziExcept e)
@@ -229,3 +234,83 @@ void scalefactorxy_i(string args)
   }
   while (subcont);
 }
+
+void gridfactors_i(string args)
+/* Converts every point in the point list from grid to latitude and longitude
+ * and computes its factors, then writes them to a CSV file if one is named.
+ */
+{
+  string filename=trim(firstarg(args));
+  Projection *chosenProjection;
+  vector<xyz> grid;
+  vector<int> numbers;
+  vector<PointFactors> factors;
+  ptlist::iterator j;
+  ofstream outfile;
+  vector<string> words;
+  double minComb=INFINITY,maxComb=-INFINITY;
+  int i,nUnknown=0,nOutside=0;
+  chrono::steady_clock::time_point start;
+  chrono::duration<double> elapsed;
+  chosenProjection=oneProj(allProjections);
+  if (!chosenProjection)
+  {
+    cout<<"Projection file is missing\n";
+    return;
+  }
+  for (j=doc.pl[0].points.begin();j!=doc.pl[0].points.end();++j)
+  {
+    numbers.push_back(j->first);
+    grid.push_back(j->second);
+  }
+  start=chrono::steady_clock::now();
+  factors=gridFactors(*chosenProjection,cube,grid);
+  elapsed=chrono::steady_clock::now()-start;
+  for (i=0;i<factors.size();i++)
+  {
+    if (std::isfinite(factors[i].combined))
+    {
+      if (factors[i].combined<minComb)
+	minComb=factors[i].combined;
+      if (factors[i].combined>maxComb)
+	maxComb=factors[i].combined;
+    }
+    else
+      nUnknown++;
+    if (!chosenProjection->in(factors[i].ll))
+      nOutside++;
+  }
+  cout<<factors.size()<<" points converted in "<<elapsed.count()<<" s";
+  if (elapsed.count()>0)
+    cout<<", "<<rint(factors.size()/elapsed.count())<<" points/s";
+  cout<<endl;
+  if (nUnknown)
+    cout<<nUnknown<<" points have unknown geoid separation"<<endl;
+  if (nOutside)
+    cout<<nOutside<<" points are not in the projection's boundary"<<endl;
+  if (minComb<=maxComb)
+    cout<<"Combined factor ranges from "<<ldecimal(minComb)<<" to "<<ldecimal(maxComb)<<endl;
+  if (filename.length())
+  {
+    outfile.open(filename);
+    if (outfile.is_open())
+    {
+      outfile<<"point,latitude,longitude,separation,grid factor,elevation factor,combined factor\n";
+      for (i=0;i<factors.size();i++)
+      {
+	words.clear();
+	words.push_back(to_string(numbers[i]));
+	words.push_back(ldecimal(radtodeg(factors[i].ll.lat)));
+	words.push_back(ldecimal(radtodeg(factors[i].ll.lon)));
+	words.push_back(ldecimal(factors[i].separation));
+	words.push_back(ldecimal(factors[i].gridFactor));
+	words.push_back(ldecimal(factors[i].elevFactor));
+	words.push_back(ldecimal(factors[i].combined));
+	outfile<<makecsvline(words)<<'\n';
+      }
+      outfile.close();
+    }
+    else
+      cout<<"Can't write "<<filename<<endl;
+  }
+}
@@ -26,3 +26,4 @@
 
 void scalefactorll_i(std::string args);
 void scalefactorxy_i(std::string args);
+void gridfactors_i(std::string args);
@@ -45,7 +45,7 @@
 
 using namespace std;
 #ifndef NDEBUG
-int closetime; // Holds the time spent in segment::closest.
+thread_local int closetime; // Holds the time spent in segment::closest.
 #endif
 
 segment::segment()
@@ -166,6 +166,22 @@ xyz segment::station(double along) const
 	     elev(along));
 }
 
+void segment::stations(const double *alongs,xyz *out,int n) const
+/* Computes station(alongs[i]) for n alongs at once. The length, which takes
+ * a square root, is computed only once.
+ */
+{
+  int i;
+  double len=length(),along,gnola;
+  for (i=0;i<n;i++)
+  {
+    along=alongs[i];
+    gnola=len-along;
+    out[i]=xyz((start.east()*gnola+end.east()*along)/len,(start.north()*gnola+end.north()*along)/len,
+	       vcurve(start.elev(),control1,control2,end.elev(),along/len));
+  }
+}
+
 double segment::contourcept(double e)
 /* Finds ret such that elev(ret)=e. Used for tracing a contour from one subedge
  * to the next within a triangle.
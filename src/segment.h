@@ -36,7 +36,7 @@
 #define START 1
 #define END 2
 #ifndef NDEBUG
-extern int closetime; // Holds the time spent in segment::closest.
+extern thread_local int closetime; // Holds the time spent in segment::closest.
 #endif
 
 class segment: public drawobj
@@ -83,6 +83,7 @@ public:
     return (end.elev()<e)^(start.elev()<e);
   }
   virtual xyz station(double along) const;
+  virtual void stations(const double *alongs,xyz *out,int n) const;
   double avgslope()
   {
     return (end.elev()-start.elev())/length();
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <iomanip>
 #include <cassert>
+#include <mutex>
 #include "config.h"
 #include "sourcegeoid.h"
 #include "smooth5.h"
@@ -36,7 +37,17 @@
 
 using namespace std;
 vector<geoid> geo;
-map<int,matrix> quadinv;
+/* quadinv remembers the inverse autocorrelation matrix of each pattern of
+ * finite points. It is split into shards by hash, each with its own lock,
+ * so that quads can be refined in several threads at once.
+ */
+const int quadinvShards=64;
+struct QuadinvShard
+{
+  mutex lock;
+  map<int,fixedmatrix<6,6> > inv;
+};
+QuadinvShard quadinv[quadinvShards];
 vector<smallcircle> excerptcircles;
 cylinterval excerptinterval;
 bool outBigEndian;
@@ -1261,30 +1272,121 @@ cylinterval geoid::boundrect()
   return ret;
 }
 
-matrix autocorr(double qpoints[][16],int qsz)
-/* Autocorrelation of the six undulation components, masked by which of qpoints
- * are finite. When all are finite, the matrix is diagonal-dominant, but when
- * only half are finite, it often isn't.
- */
+QuadBasis::QuadBasis(int qsz)
 {
+  int i,j,k;
   geoquad unitquad[6];
-  int i,j,k,l;
-  matrix ret(6,6);
-  manysum sum;
+  size=qsz;
   for (i=0;i<6;i++)
     for (j=0;j<6;j++)
       unitquad[i].und[j]=i==j;
-  for (i=0;i<6;i++)
-    for (j=0;j<=i;j++)
+  for (i=0;i<qsz;i++)
+    for (j=0;j<qsz;j++)
+      for (k=0;k<6;k++)
+	comp[k][i*qsz+j]=unitquad[k].undulation(qscale(i,qsz),qscale(j,qsz));
+}
+
+const QuadBasis &quadBasis(int qsz)
+/* The tables for all sizes are made the first time any is needed. C++11
+ * guarantees that this happens once even if several threads call it.
+ */
+{
+  static const vector<QuadBasis> bases=[]()
+  {
+    vector<QuadBasis> ret;
+    int i;
+    for (i=0;i<=16;i++)
+      ret.push_back(QuadBasis(i));
+    return ret;
+  }();
+  assert(qsz>=0 && qsz<=16);
+  return bases[qsz];
+}
+
+int flatModel(geoquad &quad,double qpoints[][16],int qsz,double *obs,double *model,int *which)
+/* Puts the finite qpoints, their undulations according to quad, and their
+ * indices in the basis table into dense arrays. Returns how many there are.
+ * If quad is subdivided, its undulation isn't a combination of the basis.
+ *
+ * The xy term is computed as (und[4]*x)*y, as geoquad::undulation does,
+ * not as und[4]*(x*y) from the table, so that the model is bit for bit
+ * the undulation.
+ */
+{
+  const QuadBasis &basis=quadBasis(qsz);
+  int i,j,k,n,w;
+  double u;
+  for (n=i=0;i<qsz;i++)
+    for (j=0;j<qsz;j++)
+      if (std::isfinite(qpoints[i][j]))
+      {
+	obs[n]=qpoints[i][j];
+	which[n]=i*qsz+j;
+	n++;
+      }
+  if (quad.subdivided())
+    for (k=0;k<n;k++)
+      model[k]=quad.undulation(qscale(which[k]/qsz,qsz),qscale(which[k]%qsz,qsz));
+  else
+    for (k=0;k<n;k++)
     {
-      sum.clear();
-      for (k=0;k<qsz;k++)
-	for (l=0;l<qsz;l++)
-	  if (std::isfinite(qpoints[k][l]))
-	    sum+=unitquad[i].undulation(qscale(k,qsz),qscale(l,qsz))
-	        *unitquad[j].undulation(qscale(k,qsz),qscale(l,qsz));
-      ret[i][j]=ret[j][i]=sum.total();
+      w=which[k];
+      u=quad.und[0]*basis.comp[0][w]+quad.und[1]*basis.comp[1][w]+quad.und[2]*basis.comp[2][w]+
+	quad.und[3]*basis.comp[3][w]+quad.und[4]*basis.comp[1][w]*basis.comp[2][w]+
+	quad.und[5]*basis.comp[5][w];
+      if (u>8850*65536 || u<-11000*65536) // same limits as geoquad::undulation
+	u=NAN;
+      model[k]=u;
     }
+  return n;
+}
+
+fixedmatrix<6,6> autocorr(double qpoints[][16],int qsz)
+/* Autocorrelation of the six undulation components, masked by which of qpoints
+ * are finite. When all are finite, the matrix is diagonal-dominant, but when
+ * only half are finite, it often isn't.
+ *
+ * The components of the finite points are gathered from the basis table,
+ * and the 21 distinct entries are pairwise dot products of rows.
+ */
+{
+  const QuadBasis &basis=quadBasis(qsz);
+  int i,j,k,l,n;
+  fixedmatrix<6,6> ret;
+  double comp[6][256];
+  for (n=k=0;k<qsz;k++)
+    for (l=0;l<qsz;l++)
+      if (std::isfinite(qpoints[k][l]))
+      {
+	for (i=0;i<6;i++)
+	  comp[i][n]=basis.comp[i][k*qsz+l];
+	n++;
+      }
+  for (i=0;i<6;i++)
+    for (j=0;j<=i;j++)
+      ret[i][j]=ret[j][i]=pairwisedot(comp[i],comp[j],n);
+  return ret;
+}
+
+fixedmatrix<6,6> quadInverse(double qpoints[][16],int qsz)
+/* Returns the inverse of autocorr(qpoints,qsz), computing it only the first
+ * time its pattern is seen. If two threads see a new pattern at once, both
+ * compute it, and they get the same answer.
+ */
+{
+  int qhash=quadhash(qpoints,qsz);
+  QuadinvShard &shard=quadinv[qhash%quadinvShards];
+  map<int,fixedmatrix<6,6> >::iterator it;
+  fixedmatrix<6,6> ret;
+  {
+    lock_guard<mutex> lk(shard.lock);
+    it=shard.inv.find(qhash);
+    if (it!=shard.inv.end())
+      return it->second;
+  }
+  ret=invert(autocorr(qpoints,qsz));
+  lock_guard<mutex> lk(shard.lock);
+  shard.inv[qhash]=ret;
   return ret;
 }
 
@@ -1311,36 +1413,24 @@ double qscale(int i,int qsz)
 }
 
 array<double,6> correction(geoquad &quad,double qpoints[][16],int qsz)
+/* Least-squares correction to the six components of quad. The residuals of
+ * the finite points are multiplied by the transposed basis, then by the
+ * inverse autocorrelation.
+ */
 {
+  const QuadBasis &basis=quadBasis(qsz);
   array<double,6> ret;
-  matrix preret(6,1);
-  int i,j,k,qhash;
-  double diff;
-  geoquad unitquad;
-  qhash=quadhash(qpoints,qsz);
-  if (quadinv.count(qhash)==0)
-    quadinv[qhash]=invert(autocorr(qpoints,qsz));
+  fixedmatrix<6,1> preret;
+  int i,k,n;
+  double obs[256],model[256],diff[256];
+  int which[256];
+  n=flatModel(quad,qpoints,qsz,obs,model,which);
+  for (k=0;k<n;k++)
+    diff[k]=obs[k]-model[k];
   for (i=0;i<6;i++)
-    ret[i]=0;
-  for (i=0;i<qsz;i++)
-    for (j=0;j<qsz;j++)
-      if (std::isfinite(qpoints[i][j]))
-      {
-	diff=qpoints[i][j]-quad.undulation(qscale(i,qsz),qscale(j,qsz));
-	for (k=0;k<6;k++)
-	{
-	  unitquad.und[k]=1;
-	  unitquad.und[(k+5)%6]=0;
-	  preret[k][0]+=diff*unitquad.undulation(qscale(i,qsz),qscale(j,qsz));
-	}
-      }
-  /*ret[0]=preret[0][0]/256;
-  ret[1]=preret[1][0]/85;
-  ret[2]=preret[2][0]/85;
-  ret[3]=preret[3][0]*2304/51409;
-  ret[4]=preret[4][0]*256/7225;
-  ret[5]=preret[5][0]*2304/51409;*/
-  preret=quadinv[qhash]*preret;
+    for (k=0;k<n;k++)
+      preret[i][0]+=diff[k]*basis.comp[i][which[k]];
+  preret=quadInverse(qpoints,qsz)*preret;
   for (i=0;i<6;i++)
     ret[i]=preret[i][0];
   return ret;
@@ -1368,17 +1458,16 @@ int quadhash(double qpoints[][16],int qsz)
 double maxerror(geoquad &quad,double qpoints[][16],int qsz)
 {
   double ret=0;
-  int i,j;
-  double diff;
-  geoquad unitquad;
-  for (i=0;i<qsz;i++)
-    for (j=0;j<qsz;j++)
-      if (std::isfinite(qpoints[i][j]))
-      {
-	diff=fabs(qpoints[i][j]-quad.undulation(qscale(i,qsz),qscale(j,qsz)));
-	if (diff>ret)
-	  ret=diff;
-      }
+  int k,n;
+  double obs[256],model[256],diff;
+  int which[256];
+  n=flatModel(quad,qpoints,qsz,obs,model,which);
+  for (k=0;k<n;k++)
+  {
+    diff=fabs(obs[k]-model[k]);
+    if (diff>ret)
+      ret=diff;
+  }
   //cout<<"maxerror "<<ret<<endl;
   return ret;
 }
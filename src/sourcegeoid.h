@@ -33,6 +33,7 @@
 #include "angle.h"
 #include "geoid.h"
 #include "matrix.h"
+#include "fixedmatrix.h"
 
 #define HASHPRIME 729683249
 // Used for hashing 256-bit patterns of which samples in a geoquad are valid.
@@ -163,8 +164,20 @@ double maxerror(geoquad &quad,double qpoints[][16],int qsz);
  * sampling the geoid for converting to a geoquad. It must be
  * in [4,16]. It can't be 3 because 9/2<6.
  */
+struct QuadBasis
+/* The six components of a unit geoquad at each of the qsz×qsz sample
+ * points, row-major, so that fitting a geoquad to the samples is a
+ * matrix-vector product.
+ */
+{
+  int size;
+  double comp[6][256];
+  QuadBasis(int qsz);
+};
+const QuadBasis &quadBasis(int qsz);
 int quadhash(double qpoints[][16],int qsz);
-matrix autocorr(double qpoints[][16],int qsz);
+fixedmatrix<6,6> autocorr(double qpoints[][16],int qsz);
+fixedmatrix<6,6> quadInverse(double qpoints[][16],int qsz);
 void dump256(double qpoints[][16],int qsz);
 bool overlap(smallcircle sc,const geoquad &gq);
 #endif
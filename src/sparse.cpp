@@ -0,0 +1,472 @@
+/******************************************************/
+/*                                                    */
+/* sparse.cpp - sparse matrices                       */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <queue>
+#include <map>
+#include "sparse.h"
+#include "except.h"
+
+using namespace std;
+
+bool operator<(const SparseEntry &a,const SparseEntry &b)
+{
+  return a.row<b.row || (a.row==b.row && a.column<b.column);
+}
+
+SparseMatrix::SparseMatrix()
+{
+  rows=columns=0;
+  rowStart.push_back(0);
+}
+
+SparseMatrix::SparseMatrix(unsigned r,unsigned c)
+{
+  rows=r;
+  columns=c;
+  rowStart.resize(rows+1,0);
+}
+
+void SparseMatrix::resize(unsigned newrows,unsigned newcolumns)
+// Clears the matrix.
+{
+  rows=newrows;
+  columns=newcolumns;
+  pending.clear();
+  rowStart.assign(rows+1,0);
+  column.clear();
+  value.clear();
+}
+
+void SparseMatrix::add(unsigned row,unsigned column,double value)
+{
+  SparseEntry ent;
+  if (row>=rows || column>=columns)
+    throw BeziExcept(matrixMismatch);
+  ent.row=row;
+  ent.column=column;
+  ent.value=value;
+  pending.push_back(ent);
+}
+
+void SparseMatrix::finish()
+/* Sorts the added entries, merging them with those already in the matrix,
+ * and adds together entries at the same place.
+ */
+{
+  size_t i;
+  unsigned r;
+  SparseEntry ent;
+  for (r=0;r<rows;r++)
+    for (i=rowStart[r];i<rowStart[r+1];i++)
+    {
+      ent.row=r;
+      ent.column=column[i];
+      ent.value=value[i];
+      pending.push_back(ent);
+    }
+  sort(pending.begin(),pending.end());
+  column.clear();
+  value.clear();
+  rowStart.assign(rows+1,0);
+  for (i=0;i<pending.size();i++)
+    if (i && pending[i].row==pending[i-1].row && pending[i].column==pending[i-1].column)
+      value.back()+=pending[i].value;
+    else
+    {
+      column.push_back(pending[i].column);
+      value.push_back(pending[i].value);
+      rowStart[pending[i].row+1]++;
+    }
+  for (r=0;r<rows;r++)
+    rowStart[r+1]+=rowStart[r];
+  pending.clear();
+  pending.shrink_to_fit();
+}
+
+double SparseMatrix::get(unsigned row,unsigned col) const
+{
+  vector<unsigned>::const_iterator i;
+  if (row>=rows || col>=columns)
+    throw BeziExcept(matrixMismatch);
+  i=lower_bound(column.begin()+rowStart[row],column.begin()+rowStart[row+1],col);
+  if (i<column.begin()+rowStart[row+1] && *i==col)
+    return value[i-column.begin()];
+  else
+    return 0;
+}
+
+vector<double> SparseMatrix::operator*(const vector<double> &v) const
+{
+  vector<double> ret(rows,0);
+  size_t i;
+  unsigned r;
+  if (v.size()!=columns)
+    throw BeziExcept(matrixMismatch);
+  for (r=0;r<rows;r++)
+    for (i=rowStart[r];i<rowStart[r+1];i++)
+      ret[r]+=value[i]*v[column[i]];
+  return ret;
+}
+
+vector<double> SparseMatrix::transposeTimes(const vector<double> &v) const
+{
+  vector<double> ret(columns,0);
+  size_t i;
+  unsigned r;
+  if (v.size()!=rows)
+    throw BeziExcept(matrixMismatch);
+  for (r=0;r<rows;r++)
+    for (i=rowStart[r];i<rowStart[r+1];i++)
+      ret[column[i]]+=value[i]*v[r];
+  return ret;
+}
+
+SparseMatrix SparseMatrix::normalMatrix() const
+/* Returns the transpose of this times this. Each row with n nonzero entries
+ * contributes n² entries, so a row of an observation matrix, which involves
+ * only the few unknowns of the points observed, costs little.
+ */
+{
+  SparseMatrix ret(columns,columns);
+  size_t i,j;
+  unsigned r;
+  for (r=0;r<rows;r++)
+    for (i=rowStart[r];i<rowStart[r+1];i++)
+      for (j=rowStart[r];j<rowStart[r+1];j++)
+	ret.add(column[i],column[j],value[i]*value[j]);
+  ret.finish();
+  return ret;
+}
+
+matrix SparseMatrix::dense() const
+{
+  matrix ret(rows,columns);
+  size_t i;
+  unsigned r;
+  for (r=0;r<rows;r++)
+    for (i=rowStart[r];i<rowStart[r+1];i++)
+      ret[r][column[i]]=value[i];
+  return ret;
+}
+
+vector<int> minimumDegreeOrder(const SparseMatrix &a)
+/* Orders the unknowns of the symmetric matrix a so that eliminating them in
+ * that order makes little fill. Each step eliminates the unknown with the
+ * least degree. Writing out the clique of each eliminated unknown's
+ * neighbors takes too long on a big network, so the graph is kept as a
+ * quotient graph: each eliminated unknown becomes an element, standing for
+ * the clique of the unknowns left next to it, and an element next to the
+ * unknown being eliminated is absorbed into it. Degrees are upper bounds
+ * computed as in approximate minimum degree (Amestoy, Davis, and Duff).
+ *
+ * Unknowns with the same neighbors, such as the x and y of a point, are
+ * merged into one supervariable first and eliminated together.
+ */
+{
+  int n=a.rows,v,u,e,nsuper,stamp=0;
+  size_t i,j,ext,left=n;
+  vector<vector<int> > adj(n),elems,elemVars,members;
+  vector<int> ret,super(n),key,mark,wStamp;
+  vector<size_t> degree,w,weight,elemWeight;
+  vector<bool> done,absorbed;
+  map<vector<int>,int> groups;
+  map<vector<int>,int>::iterator g;
+  priority_queue<pair<size_t,int>,vector<pair<size_t,int> >,greater<pair<size_t,int> > > q;
+  if (a.rows!=a.columns)
+    throw BeziExcept(matrixMismatch);
+  for (v=0;v<n;v++)
+    for (i=a.rowStart[v];i<a.rowStart[v+1];i++)
+      if (a.column[i]!=v)
+      {
+	adj[v].push_back(a.column[i]);
+	adj[a.column[i]].push_back(v);
+      }
+  for (v=0;v<n;v++)
+  {
+    sort(adj[v].begin(),adj[v].end());
+    adj[v].erase(unique(adj[v].begin(),adj[v].end()),adj[v].end());
+    key=adj[v];
+    key.insert(lower_bound(key.begin(),key.end(),v),v);
+    g=groups.find(key);
+    if (g==groups.end())
+    {
+      super[v]=groups[key]=members.size();
+      members.push_back(vector<int>(1,v));
+    }
+    else
+    {
+      super[v]=g->second;
+      members[g->second].push_back(v);
+    }
+  }
+  groups.clear();
+  nsuper=members.size();
+  elems.resize(nsuper);
+  elemVars.resize(nsuper);
+  mark.assign(nsuper,-1);
+  wStamp.assign(nsuper,-1);
+  degree.assign(nsuper,0);
+  w.resize(nsuper);
+  elemWeight.resize(nsuper);
+  done.assign(nsuper,false);
+  absorbed.assign(nsuper,false);
+  for (v=0;v<nsuper;v++)
+  {
+    weight.push_back(members[v].size());
+    key.clear();
+    for (i=0;i<adj[members[v][0]].size();i++)
+      if (super[adj[members[v][0]][i]]!=v)
+	key.push_back(super[adj[members[v][0]][i]]);
+    sort(key.begin(),key.end());
+    key.erase(unique(key.begin(),key.end()),key.end());
+    adj[v].swap(key);
+  }
+  for (v=0;v<nsuper;v++)
+  {
+    for (i=0;i<adj[v].size();i++)
+      degree[v]+=weight[adj[v][i]];
+    q.push(make_pair(degree[v],v));
+  }
+  adj.resize(nsuper);
+  while (q.size())
+  {
+    v=q.top().second;
+    if (done[v] || q.top().first!=degree[v])
+    {
+      q.pop();
+      continue;
+    }
+    q.pop();
+    done[v]=true;
+    ret.insert(ret.end(),members[v].begin(),members[v].end());
+    left-=weight[v];
+    stamp++;
+    mark[v]=stamp;
+    // The new element's unknowns are v's neighbors and its elements' unknowns.
+    vector<int> &vars=elemVars[v];
+    for (i=0;i<adj[v].size();i++)
+      if (!done[u=adj[v][i]] && mark[u]!=stamp)
+      {
+	mark[u]=stamp;
+	vars.push_back(u);
+      }
+    for (i=0;i<elems[v].size();i++)
+      if (!absorbed[e=elems[v][i]])
+      {
+	for (j=0;j<elemVars[e].size();j++)
+	  if (!done[u=elemVars[e][j]] && mark[u]!=stamp)
+	  {
+	    mark[u]=stamp;
+	    vars.push_back(u);
+	  }
+	absorbed[e]=true;
+	vector<int>().swap(elemVars[e]);
+      }
+    vector<int>().swap(adj[v]);
+    vector<int>().swap(elems[v]);
+    elemWeight[v]=0;
+    for (i=0;i<vars.size();i++)
+      elemWeight[v]+=weight[vars[i]];
+    // w[e] is the weight of the unknowns of element e not in the new element.
+    for (i=0;i<vars.size();i++)
+      for (j=0;j<elems[vars[i]].size();j++)
+	if (!absorbed[e=elems[vars[i]][j]])
+	{
+	  if (wStamp[e]!=stamp)
+	  {
+	    wStamp[e]=stamp;
+	    w[e]=elemWeight[e];
+	  }
+	  w[e]-=weight[vars[i]];
+	}
+    for (i=0;i<vars.size();i++)
+    {
+      u=vars[i];
+      vector<int> &au=adj[u],&eu=elems[u];
+      au.erase(remove_if(au.begin(),au.end(),[&](int x){return done[x] || mark[x]==stamp;}),au.end());
+      /* An element all of whose unknowns are in the new element adds nothing
+       * to anyone's degree, and is absorbed too.
+       */
+      eu.erase(remove_if(eu.begin(),eu.end(),[&](int x){return absorbed[x] || (wStamp[x]==stamp && w[x]==0);}),eu.end());
+      for (ext=j=0;j<au.size();j++)
+	ext+=weight[au[j]];
+      for (j=0;j<eu.size();j++)
+	ext+=(wStamp[eu[j]]==stamp)?w[eu[j]]:elemWeight[eu[j]];
+      eu.push_back(v);
+      degree[u]=min(min(degree[u],left-weight[u])+elemWeight[v],ext+elemWeight[v])-weight[u];
+      q.push(make_pair(degree[u],u));
+    }
+  }
+  return ret;
+}
+
+SparseCholesky::SparseCholesky()
+{
+}
+
+SparseCholesky::SparseCholesky(const SparseMatrix &a)
+{
+  factor(a);
+}
+
+void SparseCholesky::factor(const SparseMatrix &a)
+/* Computes L one row at a time. The nonzeros in row k of L are found by
+ * walking up the elimination tree from the nonzeros in column k of the upper
+ * triangle of the reordered matrix, so computing them and the column counts
+ * takes time proportional to the number of nonzeros in L.
+ */
+{
+  int n=a.rows,i,j,k,top;
+  size_t p;
+  double d,lki,diag;
+  vector<size_t> upStart(n+1,0),next;
+  vector<int> upRow,parent(n,-1),ancestor(n,-1),flag(n,-1),stack(n),path(n);
+  vector<double> upValue,x(n,0);
+  if (a.rows!=a.columns)
+    throw BeziExcept(matrixMismatch);
+  perm=minimumDegreeOrder(a);
+  inverse.resize(n);
+  for (k=0;k<n;k++)
+    inverse[perm[k]]=k;
+  // Upper triangle of the reordered matrix, by columns
+  for (i=0;i<n;i++)
+    for (p=a.rowStart[i];p<a.rowStart[i+1];p++)
+      if (inverse[i]<=inverse[a.column[p]])
+	upStart[inverse[a.column[p]]+1]++;
+  for (k=0;k<n;k++)
+    upStart[k+1]+=upStart[k];
+  upRow.resize(upStart[n]);
+  upValue.resize(upStart[n]);
+  next.assign(upStart.begin(),upStart.end()-1);
+  for (i=0;i<n;i++)
+    for (p=a.rowStart[i];p<a.rowStart[i+1];p++)
+      if (inverse[i]<=inverse[a.column[p]])
+      {
+	upRow[next[inverse[a.column[p]]]]=inverse[i];
+	upValue[next[inverse[a.column[p]]]++]=a.value[p];
+      }
+  // Elimination tree
+  for (k=0;k<n;k++)
+    for (p=upStart[k];p<upStart[k+1];p++)
+      for (i=upRow[p];i>=0 && i<k;i=j)
+      {
+	j=ancestor[i];
+	ancestor[i]=k;
+	if (j<0)
+	  parent[i]=k;
+      }
+  /* Row k of L has nonzeros in the columns returned on stack[top..n-1] by
+   * reach, in an order in which they can be computed.
+   */
+  auto reach=[&](int k)
+  {
+    int top=n,len,i;
+    size_t p;
+    flag[k]=k;
+    for (p=upStart[k];p<upStart[k+1];p++)
+    {
+      for (len=0,i=upRow[p];flag[i]!=k;i=parent[i])
+      {
+	path[len++]=i;
+	flag[i]=k;
+      }
+      while (len>0)
+	stack[--top]=path[--len];
+    }
+    return top;
+  };
+  colStart.assign(n+1,0);
+  for (k=0;k<n;k++)
+  {
+    colStart[k+1]++;
+    for (top=reach(k);top<n;top++)
+      colStart[stack[top]+1]++;
+  }
+  for (k=0;k<n;k++)
+    colStart[k+1]+=colStart[k];
+  rowIndex.resize(colStart[n]);
+  value.resize(colStart[n]);
+  zeroPivot.assign(n,false);
+  next.assign(colStart.begin(),colStart.end()-1);
+  flag.assign(n,-1);
+  for (k=0;k<n;k++)
+  {
+    top=reach(k);
+    for (p=upStart[k];p<upStart[k+1];p++)
+      x[upRow[p]]=upValue[p];
+    diag=d=x[k];
+    x[k]=0;
+    for (;top<n;top++)
+    {
+      i=stack[top];
+      lki=x[i]/value[colStart[i]];
+      x[i]=0;
+      for (p=colStart[i]+1;p<next[i];p++)
+	x[rowIndex[p]]-=value[p]*lki;
+      d-=lki*lki;
+      rowIndex[next[i]]=k;
+      value[next[i]++]=lki;
+    }
+    if (!(d>diag*1e-12))
+    { // The pivot vanishes. An infinite diagonal zeroes the rest of row k.
+      zeroPivot[k]=true;
+      d=INFINITY;
+    }
+    rowIndex[next[k]]=k;
+    value[next[k]++]=sqrt(d);
+  }
+}
+
+vector<double> SparseCholesky::solve(const vector<double> &b) const
+{
+  int n=perm.size(),j;
+  size_t p;
+  vector<double> y(n),ret(n);
+  if (b.size()!=n)
+    throw BeziExcept(matrixMismatch);
+  for (j=0;j<n;j++)
+    y[j]=b[perm[j]];
+  for (j=0;j<n;j++)
+  {
+    y[j]/=value[colStart[j]];
+    for (p=colStart[j]+1;p<colStart[j+1];p++)
+      y[rowIndex[p]]-=value[p]*y[j];
+  }
+  for (j=n-1;j>=0;j--)
+  {
+    for (p=colStart[j]+1;p<colStart[j+1];p++)
+      y[j]-=value[p]*y[rowIndex[p]];
+    y[j]/=value[colStart[j]];
+  }
+  for (j=0;j<n;j++)
+    ret[perm[j]]=zeroPivot[j]?NAN:y[j];
+  return ret;
+}
+
+int SparseCholesky::rank() const
+{
+  return count(zeroPivot.begin(),zeroPivot.end(),false);
+}
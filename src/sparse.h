@@ -0,0 +1,104 @@
+/******************************************************/
+/*                                                    */
+/* sparse.h - sparse matrices                         */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef SPARSE_H
+#define SPARSE_H
+#include <vector>
+#include "matrix.h"
+
+struct SparseEntry
+{
+  unsigned row,column;
+  double value;
+};
+
+class SparseMatrix
+/* A sparse matrix, stored by rows: the nonzero entries of row r are at
+ * rowStart[r] through rowStart[r+1]-1 of column and value, sorted by column.
+ * To make one, call add for each nonzero entry, in any order (entries at the
+ * same place are added together), then finish. The normal matrix of a survey
+ * network has a few dozen nonzero entries per row, however many rows it has.
+ */
+{
+public:
+  SparseMatrix();
+  SparseMatrix(unsigned r,unsigned c);
+  void resize(unsigned newrows,unsigned newcolumns);
+  void add(unsigned row,unsigned column,double value);
+  void finish();
+  unsigned getrows() const
+  {
+    return rows;
+  }
+  unsigned getcolumns() const
+  {
+    return columns;
+  }
+  size_t nonzeros() const
+  {
+    return value.size();
+  }
+  double get(unsigned row,unsigned column) const;
+  std::vector<double> operator*(const std::vector<double> &v) const;
+  std::vector<double> transposeTimes(const std::vector<double> &v) const;
+  SparseMatrix normalMatrix() const;
+  matrix dense() const;
+  friend class SparseCholesky;
+  friend std::vector<int> minimumDegreeOrder(const SparseMatrix &a);
+private:
+  unsigned rows,columns;
+  std::vector<SparseEntry> pending;
+  std::vector<size_t> rowStart;
+  std::vector<unsigned> column;
+  std::vector<double> value;
+};
+
+std::vector<int> minimumDegreeOrder(const SparseMatrix &a);
+
+class SparseCholesky
+/* The Cholesky factor L of a symmetric positive (semi)definite sparse matrix,
+ * with its rows and columns reordered by minimum degree to keep L sparse.
+ * L is stored by columns, each column starting with its diagonal entry.
+ * If the matrix is singular, the unknowns whose pivots vanish come out NaN,
+ * as in linearLeastSquares, and the others are solved as if they were 0.
+ */
+{
+public:
+  SparseCholesky();
+  SparseCholesky(const SparseMatrix &a);
+  void factor(const SparseMatrix &a);
+  std::vector<double> solve(const std::vector<double> &b) const;
+  size_t nonzeros() const
+  {
+    return value.size();
+  }
+  int rank() const;
+private:
+  std::vector<int> perm,inverse; // perm[k] is the kth unknown eliminated
+  std::vector<size_t> colStart;
+  std::vector<int> rowIndex;
+  std::vector<double> value;
+  std::vector<bool> zeroPivot;
+};
+
+#endif
@@ -57,6 +57,7 @@
 #include <cstdio>
 #include <iostream>
 #include <cfloat>
+#include <mutex>
 #include "spiral.h"
 #include "angle.h"
 #include "vcurve.h"
@@ -73,8 +74,9 @@ using namespace std;
 #define CURLTEST 4
 // Number of points to try in the too curly test. 2 doesn't work, but 4 appears to.
 vector<int> cornuhisto;
+mutex cornuhistoMutex; // manyArc calls cornu from several threads
 
-xy cornu(double t)
+xy cornuSeries(double t)
 /* If |t|>=6, it returns the limit points rather than a value with no precision.
  * The largest t useful in surveying is 1.430067.
  */
@@ -95,9 +97,11 @@ xy cornu(double t)
     imagparts.push_back(-facpower/(8*i+7));
     facpower*=t2/(4*i+4);
   }
+  cornuhistoMutex.lock();
   if (i>=cornuhisto.size())
     cornuhisto.resize(i+1);
   cornuhisto[i]++;
+  cornuhistoMutex.unlock();
   for (i=realparts.size()-1,bigpart=0;i>=0;i--)
   {
     if (fabsl(realparts[i])>bigpart)
@@ -114,7 +118,7 @@ xy cornu(double t)
   return xy(rsum,isum);
 }
 
-xy cornu(double t,double curvature,double clothance)
+xy cornuSeries(double t,double curvature,double clothance)
 /* Evaluates the integral of cis(clothance×t²/2+curvature×t).
  * 1+(cl×t²/2+cu×t)i-(cl×t²/2+cu×t)²/2-(cl×t²/2+cu×t)³i/6+(cl×t²/2+cu×t)⁴/24+...
  * 1+cl×t²×i/2  +cu×t×i   -cl²×t⁴/8  -cl×cu×t³×2/4  -cu²×t²/2  -cl³×t⁶×i/6/8  -cl²×cu×t⁵×3i/6/4  -cl×cu²×t⁴×3i/6/2  -cu³×t³i/6  +cl⁴×t⁸/24/16  +cl³×cu×t⁷×4/24/8  +cl²×cu²×t⁶6/24/4  +cl×cu³×t⁵×4/24/2  +cu⁴×t⁴/24+...
@@ -178,6 +182,126 @@ xy cornu(double t,double curvature,double clothance)
   return xy(rsum,isum);
 }
 
+/* cornu(t) and cornu(t,curvature,clothance) are called for every station
+ * of every spiralarc, which is most of the time spent in closest, manyArc,
+ * and drawing. The series above build hundreds of terms and add them
+ * pairwise. The functions below compute the same thing faster:
+ *
+ * cornu(t) for |t|<CORNUTABLEMAX is a piecewise Chebyshev polynomial,
+ * whose coefficients are computed from cornuSeries the first time it's
+ * called. Beyond that, it calls cornuSeries.
+ *
+ * cornu(t,curvature,clothance) depends on two parameters, so it can't
+ * be tabulated. Instead, the Taylor series of cis(clothance×t²/2+curvature×t)
+ * is computed by a recurrence: if g'=i(clothance×t+curvature)g, then
+ * (n+1)a[n+1]=i(curvature×a[n]+clothance×a[n-1]). This takes one term per
+ * power of t instead of one per power of curvature and clothance. If it
+ * doesn't converge, or loses too much precision, cornuSeries is called.
+ */
+#define CORNUTABLEMAX 4
+#define CORNUPIECES 16
+#define CORNUDEGREE 16
+
+struct CornuTable
+{
+  long double re[CORNUPIECES][CORNUDEGREE],im[CORNUPIECES][CORNUDEGREE];
+  CornuTable();
+};
+
+CornuTable::CornuTable()
+{
+  int i,j,k;
+  long double half=(long double)CORNUTABLEMAX/CORNUPIECES/2,mid,x,pi=acosl(-1);
+  xy f[CORNUDEGREE];
+  for (i=0;i<CORNUPIECES;i++)
+  {
+    mid=(2*i+1)*half;
+    for (k=0;k<CORNUDEGREE;k++)
+      f[k]=cornuSeries(mid+half*cosl(pi*(k+0.5)/CORNUDEGREE));
+    for (j=0;j<CORNUDEGREE;j++)
+    {
+      re[i][j]=im[i][j]=0;
+      for (k=0;k<CORNUDEGREE;k++)
+      {
+	x=cosl(pi*j*(k+0.5)/CORNUDEGREE)*2/CORNUDEGREE;
+	re[i][j]+=f[k].getx()*x;
+	im[i][j]+=f[k].gety()*x;
+      }
+    }
+    re[i][0]/=2;
+    im[i][0]/=2;
+  }
+}
+
+xy cornu(double t)
+{
+  static const CornuTable table; // initialized once, even with several threads
+  long double x,b0r=0,b1r=0,b2r,b0i=0,b1i=0,b2i;
+  double at=fabs(t);
+  int i,j;
+  if (!(at<CORNUTABLEMAX))
+    return cornuSeries(t);
+  if (at==0) // The polynomial is not exactly 0 there.
+    return xy(0,0);
+  i=at*CORNUPIECES/CORNUTABLEMAX;
+  x=2*((long double)at*CORNUPIECES/CORNUTABLEMAX-i)-1;
+  for (j=CORNUDEGREE-1;j>0;j--) // Clenshaw
+  {
+    b2r=b1r;
+    b1r=b0r;
+    b0r=2*x*b1r-b2r+table.re[i][j];
+    b2i=b1i;
+    b1i=b0i;
+    b0i=2*x*b1i-b2i+table.im[i][j];
+  }
+  b0r=x*b0r-b1r+table.re[i][0];
+  b0i=x*b0i-b1i+table.im[i][0];
+  if (t<0)
+  {
+    b0r=-b0r;
+    b0i=-b0i;
+  }
+  return xy(b0r,b0i);
+}
+
+xy cornu(double t,double curvature,double clothance)
+{
+  long double are,aim,lastre=0,lastim=0,nextre,nextim;
+  long double rsum=0,isum=0,tpower=t,term,bigpart=0,bigterm=1,lastbig=1;
+  double precision;
+  int n;
+  are=1;
+  aim=0;
+  // If curvature is 0, every other term is 0, so look at two terms.
+  for (n=0;(0.9+bigterm+lastbig!=0.9 || n<2) && n<4*MAXITER;n++)
+  {
+    lastbig=bigterm;
+    term=are*tpower/(n+1);
+    rsum+=term;
+    bigterm=fabsl(term);
+    if (fabsl(term)>bigpart)
+      bigpart=fabsl(term);
+    term=aim*tpower/(n+1);
+    isum+=term;
+    if (fabsl(term)>bigterm)
+      bigterm=fabsl(term);
+    if (fabsl(term)>bigpart)
+      bigpart=fabsl(term);
+    // multiply by i(curvature×a[n]+clothance×a[n-1])/(n+1)
+    nextre=-(curvature*aim+clothance*lastim)/(n+1);
+    nextim=(curvature*are+clothance*lastre)/(n+1);
+    lastre=are;
+    lastim=aim;
+    are=nextre;
+    aim=nextim;
+    tpower*=t;
+  }
+  precision=nextafterl(bigpart,2*bigpart)-bigpart;
+  if (n>=4*MAXITER || precision>1e-15*fabs(t))
+    return cornuSeries(t,curvature,clothance);
+  return xy(rsum,isum);
+}
+
 void cornustats()
 {
   int i;
@@ -384,6 +508,22 @@ xyz spiralarc::station(double along) const
   return xyz(turn(relpos,midbear)+mid,elev(along));
 }
 
+void spiralarc::stations(const double *alongs,xyz *out,int n) const
+/* The rotation to the midpoint bearing is computed once, instead of a sine
+ * and cosine for each station.
+ */
+{
+  int i;
+  xy relpos,rot=cossin(midbear);
+  for (i=0;i<n;i++)
+  {
+    relpos=cornu(alongs[i]-len/2,cur,clo);
+    out[i]=xyz(mid.getx()+rot.getx()*relpos.getx()-rot.gety()*relpos.gety(),
+	       mid.gety()+rot.gety()*relpos.getx()+rot.getx()*relpos.gety(),
+	       elev(alongs[i]));
+  }
+}
+
 xy spiralarc::center()
 /* The center of a spiralarc is the center of the circle that osculates its midpoint.
  * Thus turning an arc into a spiralarc does not change its center.
@@ -35,6 +35,8 @@
  */
 xy cornu(double t); //clothance=2
 xy cornu(double t,double curvature,double clothance);
+xy cornuSeries(double t);
+xy cornuSeries(double t,double curvature,double clothance);
 double spiralbearing(double t,double curvature,double clothance);
 int ispiralbearing(double t,double curvature,double clothance);
 double spiralcurvature(double t,double curvature,double clothance);
@@ -108,6 +110,7 @@ public:
     return clo;
   }
   virtual xyz station(double along) const;
+  virtual void stations(const double *alongs,xyz *out,int n) const;
   virtual xy center();
   virtual double sthrow();
   /* "throw" is a reserved word.
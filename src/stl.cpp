@@ -22,14 +22,30 @@
  * <http://www.gnu.org/licenses/>.
  */
 
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include "stl.h"
 #include "smooth5.h"
+#include "pointlist.h"
+#include "angle.h"
+#include "binio.h"
+#include "ldecimal.h"
+#include "except.h"
+#include "cancel.h"
 using namespace std;
 
 /* The STL polyhedron consists of three kinds of face: bottom, side, and top.
- * The bottom is a convex polygon which is triangulated. The sides are
- * trapezoids, each of which is drawn as two triangles. The top is the
- * TIN surface. Each edge is split into some number of pieces which is a
+ * The bottom is flat and is triangulated like the TIN, so it need not be
+ * convex. The sides are trapezoids, each of which is drawn as two triangles.
+ * The top is the TIN surface. Each edge is split into some number of pieces which is a
  * 5-smooth number, enough to make it smooth at the printing scale, then some
  * are split into more pieces because every triangle must have one side that
  * is split into a number of pieces that is a multiple of the number of
@@ -132,3 +148,469 @@ StlTriangle::StlTriangle(xyz A,xyz B,xyz C)
   normal=cross(a-b,b-c);
   normal.normalize();
 }
+
+Printer3dSize printer3d={P3S_RECTANGULAR,200,200,200,1,1,5,0.05};
+
+xyz StlFrame::toPrinter(xyz pnt) const
+{
+  xy off=xy(pnt)-groundCenter;
+  off=xy(off.getx()*turn.getx()+off.gety()*turn.gety(),
+	 off.gety()*turn.getx()-off.getx()*turn.gety());
+  return xyz(off*scale+printerCenter,(pnt.elev()-low)*scale+minBase);
+}
+
+unsigned roundScaleDenom(double denom,bool feet,bool roundScale)
+/* Returns the least acceptable denominator not less than denom.
+ * If feet, it is a multiple of 12. If roundScale, it is 1, 2, 2.5, or 5
+ * times a power of 10 (times 12 if feet).
+ */
+{
+  double unit=feet?12:1;
+  double decade;
+  unsigned ret;
+  if (roundScale)
+  {
+    denom/=unit;
+    decade=pow(10,floor(log10(denom)));
+    if (denom<=decade)
+      denom=decade;
+    else if (denom<=2*decade)
+      denom=2*decade;
+    else if (denom<=2.5*decade && decade>=10)
+      denom=2.5*decade;
+    else if (denom<=5*decade)
+      denom=5*decade;
+    else
+      denom=10*decade;
+    ret=lrint(denom*unit);
+  }
+  else
+    ret=lrint(ceil(denom/unit)*unit);
+  if (ret<1)
+    ret=1;
+  return ret;
+}
+
+StlFrame turnFitInPrinter(pointlist &pl,Printer3dSize &printer,bool feet,bool roundScale)
+/* Finds the bearing at which the TIN fits in the printer at the largest scale,
+ * sets the printer's scale, and returns the transformation. The scale is
+ * 1:scaleDenom; the TIN must be at least one meter across.
+ */
+{
+  int i,bear=0;
+  double width,length,denom,bestDenom=INFINITY;
+  array<double,2> lohi=pl.lohi();
+  StlFrame ret;
+  if (printer.shape==P3S_ROUND)
+  { // Rotating does not help. Fit the bounding rectangle's diagonal.
+    width=-pl.dirbound(0)-pl.dirbound(DEG180);
+    length=-pl.dirbound(DEG90)-pl.dirbound(-DEG90);
+    bestDenom=1000*hypot(width,length)/printer.x;
+  }
+  else
+    for (i=0;i<180;i++)
+    {
+      width=-pl.dirbound(degtobin(i))-pl.dirbound(degtobin(i)+DEG180);
+      length=-pl.dirbound(degtobin(i)+DEG90)-pl.dirbound(degtobin(i)-DEG90);
+      denom=1000*max(width/printer.x,length/printer.y);
+      if (denom<bestDenom)
+      {
+	bestDenom=denom;
+	bear=degtobin(i);
+      }
+    }
+  if (printer.z>printer.minBase)
+    bestDenom=max(bestDenom,1000*(lohi[1]-lohi[0])/(printer.z-printer.minBase));
+  printer.scaleNum=1;
+  printer.scaleDenom=roundScaleDenom(bestDenom,feet,roundScale);
+  ret.turn=cossin(bear);
+  ret.groundCenter=xy((pl.dirbound(bear)-pl.dirbound(bear+DEG180))/2,
+		      (pl.dirbound(bear+DEG90)-pl.dirbound(bear-DEG90))/2);
+  ret.groundCenter=xy(ret.groundCenter.getx()*ret.turn.getx()-ret.groundCenter.gety()*ret.turn.gety(),
+		      ret.groundCenter.getx()*ret.turn.gety()+ret.groundCenter.gety()*ret.turn.getx());
+  ret.printerCenter=(printer.shape==P3S_ROUND)?xy(0,0):xy(printer.x/2,printer.y/2);
+  ret.scale=1000.*printer.scaleNum/printer.scaleDenom;
+  ret.low=lohi[0];
+  ret.minBase=printer.minBase;
+  return ret;
+}
+
+vector<array<edge *,3> > triangleSides(pointlist &pl)
+/* Returns the sides opposite a, b, and c of each triangle. This does not
+ * use point::isNeighbor, which rotates the points' edge pointers, so it can
+ * run in a thread while the GUI is painting the TIN.
+ */
+{
+  vector<array<edge *,3> > ret;
+  map<triangle *,size_t> triIndex;
+  map<int,triangle>::iterator t;
+  map<int,edge>::iterator e;
+  triangle *tri;
+  int i;
+  for (t=pl.triangles.begin();t!=pl.triangles.end();++t)
+  {
+    triIndex[&t->second]=ret.size();
+    ret.push_back(array<edge *,3>{nullptr,nullptr,nullptr});
+  }
+  for (e=pl.edges.begin();e!=pl.edges.end();++e)
+    for (i=0;i<2;i++)
+    {
+      tri=i?e->second.trib:e->second.tria;
+      if (tri && triIndex.count(tri))
+      {
+	if (tri->a!=e->second.a && tri->a!=e->second.b)
+	  ret[triIndex[tri]][0]=&e->second;
+	else if (tri->b!=e->second.a && tri->b!=e->second.b)
+	  ret[triIndex[tri]][1]=&e->second;
+	else
+	  ret[triIndex[tri]][2]=&e->second;
+      }
+    }
+  return ret;
+}
+
+int stlChainSplit(int code)
+/* Returns the code of the least number, not less than stltable[code], in
+ * the chain 1, 2, 4, ..., 256, 768, 2304, ..., 62208, 311040, 1555200, 7776000,
+ * each of which divides the next.
+ */
+{
+  int n=1;
+  while (n<stltable[code])
+    n*=(n<256)?2:(n<62208)?3:5;
+  return lower_bound(stltable.begin(),stltable.end(),n)-stltable.begin();
+}
+
+void setStlSplits(pointlist &pl,double maxError)
+/* Sets each edge's stlsplit so that the surface deviates from the STL mesh
+ * by at most maxError, and so that every triangle can be meshed.
+ * Choosing splits for each triangle with adjustStlSplit does not work on
+ * a large TIN: raising a side to suit one triangle makes the triangle on
+ * the other side unmeshable, and the splits escalate to millions. Instead
+ * all splits are taken from a chain in which each number divides the next,
+ * so a triangle is meshable as soon as its two least splits are equal,
+ * and no split ever exceeds the greatest minimum rounded up to the chain.
+ */
+{
+  map<int,edge>::iterator e;
+  map<int,triangle>::iterator t;
+  map<triangle *,size_t> triIndex;
+  vector<triangle *> queue;
+  vector<array<edge *,3> > allSides=triangleSides(pl);
+  array<edge *,3> sides;
+  triangle *tri;
+  initStlTable();
+  for (e=pl.edges.begin();e!=pl.edges.end();++e)
+  {
+    e->second.stlSplit(maxError);
+    e->second.stlsplit=stlChainSplit(e->second.stlmin);
+  }
+  for (t=pl.triangles.begin();t!=pl.triangles.end();++t)
+  {
+    triIndex[&t->second]=queue.size();
+    queue.push_back(&t->second);
+  }
+  while (queue.size())
+  {
+    checkCancel();
+    tri=queue.back();
+    queue.pop_back();
+    sides=allSides[triIndex[tri]];
+    if (sides[0]->stlsplit>sides[1]->stlsplit)
+      swap(sides[0],sides[1]);
+    if (sides[1]->stlsplit>sides[2]->stlsplit)
+      swap(sides[1],sides[2]);
+    if (sides[0]->stlsplit>sides[1]->stlsplit)
+      swap(sides[0],sides[1]);
+    if (sides[0]->stlsplit<sides[1]->stlsplit)
+    {
+      sides[0]->stlsplit=sides[1]->stlsplit;
+      if (sides[0]->othertri(tri))
+	queue.push_back(sides[0]->othertri(tri));
+    }
+  }
+}
+
+void writeStlBinary(ostream &file,const StlTriangle &tri)
+{
+  writelefloat(file,tri.normal.getx());
+  writelefloat(file,tri.normal.gety());
+  writelefloat(file,tri.normal.getz());
+  writelefloat(file,tri.a.getx());
+  writelefloat(file,tri.a.gety());
+  writelefloat(file,tri.a.getz());
+  writelefloat(file,tri.b.getx());
+  writelefloat(file,tri.b.gety());
+  writelefloat(file,tri.b.getz());
+  writelefloat(file,tri.c.getx());
+  writelefloat(file,tri.c.gety());
+  writelefloat(file,tri.c.getz());
+  writeleshort(file,0);
+}
+
+void writeStlText(ostream &file,const StlTriangle &tri)
+{
+  file<<"facet normal "<<ldecimal(tri.normal.getx())<<' '<<ldecimal(tri.normal.gety())
+      <<' '<<ldecimal(tri.normal.getz())<<"\n outer loop\n";
+  file<<"  vertex "<<ldecimal(tri.a.getx())<<' '<<ldecimal(tri.a.gety())<<' '<<ldecimal(tri.a.getz())<<'\n';
+  file<<"  vertex "<<ldecimal(tri.b.getx())<<' '<<ldecimal(tri.b.gety())<<' '<<ldecimal(tri.b.getz())<<'\n';
+  file<<"  vertex "<<ldecimal(tri.c.getx())<<' '<<ldecimal(tri.c.gety())<<' '<<ldecimal(tri.c.getz())<<'\n';
+  file<<" endloop\nendfacet\n";
+}
+
+/* The mesh of one TIN triangle consists of its top surface, a flat bottom,
+ * and a wall on each side that is on the boundary. A point on an edge is
+ * always computed from the edge, starting at its a end, so that both
+ * triangles sharing the edge compute bitwise the same point and the mesh
+ * is watertight.
+ */
+
+struct StlSink
+{
+  ostream &file;
+  bool asc;
+  void put(xyz a,xyz b,xyz c)
+  {
+    StlTriangle tri(a,b,c);
+    if (asc)
+      writeStlText(file,tri);
+    else
+      writeStlBinary(file,tri);
+  }
+};
+
+xyz stlEdgePoint(edge *e,segment &seg,point *from,int i,int n)
+// The ith of n+1 points along e, counting from the end at from.
+{
+  if (from!=e->a)
+    i=n-i;
+  if (i==0)
+    return *e->a;
+  if (i==n)
+    return *e->b;
+  return seg.station(seg.length()*i/n);
+}
+
+int64_t stlTriangleCount(const array<edge *,3> &sides)
+{
+  int64_t ret=0;
+  int i,perim=0;
+  for (i=0;i<3;i++)
+  {
+    if (!sides[i]->tria || !sides[i]->trib)
+    {
+      ret+=2*stltable[sides[i]->stlsplit];
+      perim+=stltable[sides[i]->stlsplit];
+    }
+    else
+      perim++;
+  }
+  ret+=stlProd(sides[0]->stlsplit,sides[1]->stlsplit,sides[2]->stlsplit);
+  ret+=(perim==3)?1:perim; // stlTriangleMesh fans the bottom only if perim>3
+  return ret;
+}
+
+void stlTriangleMesh(triangle &tri,const array<edge *,3> &sides,const StlFrame &frame,StlSink &sink)
+{
+  array<point *,3> corner={tri.a,tri.b,tri.c};
+  array<segment,3> seg;
+  array<int,3> split;
+  vector<xyz> above,below,perim;
+  xyz pnt,center;
+  int i,j,k,r,n,m,longSide=0,ia,ib;
+  int64_t nt,nb;
+  for (i=0;i<3;i++)
+  {
+    seg[i]=sides[i]->getsegment();
+    split[i]=stltable[sides[i]->stlsplit];
+    if (split[i]>split[longSide])
+      longSide=i;
+  }
+  /* Rotate so that A is opposite the long side, which is split into m=k*n
+   * pieces. Row r of the mesh is parallel to BC at r/n of the way from A,
+   * with r*k+1 points, and the strip between rows r-1 and r has (2r-1)*k
+   * triangles.
+   */
+  point *A=corner[longSide],*B=corner[(longSide+1)%3],*C=corner[(longSide+2)%3];
+  edge *eAB=sides[(longSide+2)%3],*eCA=sides[(longSide+1)%3],*eBC=sides[longSide];
+  segment &sAB=seg[(longSide+2)%3],&sCA=seg[(longSide+1)%3],&sBC=seg[longSide];
+  m=split[longSide];
+  n=split[(longSide+1)%3];
+  k=m/n;
+  above.push_back(frame.toPrinter(*A));
+  for (r=1;r<=n;r++)
+  {
+    below.clear();
+    for (j=0;j<=r*k;j++)
+    {
+      if (r==n)
+	pnt=stlEdgePoint(eBC,sBC,B,j,m);
+      else if (j==0)
+	pnt=stlEdgePoint(eAB,sAB,A,r,n);
+      else if (j==r*k)
+	pnt=stlEdgePoint(eCA,sCA,C,n-r,n);
+      else
+      {
+	pnt=xyz(*A)*(1-(double)r/n)+xyz(*B)*((double)r/n-(double)j/m)+xyz(*C)*((double)j/m);
+	pnt=xyz(xy(pnt),tri.elevation(pnt));
+      }
+      below.push_back(frame.toPrinter(pnt));
+    }
+    nt=above.size()-1;
+    nb=below.size()-1;
+    for (ia=ib=0;ia<nt || ib<nb;)
+      if (ia==nt || (ib<nb && (ib+1)*nt<=(ia+1)*nb))
+      {
+	sink.put(above[ia],below[ib],below[ib+1]);
+	ib++;
+      }
+      else
+      {
+	sink.put(above[ia],below[ib],above[ia+1]);
+	ia++;
+      }
+    swap(above,below);
+  }
+  // Walls and bottom
+  for (i=0;i<3;i++)
+  {
+    point *from=corner[(i+1)%3];
+    bool onBoundary=!sides[i]->tria || !sides[i]->trib;
+    int pieces=onBoundary?split[i]:1;
+    xyz top0,top1,bot0,bot1;
+    for (j=0;j<pieces;j++)
+    {
+      top0=frame.toPrinter(onBoundary?stlEdgePoint(sides[i],seg[i],from,j,pieces):*from);
+      perim.push_back(xyz(xy(top0),0));
+      if (onBoundary)
+      {
+	top1=frame.toPrinter(stlEdgePoint(sides[i],seg[i],from,j+1,pieces));
+	bot0=xyz(xy(top0),0);
+	bot1=xyz(xy(top1),0);
+	sink.put(top0,bot0,bot1);
+	sink.put(top0,bot1,top1);
+      }
+    }
+  }
+  if (perim.size()==3)
+    sink.put(perim[0],perim[2],perim[1]);
+  else
+  { // Fan the bottom from the centroid, so that no triangle is degenerate.
+    center=(frame.toPrinter(*A)+frame.toPrinter(*B)+frame.toPrinter(*C))/3;
+    center=xyz(xy(center),0);
+    for (i=0;i<perim.size();i++)
+      sink.put(center,perim[(i+1)%perim.size()],perim[i]);
+  }
+}
+
+long long writeStlMesh(ostream &file,pointlist &pl,const StlFrame &frame,bool asc,int nthreads)
+/* Writes the mesh of the whole TIN, which must have stlsplit set on all edges.
+ * The TIN triangles are divided into chunks of about stlChunkSize STL
+ * triangles. Worker threads mesh chunks into their own buffers, then write
+ * them to the file in order, so only a few chunks are in memory at once.
+ * Returns the number of STL triangles written.
+ */
+{
+  const int64_t stlChunkSize=65536;
+  map<int,triangle>::iterator t;
+  vector<triangle *> tris;
+  vector<array<edge *,3> > sides;
+  vector<size_t> chunkStart;
+  int64_t total=0,chunkTotal=0,thisCount;
+  size_t i,nextToWrite=0;
+  atomic<size_t> nextChunk(0);
+  mutex writeMutex;
+  condition_variable written;
+  vector<thread> threads;
+  atomic<bool> *cancel=cancelFlag();
+  ActionProgress *progress=actionProgress();
+  atomic<bool> failed(false);
+  exception_ptr error;
+  char header[80];
+  for (t=pl.triangles.begin();t!=pl.triangles.end();++t)
+    tris.push_back(&t->second);
+  sides=triangleSides(pl);
+  chunkStart.push_back(0);
+  for (i=0;i<tris.size();i++)
+  {
+    thisCount=stlTriangleCount(sides[i]);
+    total+=thisCount;
+    chunkTotal+=thisCount;
+    if (chunkTotal>=stlChunkSize)
+    {
+      chunkStart.push_back(i+1);
+      chunkTotal=0;
+    }
+  }
+  if (chunkStart.back()<tris.size())
+    chunkStart.push_back(tris.size());
+  if (asc)
+    file<<"solid bezitopo\n";
+  else
+  {
+    if (total>UINT32_MAX)
+      throw BeziExcept(fileError);
+    memset(header,0,sizeof(header));
+    strcpy(header,"Bezitopo binary STL");
+    file.write(header,sizeof(header));
+    writeleint(file,total);
+  }
+  auto fail=[&](exception_ptr e)
+  { // Keeps the first exception and wakes any thread waiting to write.
+    lock_guard<mutex> lock(writeMutex);
+    if (!failed)
+      error=e;
+    failed=true;
+    written.notify_all();
+  };
+  auto work=[&]()
+  {
+    size_t chunk,j;
+    /* A chunk once taken is always written, so that no thread waits for a
+     * chunk that will never come; on cancel, threads just stop taking them.
+     * If meshing or writing a chunk throws, the others stop at once.
+     */
+    try
+    {
+      while (!isCanceled(cancel) && !failed && (chunk=nextChunk++)+1<chunkStart.size())
+      {
+	ostringstream buffer;
+	StlSink sink={buffer,asc};
+	for (j=chunkStart[chunk];j<chunkStart[chunk+1];j++)
+	  stlTriangleMesh(*tris[j],sides[j],frame,sink);
+	unique_lock<mutex> lock(writeMutex);
+	written.wait(lock,[&]{return nextToWrite==chunk || failed;});
+	if (failed)
+	  break;
+	file<<buffer.str();
+	nextToWrite++;
+	setProgress(progress,nextToWrite,chunkStart.size()-1);
+	written.notify_all();
+      }
+    }
+    catch (...)
+    {
+      fail(current_exception());
+    }
+  };
+  if (nthreads<=0)
+    nthreads=thread::hardware_concurrency();
+  try
+  {
+    for (i=1;i<nthreads && i+1<chunkStart.size();i++)
+      threads.push_back(thread(work));
+  }
+  catch (...)
+  {
+    fail(current_exception());
+  }
+  work();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+  if (error)
+    rethrow_exception(error);
+  checkCancel();
+  if (asc)
+    file<<"endsolid bezitopo\n";
+  return total;
+}
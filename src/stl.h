@@ -22,13 +22,24 @@
  * <http://www.gnu.org/licenses/>.
  */
 
+#ifndef STL_H
+#define STL_H
 #include <array>
+#include <cstdint>
 #include <vector>
+#include <iostream>
 #include "point.h"
 #include "config.h"
 
+#define P3S_RECTANGULAR 0
+#define P3S_ROUND 1
+
+class pointlist;
+
 extern std::vector<int> stltable; // used in bezier.cpp
 void initStlTable();
+int64_t stlProd(int i,int j,int k);
+bool stlValid(int i,int j,int k);
 std::array<int,3> adjustStlSplit(std::array<int,3> stlSplit,std::array<int,3> stlMin);
 
 struct StlTriangle
@@ -41,8 +52,31 @@ struct StlTriangle
 
 struct Printer3dSize
 {
-  int shape;
+  int shape; // P3S_RECTANGULAR or P3S_ROUND; if round, x is the diameter
   double x,y,z; // all in millimeters
   unsigned scaleNum,scaleDenom;
   double minBase;
+  double resolution; // greatest allowed deviation from the surface, in mm
+};
+
+struct StlFrame
+/* Transforms ground coordinates in meters to printer coordinates in
+ * millimeters. The TIN is turned, scaled, and moved so that it is centered
+ * on the printer bed and its lowest point is minBase above the bed.
+ */
+{
+  xy turn; // cos and sin of the bearing
+  xy groundCenter,printerCenter;
+  double scale; // millimeters per meter
+  double low,minBase;
+  xyz toPrinter(xyz pnt) const;
 };
+
+extern Printer3dSize printer3d;
+
+StlFrame turnFitInPrinter(pointlist &pl,Printer3dSize &printer,bool feet,bool roundScale);
+void setStlSplits(pointlist &pl,double maxError);
+void writeStlBinary(std::ostream &file,const StlTriangle &tri);
+void writeStlText(std::ostream &file,const StlTriangle &tri);
+long long writeStlMesh(std::ostream &file,pointlist &pl,const StlFrame &frame,bool asc,int nthreads=0);
+#endif
@@ -0,0 +1,342 @@
+/******************************************************/
+/*                                                    */
+/* threads.cpp - file I/O threads                     */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <atomic>
+#include <fstream>
+#include <cmath>
+#include "threads.h"
+#include "readtin.h"
+#include "tintext.h"
+#include "fileio.h"
+#include "except.h"
+#include "cancel.h"
+
+using namespace std;
+
+mutex actMutex;
+condition_variable actCond;
+deque<ThreadAction> actQueue;
+vector<ThreadAction> actDone;
+vector<thread> ioThreads;
+map<int,atomic<bool> *> runningFlags; // cancel flags of running actions, by id
+map<int,ActionProgress *> runningProgress;
+function<void()> progressNotify;
+int runningReads=0,runningWrites=0,runningStl=0,nextActionId=0,totalActions=0;
+bool stopIo=false;
+
+ThreadAction::ThreadAction()
+{
+  opcode=id=result=readResult=flags=plnum=0;
+  asc=false;
+  param1=1;
+  doc=nullptr;
+}
+
+bool isReadAction(int opcode)
+{
+  return opcode<ACT_WRITE_BEZ;
+}
+
+void doAction(ThreadAction &act)
+/* Runs in an I/O thread. Exceptions are caught and their numbers returned
+ * in act.result, so that the GUI can report them.
+ */
+{
+  ofstream ofile;
+  ifstream ifile;
+  string line;
+  int i;
+  double size,done=0;
+  try
+  {
+    switch (act.opcode)
+    {
+      case ACT_READ_TIN:
+	act.newDoc->makepointlist(1);
+	act.readResult=readTinFile(act.newDoc->pl[1],act.filename,act.param1);
+	break;
+      case ACT_READ_PNEZD:
+	act.newDoc->readpnezd(act.filename);
+	break;
+      case ACT_READ_BREAKLINES:
+	act.newDoc->makepointlist(1);
+	ifile.open(act.filename,fstream::in);
+	size=streamSize(ifile);
+	while (!ifile.eof() && !ifile.fail())
+	{
+	  checkCancel(done,size);
+	  getline(ifile,line);
+	  done+=line.length()+1;
+	  act.newDoc->pl[1].stringToBreakline(line);
+	}
+	if (!ifile.eof())
+	  throw BeziExcept(fileError);
+	break;
+      case ACT_READ_GEOID:
+	ifile.open(act.filename,ios::binary);
+	act.newGhead->readBinary(ifile);
+	act.newCube->scale=pow(2,act.newGhead->logScale);
+	act.newCube->readBinary(ifile);
+	break;
+      case ACT_WRITE_BEZ:
+	ofile.open(act.filename,fstream::out);
+	act.doc->writeXml(ofile);
+	ofile.close();
+	if (ofile.fail())
+	  throw BeziExcept(fileError);
+	break;
+      case ACT_WRITE_DXF:
+	writeDxf(act.filename,act.doc->pl[act.plnum],act.asc,act.param1,act.flags);
+	break;
+      case ACT_WRITE_TIN_TEXT:
+	writeTinText(act.filename,act.doc->pl[act.plnum],act.param1,act.flags);
+	break;
+      case ACT_WRITE_STL:
+	writeStl(act.filename,act.doc->pl[act.plnum],act.asc,act.param1,act.flags);
+	break;
+      case ACT_WRITE_BREAKLINES:
+	ofile.open(act.filename,fstream::out);
+	for (i=0;i<act.doc->pl[act.plnum].type0Breaklines.size();i++)
+	{
+	  checkCancel(i,act.doc->pl[act.plnum].type0Breaklines.size());
+	  act.doc->pl[act.plnum].type0Breaklines[i].writeText(ofile);
+	  ofile<<endl;
+	}
+	ofile.close();
+	if (ofile.fail())
+	  throw BeziExcept(fileError);
+	break;
+    }
+  }
+  catch (BeziExcept &e)
+  {
+    act.result=e.getNumber();
+  }
+  catch (...)
+  {
+    act.result=fileerror;
+  }
+}
+
+bool canStart(const ThreadAction &act)
+/* Call with actMutex locked. Actions start in the order they were queued,
+ * so a read waits for earlier writes of the old document to finish.
+ * STL writes run one at a time, as they set stlsplit on the TIN's edges.
+ */
+{
+  if (isReadAction(act.opcode))
+    return runningReads+runningWrites==0;
+  else if (act.opcode==ACT_WRITE_STL)
+    return runningReads+runningStl==0;
+  else
+    return runningReads==0;
+}
+
+void ioThreadLoop()
+{
+  ThreadAction act;
+  atomic<bool> cancel;
+  bool canceled;
+  unique_lock<mutex> lock(actMutex);
+  while (true)
+  {
+    actCond.wait(lock,[]{return stopIo || (actQueue.size() && canStart(actQueue.front()));});
+    if (stopIo)
+      break;
+    act=actQueue.front();
+    actQueue.pop_front();
+    if (isReadAction(act.opcode))
+      runningReads++;
+    else
+      runningWrites++;
+    if (act.opcode==ACT_WRITE_STL)
+      runningStl++;
+    cancel=false;
+    runningFlags[act.id]=&cancel;
+    runningProgress[act.id]=act.progress.get();
+    lock.unlock();
+    cancelFlag()=&cancel;
+    actionProgress()=act.progress.get();
+    doAction(act);
+    cancelFlag()=nullptr;
+    actionProgress()=nullptr;
+    lock.lock();
+    if (isReadAction(act.opcode))
+      runningReads--;
+    else
+      runningWrites--;
+    if (act.opcode==ACT_WRITE_STL)
+      runningStl--;
+    runningFlags.erase(act.id);
+    runningProgress.erase(act.id);
+    canceled=cancel;
+    if (canceled)
+    {
+      act.result=ACT_CANCELED;
+      act.newDoc.reset();
+      act.newGhead.reset();
+      act.newCube.reset();
+      if (!isReadAction(act.opcode))
+	deleteFile(act.filename);
+    }
+    actDone.push_back(act);
+    actCond.notify_all();
+  }
+}
+
+void startIoThreads(int n,function<void()> progressed)
+/* Starts n I/O threads, or as many as there are cores (at least two) if n
+ * is 0. Two threads are enough to write two formats at once. progressed is
+ * called in an I/O thread whenever an action's progress changes.
+ */
+{
+  int i;
+  progressNotify=progressed;
+  if (n<=0)
+    n=thread::hardware_concurrency();
+  if (n<2)
+    n=2;
+  stopIo=false;
+  for (i=0;i<n;i++)
+    ioThreads.push_back(thread(ioThreadLoop));
+}
+
+void stopIoThreads()
+/* Waits for running actions to finish. Queued actions are dropped. */
+{
+  int i;
+  actMutex.lock();
+  stopIo=true;
+  actQueue.clear();
+  actCond.notify_all();
+  actMutex.unlock();
+  for (i=0;i<ioThreads.size();i++)
+    ioThreads[i].join();
+  ioThreads.clear();
+  actDone.clear();
+  totalActions=0;
+}
+
+int enqueueAction(ThreadAction a)
+/* Returns the id of the action. Read actions get a new document, header,
+ * or cube here, so the caller need not allocate them.
+ */
+{
+  lock_guard<mutex> lock(actMutex);
+  a.id=++nextActionId;
+  a.result=0;
+  a.progress=make_shared<ActionProgress>();
+  a.progress->notify=progressNotify;
+  if (!a.newDoc && (a.opcode==ACT_READ_TIN || a.opcode==ACT_READ_PNEZD || a.opcode==ACT_READ_BREAKLINES))
+    a.newDoc=make_shared<document>();
+  if (a.opcode==ACT_READ_GEOID)
+  {
+    a.newGhead=make_shared<geoheader>();
+    a.newCube=make_shared<cubemap>();
+  }
+  actQueue.push_back(a);
+  totalActions++;
+  actCond.notify_all();
+  return a.id;
+}
+
+bool finishedAction(ThreadAction &a)
+/* If an action has finished, puts it in a and returns true. The GUI calls
+ * this from a timer and swaps in what was read.
+ */
+{
+  lock_guard<mutex> lock(actMutex);
+  bool ret=actDone.size()>0;
+  if (ret)
+  {
+    a=actDone[0];
+    actDone.erase(actDone.begin());
+    if (actQueue.empty() && runningReads+runningWrites==0 && actDone.empty())
+      totalActions=0;
+  }
+  return ret;
+}
+
+void cancelActions()
+/* Queued actions are finished at once as canceled. Running actions have
+ * their cancel flags set, which makes them stop at the next checkCancel;
+ * their results are discarded and any file written is deleted.
+ */
+{
+  map<int,atomic<bool> *>::iterator i;
+  lock_guard<mutex> lock(actMutex);
+  while (actQueue.size())
+  {
+    actQueue.front().result=ACT_CANCELED;
+    actDone.push_back(actQueue.front());
+    actQueue.pop_front();
+  }
+  for (i=runningFlags.begin();i!=runningFlags.end();++i)
+    *i->second=true;
+}
+
+int actionsPending()
+// Actions queued or running, not counting finished ones not yet picked up.
+{
+  lock_guard<mutex> lock(actMutex);
+  return actQueue.size()+runningReads+runningWrites;
+}
+
+int actionsTotal()
+// Actions enqueued since the queue was last empty.
+{
+  lock_guard<mutex> lock(actMutex);
+  return totalActions;
+}
+
+int actionsProgress()
+/* Returns how much of the actions counted by actionsTotal is done, in
+ * thousandths of an action.
+ */
+{
+  map<int,ActionProgress *>::iterator i;
+  int ret;
+  lock_guard<mutex> lock(actMutex);
+  ret=1000*(totalActions-actQueue.size()-runningReads-runningWrites);
+  for (i=runningProgress.begin();i!=runningProgress.end();++i)
+    ret+=i->second->permille;
+  return ret;
+}
+
+int writesPending()
+/* If this is nonzero, the document must not be changed, as a thread is
+ * reading it.
+ */
+{
+  int i,ret;
+  lock_guard<mutex> lock(actMutex);
+  ret=runningWrites;
+  for (i=0;i<actQueue.size();i++)
+    ret+=!isReadAction(actQueue[i].opcode);
+  return ret;
+}
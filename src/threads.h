@@ -0,0 +1,81 @@
+/******************************************************/
+/*                                                    */
+/* threads.h - file I/O threads                       */
+/*                                                    */
+/******************************************************/
+/* Copyright 2022 Pierre Abbat.
+ * This file is part of Bezitopo.
+ *
+ * Bezitopo is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Bezitopo is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License and Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * and Lesser General Public License along with Bezitopo. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef THREADS_H
+#define THREADS_H
+#include <string>
+#include <memory>
+#include "document.h"
+#include "geoid.h"
+#include "cancel.h"
+
+#define ACT_READ_TIN 1
+#define ACT_READ_PNEZD 2
+#define ACT_READ_BREAKLINES 3
+#define ACT_READ_GEOID 4
+#define ACT_WRITE_BEZ 16
+#define ACT_WRITE_DXF 17
+#define ACT_WRITE_TIN_TEXT 18
+#define ACT_WRITE_STL 19
+#define ACT_WRITE_BREAKLINES 20
+/* Actions below ACT_WRITE_BEZ read a file into a new document or geoid,
+ * which the GUI swaps in when it picks up the finished action. Only one of
+ * them runs at a time, and no write runs alongside it. Write actions read
+ * the canvas's document, which must not be changed until they finish;
+ * several writes, e.g. different formats of the same TIN, may run at once,
+ * except that STL writes, which set the edges' stlsplit, run one at a time.
+ * Canceling a running action stops it at its next checkCancel (cancel.h),
+ * where it also reports its progress.
+ */
+
+#define ACT_CANCELED -1
+
+struct ThreadAction
+{
+  int opcode;
+  int id;
+  int result; // 0 if done, exception number if failed, or ACT_CANCELED
+  int readResult; // what readTinFile returned
+  int flags;
+  int plnum;
+  bool asc;
+  double param1; // length unit
+  std::string filename;
+  document *doc; // the document to be written
+  std::shared_ptr<document> newDoc; // the document read
+  std::shared_ptr<geoheader> newGhead;
+  std::shared_ptr<cubemap> newCube;
+  std::shared_ptr<ActionProgress> progress;
+  ThreadAction();
+};
+
+void startIoThreads(int n=0,std::function<void()> progressed=nullptr);
+void stopIoThreads();
+int enqueueAction(ThreadAction a);
+bool finishedAction(ThreadAction &a);
+void cancelActions();
+int actionsPending();
+int actionsTotal();
+int actionsProgress();
+int writesPending();
+#endif
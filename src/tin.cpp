@@ -55,6 +55,7 @@ edge::edge()
   extrema[0]=extrema[1]=NAN;
   broken=contour=stlsplit=0;
   flipcnt=0;
+  stamp=0;
 }
 
 edge* edge::next(point* end)
@@ -139,6 +140,7 @@ void edge::flip(pointlist *topopoints)
 {
   edge *temp1,*temp2;
   int i,size;
+  topopoints->edgeIndex.clear();
   size=topopoints->points.size();
   for (i=0;i<size && a->line->next(a)!=this;i++)
     a->line=a->line->next(a);
@@ -442,9 +444,9 @@ void edge::stlSplit(double maxError)
 {
   segment thisSeg=getsegment();
   double maxAccel,error;
-  maxAccel=thisSeg.accel(0);
-  if (thisSeg.accel(length())>maxAccel)
-    maxAccel=thisSeg.accel(length());
+  maxAccel=fabs(thisSeg.accel(0));
+  if (fabs(thisSeg.accel(length()))>maxAccel)
+    maxAccel=fabs(thisSeg.accel(length()));
   error=sqr(length())*maxAccel/4;
   for (stlmin=0;stlmin<216 && error>maxError*sqr(stltable[stlmin]);stlmin++);
   if (stlmin==216)
@@ -549,6 +551,7 @@ bool pointlist::tryStartPoint(PostScript &ps,xy &startpnt)
   bool fail;
   maxedges=3*points.size()-6;
   edges.clear();
+  edgeIndex.clear();
   convexhull.clear();
   for (m=0;m<100;m++)
   {
@@ -941,6 +944,7 @@ void pointlist::maketin(string filename,bool colorfibaster)
     startpnt+=i->second;
   startpnt/=points.size();
   edges.clear();
+  edgeIndex.clear();
   splitBreaklines();
   /* startpnt has to be within or out the side of the triangle formed
    * by the three nearest points. In a 100-point asteraceous pattern,
@@ -1086,6 +1090,7 @@ void pointlist::maketriangles()
   point *a,*b,*c,*d;
   edge *e;
   triangle cib,*t;
+  clearLocalSets();
   triangles.clear();
   for (i=0;i<edges.size();i++)
   {
@@ -67,6 +67,7 @@ public:
    * when writing an STL file.
    */
   short flipcnt;
+  unsigned stamp; // generation of local sets this edge is in
   edge();
   void flip(pointlist *topopoints);
   void reverse();
@@ -29,6 +29,7 @@
 #include "textfile.h"
 #include "ldecimal.h"
 #include "firstarg.h"
+#include "cancel.h"
 using namespace std;
 
 bool readTinText(string inputFile,pointlist &pl,double unit)
@@ -132,6 +133,7 @@ void writeTinText(string outputFile,pointlist &pl,double outUnit,int flags)
   tinFile<<"TIN\nBEGT\nVERT "<<pl.lastPointNum()<<endl;
   for (i=1;i<=pl.lastPointNum();i++)
   {
+    checkCancel(i,pl.lastPointNum()+pl.triangles.size());
     if (pl.pointExists(i))
     {
       tinFile<<ldecimal(pl.points[i].getx()/outUnit)<<' ';
@@ -147,6 +149,7 @@ void writeTinText(string outputFile,pointlist &pl,double outUnit,int flags)
   for (i=0;i<pl.triangles.size();i++)
     if (pl.shouldWrite(i,flags,false))
     {
+      checkCancel(pl.lastPointNum()+i,pl.lastPointNum()+pl.triangles.size());
       tinFile<<pl.revpoints[pl.triangles[i].a]<<' ';
       tinFile<<pl.revpoints[pl.triangles[i].b]<<' ';
       tinFile<<pl.revpoints[pl.triangles[i].c]<<'\n';
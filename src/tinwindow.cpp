@@ -117,6 +117,11 @@ void TinWindow::makeActions()
   sizeToFitAction->setText(tr("Size to Fit"));
   viewMenu->addAction(sizeToFitAction);
   connect(sizeToFitAction,SIGNAL(triggered(bool)),canvas,SLOT(sizeToFit()));
+  paintStatsAction=new QAction(this);
+  paintStatsAction->setText(tr("Show painting statistics"));
+  paintStatsAction->setCheckable(true);
+  viewMenu->addAction(paintStatsAction);
+  connect(paintStatsAction,SIGNAL(triggered(bool)),canvas,SLOT(setShowStats(bool)));
   // File menu
   openAction=new QAction(this);
   openAction->setIcon(QIcon::fromTheme("document-open"));
@@ -177,6 +182,14 @@ void TinWindow::makeActions()
   exportTinTxtAction->setText(tr("TIN Text"));
   exportMenu->addAction(exportTinTxtAction);
   connect(exportTinTxtAction,SIGNAL(triggered(bool)),this,SLOT(exportTinTxt()));
+  exportStlTxtAction=new QAction(this);
+  exportStlTxtAction->setText(tr("STL Text"));
+  exportMenu->addAction(exportStlTxtAction);
+  connect(exportStlTxtAction,SIGNAL(triggered(bool)),this,SLOT(exportStlTxt()));
+  exportStlBinAction=new QAction(this);
+  exportStlBinAction->setText(tr("STL Binary"));
+  exportMenu->addAction(exportStlBinAction);
+  connect(exportStlBinAction,SIGNAL(triggered(bool)),this,SLOT(exportStlBin()));
   // Contour menu
   makeTinAction=new QAction(this);
   //makeTinAction->setIcon(QIcon(":/maketin.png"));
@@ -335,8 +348,7 @@ void TinWindow::exportDxfTxt()
   int dialogResult;
   QStringList files;
   string fileName;
-  double unit;
-  //ThreadAction ta;
+  ThreadAction ta;
   fileDialog=new QFileDialog(this);
   fileDialog->setWindowTitle(tr("Export TIN and Contours as DXF Text"));
   fileDialog->setFileMode(QFileDialog::AnyFile);
@@ -348,13 +360,12 @@ void TinWindow::exportDxfTxt()
   {
     files=fileDialog->selectedFiles();
     fileName=files[0].toStdString();
-    unit=canvas->getDoc()->ms.toCoherent(1,LENGTH);
-    writeDxf(fileName,canvas->getDoc()->pl[1],true,unit,0);
-    //ta.param1=lengthUnit;
-    //ta.filename=fileName;
-    //ta.flags=exportEmpty+2*onlyInBoundary;
-    //ta.opcode=ACT_WRITE_TIN;
-    //enqueueAction(ta);
+    ta.param1=canvas->getDoc()->ms.toCoherent(1,LENGTH);
+    ta.filename=fileName;
+    ta.plnum=1;
+    ta.asc=true;
+    ta.opcode=ACT_WRITE_DXF;
+    canvas->startIo(ta);
   }
   delete fileDialog;
   fileDialog=nullptr;
@@ -365,8 +376,7 @@ void TinWindow::exportDxfBin()
   int dialogResult;
   QStringList files;
   string fileName;
-  double unit;
-  //ThreadAction ta;
+  ThreadAction ta;
   fileDialog=new QFileDialog(this);
   fileDialog->setWindowTitle(tr("Export TIN and Contours as DXF Text"));
   fileDialog->setFileMode(QFileDialog::AnyFile);
@@ -378,13 +388,12 @@ void TinWindow::exportDxfBin()
   {
     files=fileDialog->selectedFiles();
     fileName=files[0].toStdString();
-    unit=canvas->getDoc()->ms.toCoherent(1,LENGTH);
-    writeDxf(fileName,canvas->getDoc()->pl[1],false,unit,0);
-    //ta.param1=lengthUnit;
-    //ta.filename=fileName;
-    //ta.flags=exportEmpty+2*onlyInBoundary;
-    //ta.opcode=ACT_WRITE_TIN;
-    //enqueueAction(ta);
+    ta.param1=canvas->getDoc()->ms.toCoherent(1,LENGTH);
+    ta.filename=fileName;
+    ta.plnum=1;
+    ta.asc=false;
+    ta.opcode=ACT_WRITE_DXF;
+    canvas->startIo(ta);
   }
   delete fileDialog;
   fileDialog=nullptr;
@@ -395,8 +404,7 @@ void TinWindow::exportTinTxt()
   int dialogResult;
   QStringList files;
   string fileName;
-  double unit;
-  //ThreadAction ta;
+  ThreadAction ta;
   fileDialog=new QFileDialog(this);
   fileDialog->setWindowTitle(tr("Export TIN as Text (AquaVeo)"));
   fileDialog->setFileMode(QFileDialog::AnyFile);
@@ -408,13 +416,67 @@ void TinWindow::exportTinTxt()
   {
     files=fileDialog->selectedFiles();
     fileName=files[0].toStdString();
-    unit=canvas->getDoc()->ms.toCoherent(1,LENGTH);
-    writeTinText(fileName,canvas->getDoc()->pl[1],unit,0);
-    //ta.param1=lengthUnit;
-    //ta.filename=fileName;
-    //ta.flags=exportEmpty+2*onlyInBoundary;
-    //ta.opcode=ACT_WRITE_TIN;
-    //enqueueAction(ta);
+    ta.param1=canvas->getDoc()->ms.toCoherent(1,LENGTH);
+    ta.filename=fileName;
+    ta.plnum=1;
+    ta.opcode=ACT_WRITE_TIN_TEXT;
+    canvas->startIo(ta);
+  }
+  delete fileDialog;
+  fileDialog=nullptr;
+}
+
+void TinWindow::exportStlTxt()
+{
+  int dialogResult;
+  QStringList files;
+  string fileName;
+  ThreadAction ta;
+  fileDialog=new QFileDialog(this);
+  fileDialog->setWindowTitle(tr("Export TIN as STL Text"));
+  fileDialog->setFileMode(QFileDialog::AnyFile);
+  fileDialog->setAcceptMode(QFileDialog::AcceptSave);
+  fileDialog->selectFile(QString::fromStdString(saveFileName+".stl"));
+  fileDialog->setNameFilter(tr("(*.stl)"));
+  dialogResult=fileDialog->exec();
+  if (dialogResult)
+  {
+    files=fileDialog->selectedFiles();
+    fileName=files[0].toStdString();
+    ta.param1=canvas->getDoc()->ms.toCoherent(1,LENGTH);
+    ta.filename=fileName;
+    ta.plnum=1;
+    ta.asc=true;
+    ta.opcode=ACT_WRITE_STL;
+    canvas->startIo(ta);
+  }
+  delete fileDialog;
+  fileDialog=nullptr;
+}
+
+void TinWindow::exportStlBin()
+{
+  int dialogResult;
+  QStringList files;
+  string fileName;
+  ThreadAction ta;
+  fileDialog=new QFileDialog(this);
+  fileDialog->setWindowTitle(tr("Export TIN as STL Binary"));
+  fileDialog->setFileMode(QFileDialog::AnyFile);
+  fileDialog->setAcceptMode(QFileDialog::AcceptSave);
+  fileDialog->selectFile(QString::fromStdString(saveFileName+".stl"));
+  fileDialog->setNameFilter(tr("(*.stl)"));
+  dialogResult=fileDialog->exec();
+  if (dialogResult)
+  {
+    files=fileDialog->selectedFiles();
+    fileName=files[0].toStdString();
+    ta.param1=canvas->getDoc()->ms.toCoherent(1,LENGTH);
+    ta.filename=fileName;
+    ta.plnum=1;
+    ta.asc=false;
+    ta.opcode=ACT_WRITE_STL;
+    canvas->startIo(ta);
   }
   delete fileDialog;
   fileDialog=nullptr;
@@ -59,6 +59,8 @@ public slots:
   void exportDxfTxt();
   void exportDxfBin();
   void exportTinTxt();
+  void exportStlTxt();
+  void exportStlBin();
   void gridToLatlong();
   void latlongToGrid();
   void aboutProgram();
@@ -74,7 +76,7 @@ private:
   std::vector<MeasureButton *> measureButtons;
   LatlongFactorDialog *llDialog;
   GridFactorDialog *grDialog;
-  QAction *sizeToFitAction;
+  QAction *sizeToFitAction,*paintStatsAction;
   QAction *openAction,*saveAction,*saveAsAction,*exitAction;
   QAction *asterAction,*importPnezdAction,*importCriteriaAction;
   QAction *exportDxfTxtAction,*exportDxfBinAction,*exportTinTxtAction;
@@ -82,12 +82,24 @@ TopoCanvas::TopoCanvas(QWidget *parent):QWidget(parent)
   progressDialog->reset();
   ciDialog=new ContourIntervalDialog(this);
   timer=new QTimer(this);
+  ioProgressDialog=new QProgressDialog(this);
+  ioProgressDialog->reset();
+  ioProgressDialog->setWindowModality(Qt::NonModal);
+  ioProgressDialog->setWindowTitle(tr("Reading and writing files"));
+  connect(ioProgressDialog,SIGNAL(canceled()),this,SLOT(ioCancel()));
+  ioTimer=new QTimer(this);
+  connect(ioTimer,SIGNAL(timeout()),this,SLOT(checkIoActions()));
+  connect(this,SIGNAL(ioProgress()),this,SLOT(checkIoActions()),Qt::QueuedConnection);
+  ioReads=0;
+  startIoThreads(0,[this]{emit ioProgress();});
   plnum=-1;
   goal=DONE;
   rotation=0;
   tipXyz=false;
   showDelaunay=true;
   allowFlip=true;
+  showStats=false;
+  contourCache.startThreads([this]{QMetaObject::invokeMethod(this,"update",Qt::QueuedConnection);});
   //for (i=0;i<doc.pl[1].edges.size();i++)
     //doc.pl[1].edges[i].dump(&doc.pl[1]);
   show();
@@ -96,6 +108,12 @@ TopoCanvas::TopoCanvas(QWidget *parent):QWidget(parent)
   contoursShouldBeCurvy=true;
 }
 
+TopoCanvas::~TopoCanvas()
+{
+  contourCache.stopThreads();
+  stopIoThreads();
+}
+
 QPointF TopoCanvas::worldToWindow(xy pnt)
 {
   pnt.roscat(worldCenter,rotation,zoomratio(scale)*windowSize,windowCenter);
@@ -210,6 +228,12 @@ void TopoCanvas::setShowDelaunay(bool showd)
   showDelaunay=showd;
 }
 
+void TopoCanvas::setShowStats(bool show)
+{
+  showStats=show;
+  update();
+}
+
 void TopoCanvas::setAllowFlip(bool allow)
 {
   allowFlip=allow;
@@ -303,10 +327,9 @@ void TopoCanvas::open()
  * When I implement reading Bezitopo files, I'll duplicate it.
  */
 {
-  int dialogResult,readResult;
+  int dialogResult;
   QStringList files;
-  string fileName;
-  double unit;
+  ThreadAction ta;
   fileDialog->setWindowTitle(tr("Load TIN"));
   fileDialog->setFileMode(QFileDialog::ExistingFile);
   fileDialog->setAcceptMode(QFileDialog::AcceptOpen);
@@ -315,44 +338,18 @@ void TopoCanvas::open()
   if (dialogResult)
   {
     files=fileDialog->selectedFiles();
-    fileName=files[0].toStdString();
-    doc.pl.clear();
-    doc.makepointlist(1);
-    unit=doc.ms.toCoherent(1,LENGTH);
-    setCursor(Qt::WaitCursor);
-    readResult=readTinFile(doc.pl[1],fileName,unit);
-    plnum=1;
-    sizeToFit();
-    setCursor(Qt::ArrowCursor);
-    if (readResult<2)
-    {
-      fileChanged("");
-      QMessageBox msgBox(this);
-      if (readResult)
-	msgBox.setText(tr("The TIN file is corrupt."));
-      else
-	msgBox.setText(tr("The file does not appear to contain a TIN."));
-      msgBox.setStandardButtons(QMessageBox::Ok);
-      msgBox.setIcon(QMessageBox::Warning);
-      msgBox.exec();
-    }
-    else
-      fileChanged(fileName);
-    tinerror=startPointTries=passCount=0;
-    pointsValid=true;
-    tinValid=true;
-    surfaceValid=true;
-    roughContoursValid=false;
+    ta.filename=files[0].toStdString();
+    ta.param1=doc.ms.toCoherent(1,LENGTH);
+    ta.opcode=ACT_READ_TIN;
+    startIo(ta); // finishIo swaps in the TIN
   }
 }
 
 void TopoCanvas::saveAs()
 {
-  int i;
   int dialogResult;
   QStringList files;
-  string fileName;
-  ofstream file;
+  ThreadAction ta;
   fileDialog->setWindowTitle(tr("Save Drawing"));
   fileDialog->setFileMode(QFileDialog::AnyFile);
   fileDialog->setAcceptMode(QFileDialog::AcceptSave);
@@ -362,22 +359,21 @@ void TopoCanvas::saveAs()
   if (dialogResult)
   {
     files=fileDialog->selectedFiles();
-    fileName=files[0].toStdString();
-    docFileName=fileName;
-    file.open(fileName,fstream::out);
-    doc.writeXml(file);
-    file.close();
+    ta.filename=files[0].toStdString();
+    ta.opcode=ACT_WRITE_BEZ;
+    if (startIo(ta))
+      docFileName=ta.filename;
   }
 }
 
 void TopoCanvas::save()
 {
-  ofstream file;
+  ThreadAction ta;
   if (docFileName.length())
   {
-    file.open(docFileName,fstream::out);
-    doc.writeXml(file);
-    file.close();
+    ta.filename=docFileName;
+    ta.opcode=ACT_WRITE_BEZ;
+    startIo(ta);
   }
   else
     saveAs();
@@ -385,6 +381,8 @@ void TopoCanvas::save()
 
 void TopoCanvas::testPatternAster()
 {
+  if (docBusy())
+    return;
   doc.pl.clear();
   doc.makepointlist(1);
   plnum=1;
@@ -394,10 +392,9 @@ void TopoCanvas::testPatternAster()
 
 void TopoCanvas::importPnezd()
 {
-  int dialogResult,err=0;
+  int dialogResult;
   QStringList files;
-  QString errMsg;
-  string fileName;
+  ThreadAction ta;
   fileDialog->setWindowTitle(tr("Open PNEZD File"));
   fileDialog->setFileMode(QFileDialog::ExistingFile);
   fileDialog->setAcceptMode(QFileDialog::AcceptOpen);
@@ -406,30 +403,12 @@ void TopoCanvas::importPnezd()
   if (dialogResult)
   {
     files=fileDialog->selectedFiles();
-    fileName=files[0].toStdString();
     // TODO check whether there are unsaved changes to breaklines
-    doc.pl.clear();
-    doc.makepointlist(0);
-    try
-    {
-      doc.readpnezd(fileName);
-    }
-    catch (BeziExcept e)
-    {
-      err=e.getNumber();
-      errMsg=e.message();
-    }
-    plnum=0;
-    sizeToFit();
-    pointsValid=false;
-    tinValid=false;
-    surfaceValid=false;
-    roughContoursValid=false;
-  }
-  if (err)
-  {
-    QString msg=tr("Can't read points. Error: ")+errMsg;
-    errorMessage->showMessage(msg);
+    ta.filename=files[0].toStdString();
+    ta.opcode=ACT_READ_PNEZD;
+    ta.newDoc=make_shared<document>();
+    ta.newDoc->ms=doc.ms;
+    startIo(ta);
   }
 }
 
@@ -443,7 +422,7 @@ void TopoCanvas::importCriteria()
   fileDialog->setAcceptMode(QFileDialog::AcceptOpen);
   fileDialog->setNameFilter(tr("(*.crit);;(*)"));
   dialogResult=fileDialog->exec();
-  if (dialogResult)
+  if (dialogResult && !docBusy())
   {
     files=fileDialog->selectedFiles();
     fileName=files[0].toStdString();
@@ -458,14 +437,10 @@ void TopoCanvas::importCriteria()
 
 void TopoCanvas::importBreaklines()
 {
-  int i,err=0;
   bool loadAnyway;
   int dialogResult;
   QStringList files;
-  QString errMsg;
-  string fileName,line;
-  fstream file;
-  vector<Breakline0> saveBreaklines0;
+  ThreadAction ta;
   fileDialog->setWindowTitle(tr("Open Breakline File"));
   fileDialog->setFileMode(QFileDialog::ExistingFile);
   fileDialog->setAcceptMode(QFileDialog::AcceptOpen);
@@ -488,61 +463,33 @@ void TopoCanvas::importBreaklines()
     if (loadAnyway && plnum>=0)
     {
       files=fileDialog->selectedFiles();
-      fileName=files[0].toStdString();
-      saveBreaklines0=doc.pl[plnum].type0Breaklines;
-      try
-      {
-        doc.pl[plnum].type0Breaklines.clear();
-        file.open(fileName,fstream::in);
-        while (!file.eof() && !file.fail())
-        {
-          getline(file,line);
-          doc.pl[plnum].stringToBreakline(line);
-        }
-        if (!file.eof())
-          throw BeziExcept(fileError);
-        tinValid=surfaceValid=roughContoursValid=smoothContoursValid=false;
-        doc.pl[plnum].whichBreak0Valid=1;
-      }
-      catch (BeziExcept e)
-      {
-        err=e.getNumber();
-        errMsg=e.message();
-      }
-      if (err)
-      {
-        QString msg=tr("Can't read breaklines. Error: ")+errMsg;
-        doc.pl[plnum].type0Breaklines=saveBreaklines0;
-        errorMessage->showMessage(msg);
-      }
+      ta.filename=files[0].toStdString();
+      ta.plnum=plnum;
+      ta.opcode=ACT_READ_BREAKLINES;
+      startIo(ta); // If reading fails, the old breaklines are kept.
     }
   }
 }
 
 void TopoCanvas::exportBreaklines()
 {
-  int i;
   int dialogResult;
   QStringList files;
-  string fileName;
-  fstream file;
+  ThreadAction ta;
   fileDialog->setWindowTitle(tr("Save Breakline File"));
   fileDialog->setFileMode(QFileDialog::AnyFile);
   fileDialog->setAcceptMode(QFileDialog::AcceptSave);
   fileDialog->setNameFilter(tr("(*.brk);;(*)"));
   dialogResult=fileDialog->exec();
-  if (dialogResult)
+  if (dialogResult && !docBusy())
   {
     files=fileDialog->selectedFiles();
-    fileName=files[0].toStdString();
-    file.open(fileName,fstream::out);
+    ta.filename=files[0].toStdString();
+    ta.plnum=plnum;
+    ta.opcode=ACT_WRITE_BREAKLINES;
     if (doc.pl[plnum].whichBreak0Valid!=1)
       doc.pl[plnum].edgesToBreaklines();
-    for (i=0;i<doc.pl[plnum].type0Breaklines.size();i++)
-    {
-      doc.pl[plnum].type0Breaklines[i].writeText(file);
-      file<<endl;
-    }
+    startIo(ta);
   }
 }
 
@@ -571,6 +518,8 @@ bool TopoCanvas::makeTinCheckEdited()
 void TopoCanvas::makeTin()
 {
   //cout<<"makeTin"<<endl;
+  if (goal==DONE && docBusy())
+    return;
   doc.makepointlist(1);
   if ((doc.pl[1].size()==0 && doc.pl[0].size()>0) || !pointsValid)
   {
@@ -799,6 +748,8 @@ void TopoCanvas::selectContourInterval()
 
 void TopoCanvas::roughContours()
 {
+  if (goal==DONE && docBusy())
+    return;
   conterval=doc.pl[plnum].contourInterval.fineInterval();
   if (goal==DONE)
   {
@@ -871,6 +822,8 @@ void TopoCanvas::contoursCancel()
 
 void TopoCanvas::smoothContours()
 {
+  if (goal==DONE && docBusy())
+    return;
   if (goal==DONE)
   {
     goal=SMOOTH_CONTOURS;
@@ -928,10 +881,9 @@ void TopoCanvas::smoothContoursFinish()
 
 void TopoCanvas::loadGeoid()
 {
-  int dialogResult,err=0;
-  QString errMsg;
+  int dialogResult;
   QStringList files;
-  string fileName;
+  ThreadAction ta;
   fileDialog->setWindowTitle(tr("Load Geoid File"));
   fileDialog->setFileMode(QFileDialog::ExistingFile);
   fileDialog->setAcceptMode(QFileDialog::AcceptOpen);
@@ -940,29 +892,147 @@ void TopoCanvas::loadGeoid()
   if (dialogResult)
   {
     files=fileDialog->selectedFiles();
-    fileName=files[0].toStdString();
-    if (fileName.length())
+    ta.filename=files[0].toStdString();
+    ta.opcode=ACT_READ_GEOID;
+    if (ta.filename.length())
+      startIo(ta);
+  }
+}
+
+bool TopoCanvas::docBusy()
+/* Returns true, after telling the user, if the document must not be changed
+ * because it is being written or is about to be replaced by one being read.
+ */
+{
+  bool ret=ioReads>0 || writesPending()>0;
+  if (ret)
+    errorMessage->showMessage(tr("Wait until the files are done reading and writing."));
+  return ret;
+}
+
+bool TopoCanvas::startIo(ThreadAction ta)
+/* Queues a file to be read or written by the I/O threads. Writes read doc,
+ * so nothing may change it until they're done; what a read produces is
+ * swapped in by finishIo, so nothing may be queued after it until then.
+ */
+{
+  bool ret=goal==DONE && ioReads==0;
+  if (ret)
+  {
+    ta.doc=&doc;
+    if (ta.opcode<ACT_WRITE_BEZ)
+      ioReads++;
+    enqueueAction(ta);
+    ioProgressDialog->setLabelText(tr("Reading and writing files..."));
+    ioTimer->start(100);
+    checkIoActions();
+  }
+  else
+    errorMessage->showMessage(tr("Wait until the file is read or the TIN is made."));
+  return ret;
+}
+
+void TopoCanvas::checkIoActions()
+/* Called by the timer, which picks up finished actions, and through the
+ * queued ioProgress signal, which moves the bar as an action goes along.
+ * The bar counts thousandths of actions.
+ */
+{
+  ThreadAction ta;
+  int total,pending;
+  while (finishedAction(ta))
+    finishIo(ta);
+  total=actionsTotal();
+  pending=actionsPending();
+  if (pending)
+  {
+    ioProgressDialog->setRange(0,1000*total);
+    ioProgressDialog->setValue(actionsProgress());
+  }
+  else
+  {
+    ioProgressDialog->reset();
+    ioTimer->stop();
+  }
+}
+
+void TopoCanvas::ioCancel()
+{
+  cancelActions();
+  checkIoActions();
+}
+
+void TopoCanvas::finishIo(ThreadAction &ta)
+/* Called in the GUI thread when an action is finished. Documents and geoids
+ * read are swapped in; the old ones are freed when ta goes away.
+ */
+{
+  int i;
+  QString msg;
+  if (ta.opcode<ACT_WRITE_BEZ)
+    ioReads--;
+  if (ta.result>0)
+  {
+    if (ta.opcode<ACT_WRITE_BEZ)
+      msg=tr("Can't read %1. Error: ");
+    else
+      msg=tr("Can't write %1. Error: ");
+    msg=msg.arg(QString::fromStdString(ta.filename))+BeziExcept(ta.result).message();
+    errorMessage->showMessage(msg);
+  }
+  if (ta.result==0)
+    switch (ta.opcode)
     {
-      try
-      {
-	ifstream geofile(fileName,ios::binary);
-	ghead.readBinary(geofile);
-	cube.scale=pow(2,ghead.logScale);
-	cube.readBinary(geofile);
-	cout<<"read "<<fileName<<endl;
-      }
-      catch(BeziExcept e)
-      {
-        err=e.getNumber();
-        errMsg=e.message();
-      }
-      if (err)
-      {
-        QString msg=tr("Can't read geoid. Error: ")+errMsg;
-        errorMessage->showMessage(msg);
-      }
+      case ACT_READ_TIN:
+	swap(doc.pl,ta.newDoc->pl);
+	plnum=1;
+	sizeToFit();
+	if (ta.readResult<2)
+	{
+	  fileChanged("");
+	  QMessageBox msgBox(this);
+	  if (ta.readResult)
+	    msgBox.setText(tr("The TIN file is corrupt."));
+	  else
+	    msgBox.setText(tr("The file does not appear to contain a TIN."));
+	  msgBox.setStandardButtons(QMessageBox::Ok);
+	  msgBox.setIcon(QMessageBox::Warning);
+	  msgBox.exec();
+	}
+	else
+	  fileChanged(ta.filename);
+	tinerror=startPointTries=passCount=0;
+	pointsValid=true;
+	tinValid=true;
+	surfaceValid=true;
+	roughContoursValid=false;
+	break;
+      case ACT_READ_PNEZD:
+	swap(doc.pl,ta.newDoc->pl);
+	plnum=0;
+	sizeToFit();
+	pointsValid=false;
+	tinValid=false;
+	surfaceValid=false;
+	roughContoursValid=false;
+	break;
+      case ACT_READ_BREAKLINES:
+	if (ta.plnum<doc.pl.size())
+	{
+	  swap(doc.pl[ta.plnum].type0Breaklines,ta.newDoc->pl[1].type0Breaklines);
+	  tinValid=surfaceValid=roughContoursValid=smoothContoursValid=false;
+	  doc.pl[ta.plnum].whichBreak0Valid=1;
+	}
+	break;
+      case ACT_READ_GEOID:
+	ghead=*ta.newGhead;
+	for (i=0;i<6;i++)
+	  cube.faces[i].swap(ta.newCube->faces[i]);
+	swap(cube.scale,ta.newCube->scale);
+	cout<<"read "<<ta.filename<<endl;
+	break;
     }
-  }
+  update();
 }
 
 void TopoCanvas::dump()
@@ -991,7 +1061,8 @@ void TopoCanvas::paintEvent(QPaintEvent *event)
   double r;
   bezier3d b3d;
   ptlist::iterator j;
-  set<edge *>::iterator e;
+  edge *e;
+  vector<edge *> visibleEdges;
   RenderItem ri;
   QTime paintTime,subTime;
   QPen itemPen;
@@ -1006,14 +1077,18 @@ void TopoCanvas::paintEvent(QPaintEvent *event)
   {
     doc.pl[plnum].setLocalSets(worldCenter,viewableRadius());
     if (doc.pl[plnum].triangles.size())
-      if (doc.pl[plnum].localEdges.count(nullptr))
-	for (i=0;plnum>=0 && i<doc.pl[plnum].edges.size();i++)
+      if (doc.pl[plnum].localSetsAll)
+      { // The view is too big for local sets. Look only at edges long enough to see.
+	if (!doc.pl[plnum].edgeIndex.isValid(doc.pl[plnum].edges.size()))
+	  doc.pl[plnum].edgeIndex.build(doc.pl[plnum].edges);
+	visibleEdges=doc.pl[plnum].edgeIndex.find(worldCenter,viewableRadius(),pixelScale());
+	for (i=0;i<visibleEdges.size();i++)
 	{
-	  seg=doc.pl[plnum].edges[i].getsegment();
+	  seg=visibleEdges[i]->getsegment();
 	  if (seg.length()>pixelScale() && fabs(pldist(worldCenter,seg.getstart(),seg.getend()))<viewableRadius())
 	  {
-	    if (!showDelaunay || doc.pl[plnum].edges[i].delaunay())
-	      if (doc.pl[plnum].edges[i].broken&1)
+	    if (!showDelaunay || visibleEdges[i]->delaunay())
+	      if (visibleEdges[i]->broken&1)
 		painter.setPen(breakEdgePen);
 	      else
 		painter.setPen(normalEdgePen);
@@ -1022,14 +1097,16 @@ void TopoCanvas::paintEvent(QPaintEvent *event)
 	    painter.drawLine(worldToWindow(seg.getstart()),worldToWindow(seg.getend()));
 	  }
 	}
+      }
       else
-	for (e=doc.pl[plnum].localEdges.begin();e!=doc.pl[plnum].localEdges.end();++e)
+	for (i=0;i<doc.pl[plnum].localEdges.size();i++)
 	{
-	  seg=(*e)->getsegment();
+	  e=doc.pl[plnum].localEdges[i];
+	  seg=e->getsegment();
 	  if (seg.length()>pixelScale() && fabs(pldist(worldCenter,seg.getstart(),seg.getend()))<viewableRadius())
 	  {
-	    if (!showDelaunay || (*e)->delaunay())
-	      if ((*e)->broken&1)
+	    if (!showDelaunay || e->delaunay())
+	      if (e->broken&1)
 		painter.setPen(breakEdgePen);
 	      else
 		painter.setPen(normalEdgePen);
@@ -1083,6 +1160,7 @@ void TopoCanvas::paintEvent(QPaintEvent *event)
         strokeTime+=subTime.elapsed();
       }
     } while (ri.present);
+    contourCache.prerender(vector<double>{zoomratio(-scale-1)/windowSize,zoomratio(-scale+1)/windowSize});
 #else
     for (i=0;i<doc.pl[plnum].contours.size();i++)
     {
@@ -1104,7 +1182,20 @@ void TopoCanvas::paintEvent(QPaintEvent *event)
   }
   else
     ; // nothing to paint, since plnum is not the index of a pointlist
-  //cout<<"Painting took "<<paintTime.elapsed()<<" ms, rendering "<<renderTime<<", paths "<<pathTime<<", stroke "<<strokeTime<<endl;
+  contourCache.stats.paintTime=paintTime.elapsed();
+  contourCache.stats.renderTime=renderTime;
+  contourCache.stats.pathTime=pathTime;
+  contourCache.stats.strokeTime=strokeTime;
+  if (showStats)
+  {
+    painter.setPen(normalEdgePen);
+    painter.drawText(rect().adjusted(4,4,-4,-4),Qt::AlignLeft|Qt::AlignTop,
+      tr("Paint %1 ms: render %2, paths %3, stroke %4\n"
+         "%5 contours cached, %6 rendered now, %7 prerendered, %8 in background")
+      .arg(contourCache.stats.paintTime).arg(renderTime).arg(pathTime).arg(strokeTime)
+      .arg(contourCache.stats.nItems).arg(contourCache.stats.syncRenders)
+      .arg(contourCache.stats.aheadHits).arg(contourCache.stats.queued));
+  }
   lastPaintTime=paintTime;
   lastPaintDuration=paintTime.elapsed();
 }
@@ -1126,10 +1217,13 @@ bool TopoCanvas::mouseCheckImported()
 /* If the user clicks on an edge to edit the breaklines in the TIN, but the
  * breaklines imported from a file are more recent, pops up a message box
  * and asks if he wants to edit the TIN. Else returns true.
+ * Also returns false if the TIN is being written.
  */
 {
   bool ret;
-  if (doc.pl[plnum].whichBreak0Valid==1)
+  if (docBusy())
+    ret=false;
+  else if (doc.pl[plnum].whichBreak0Valid==1)
   {
     QMessageBox msgBox(this);
     msgBox.setText(tr("You have imported breaklines."));
@@ -34,6 +34,7 @@
 #include "cidialog.h"
 #include "factordialog.h"
 #include "rendercache.h"
+#include "threads.h"
 
 // goals
 #define DONE 0
@@ -46,6 +47,7 @@ class TopoCanvas: public QWidget
   Q_OBJECT
 public:
   TopoCanvas(QWidget *parent=0);
+  ~TopoCanvas();
   void setBrush(const QBrush &qbrush);
   QPointF worldToWindow(xy pnt);
   xy windowToWorld(QPointF pnt);
@@ -55,9 +57,12 @@ public:
   bool mouseCheckImported();
   bool makeTinCheckEdited();
   document *getDoc();
+  bool startIo(ThreadAction ta);
+  bool docBusy();
 signals:
   void measureChanged(Measure newMeasure);
   void fileChanged(std::string fileName);
+  void ioProgress(); // emitted in an I/O thread
 public slots:
   void sizeToFit();
   void zoom(int steps);
@@ -70,6 +75,7 @@ public slots:
   void setShowDelaunay(bool showd);
   void setAllowFlip(bool allow);
   void setTipXyz(bool tipxyz);
+  void setShowStats(bool show);
   void rotatecw();
   void rotateccw();
   void setButtonBits(int bits);
@@ -104,8 +110,11 @@ public slots:
   void smooth1Contour();
   void smoothContoursFinish();
   void loadGeoid();
+  void checkIoActions();
+  void ioCancel();
   void dump();
 protected:
+  void finishIo(ThreadAction &ta);
   void setSize();
   void paintEvent(QPaintEvent *event) Q_DECL_OVERRIDE;
   void resizeEvent(QResizeEvent *event) Q_DECL_OVERRIDE;
@@ -127,6 +136,9 @@ private:
   QFileDialog *fileDialog;
   QProgressDialog *progressDialog;
   QTimer *timer;
+  QProgressDialog *ioProgressDialog;
+  QTimer *ioTimer;
+  int ioReads; // read actions enqueued and not yet swapped in
   ContourIntervalDialog *ciDialog;
   double conterval;
   xy windowCenter,worldCenter,dragStart;
@@ -159,6 +171,7 @@ private:
   /* If true, tooltip shows xyz while cursor is in TIN.
    * If false, shows point numbers.
    */
+  bool showStats; // If true, shows how long painting took and what the render cache did.
   QTime lastPaintTime;
   int lastPaintDuration;
 };
@@ -210,3 +210,60 @@ xyz decodedir(vball code)
     ret=ret*(EARTHRAD/ret.length());
   return ret;
 }
+
+void encodedirs(const double *x,const double *y,const double *z,vball *out,size_t n)
+/* The face is chosen by comparisons which select values rather than jump,
+ * so that the loop has no branches and the compiler can vectorize it.
+ * As in encodedir, a tie goes to z over y over x.
+ */
+{
+  size_t i;
+  double absx,absy,absz,m,u,w;
+  int bz,by,zero,bad,axis,face;
+  for (i=0;i<n;i++)
+  {
+    absx=fabs(x[i]);
+    absy=fabs(y[i]);
+    absz=fabs(z[i]);
+    bz=(absz>=absx)&(absz>=absy);
+    by=(!bz)&(absy>=absz)&(absy>=absx);
+    m=bz?z[i]:(by?y[i]:x[i]);
+    u=bz?x[i]:(by?z[i]:y[i]);
+    w=bz?y[i]:(by?x[i]:z[i]);
+    axis=2*bz+by;
+    face=(m<0)?6-axis:axis+1;
+    zero=(absx==0)&(absy==0)&(absz==0);
+    bad=std::isnan(absx)|std::isnan(absy)|std::isnan(absz)|
+        ((std::isinf(absx)+std::isinf(absy)+std::isinf(absz))>1);
+    u/=fabs(m);
+    w/=m;
+    out[i].face=zero?0:(bad?7:face);
+    out[i].x=zero?0:(bad?NAN:u);
+    out[i].y=zero?0:(bad?NAN:w);
+  }
+}
+
+void decodedirs(const vball *in,double *x,double *y,double *z,size_t n)
+/* Faces 1-3 are the positive x, y, and z faces, and 6-4 the negative ones,
+ * so the axis and sign come from the face by arithmetic instead of a switch.
+ */
+{
+  size_t i;
+  int f,axis;
+  double s,u,w,cx,cy,cz,r;
+  for (i=0;i<n;i++)
+  {
+    f=in[i].face&7;
+    axis=(f<=3)?f-1:6-f;
+    s=(f<=3)?1:-1;
+    u=in[i].x;
+    w=s*in[i].y;
+    cx=(axis==0)?s:((axis==1)?w:u);
+    cy=(axis==1)?s:((axis==2)?w:u);
+    cz=(axis==2)?s:((axis==0)?w:u);
+    r=EARTHRAD/sqrt(cx*cx+cy*cy+cz*cz);
+    x[i]=(f==0)?0:((f==7)?NAN:cx*r);
+    y[i]=(f==0)?0:((f==7)?NAN:cy*r);
+    z[i]=(f==0)?0:((f==7)?NAN:cz*r);
+  }
+}
@@ -23,6 +23,7 @@
  */
 #ifndef VBALL_H
 #define VBALL_H
+#include <cstddef>
 #include "xyz.h"
 #define EARTHRAD 6371e3
 #define EARTHRADSQ 4.0589641e13
@@ -42,4 +43,9 @@ public:
 
 vball encodedir(xyz dir);
 xyz decodedir(vball code);
+/* Batch forms for many directions at once, with the coordinates in separate
+ * arrays. They give bit-for-bit the same results as encodedir and decodedir.
+ */
+void encodedirs(const double *x,const double *y,const double *z,vball *out,size_t n);
+void decodedirs(const vball *in,double *x,double *y,double *z,size_t n);
 #endif